@@ -0,0 +1,397 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace performance {
+
+    /** One named group of remote endpoints, parsed from
+     *
+     *      <name>: [<prefix> ...] [port <port | first-last>[,...]]
+     *
+     *      database: 10.1.0.0/16 10.2.3.0/24 port 5432,3306
+     *      cache: 10.3.0.0/16 port 6379
+     *      web: port 80,443,8000-8099
+     *
+     *  Without prefixes the ports match any address, without ports the
+     *  prefixes match any port. Addresses are host order here. */
+    struct address_group_t {
+        struct prefix_t {
+            std::uint32_t   address{ 0 };
+            std::uint8_t    length{ 0 };
+        };
+
+        std::string                 name;
+        std::string                 text;
+        std::vector<prefix_t>       prefixes;
+        std::vector<std::uint16_t>  ports;
+
+        static constexpr std::size_t max_ports = 4096;
+
+        /** nullopt, with the reason on std::cerr, for an invalid group. */
+        static inline std::optional<address_group_t>
+        parse(std::string_view text) {
+            try {
+                return parse_or_throw(text);
+            }
+            catch (std::exception& err) {
+                std::cerr << "Invalid group \"" << text << "\": " << err.what() << "\n";
+                return std::nullopt;
+            }
+        }
+
+        static inline address_group_t
+        parse_or_throw(std::string_view text) {
+            address_group_t group;
+            group.text = std::string{ text };
+            const auto colon = text.find(':');
+            if (colon == std::string_view::npos) {
+                throw std::invalid_argument("expected <name>: [<prefix> ...] [port <ports>]");
+            }
+            group.name = std::string{ trim(text.substr(0, colon)) };
+            if (group.name.empty() || group.name.size() > 64 ||
+                std::any_of(group.name.begin(), group.name.end(),
+                            [](char c) { return !std::isalnum((unsigned char)c) && c != '_' && c != '-' && c != '.'; })) {
+                throw std::invalid_argument("names are up to 64 letters, digits, _ - and .");
+            }
+            text.remove_prefix(colon + 1);
+            for (auto word = next_word(text); !word.empty(); word = next_word(text)) {
+                if (word == "port") {
+                    group.ports = parse_ports(next_word(text));
+                    if (!next_word(text).empty()) {
+                        throw std::invalid_argument("port must come last");
+                    }
+                    break;
+                }
+                group.prefixes.push_back(parse_prefix(word));
+            }
+            if (group.prefixes.empty() && group.ports.empty()) {
+                throw std::invalid_argument("expected prefixes, ports or both");
+            }
+            return group;
+        }
+
+        static inline prefix_t
+        parse_prefix(std::string_view word) {
+            prefix_t prefix;
+            const auto slash = word.find('/');
+            auto address = word.substr(0, slash);
+            for (int ii = 0; ii < 4; ii++) {
+                const auto dot   = ii < 3 ? address.find('.') : address.size();
+                const auto octet = number(address.substr(0, dot), 255);
+                if (dot == std::string_view::npos) {
+                    throw std::invalid_argument("invalid address " + std::string{ word });
+                }
+                prefix.address = (prefix.address << 8) | octet;
+                address.remove_prefix(std::min(dot + 1, address.size()));
+            }
+            prefix.length = slash == std::string_view::npos ? 32 : (std::uint8_t)number(word.substr(slash + 1), 32);
+            // host bits are ignored
+            prefix.address &= prefix.length ? ~0u << (32 - prefix.length) : 0u;
+            return prefix;
+        }
+
+    private:
+        static inline std::vector<std::uint16_t>
+        parse_ports(std::string_view word) {
+            std::vector<std::uint16_t> ports;
+            while (!word.empty()) {
+                const auto comma = std::min(word.find(','), word.size());
+                const auto item  = word.substr(0, comma);
+                const auto dash  = item.find('-');
+                const auto first = number(item.substr(0, dash), 65535);
+                const auto last  = dash == std::string_view::npos ? first : number(item.substr(dash + 1), 65535);
+                if (last < first || ports.size() + (last - first) >= max_ports) {
+                    throw std::invalid_argument("invalid or too many ports");
+                }
+                for (auto port = first; port <= last; port++) {
+                    ports.push_back((std::uint16_t)port);
+                }
+                word.remove_prefix(std::min(comma + 1, word.size()));
+            }
+            if (ports.empty()) {
+                throw std::invalid_argument("missing ports");
+            }
+            std::sort(ports.begin(), ports.end());
+            ports.erase(std::unique(ports.begin(), ports.end()), ports.end());
+            return ports;
+        }
+
+        static inline std::uint32_t
+        number(std::string_view word, std::uint32_t max) {
+            std::uint32_t value{ 0 };
+            if (word.empty() || word.size() > 5) {
+                throw std::invalid_argument("invalid number " + std::string{ word });
+            }
+            for (auto c : word) {
+                if (!std::isdigit((unsigned char)c)) {
+                    throw std::invalid_argument("invalid number " + std::string{ word });
+                }
+                value = value * 10 + (c - '0');
+            }
+            if (value > max) {
+                throw std::invalid_argument(std::string{ word } + " is out of range");
+            }
+            return value;
+        }
+
+        static inline std::string_view
+        trim(std::string_view str) noexcept {
+            while (!str.empty() && std::isspace((unsigned char)str.front())) str.remove_prefix(1);
+            while (!str.empty() && std::isspace((unsigned char)str.back()))  str.remove_suffix(1);
+            return str;
+        }
+
+        static inline std::string_view
+        next_word(std::string_view& text) noexcept {
+            text = trim(text);
+            std::size_t end = 0;
+            while (end < text.size() && !std::isspace((unsigned char)text[end])) end++;
+            const auto word = text.substr(0, end);
+            text.remove_prefix(end);
+            return word;
+        }
+    };
+
+    /** Maps a remote address and port to the address_group_t it belongs to.
+     *
+     *  Addresses go through a DIR-16-8-8 table: the top 16 bits index a
+     *  65536 entry table whose entries are either a class or a 256 entry
+     *  chunk for the next 8 bits, and so on, so a lookup is at most three
+     *  dependent loads whatever the number of prefixes. The class of the
+     *  longest prefix holding the address then maps the port: to a group
+     *  given for that port, else to the group of any port.
+     *
+     *  Prefixes are inserted shortest first, each one overwriting its range
+     *  and starting from the class of the prefix it refines, so port rules
+     *  are inherited down to the next prefix with an any port rule. Longer
+     *  prefixes win, then rules with ports, then the group listed first.
+     *
+     *  Immutable once built, so it can be shared with the trace thread and
+     *  replaced by a new one at any time. Group 0 is "none". */
+    class address_classifier_t {
+    public:
+        static constexpr std::uint16_t none       = 0;
+        static constexpr std::size_t   max_groups = 255;
+
+        /** nullopt, with the reason on std::cerr, when there are too many
+         *  groups. */
+        static inline std::optional<address_classifier_t>
+        build(const std::vector<address_group_t>& groups) {
+            if (groups.size() > max_groups) {
+                std::cerr << "At most " << max_groups << " address groups\n";
+                return std::nullopt;
+            }
+            address_classifier_t classifier;
+            classifier._names.emplace_back("none");
+            for (const auto& group : groups) {
+                classifier._names.push_back(group.name);
+            }
+
+            // every rule attached to its prefix, port only groups to 0/0
+            struct rule_t {
+                std::uint32_t   address;
+                std::uint8_t    length;
+                std::uint16_t   group;
+                const std::vector<std::uint16_t>* ports;
+            };
+            std::vector<rule_t> rules;
+            for (std::uint16_t ii = 0; ii < groups.size(); ii++) {
+                const auto& group = groups[ii];
+                if (group.prefixes.empty()) {
+                    rules.push_back({ 0, 0, (std::uint16_t)(ii + 1), &group.ports });
+                }
+                for (const auto& prefix : group.prefixes) {
+                    rules.push_back({ prefix.address, prefix.length, (std::uint16_t)(ii + 1), &group.ports });
+                }
+            }
+            std::stable_sort(rules.begin(), rules.end(), [](const rule_t& a, const rule_t& b) {
+                return a.length != b.length ? a.length < b.length : a.address < b.address;
+            });
+
+            classifier._classes.push_back(class_t{});
+            classifier._level1.assign(1 << 16, 0);
+            for (std::size_t first = 0; first < rules.size();) {
+                auto last = first;
+                while (last < rules.size() && rules[last].length == rules[first].length &&
+                       rules[last].address == rules[first].address) {
+                    last++;
+                }
+                // refine the class of the covering prefix, the first rule wins
+                const auto parent = classifier.lookup(rules[first].address);
+                auto       cls    = classifier._classes[parent];
+                std::vector<std::pair<std::uint16_t, std::uint16_t>> ports(
+                    classifier._ports.begin() + cls.first_port, classifier._ports.begin() + cls.first_port + cls.n_of_ports);
+                bool any_set = false;
+                std::vector<std::pair<std::uint16_t, std::uint16_t>> added;
+                for (auto ii = first; ii < last; ii++) {
+                    const auto& rule = rules[ii];
+                    if (rule.ports->empty()) {
+                        if (!any_set) {
+                            cls.any_port = rule.group;
+                            any_set = true;
+                        }
+                        continue;
+                    }
+                    for (const auto port : *rule.ports) {
+                        added.emplace_back(port, rule.group);
+                    }
+                }
+                // an address rule beats the port rules of shorter prefixes
+                if (any_set) {
+                    ports.clear();
+                }
+                // stable: per port the earliest rule stays first
+                std::stable_sort(added.begin(), added.end(),
+                                 [](const auto& a, const auto& b) { return a.first < b.first; });
+                added.erase(std::unique(added.begin(), added.end(),
+                                        [](const auto& a, const auto& b) { return a.first == b.first; }),
+                            added.end());
+                for (const auto& entry : added) {
+                    const auto it = std::lower_bound(ports.begin(), ports.end(), entry,
+                                                     [](const auto& a, const auto& b) { return a.first < b.first; });
+                    if (it != ports.end() && it->first == entry.first) {
+                        it->second = entry.second;
+                    }
+                    else {
+                        ports.insert(it, entry);
+                    }
+                }
+                cls.first_port = (std::uint32_t)classifier._ports.size();
+                cls.n_of_ports = (std::uint32_t)ports.size();
+                classifier._ports.insert(classifier._ports.end(), ports.begin(), ports.end());
+                classifier._classes.push_back(cls);
+                classifier.insert(rules[first].address, rules[first].length, (std::uint32_t)(classifier._classes.size() - 1));
+                first = last;
+            }
+            return classifier;
+        }
+
+        /** Group of a remote endpoint, @p address and @p port in host order. */
+        inline std::uint16_t
+        classify(std::uint32_t address, std::uint16_t port) const noexcept {
+            const auto& cls   = _classes[lookup(address)];
+            const auto* first = _ports.data() + cls.first_port;
+            const auto* last  = first + cls.n_of_ports;
+            // a handful of ports per class, a branchy binary search is fine
+            while (first < last) {
+                const auto* middle = first + (last - first) / 2;
+                if (middle->first < port)       first = middle + 1;
+                else if (middle->first > port)  last  = middle;
+                else                            return middle->second;
+            }
+            return cls.any_port;
+        }
+
+        /** The same for an address and port as in network_event_t, network order. */
+        inline std::uint16_t
+        classify_network(std::uint32_t address, std::uint16_t port) const noexcept {
+            return classify(byteswap(address), (std::uint16_t)((port >> 8) | (port << 8)));
+        }
+
+        /** Names by group, "none" first. */
+        inline const std::vector<std::string>&
+        names() const noexcept {
+            return _names;
+        }
+
+        /** Renumbers every group to @p ids[group], before sharing it. */
+        inline void
+        renumber(const std::vector<std::uint16_t>& ids) {
+            for (auto& cls : _classes) {
+                cls.any_port = ids[cls.any_port];
+            }
+            for (auto& entry : _ports) {
+                entry.second = ids[entry.second];
+            }
+        }
+
+        /** Bytes of the lookup tables. */
+        inline std::size_t
+        memory() const noexcept {
+            return (_level1.size() + _level2.size() + _level3.size()) * sizeof(std::uint32_t) +
+                   _classes.size() * sizeof(class_t) + _ports.size() * sizeof(_ports[0]);
+        }
+
+    private:
+        static constexpr std::uint32_t chunk = 0x80000000u;
+
+        struct class_t {
+            std::uint16_t   any_port{ none };
+            std::uint32_t   first_port{ 0 };
+            std::uint32_t   n_of_ports{ 0 };
+        };
+
+        address_classifier_t() = default;
+
+        static inline std::uint32_t
+        byteswap(std::uint32_t value) noexcept {
+#ifdef _MSC_VER
+            return _byteswap_ulong(value);
+#else
+            return __builtin_bswap32(value);
+#endif
+        }
+
+        inline std::uint32_t
+        lookup(std::uint32_t address) const noexcept {
+            auto entry = _level1[address >> 16];
+            if (entry & chunk) {
+                entry = _level2[((entry & ~chunk) << 8) | ((address >> 8) & 0xFF)];
+                if (entry & chunk) {
+                    entry = _level3[((entry & ~chunk) << 8) | (address & 0xFF)];
+                }
+            }
+            return entry;
+        }
+
+        /** Overwrites the range of the prefix with @p cls, every prefix
+         *  already in is shorter or equal. */
+        inline void
+        insert(std::uint32_t address, std::uint8_t length, std::uint32_t cls) {
+            if (length <= 16) {
+                const auto first = address >> 16;
+                std::fill_n(_level1.begin() + first, std::size_t{ 1 } << (16 - length), cls);
+                return;
+            }
+            auto& entry1 = _level1[address >> 16];
+            const auto chunk2 = expand(entry1, _level2);
+            if (length <= 24) {
+                const auto first = (chunk2 << 8) | ((address >> 8) & 0xFF);
+                std::fill_n(_level2.begin() + first, std::size_t{ 1 } << (24 - length), cls);
+                return;
+            }
+            const auto chunk3 = expand(_level2[(chunk2 << 8) | ((address >> 8) & 0xFF)], _level3);
+            const auto first  = (chunk3 << 8) | (address & 0xFF);
+            std::fill_n(_level3.begin() + first, std::size_t{ 1 } << (32 - length), cls);
+        }
+
+        /** Index of the chunk @p entry points to, a new one filled with its
+         *  class when it doesn't. */
+        static inline std::uint32_t
+        expand(std::uint32_t& entry, std::vector<std::uint32_t>& level) {
+            if (entry & chunk) {
+                return entry & ~chunk;
+            }
+            const auto index = (std::uint32_t)(level.size() >> 8);
+            level.resize(level.size() + 256, entry);
+            entry = index | chunk;
+            return index;
+        }
+
+        std::vector<std::uint32_t>                                  _level1;
+        std::vector<std::uint32_t>                                  _level2;
+        std::vector<std::uint32_t>                                  _level3;
+        std::vector<class_t>                                        _classes;
+        std::vector<std::pair<std::uint16_t, std::uint16_t>>        _ports;    // port, group
+        std::vector<std::string>                                    _names;
+    };
+}
@@ -0,0 +1,617 @@
+#pragma once
+
+#include "burst_analyzer.h"
+#include "network_monitor.h"
+#include "pid_table.h"
+
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace performance {
+
+    enum class alert_scope_t : std::uint8_t {
+        tcp,        // tcp_data_t totals
+        udp,        // udp_data_t totals
+        pid,        // every pid_data_t observed
+        flow,       // every flow of a burst_analyzer_t report
+        n_of_scopes,
+    };
+
+    enum class alert_metric_t : std::uint8_t {
+        connections,
+        connections_lost,
+        pkg_sent,
+        pkg_recv,
+        bytes_sent,
+        bytes_recv,
+        retransmissions,
+        bytes,          // sent + received
+        packets,        // sent + received
+        peak_bytes,     // flows, busiest burst window of the interval
+        peak_packets,
+        n_of_metrics,
+    };
+
+    /** One alert rule, parsed from
+     *
+     *      <name>: <scope>.<metric> [rate] <|> <value> [for <duration>] [clear <value>]
+     *
+     *      retx_storm: pid.retransmissions rate > 50 for 10s clear 10
+     *      tcp_ingress: tcp.bytes_recv rate > 100M
+     *      fan_out: tcp.connections > 5000 for 1m
+     *      elephant: flow.bytes > 1G
+     *
+     *  Scopes: tcp udp pid flow. rate compares the change per second instead
+     *  of the value. Values take K, M and G suffixes (powers of 1024),
+     *  durations ms, s and m. The rule fires once the comparison held for the
+     *  duration and clears when the value is back across the clear value,
+     *  the threshold by default: clear gives it hysteresis. Flow metrics are
+     *  per interval, a flow without traffic counts as 0. */
+    struct alert_rule_t {
+        std::string                 name;
+        std::string                 text;
+        alert_scope_t               scope{ alert_scope_t::tcp };
+        alert_metric_t              metric{ alert_metric_t::bytes };
+        bool                        rate{ false };
+        bool                        above{ true };
+        double                      threshold{ 0 };
+        double                      clear{ 0 };
+        std::chrono::nanoseconds    duration{ 0 };
+
+        /** nullopt, with the reason on std::cerr, for an invalid rule. */
+        static inline std::optional<alert_rule_t>
+        parse(std::string_view text) {
+            try {
+                return parse_or_throw(text);
+            }
+            catch (std::exception& err) {
+                std::cerr << "Invalid alert \"" << text << "\": " << err.what() << "\n";
+                return std::nullopt;
+            }
+        }
+
+        static inline alert_rule_t
+        parse_or_throw(std::string_view text) {
+            alert_rule_t rule;
+            rule.text = std::string{ text };
+            const auto colon = text.find(':');
+            if (colon == std::string_view::npos) {
+                throw std::invalid_argument("expected <name>: <scope>.<metric> ...");
+            }
+            rule.name = std::string{ trim(text.substr(0, colon)) };
+            if (rule.name.empty() || rule.name.size() > 64 ||
+                std::any_of(rule.name.begin(), rule.name.end(),
+                            [](char c) { return !std::isalnum((unsigned char)c) && c != '_' && c != '-' && c != '.'; })) {
+                throw std::invalid_argument("names are up to 64 letters, digits, _ - and .");
+            }
+            text.remove_prefix(colon + 1);
+
+            const auto input = next_word(text);
+            const auto dot   = input.find('.');
+            if (dot == std::string_view::npos) {
+                throw std::invalid_argument("expected <scope>.<metric>");
+            }
+            rule.scope  = parse_scope(input.substr(0, dot));
+            rule.metric = parse_metric(input.substr(dot + 1));
+            if (!has_metric(rule.scope, rule.metric)) {
+                throw std::invalid_argument(std::string{ input } + " isn't a metric of that scope");
+            }
+            auto word = next_word(text);
+            if (word == "rate") {
+                rule.rate = true;
+                word = next_word(text);
+            }
+            if (word == ">")      rule.above = true;
+            else if (word == "<") rule.above = false;
+            else                  throw std::invalid_argument("expected > or <");
+            rule.threshold = parse_value(next_word(text));
+            rule.clear     = rule.threshold;
+            while (!(word = next_word(text)).empty()) {
+                if (word == "for") {
+                    rule.duration = parse_duration(next_word(text));
+                }
+                else if (word == "clear") {
+                    rule.clear = parse_value(next_word(text));
+                    if (rule.above ? rule.clear > rule.threshold : rule.clear < rule.threshold) {
+                        throw std::invalid_argument("the clear value is past the threshold");
+                    }
+                }
+                else {
+                    throw std::invalid_argument("unexpected " + std::string{ word });
+                }
+            }
+            return rule;
+        }
+
+        /** Whether @p scope has @p metric. */
+        static inline bool
+        has_metric(alert_scope_t scope, alert_metric_t metric) noexcept {
+            constexpr auto bit = [](alert_metric_t m) { return 1u << (unsigned)m; };
+            constexpr unsigned traffic = bit(alert_metric_t::pkg_sent) | bit(alert_metric_t::pkg_recv) |
+                                         bit(alert_metric_t::bytes_sent) | bit(alert_metric_t::bytes_recv) |
+                                         bit(alert_metric_t::bytes) | bit(alert_metric_t::packets);
+            constexpr unsigned metrics[] = {
+                traffic | bit(alert_metric_t::connections) | bit(alert_metric_t::connections_lost) | bit(alert_metric_t::retransmissions),
+                traffic | bit(alert_metric_t::connections_lost),
+                traffic | bit(alert_metric_t::connections) | bit(alert_metric_t::retransmissions),
+                bit(alert_metric_t::bytes) | bit(alert_metric_t::packets) |
+                bit(alert_metric_t::peak_bytes) | bit(alert_metric_t::peak_packets),
+            };
+            return (metrics[(std::size_t)scope] & bit(metric)) != 0;
+        }
+
+        static inline const char*
+        scope_name(alert_scope_t scope) noexcept {
+            constexpr const char* names[] = { "tcp", "udp", "pid", "flow" };
+            return scope < alert_scope_t::n_of_scopes ? names[(std::size_t)scope] : "?";
+        }
+
+    private:
+        static inline std::string_view
+        trim(std::string_view str) noexcept {
+            while (!str.empty() && std::isspace((unsigned char)str.front())) str.remove_prefix(1);
+            while (!str.empty() && std::isspace((unsigned char)str.back()))  str.remove_suffix(1);
+            return str;
+        }
+
+        static inline std::string_view
+        next_word(std::string_view& text) noexcept {
+            text = trim(text);
+            std::size_t end = 0;
+            while (end < text.size() && !std::isspace((unsigned char)text[end])) end++;
+            const auto word = text.substr(0, end);
+            text.remove_prefix(end);
+            return word;
+        }
+
+        static inline alert_scope_t
+        parse_scope(std::string_view name) {
+            for (std::size_t ii = 0; ii < (std::size_t)alert_scope_t::n_of_scopes; ii++) {
+                if (name == scope_name((alert_scope_t)ii)) return (alert_scope_t)ii;
+            }
+            throw std::invalid_argument("unknown scope " + std::string{ name });
+        }
+
+        static inline alert_metric_t
+        parse_metric(std::string_view name) {
+            constexpr const char* names[] = {
+                "connections", "connections_lost", "pkg_sent", "pkg_recv", "bytes_sent", "bytes_recv",
+                "retransmissions", "bytes", "packets", "peak_bytes", "peak_packets",
+            };
+            for (std::size_t ii = 0; ii < (std::size_t)alert_metric_t::n_of_metrics; ii++) {
+                if (name == names[ii]) return (alert_metric_t)ii;
+            }
+            throw std::invalid_argument("unknown metric " + std::string{ name });
+        }
+
+        static inline double
+        parse_value(std::string_view word) {
+            if (word.empty()) {
+                throw std::invalid_argument("missing value");
+            }
+            double scale = 1;
+            switch (word.back()) {
+            case 'K': scale = 1024.0; break;
+            case 'M': scale = 1024.0 * 1024; break;
+            case 'G': scale = 1024.0 * 1024 * 1024; break;
+            }
+            if (scale != 1) {
+                word.remove_suffix(1);
+            }
+            std::size_t used = 0;
+            const auto value = std::stod(std::string{ word }, &used);
+            if (used != word.size()) {
+                throw std::invalid_argument("invalid value " + std::string{ word });
+            }
+            return value * scale;
+        }
+
+        static inline std::chrono::nanoseconds
+        parse_duration(std::string_view word) {
+            std::size_t used = 0;
+            const auto value = std::stoull(std::string{ word }, &used);
+            const auto unit  = word.substr(used);
+            if (unit == "ms") return std::chrono::milliseconds{ value };
+            if (unit == "s")  return std::chrono::seconds{ value };
+            if (unit == "m")  return std::chrono::minutes{ value };
+            throw std::invalid_argument("expected a duration like 500ms, 10s or 5m");
+        }
+    };
+
+    enum class alert_state_t : std::uint8_t {
+        fired,
+        cleared,
+    };
+
+    /** A rule instance changing state. rule is valid until the next
+     *  alert_engine_t::set_rules(). */
+    struct alert_t {
+        const alert_rule_t*     rule{ nullptr };
+        alert_state_t           state{ alert_state_t::fired };
+        std::uint32_t           pid{ 0 };       // pid scope
+        flow_key_t              flow;           // flow scope
+        double                  value{ 0 };     // the value or rate compared
+        std::int64_t            timestamp_ns{ 0 };
+    };
+
+    /** Evaluates alert rules over the counters observed every interval.
+     *
+     *  Every (entity, metric) pair some rule reads is an input holding one
+     *  instance per rule. observe() only queues inputs whose value changed,
+     *  evaluate() then steps the instances of queued inputs plus those
+     *  still moving: a non zero rate drops to zero without any change, and
+     *  a pending instance is waiting for its duration. Everything else
+     *  keeps its state, so an interval costs the changed inputs, not the
+     *  rules times the entities.
+     *
+     *  Not thread safe, observe and evaluate from one thread. */
+    class alert_engine_t {
+    public:
+        using callback_t = std::function<void(const alert_t&)>;
+
+        /** Replaces every rule. Instances of the previous rules are dropped
+         *  without clearing. */
+        inline void
+        set_rules(std::vector<alert_rule_t> rules) {
+            _rules = std::move(rules);
+            _entities.clear();
+            _free_entities.clear();
+            _inputs.clear();
+            _free_inputs.clear();
+            _queue.clear();
+            _active.clear();
+            _pids.clear();
+            _flows.clear();
+            _firing = 0;
+            for (auto& scope : _rules_of) {
+                for (auto& metric : scope) {
+                    metric.clear();
+                }
+            }
+            for (std::uint32_t ii = 0; ii < _rules.size(); ii++) {
+                _rules_of[(std::size_t)_rules[ii].scope][(std::size_t)_rules[ii].metric].push_back(ii);
+            }
+            _globals[0] = entity_of(alert_scope_t::tcp, 0, {});
+            _globals[1] = entity_of(alert_scope_t::udp, 0, {});
+        }
+
+        inline const std::vector<alert_rule_t>&
+        rules() const noexcept {
+            return _rules;
+        }
+
+        /** Called for every fired and cleared alert, from evaluate(). */
+        inline void
+        on_alert(callback_t callback) {
+            _callback = std::move(callback);
+        }
+
+        inline void
+        observe(const tcp_data_t& data) {
+            const auto entity = _globals[0];
+            if (entity == none) return;
+            set(entity, alert_metric_t::connections,      (double)data.connections);
+            set(entity, alert_metric_t::connections_lost, (double)data.connections_lost);
+            set(entity, alert_metric_t::retransmissions,  (double)data.retransmissions);
+            set_traffic(entity, data);
+        }
+
+        inline void
+        observe(const udp_data_t& data) {
+            const auto entity = _globals[1];
+            if (entity == none) return;
+            set(entity, alert_metric_t::connections_lost, (double)data.connections_lost);
+            set_traffic(entity, data);
+        }
+
+        inline void
+        observe(const pid_data_t& data) {
+            const auto entity = entity_of(alert_scope_t::pid, data.pid, {});
+            if (entity == none) return;
+            set(entity, alert_metric_t::connections,     (double)data.connections);
+            set(entity, alert_metric_t::retransmissions, (double)data.retransmissions);
+            set_traffic(entity, data);
+        }
+
+        /** One window of a burst_analyzer_t flow report, the first window
+         *  reported for a flow in an interval wins. */
+        inline void
+        observe(const flow_key_t& key, const burst_stats_t& stats) {
+            const auto entity = entity_of(alert_scope_t::flow, 0, key);
+            if (entity == none || _entities[entity].seen == _epoch) return;
+            _entities[entity].seen = _epoch;
+            set(entity, alert_metric_t::bytes,        (double)stats.bytes);
+            set(entity, alert_metric_t::packets,      (double)stats.packets);
+            set(entity, alert_metric_t::peak_bytes,   (double)stats.peak_bytes);
+            set(entity, alert_metric_t::peak_packets, (double)stats.peak_packets);
+        }
+
+        /** Ends the interval at @p timestamp_ns and delivers its alerts.
+         *  Returns how many rule instances were evaluated. */
+        inline std::size_t
+        evaluate(std::int64_t timestamp_ns) {
+            // flows are per interval, silence is zero
+            for (const auto& [key, entity] : _flows) {
+                if (_entities[entity].seen != _epoch) {
+                    for (auto metric : flow_metrics) {
+                        set(entity, metric, 0);
+                    }
+                }
+            }
+            for (const auto input : _active) {
+                queue(input);
+            }
+            _active.clear();
+            std::size_t evaluated{ 0 };
+            for (const auto input : _queue) {
+                evaluated += step(input, timestamp_ns);
+            }
+            _queue.clear();
+            forget_idle_flows();
+            _epoch++;
+            return evaluated;
+        }
+
+        /** Rule instances, one per rule and observed entity. */
+        inline std::size_t
+        instances() const noexcept {
+            std::size_t count{ 0 };
+            for (const auto& input : _inputs) {
+                count += input.instances.size();
+            }
+            return count;
+        }
+
+        inline std::size_t
+        firing() const noexcept {
+            return _firing;
+        }
+
+    private:
+        static constexpr std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+        static constexpr alert_metric_t flow_metrics[] = {
+            alert_metric_t::bytes, alert_metric_t::packets, alert_metric_t::peak_bytes, alert_metric_t::peak_packets,
+        };
+
+        enum class phase_t : std::uint8_t {
+            idle,
+            pending,    // over the threshold, waiting for the rule's duration
+            firing,
+        };
+
+        struct instance_t {
+            std::uint32_t       rule;
+            phase_t             phase{ phase_t::idle };
+            std::int64_t        since{ 0 };
+        };
+
+        struct input_t {
+            std::uint32_t               entity{ none };
+            double                      value{ 0 };
+            double                      last_value{ 0 };
+            std::int64_t                last_time{ 0 };
+            double                      rate{ 0 };
+            bool                        has_last{ false };
+            std::uint64_t               queued{ 0 };    // epoch + 1 when in the queue
+            std::vector<instance_t>     instances;
+        };
+
+        struct entity_t {
+            alert_scope_t                                               scope{ alert_scope_t::tcp };
+            std::uint32_t                                               pid{ 0 };
+            flow_key_t                                                  flow;
+            std::uint64_t                                               seen{ std::numeric_limits<std::uint64_t>::max() };
+            std::array<std::uint32_t, (std::size_t)alert_metric_t::n_of_metrics> inputs;
+        };
+
+        /** The entity, created with an input per metric some rule reads,
+         *  none when no rule reads @p scope. */
+        inline std::uint32_t
+        entity_of(alert_scope_t scope, std::uint32_t pid, const flow_key_t& flow) {
+            const auto& rules = _rules_of[(std::size_t)scope];
+            if (std::all_of(std::begin(rules), std::end(rules), [](const auto& ids) { return ids.empty(); })) {
+                return none;
+            }
+            std::uint32_t* slot = nullptr;
+            if (scope == alert_scope_t::pid) {
+                const auto it = _pids.try_emplace(pid, none).first;
+                slot = &it->second;
+            }
+            else if (scope == alert_scope_t::flow) {
+                const auto it = _flows.try_emplace(flow, none).first;
+                slot = &it->second;
+            }
+            if (slot && *slot != none) {
+                return *slot;
+            }
+            const auto index = allocate(_entities, _free_entities);
+            auto& entity = _entities[index];
+            entity        = entity_t{};
+            entity.scope  = scope;
+            entity.pid    = pid;
+            entity.flow   = flow;
+            entity.inputs.fill(none);
+            for (std::size_t metric = 0; metric < entity.inputs.size(); metric++) {
+                if (rules[metric].empty()) {
+                    continue;
+                }
+                const auto input = allocate(_inputs, _free_inputs);
+                _inputs[input] = input_t{};
+                _inputs[input].entity = index;
+                for (const auto rule : rules[metric]) {
+                    _inputs[input].instances.push_back(instance_t{ rule });
+                }
+                _entities[index].inputs[metric] = input;
+                // evaluated once even if it stays 0
+                queue(input);
+            }
+            if (slot) {
+                *slot = index;
+            }
+            return index;
+        }
+
+        template <class data_t>
+        inline void
+        set_traffic(std::uint32_t entity, const data_t& data) {
+            set(entity, alert_metric_t::pkg_sent,   (double)data.pkg_sent);
+            set(entity, alert_metric_t::pkg_recv,   (double)data.pkg_recv);
+            set(entity, alert_metric_t::bytes_sent, (double)data.bytes_sent);
+            set(entity, alert_metric_t::bytes_recv, (double)data.bytes_recv);
+            set(entity, alert_metric_t::bytes,      (double)data.bytes_sent + (double)data.bytes_recv);
+            set(entity, alert_metric_t::packets,    (double)data.pkg_sent + (double)data.pkg_recv);
+        }
+
+        inline void
+        set(std::uint32_t entity, alert_metric_t metric, double value) {
+            const auto input = _entities[entity].inputs[(std::size_t)metric];
+            if (input == none || _inputs[input].value == value) {
+                return;
+            }
+            _inputs[input].value = value;
+            queue(input);
+        }
+
+        inline void
+        queue(std::uint32_t input) {
+            if (_inputs[input].queued != _epoch + 1) {
+                _inputs[input].queued = _epoch + 1;
+                _queue.push_back(input);
+            }
+        }
+
+        /** Steps every instance of @p index, returns how many. */
+        inline std::size_t
+        step(std::uint32_t index, std::int64_t now) {
+            auto& input = _inputs[index];
+            const bool has_rate = input.has_last && now > input.last_time;
+            input.rate       = has_rate ? (input.value - input.last_value) * 1e9 / (double)(now - input.last_time) : 0.0;
+            input.last_value = input.value;
+            input.last_time  = now;
+            input.has_last   = true;
+            bool moving = input.rate != 0;
+            for (auto& instance : input.instances) {
+                const auto& rule = _rules[instance.rule];
+                if (rule.rate && !has_rate) {
+                    // the first value is only the base of the rate
+                    continue;
+                }
+                const double value = rule.rate ? input.rate : input.value;
+                const bool   over  = rule.above ? value > rule.threshold : value < rule.threshold;
+                switch (instance.phase) {
+                case phase_t::idle:
+                    if (over) {
+                        instance.phase = phase_t::pending;
+                        instance.since = now;
+                    }
+                    [[fallthrough]];
+                case phase_t::pending:
+                    if (!over) {
+                        instance.phase = phase_t::idle;
+                    }
+                    else if (now - instance.since >= rule.duration.count()) {
+                        instance.phase = phase_t::firing;
+                        _firing++;
+                        deliver(input, rule, alert_state_t::fired, value, now);
+                    }
+                    break;
+                case phase_t::firing:
+                    if (rule.above ? value <= rule.clear : value >= rule.clear) {
+                        instance.phase = phase_t::idle;
+                        _firing--;
+                        deliver(input, rule, alert_state_t::cleared, value, now);
+                    }
+                    break;
+                }
+                moving |= instance.phase == phase_t::pending;
+            }
+            if (moving) {
+                _active.push_back(index);
+            }
+            return input.instances.size();
+        }
+
+        inline void
+        deliver(const input_t& input, const alert_rule_t& rule, alert_state_t state, double value, std::int64_t now) {
+            if (!_callback) {
+                return;
+            }
+            const auto& entity = _entities[input.entity];
+            alert_t alert;
+            alert.rule         = &rule;
+            alert.state        = state;
+            alert.pid          = entity.pid;
+            alert.flow         = entity.flow;
+            alert.value        = value;
+            alert.timestamp_ns = now;
+            _callback(alert);
+        }
+
+        /** Flows come and go, drop those at 0 whose instances are idle. */
+        inline void
+        forget_idle_flows() {
+            for (auto it = _flows.begin(); it != _flows.end();) {
+                const auto entity = it->second;
+                bool idle = true;
+                for (const auto input : _entities[entity].inputs) {
+                    if (input == none) continue;
+                    const auto& data = _inputs[input];
+                    idle &= data.value == 0 && data.rate == 0 &&
+                            std::all_of(data.instances.begin(), data.instances.end(),
+                                        [](const instance_t& instance) { return instance.phase == phase_t::idle; });
+                }
+                if (!idle) {
+                    ++it;
+                    continue;
+                }
+                for (const auto input : _entities[entity].inputs) {
+                    if (input == none) continue;
+                    _inputs[input].instances.clear();
+                    _free_inputs.push_back(input);
+                }
+                _free_entities.push_back(entity);
+                it = _flows.erase(it);
+            }
+        }
+
+        template <class item_t>
+        static inline std::uint32_t
+        allocate(std::vector<item_t>& items, std::vector<std::uint32_t>& free) {
+            if (!free.empty()) {
+                const auto index = free.back();
+                free.pop_back();
+                return index;
+            }
+            items.emplace_back();
+            return (std::uint32_t)(items.size() - 1);
+        }
+
+        using rule_ids_t = std::vector<std::uint32_t>;
+
+        std::vector<alert_rule_t>                                       _rules;
+        rule_ids_t                                                      _rules_of[(std::size_t)alert_scope_t::n_of_scopes][(std::size_t)alert_metric_t::n_of_metrics];
+        callback_t                                                      _callback;
+        std::vector<entity_t>                                           _entities;
+        std::vector<std::uint32_t>                                      _free_entities;
+        std::vector<input_t>                                            _inputs;
+        std::vector<std::uint32_t>                                      _free_inputs;
+        std::vector<std::uint32_t>                                      _queue;
+        std::vector<std::uint32_t>                                      _active;
+        std::uint32_t                                                   _globals[2]{ none, none };
+        std::unordered_map<std::uint32_t, std::uint32_t>                _pids;
+        std::unordered_map<flow_key_t, std::uint32_t, flow_key_hash_t>  _flows;
+        std::uint64_t                                                   _epoch{ 0 };
+        std::size_t                                                     _firing{ 0 };
+    };
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+namespace performance {
+
+    /** Buffer tuning of a trace session. ETW allocates between minimum and
+     *  maximum buffers of buffer_size_kb each and flushes partially filled
+     *  buffers to the consumer every flush_timer_s. */
+    struct session_config_t {
+        std::uint32_t   buffer_size_kb{ 64 };
+        std::uint32_t   minimum_buffers{ 16 };
+        std::uint32_t   maximum_buffers{ 64 };
+        std::uint32_t   flush_timer_s{ 1 };
+        std::uint32_t   max_memory_kb{ 64 * 1024 };   // upper bound for any controller
+
+        inline std::uint64_t
+        memory_kb() const noexcept {
+            return (std::uint64_t)buffer_size_kb * maximum_buffers;
+        }
+
+        inline std::uint32_t
+        buffers_in_budget() const noexcept {
+            return buffer_size_kb ? max_memory_kb / buffer_size_kb : 0;
+        }
+    };
+
+    /** What the session reported since it started; counters are cumulative
+     *  and go back to zero when the session restarts. */
+    struct buffer_sample_t {
+        std::size_t     events_lost{ 0 };
+        std::size_t     buffers_lost{ 0 };
+        std::int64_t    consumer_lag_ns{ 0 };
+        std::size_t     number_of_buffers{ 0 };
+        std::size_t     free_buffers{ 0 };
+    };
+
+    enum class buffer_action_t {
+        none,
+        update,     // maximum_buffers/flush_timer_s, applied to the running session
+        restart     // buffer_size_kb/minimum_buffers, needs a new session
+    };
+
+    struct buffer_decision_t {
+        buffer_action_t  action{ buffer_action_t::none };
+        session_config_t config;
+    };
+
+    /** Decides how the session buffers should change from periodic samples.
+     *  Free of ETW so it can be driven by a simulated event source. */
+    class buffer_controller_t {
+    public:
+        virtual ~buffer_controller_t() = default;
+
+        virtual buffer_decision_t
+        decide(const session_config_t& current, const buffer_sample_t& sample) = 0;
+    };
+
+    /** Doubles maximum_buffers while events are lost or the consumer lags,
+     *  up to max_memory_kb. Once the budget is used, losses restart the
+     *  session with every buffer preallocated. After quiet_samples samples
+     *  without pressure and with most buffers free, gives back a quarter of
+     *  the buffers, never going below the initial configuration nor the
+     *  preallocated ones. */
+    class adaptive_buffer_controller_t : public buffer_controller_t {
+    public:
+        explicit adaptive_buffer_controller_t(const session_config_t& initial,
+                                              std::int64_t max_lag_ns = 500'000'000,
+                                              std::size_t  quiet_samples = 30,
+                                              std::size_t  restart_cooldown = 10)
+            : _initial{ initial }
+            , _max_lag_ns{ max_lag_ns }
+            , _quiet_samples{ quiet_samples }
+            , _restart_cooldown{ restart_cooldown } {}
+
+        inline buffer_decision_t
+        decide(const session_config_t& current, const buffer_sample_t& sample) override {
+            const auto lost = delta(sample.events_lost, _last.events_lost) +
+                              delta(sample.buffers_lost, _last.buffers_lost);
+            _last = sample;
+            if (_cooldown) {
+                _cooldown--;
+            }
+
+            buffer_decision_t decision{ buffer_action_t::none, current };
+            auto& next = decision.config;
+            if (lost || sample.consumer_lag_ns > _max_lag_ns) {
+                _quiet = 0;
+                const auto budget = current.buffers_in_budget();
+                if (current.maximum_buffers < budget) {
+                    next.maximum_buffers = std::min(std::max(current.maximum_buffers * 2,
+                                                             current.minimum_buffers + 1),
+                                                    budget);
+                    decision.action = buffer_action_t::update;
+                }
+                else if (lost && !_cooldown && current.minimum_buffers < current.maximum_buffers) {
+                    // no memory left to grow into, at least don't wait for
+                    // ETW to allocate buffers in the middle of a burst
+                    next.minimum_buffers = current.maximum_buffers;
+                    decision.action      = buffer_action_t::restart;
+                    _cooldown            = _restart_cooldown;
+                }
+                return decision;
+            }
+
+            const auto used = sample.number_of_buffers - std::min(sample.free_buffers, sample.number_of_buffers);
+            if (++_quiet >= _quiet_samples &&
+                current.maximum_buffers > std::max(_initial.maximum_buffers, current.minimum_buffers) &&
+                used < current.maximum_buffers / 4) {
+                _quiet = 0;
+                // preallocated buffers stay until the next restart
+                next.maximum_buffers = std::max({ current.maximum_buffers - current.maximum_buffers / 4,
+                                                  _initial.maximum_buffers,
+                                                  current.minimum_buffers });
+                decision.action = buffer_action_t::update;
+            }
+            return decision;
+        }
+
+    private:
+        static inline std::size_t
+        delta(std::size_t now, std::size_t last) noexcept {
+            // a restarted session counts from zero again
+            return now >= last ? now - last : now;
+        }
+
+        session_config_t                          _initial;
+        std::int64_t                              _max_lag_ns;
+        std::size_t                               _quiet_samples;
+        std::size_t                               _restart_cooldown;
+        std::size_t                               _quiet{ 0 };
+        std::size_t                               _cooldown{ 0 };
+        buffer_sample_t                           _last;
+    };
+}
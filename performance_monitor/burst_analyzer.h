@@ -0,0 +1,385 @@
+#pragma once
+
+#include "clock.h"
+#include "memory_budget.h"
+#include "network_event.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace performance {
+
+    /** Peaks of one entity in one window size during a reporting interval. */
+    struct burst_stats_t {
+        std::int64_t    window_ns{ 0 };
+        std::int64_t    peak_bytes{ 0 };
+        std::int64_t    peak_bytes_timestamp{ 0 };
+        std::int64_t    peak_packets{ 0 };
+        std::int64_t    peak_packets_timestamp{ 0 };
+        std::int64_t    bytes{ 0 };             // whole interval
+        std::int64_t    packets{ 0 };
+        double          peak_to_average{ 0 };   // bytes, peak window / average window
+    };
+
+    /** Sliding sums of bytes and packets over several window lengths.
+     *  Events are kept once in a ring sized for the longest window and every
+     *  window advances its own tail over it, so an update is O(1) amortized
+     *  per window. Timestamps are event ticks.
+     *
+     *  The ring is charged to @p account: when it can't grow, add() throws
+     *  std::bad_alloc before changing anything, unless @p enforce is false
+     *  (an "other" tracker, which must take every event). */
+    class burst_tracker_t {
+    public:
+        explicit burst_tracker_t(const std::vector<std::int64_t>& window_ticks,
+                                 memory_account_t* account = nullptr,
+                                 bool enforce = true)
+            : _account{ account }
+            , _enforce{ enforce } {
+            _windows.resize(window_ticks.size());
+            for (std::size_t ii = 0; ii < window_ticks.size(); ii++) {
+                _windows[ii].length = window_ticks[ii];
+            }
+            charge(16 * sizeof(sample_t));
+            _ring.resize(16);
+        }
+
+        burst_tracker_t(burst_tracker_t&& other) noexcept
+            : _account{ other._account }
+            , _enforce{ other._enforce }
+            , _charged{ std::exchange(other._charged, 0) }
+            , _ring{ std::move(other._ring) }
+            , _begin{ other._begin }
+            , _size{ other._size }
+            , _windows{ std::move(other._windows) }
+            , _last_timestamp{ other._last_timestamp }
+            , _interval_bytes{ other._interval_bytes }
+            , _interval_packets{ other._interval_packets } {}
+        burst_tracker_t(const burst_tracker_t&) = delete;
+
+        ~burst_tracker_t() noexcept {
+            if (_account && _charged) {
+                _account->release(_charged);
+            }
+        }
+
+        inline void
+        add(std::int64_t timestamp, std::uint32_t bytes) {
+            if (_size == _ring.size()) {
+                grow();
+            }
+            // per cpu buffers may deliver slightly out of order
+            timestamp = std::max(timestamp, _last_timestamp);
+            _last_timestamp = timestamp;
+            const auto head = _begin + _size;
+            _ring[head & (_ring.size() - 1)] = { timestamp, bytes };
+            _size++;
+            _interval_bytes += bytes;
+            _interval_packets++;
+
+            std::uint64_t oldest_tail = head;
+            for (auto& window : _windows) {
+                window.bytes += bytes;
+                window.packets++;
+                while (_ring[window.tail & (_ring.size() - 1)].timestamp <= timestamp - window.length) {
+                    const auto& old = _ring[window.tail & (_ring.size() - 1)];
+                    window.bytes -= old.bytes;
+                    window.packets--;
+                    window.tail++;
+                }
+                if (window.bytes > window.peak_bytes) {
+                    window.peak_bytes           = window.bytes;
+                    window.peak_bytes_timestamp = timestamp;
+                }
+                if (window.packets > window.peak_packets) {
+                    window.peak_packets           = window.packets;
+                    window.peak_packets_timestamp = timestamp;
+                }
+                oldest_tail = std::min(oldest_tail, window.tail);
+            }
+            _size  -= (std::size_t)(oldest_tail - _begin);
+            _begin  = oldest_tail;
+        }
+
+        /** Stats of the @p interval_ticks long interval since the previous
+         *  report; starts a new interval. */
+        template <class callback_t>
+        inline void
+        report(std::int64_t interval_ticks, const tick_converter_t& converter, callback_t&& callback) {
+            for (auto& window : _windows) {
+                burst_stats_t stats;
+                stats.window_ns              = converter.to_ns(window.length);
+                stats.peak_bytes             = window.peak_bytes;
+                stats.peak_bytes_timestamp   = window.peak_bytes_timestamp;
+                stats.peak_packets           = window.peak_packets;
+                stats.peak_packets_timestamp = window.peak_packets_timestamp;
+                stats.bytes                  = _interval_bytes;
+                stats.packets                = _interval_packets;
+                if (_interval_bytes > 0 && interval_ticks > 0) {
+                    const double average = (double)_interval_bytes * window.length / interval_ticks;
+                    stats.peak_to_average = window.peak_bytes / std::max(average, 1.0);
+                }
+                callback(stats);
+                window.peak_bytes   = window.bytes;
+                window.peak_packets = window.packets;
+            }
+            _interval_bytes = _interval_packets = 0;
+        }
+
+        inline bool
+        idle() const noexcept {
+            return _interval_packets == 0;
+        }
+
+        /** Event time of the last add(). */
+        inline std::int64_t
+        last_timestamp() const noexcept {
+            return _last_timestamp;
+        }
+
+        /** Adds the interval totals of @p evicted, whose peaks are lost. */
+        inline void
+        fold(const burst_tracker_t& evicted) noexcept {
+            _interval_bytes   += evicted._interval_bytes;
+            _interval_packets += evicted._interval_packets;
+        }
+
+    private:
+        struct sample_t {
+            std::int64_t    timestamp;
+            std::uint32_t   bytes;
+        };
+
+        struct window_t {
+            std::int64_t    length{ 0 };
+            std::uint64_t   tail{ 0 };
+            std::int64_t    bytes{ 0 };
+            std::int64_t    packets{ 0 };
+            std::int64_t    peak_bytes{ 0 };
+            std::int64_t    peak_bytes_timestamp{ 0 };
+            std::int64_t    peak_packets{ 0 };
+            std::int64_t    peak_packets_timestamp{ 0 };
+        };
+
+        inline void
+        charge(std::size_t bytes) {
+            if (!_account) {
+                return;
+            }
+            if (!_enforce) {
+                _account->charge(bytes);
+            }
+            else if (!_account->try_charge(bytes)) {
+                throw std::bad_alloc{};
+            }
+            _charged += bytes;
+        }
+
+        inline void
+        grow() {
+            // keep positions valid: unwrap into a ring twice as big
+            std::vector<sample_t> ring(_ring.size() * 2);
+            charge(_ring.size() * sizeof(sample_t));
+            for (std::uint64_t ii = _begin; ii < _begin + _size; ii++) {
+                ring[ii & (ring.size() - 1)] = _ring[ii & (_ring.size() - 1)];
+            }
+            _ring.swap(ring);
+        }
+
+        memory_account_t*                         _account;
+        bool                                      _enforce;
+        std::size_t                               _charged{ 0 };
+        std::vector<sample_t>                     _ring;
+        std::uint64_t                             _begin{ 0 };
+        std::size_t                               _size{ 0 };
+        std::vector<window_t>                     _windows;
+        std::int64_t                              _last_timestamp{ 0 };
+        std::int64_t                              _interval_bytes{ 0 };
+        std::int64_t                              _interval_packets{ 0 };
+    };
+
+    /** Micro-burst detection per process and per flow for send/receive events.
+     *
+     *  Processes and flows are kept in maps whose nodes come out of a pool
+     *  charged to @p account, like the rings of their trackers. At
+     *  max_flows flows, or when the budget refuses memory, the least
+     *  recently active eighth of the flows (or processes) is evicted and
+     *  its interval totals folded into an other entry: other_flow and
+     *  other_pid, reported like the rest. */
+    class burst_analyzer_t {
+    public:
+        using pid_callback_t  = std::function<void(std::uint32_t, const burst_stats_t&)>;
+        using flow_callback_t = std::function<void(const flow_key_t&, const burst_stats_t&)>;
+
+        static constexpr std::uint32_t other_pid = std::numeric_limits<std::uint32_t>::max() - 1;
+        static inline const flow_key_t other_flow{};
+
+        /** @p converter is the tick rate of the event timestamps. */
+        burst_analyzer_t(const std::vector<std::chrono::nanoseconds>& windows,
+                         const tick_converter_t& converter,
+                         std::size_t max_flows = 4096,
+                         memory_account_t* account = nullptr)
+            : _converter{ converter }
+            , _max_flows{ max_flows }
+            , _account{ account }
+            , _pool{ std::make_shared<memory_pool_t>(account) }
+            , _pids{ 0, std::hash<std::uint32_t>{}, std::equal_to<std::uint32_t>{}, pid_allocator_t{ _pool } }
+            , _flows{ 0, flow_key_hash_t{}, std::equal_to<flow_key_t>{}, flow_allocator_t{ _pool } } {
+            for (auto& window : windows) {
+                _window_ticks.push_back(std::max<std::int64_t>(_converter.to_ticks(window.count()), 1));
+            }
+            _other_pid.emplace(_window_ticks, account, false);
+            _other_flow.emplace(_window_ticks, account, false);
+        }
+
+        inline void
+        add(const network_event_t& e) {
+            if (e.type != EVENT_TRACE_TYPE_SEND && e.type != EVENT_TRACE_TYPE_RECEIVE) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock{ _mtx };
+            if (!_interval_start) {
+                _interval_start = e.timestamp;
+            }
+            _last_timestamp = std::max(_last_timestamp, e.timestamp);
+            if (!add(_pids, e.pid, e, *_other_pid)) {
+                _other_pid->add(e.timestamp, e.size);
+            }
+            if (_flows.size() >= _max_flows && _flows.find(flow_key_t{ e }) == _flows.end()) {
+                evict(_flows, *_other_flow);
+            }
+            if (!add(_flows, flow_key_t{ e }, e, *_other_flow)) {
+                _untracked_flows++;
+                _other_flow->add(e.timestamp, e.size);
+            }
+        }
+
+        /** Reports the interval since the previous call and starts a new one.
+         *  Processes and flows without traffic in the interval are forgotten. */
+        inline void
+        report(const pid_callback_t& on_pid, const flow_callback_t& on_flow) {
+            std::lock_guard<std::mutex> lock{ _mtx };
+            const auto interval_ticks = _last_timestamp - _interval_start;
+            for (auto it = _pids.begin(); it != _pids.end();) {
+                if (it->second.idle()) {
+                    it = _pids.erase(it);
+                    continue;
+                }
+                const auto pid = it->first;
+                it->second.report(interval_ticks, _converter, [&](const burst_stats_t& stats) { on_pid(pid, stats); });
+                ++it;
+            }
+            for (auto it = _flows.begin(); it != _flows.end();) {
+                if (it->second.idle()) {
+                    it = _flows.erase(it);
+                    continue;
+                }
+                const auto& key = it->first;
+                it->second.report(interval_ticks, _converter, [&](const burst_stats_t& stats) { on_flow(key, stats); });
+                ++it;
+            }
+            if (!_other_pid->idle()) {
+                _other_pid->report(interval_ticks, _converter, [&](const burst_stats_t& stats) { on_pid(other_pid, stats); });
+            }
+            if (!_other_flow->idle()) {
+                _other_flow->report(interval_ticks, _converter, [&](const burst_stats_t& stats) { on_flow(other_flow, stats); });
+            }
+            _interval_start = _last_timestamp;
+        }
+
+        /** Flows counted in other_flow because there was no room for them. */
+        inline std::size_t
+        untracked_flows() const {
+            std::lock_guard<std::mutex> lock{ _mtx };
+            return _untracked_flows;
+        }
+
+    private:
+        using pid_allocator_t  = pool_allocator_t<std::pair<const std::uint32_t, burst_tracker_t>>;
+        using flow_allocator_t = pool_allocator_t<std::pair<const flow_key_t, burst_tracker_t>>;
+        using pid_map_t        = std::unordered_map<std::uint32_t, burst_tracker_t,
+                                                    std::hash<std::uint32_t>, std::equal_to<std::uint32_t>, pid_allocator_t>;
+        using flow_map_t       = std::unordered_map<flow_key_t, burst_tracker_t,
+                                                    flow_key_hash_t, std::equal_to<flow_key_t>, flow_allocator_t>;
+
+        /** Adds @p e to the tracker of @p key, evicting once when there's
+         *  no memory for it. False when it still didn't fit. */
+        template <class map_t, class key_t>
+        inline bool
+        add(map_t& map, const key_t& key, const network_event_t& e, burst_tracker_t& other) {
+            for (int attempt = 0; attempt < 2; attempt++) {
+                try {
+                    auto it = map.find(key);
+                    if (it == map.end()) {
+                        it = map.emplace(key, burst_tracker_t{ _window_ticks, _account }).first;
+                    }
+                    it->second.add(e.timestamp, e.size);
+                    return true;
+                }
+                catch (const std::bad_alloc&) {
+                    if (attempt || !evict(map, other)) {
+                        break;
+                    }
+                }
+            }
+            if (_account) {
+                _account->count_refused();
+            }
+            return false;
+        }
+
+        /** Folds the least recently active eighth of @p map into @p other. */
+        template <class map_t>
+        inline bool
+        evict(map_t& map, burst_tracker_t& other) {
+            if (map.empty()) {
+                return false;
+            }
+            _last_seen.clear();
+            for (const auto& [key, tracker] : map) {
+                _last_seen.push_back(tracker.last_timestamp());
+            }
+            const auto n = std::max<std::size_t>(_last_seen.size() / 8, 1);
+            std::nth_element(_last_seen.begin(), _last_seen.begin() + (n - 1), _last_seen.end());
+            const auto oldest = _last_seen[n - 1];
+            std::size_t evicted{ 0 };
+            for (auto it = map.begin(); it != map.end() && evicted < n;) {
+                if (it->second.last_timestamp() > oldest) {
+                    ++it;
+                    continue;
+                }
+                other.fold(it->second);
+                it = map.erase(it);
+                evicted++;
+            }
+            if (_account) {
+                _account->count_evicted(evicted);
+            }
+            return true;
+        }
+
+        mutable std::mutex                                              _mtx;
+        tick_converter_t                                                _converter;
+        std::size_t                                                     _max_flows;
+        memory_account_t*                                               _account;
+        std::shared_ptr<memory_pool_t>                                  _pool;
+        std::vector<std::int64_t>                                       _window_ticks;
+        pid_map_t                                                       _pids;
+        flow_map_t                                                      _flows;
+        std::optional<burst_tracker_t>                                  _other_pid;
+        std::optional<burst_tracker_t>                                  _other_flow;
+        std::vector<std::int64_t>                                       _last_seen;
+        std::int64_t                                                    _interval_start{ 0 };
+        std::int64_t                                                    _last_timestamp{ 0 };
+        std::size_t                                                     _untracked_flows{ 0 };
+    };
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "network_monitor.h"
+#include "output_sink.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <thread>
+
+namespace performance {
+
+    #pragma pack (push, 1)
+    /** Start of a capture file, followed by network_event_t records until
+     *  the end of the file. Fixed size records let readers split a capture
+     *  anywhere without scanning it. */
+    struct capture_header_t {
+        static constexpr char magic_value[4] = { 'P', 'W', 'C', '1' };
+
+        char            magic[4]{ 'P', 'W', 'C', '1' };
+        std::uint32_t   record_size{ sizeof(network_event_t) };
+        std::uint64_t   frequency{ 0 };         // of the event timestamps
+        std::int64_t    start_timestamp{ 0 };   // event ticks when the capture started
+        std::int64_t    start_unix_ns{ 0 };
+
+        inline bool
+        valid() const noexcept {
+            return std::memcmp(magic, magic_value, sizeof(magic)) == 0 &&
+                   record_size == sizeof(network_event_t) &&
+                   frequency > 0;
+        }
+    };
+    #pragma pack (pop)
+
+    /** Records every decoded event of a monitor to a file. Events are pulled
+     *  from a subscription on a thread of its own and written in batches. */
+    class capture_writer_t {
+    public:
+        capture_writer_t() = default;
+        ~capture_writer_t() noexcept {
+            stop();
+        }
+
+        inline bool
+        start(network_monitor_t& monitor, const std::filesystem::path& path, std::size_t capacity = 64 * 1024) {
+            stop();
+            auto* file = std::fopen(path.string().c_str(), "wb");
+            if (!file) {
+                std::cerr << "Failed to open capture " << path;
+                return false;
+            }
+            _monitor = &monitor;
+            _writer  = std::make_unique<batch_writer_t>(file, true);
+
+            const auto& clock = monitor.event_clock();
+            capture_header_t header;
+            header.frequency       = clock.frequency();
+            header.start_timestamp = tick_clock_t::qpc();
+            header.start_unix_ns   = clock.to_unix_ns(header.start_timestamp);
+            auto* out = _writer->reserve();
+            std::memcpy(out, &header, sizeof(header));
+            _writer->commit(out + sizeof(header));
+
+            _subscription = monitor.subscribe(capacity);
+            _running      = true;
+            _thread = std::thread([this]() { run(); });
+            return true;
+        }
+
+        inline void
+        stop() noexcept {
+            if (!_running) return;
+            _running = false;
+            if (_thread.joinable()) {
+                _thread.join();
+            }
+            _monitor->unsubscribe(_subscription);
+            _subscription.reset();
+            _writer.reset();
+        }
+
+        inline std::size_t
+        events_written() const noexcept {
+            return _events_written;
+        }
+
+    private:
+        inline void
+        run() {
+            event_subscription_t::batch_t batch;
+            constexpr auto per_reserve = batch_writer_t::max_record_size / sizeof(network_event_t);
+            while (_running) {
+                if (!_subscription->pop_batch(batch, 4096, std::chrono::milliseconds{ 100 })) {
+                    continue;
+                }
+                for (std::size_t ii = 0; ii < batch.size(); ii += per_reserve) {
+                    const auto count = std::min(per_reserve, batch.size() - ii);
+                    auto* out = _writer->reserve();
+                    std::memcpy(out, &batch[ii], count * sizeof(network_event_t));
+                    _writer->commit(out + count * sizeof(network_event_t));
+                }
+                _events_written += batch.size();
+                _writer->submit();
+            }
+        }
+
+        network_monitor_t*                        _monitor{ nullptr };
+        std::unique_ptr<batch_writer_t>           _writer;
+        std::shared_ptr<event_subscription_t>     _subscription;
+        std::atomic<bool>                         _running{ false };
+        std::atomic<std::size_t>                  _events_written{ 0 };
+        std::thread                               _thread;
+    };
+
+    /** Reads the header of a capture, nullopt when it isn't one. */
+    inline std::optional<capture_header_t>
+    read_capture_header(const std::filesystem::path& path) {
+        std::ifstream file{ path, std::ios::binary };
+        capture_header_t header;
+        if (!file.read((char*)&header, sizeof(header)) || !header.valid()) {
+            return std::nullopt;
+        }
+        return header;
+    }
+}
@@ -0,0 +1,474 @@
+#pragma once
+
+#include "burst_analyzer.h"
+#include "capture.h"
+#include "instrumentation.h"
+#include "network_monitor.h"
+#include "output_sink.h"
+#include "pid_table.h"
+#include "sampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+namespace performance {
+
+    /** HyperLogLog estimate of distinct values, ~1.6% error with the 4096
+     *  registers used here. Merging is a register wise max, so partial
+     *  sketches merge in any order to the same result. */
+    class distinct_sketch_t {
+    public:
+        static constexpr std::size_t precision = 12;
+        static constexpr std::size_t registers = std::size_t{ 1 } << precision;
+
+        inline void
+        add(std::uint64_t value) noexcept {
+            // finalizer of splitmix64, spreads close addresses over all registers
+            value ^= value >> 30; value *= 0xBF58476D1CE4E5B9ull;
+            value ^= value >> 27; value *= 0x94D049BB133111EBull;
+            value ^= value >> 31;
+            const auto index = value >> (64 - precision);
+            const auto rest  = (value << precision) | (std::uint64_t{ 1 } << (precision - 1));
+            std::uint8_t rank = 1;
+            while (!(rest & (std::uint64_t{ 1 } << (64 - rank)))) {
+                rank++;
+            }
+            _registers[index] = std::max(_registers[index], rank);
+        }
+
+        inline void
+        merge(const distinct_sketch_t& other) noexcept {
+            for (std::size_t ii = 0; ii < registers; ii++) {
+                _registers[ii] = std::max(_registers[ii], other._registers[ii]);
+            }
+        }
+
+        inline double
+        estimate() const noexcept {
+            double      sum{ 0 };
+            std::size_t zeros{ 0 };
+            for (auto reg : _registers) {
+                sum += std::ldexp(1.0, -reg);
+                zeros += reg == 0;
+            }
+            const double m     = (double)registers;
+            const double alpha = 0.7213 / (1 + 1.079 / m);
+            const double raw   = alpha * m * m / sum;
+            if (raw <= 2.5 * m && zeros) {
+                // linear counting is better for small sets
+                return m * std::log(m / zeros);
+            }
+            return raw;
+        }
+
+    private:
+        std::uint8_t                              _registers[registers]{};
+    };
+
+    struct flow_totals_t {
+        std::int64_t    pkg_sent{ 0 };
+        std::int64_t    pkg_recv{ 0 };
+        std::int64_t    bytes_sent{ 0 };
+        std::int64_t    bytes_recv{ 0 };
+        std::int64_t    retransmissions{ 0 };
+    };
+
+    /** Counters of one event, with the semantics of the live monitor. */
+    inline void
+    account_event(tcp_data_t& data, const network_event_t& e) noexcept {
+        data.packages++;
+        switch (e.type) {
+        case EVENT_TRACE_TYPE_CONNECT:    data.connections++;                                  break;
+        case EVENT_TRACE_TYPE_DISCONNECT: data.connections--; data.connections_lost++;         break;
+        case EVENT_TRACE_TYPE_CONNFAIL:   data.connections_lost++;                             break;
+        case EVENT_TRACE_TYPE_RETRANSMIT: data.retransmissions++;                              break;
+        case EVENT_TRACE_TYPE_RECEIVE:    data.pkg_recv++; data.bytes_recv += e.size;          break;
+        case EVENT_TRACE_TYPE_SEND:       data.pkg_sent++; data.bytes_sent += e.size;          break;
+        }
+        data.last_timestamp = std::max(data.last_timestamp, e.timestamp);
+    }
+
+    inline void
+    account_event(udp_data_t& data, const network_event_t& e) noexcept {
+        data.packages++;
+        switch (e.type) {
+        case EVENT_TRACE_TYPE_CONNFAIL:   data.connections_lost++;                             break;
+        case EVENT_TRACE_TYPE_RECEIVE:    data.pkg_recv++; data.bytes_recv += e.size;          break;
+        case EVENT_TRACE_TYPE_SEND:       data.pkg_sent++; data.bytes_sent += e.size;          break;
+        }
+        data.last_timestamp = std::max(data.last_timestamp, e.timestamp);
+    }
+
+    inline void
+    account_event(pid_data_t& data, const network_event_t& e) noexcept {
+        switch (e.type) {
+        case EVENT_TRACE_TYPE_SEND:       data.pkg_sent++; data.bytes_sent += e.size;          break;
+        case EVENT_TRACE_TYPE_RECEIVE:    data.pkg_recv++; data.bytes_recv += e.size;          break;
+        case EVENT_TRACE_TYPE_RETRANSMIT: data.retransmissions++;                              break;
+        case EVENT_TRACE_TYPE_CONNECT:
+        case EVENT_TRACE_TYPE_ACCEPT:     data.connections++;                                  break;
+        // unlike the live table no clamping at 0: a part of a capture may
+        // see a disconnect before its connect, the sums even out on merge
+        case EVENT_TRACE_TYPE_DISCONNECT: data.connections--;                                  break;
+        }
+        data.last_timestamp = std::max(data.last_timestamp, e.timestamp);
+    }
+
+    inline void
+    account_event(flow_totals_t& data, const network_event_t& e) noexcept {
+        switch (e.type) {
+        case EVENT_TRACE_TYPE_SEND:       data.pkg_sent++; data.bytes_sent += e.size;          break;
+        case EVENT_TRACE_TYPE_RECEIVE:    data.pkg_recv++; data.bytes_recv += e.size;          break;
+        case EVENT_TRACE_TYPE_RETRANSMIT: data.retransmissions++;                              break;
+        }
+    }
+
+    /** Totals of a capture, or of a part of it. Every member merges with
+     *  sums, max or register max, so the result doesn't depend on how the
+     *  capture was split nor on the order parts are merged in. */
+    struct capture_analysis_t {
+        capture_header_t                                            header;
+        std::int64_t                                                interval_ticks{ 0 };
+        std::size_t                                                 events{ 0 };
+        tcp_data_t                                                  tcp;
+        udp_data_t                                                  udp;
+        std::unordered_map<std::uint32_t, pid_data_t>               pids;
+        std::unordered_map<flow_key_t, flow_totals_t, flow_key_hash_t> flows;
+        std::map<std::int64_t, network_snapshot_t>                  intervals;
+        latency_histogram_t                                         sizes;   // log2 of payload bytes
+        distinct_sketch_t                                           peers;   // remote address:port
+
+        inline void
+        add(const network_event_t& e) {
+            add(e, intervals[interval_index(e)]);
+        }
+
+        /** Events of a capture mostly come in time order, consecutive ones
+         *  share the interval lookup. */
+        inline void
+        add(const network_event_t* first, std::size_t count) {
+            std::int64_t        last_index{ -1 };
+            network_snapshot_t* interval{ nullptr };
+            for (std::size_t ii = 0; ii < count; ii++) {
+                const auto index = interval_index(first[ii]);
+                if (index != last_index) {
+                    last_index = index;
+                    interval   = &intervals[index];
+                }
+                add(first[ii], *interval);
+            }
+        }
+
+        inline void
+        add(const network_event_t& e, network_snapshot_t& interval) {
+            events++;
+            if (e.protocol == protocol_t::tcp) {
+                account_event(tcp, e);
+                account_event(interval.tcp, e);
+            }
+            else {
+                account_event(udp, e);
+                account_event(interval.udp, e);
+            }
+            auto& pid = pids[e.pid];
+            pid.pid = e.pid;
+            account_event(pid, e);
+            account_event(flows[flow_key_t{ e }], e);
+            if (e.type == EVENT_TRACE_TYPE_SEND || e.type == EVENT_TRACE_TYPE_RECEIVE) {
+                sizes.buckets[latency_histogram_t::bucket(e.size)]++;
+            }
+            peers.add((std::uint64_t)e.daddr << 16 | e.dport);
+        }
+
+        inline void
+        merge(const capture_analysis_t& other) {
+            events += other.events;
+            merge_data(tcp, other.tcp);
+            merge_data(udp, other.udp);
+            for (const auto& [pid, data] : other.pids) {
+                auto& mine = pids[pid];
+                mine.pid              = pid;
+                mine.connections     += data.connections;
+                mine.pkg_sent        += data.pkg_sent;
+                mine.pkg_recv        += data.pkg_recv;
+                mine.bytes_sent      += data.bytes_sent;
+                mine.bytes_recv      += data.bytes_recv;
+                mine.retransmissions += data.retransmissions;
+                mine.last_timestamp   = std::max(mine.last_timestamp, data.last_timestamp);
+            }
+            for (const auto& [key, data] : other.flows) {
+                auto& mine = flows[key];
+                mine.pkg_sent        += data.pkg_sent;
+                mine.pkg_recv        += data.pkg_recv;
+                mine.bytes_sent      += data.bytes_sent;
+                mine.bytes_recv      += data.bytes_recv;
+                mine.retransmissions += data.retransmissions;
+            }
+            for (const auto& [index, data] : other.intervals) {
+                auto& mine = intervals[index];
+                merge_data(mine.tcp, data.tcp);
+                merge_data(mine.udp, data.udp);
+            }
+            for (std::size_t ii = 0; ii < latency_histogram_t::n_of_buckets; ii++) {
+                sizes.buckets[ii] += other.sizes.buckets[ii];
+            }
+            peers.merge(other.peers);
+        }
+
+        /** Rows for an output sink: one snapshot per interval, then every
+         *  process and flow, sorted so equal captures give equal output. */
+        inline void
+        write(output_sink_t& sink) const {
+            const tick_converter_t converter{ header.frequency };
+            for (const auto& [index, data] : intervals) {
+                auto row = data;
+                row.tcp.interval_ms = row.udp.interval_ms = converter.to_ms(interval_ticks);
+                sink.write(header.start_unix_ns + converter.to_ns(index * interval_ticks), row);
+            }
+            const auto end_ns = header.start_unix_ns + converter.to_ns(std::max(tcp.last_timestamp, udp.last_timestamp) - header.start_timestamp);
+            std::vector<const pid_data_t*> sorted_pids;
+            for (const auto& [pid, data] : pids) sorted_pids.push_back(&data);
+            std::sort(sorted_pids.begin(), sorted_pids.end(),
+                      [](const pid_data_t* a, const pid_data_t* b) { return a->pid < b->pid; });
+            for (const auto* data : sorted_pids) {
+                sink.write(end_ns, *data);
+            }
+            std::vector<std::pair<flow_key_t, flow_totals_t>> sorted_flows{ flows.begin(), flows.end() };
+            std::sort(sorted_flows.begin(), sorted_flows.end(), [](const auto& a, const auto& b) {
+                const auto& x = a.first;
+                const auto& y = b.first;
+                return std::tie(x.saddr, x.daddr, x.sport, x.dport, x.protocol) <
+                       std::tie(y.saddr, y.daddr, y.sport, y.dport, y.protocol);
+            });
+            for (const auto& [key, data] : sorted_flows) {
+                output_record_t record{ output_record_t::kind_t::flow_totals };
+                record.add("timestamp_ns", end_ns)
+                      .add("protocol", (std::int64_t)key.protocol)
+                      .add("saddr", (std::int64_t)key.saddr, output_record_t::type_t::ipv4)
+                      .add("sport", (std::int64_t)(std::uint16_t)((key.sport >> 8) | (key.sport << 8)))
+                      .add("daddr", (std::int64_t)key.daddr, output_record_t::type_t::ipv4)
+                      .add("dport", (std::int64_t)(std::uint16_t)((key.dport >> 8) | (key.dport << 8)))
+                      .add("pkg_sent", data.pkg_sent)
+                      .add("pkg_recv", data.pkg_recv)
+                      .add("bytes_sent", data.bytes_sent)
+                      .add("bytes_recv", data.bytes_recv)
+                      .add("retransmissions", data.retransmissions);
+                sink.write(record);
+            }
+            sink.flush();
+        }
+
+    private:
+        inline std::int64_t
+        interval_index(const network_event_t& e) const noexcept {
+            return std::max<std::int64_t>(e.timestamp - header.start_timestamp, 0) / interval_ticks;
+        }
+
+        template <class data_t>
+        static inline void
+        merge_data(data_t& mine, const data_t& other) noexcept {
+            mine.packages         += other.packages;
+            mine.connections_lost += other.connections_lost;
+            mine.max_seg_size      = std::max(mine.max_seg_size, other.max_seg_size);
+            mine.pkg_sent         += other.pkg_sent;
+            mine.pkg_recv         += other.pkg_recv;
+            mine.bytes_sent       += other.bytes_sent;
+            mine.bytes_recv       += other.bytes_recv;
+            mine.last_timestamp    = std::max(mine.last_timestamp, other.last_timestamp);
+            if constexpr (std::is_same_v<data_t, tcp_data_t>) {
+                mine.connections     += other.connections;
+                mine.retransmissions += other.retransmissions;
+            }
+        }
+    };
+
+    /** Runs chunk indexes [0, n_of_chunks) on @p n_of_threads threads.
+     *  Every thread starts with a contiguous range of chunks, reading them
+     *  front to back, and steals from the back of the others once it runs
+     *  out, so uneven chunks don't leave cores idle. */
+    template <class callback_t>
+    inline void
+    run_work_stealing(std::size_t n_of_chunks, std::size_t n_of_threads, callback_t&& callback) {
+        struct queue_t {
+            std::mutex              mtx;
+            std::deque<std::size_t> chunks;
+        };
+        n_of_threads = std::max<std::size_t>(std::min(n_of_threads, n_of_chunks), 1);
+        std::vector<queue_t> queues(n_of_threads);
+        for (std::size_t ii = 0; ii < n_of_threads; ii++) {
+            for (auto chunk = ii * n_of_chunks / n_of_threads; chunk < (ii + 1) * n_of_chunks / n_of_threads; chunk++) {
+                queues[ii].chunks.push_back(chunk);
+            }
+        }
+        const auto next_chunk = [&](std::size_t worker) -> std::optional<std::size_t> {
+            {
+                auto& own = queues[worker];
+                std::lock_guard<std::mutex> lock{ own.mtx };
+                if (!own.chunks.empty()) {
+                    const auto chunk = own.chunks.front();
+                    own.chunks.pop_front();
+                    return chunk;
+                }
+            }
+            for (std::size_t ii = 1; ii < n_of_threads; ii++) {
+                auto& victim = queues[(worker + ii) % n_of_threads];
+                std::lock_guard<std::mutex> lock{ victim.mtx };
+                if (!victim.chunks.empty()) {
+                    const auto chunk = victim.chunks.back();
+                    victim.chunks.pop_back();
+                    return chunk;
+                }
+            }
+            // chunks are only taken, never added: nothing left anywhere
+            return std::nullopt;
+        };
+        std::vector<std::thread> threads;
+        for (std::size_t worker = 0; worker < n_of_threads; worker++) {
+            threads.emplace_back([&, worker]() {
+                while (auto chunk = next_chunk(worker)) {
+                    callback(worker, *chunk);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    /** Aggregates a capture on @p n_of_threads threads, in @p interval long
+     *  intervals. nullopt when the file isn't a capture. */
+    inline std::optional<capture_analysis_t>
+    analyze_capture(const std::filesystem::path& path,
+                    std::chrono::milliseconds interval,
+                    std::size_t n_of_threads = std::thread::hardware_concurrency(),
+                    std::size_t chunk_events = 256 * 1024) {
+        const auto header = read_capture_header(path);
+        if (!header) {
+            std::cerr << path << " isn't a capture";
+            return std::nullopt;
+        }
+        std::error_code error;
+        const auto file_size = std::filesystem::file_size(path, error);
+        if (error) {
+            std::cerr << "Failed to read " << path << ": " << error.message();
+            return std::nullopt;
+        }
+        const auto n_of_events = (file_size - sizeof(capture_header_t)) / sizeof(network_event_t);
+        const auto n_of_chunks = (n_of_events + chunk_events - 1) / chunk_events;
+        n_of_threads = std::max<std::size_t>(n_of_threads, 1);
+
+        capture_analysis_t empty;
+        empty.header         = *header;
+        empty.interval_ticks = std::max<std::int64_t>(tick_converter_t{ header->frequency }.to_ticks(
+                                   std::chrono::duration_cast<std::chrono::nanoseconds>(interval).count()), 1);
+        std::vector<capture_analysis_t>            partials(n_of_threads, empty);
+        std::vector<std::vector<network_event_t>>  buffers(n_of_threads);
+        std::vector<std::ifstream>                 files(n_of_threads);
+
+        run_work_stealing(n_of_chunks, n_of_threads, [&](std::size_t worker, std::size_t chunk) {
+            auto& file   = files[worker];
+            auto& buffer = buffers[worker];
+            if (!file.is_open()) {
+                file.open(path, std::ios::binary);
+                buffer.resize(std::min<std::size_t>(chunk_events, 64 * 1024));
+            }
+            const auto first = chunk * chunk_events;
+            const auto last  = std::min(first + chunk_events, (std::size_t)n_of_events);
+            file.clear();
+            file.seekg(sizeof(capture_header_t) + first * sizeof(network_event_t));
+            for (auto position = first; position < last; position += buffer.size()) {
+                const auto count = std::min(buffer.size(), last - position);
+                if (!file.read((char*)buffer.data(), count * sizeof(network_event_t))) {
+                    break;
+                }
+                partials[worker].add(buffer.data(), count);
+            }
+        });
+
+        auto result = std::move(partials[0]);
+        for (std::size_t ii = 1; ii < partials.size(); ii++) {
+            result.merge(partials[ii]);
+        }
+        return result;
+    }
+
+    /** Sampled estimate of the payload bytes of a capture against the
+     *  exact total, see replay_sampling(). */
+    struct sampling_error_t {
+        std::uint32_t   rate{ 1 };
+        std::size_t     events_kept{ 0 };
+        double          exact{ 0 };
+        estimate_t      estimate;
+
+        inline double
+        relative_error() const noexcept {
+            return exact > 0 ? (estimate.value - exact) / exact : 0;
+        }
+
+        inline bool
+        covered() const noexcept {
+            return estimate.low() <= exact && exact <= estimate.high();
+        }
+    };
+
+    /** Replays a capture through one sampler per rate, in a single pass,
+     *  to measure how far sampled byte totals are from the exact ones. */
+    inline std::optional<std::vector<sampling_error_t>>
+    replay_sampling(const std::filesystem::path& path,
+                    sampling_mode_t mode,
+                    const std::vector<std::uint32_t>& rates) {
+        const auto header = read_capture_header(path);
+        if (!header) {
+            std::cerr << path << " isn't a capture";
+            return std::nullopt;
+        }
+        std::ifstream file{ path, std::ios::binary };
+        file.seekg(sizeof(capture_header_t));
+
+        std::vector<sampler_t>              samplers(rates.size());
+        std::vector<sampling_variance_t>    variances(rates.size());
+        std::vector<sampling_error_t>       errors(rates.size());
+        for (std::size_t ii = 0; ii < rates.size(); ii++) {
+            sampling_config_t config;
+            config.mode     = mode;
+            config.rate     = rates[ii];
+            config.max_rate = rates[ii];
+            samplers[ii].set_config(config);
+            errors[ii].rate = samplers[ii].rate();
+        }
+        double exact{ 0 };
+        std::vector<network_event_t> buffer(64 * 1024);
+        while (file.read((char*)buffer.data(), buffer.size() * sizeof(network_event_t)) || file.gcount() > 0) {
+            const auto count = (std::size_t)file.gcount() / sizeof(network_event_t);
+            for (std::size_t ee = 0; ee < count; ee++) {
+                const auto& e = buffer[ee];
+                const bool payload = e.type == EVENT_TRACE_TYPE_SEND || e.type == EVENT_TRACE_TYPE_RECEIVE;
+                exact += payload ? e.size : 0;
+                for (std::size_t ii = 0; ii < samplers.size(); ii++) {
+                    const auto weight = samplers[ii].weight(e);
+                    if (!weight) {
+                        continue;
+                    }
+                    errors[ii].events_kept++;
+                    if (payload) {
+                        errors[ii].estimate.value += (double)weight * e.size;
+                        variances[ii].add_packet(sampling_variance_t::pkg_sent, sampling_variance_t::bytes_sent, weight, e.size);
+                    }
+                }
+            }
+        }
+        for (std::size_t ii = 0; ii < errors.size(); ii++) {
+            errors[ii].exact    = exact;
+            errors[ii].estimate = variances[ii].estimate(sampling_variance_t::bytes_sent, errors[ii].estimate.value);
+        }
+        return errors;
+    }
+}
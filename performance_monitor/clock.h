@@ -0,0 +1,203 @@
+#pragma once
+
+#include <Windows.h>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#endif
+
+#include <cstdint>
+
+namespace performance {
+
+    /** Exact integer conversions between ticks of a given rate and ns. */
+    class tick_converter_t {
+    public:
+        tick_converter_t() = default;
+        explicit tick_converter_t(std::uint64_t frequency) noexcept
+            : _frequency{ frequency ? frequency : 1 } {}
+
+        inline std::uint64_t
+        frequency() const noexcept {
+            return _frequency;
+        }
+
+        /** Splitting whole seconds from the remainder keeps the product in
+         *  range for any frequency below ~9 GHz. */
+        inline std::int64_t
+        to_ns(std::int64_t ticks) const noexcept {
+            const auto frequency = (std::int64_t)_frequency;
+            return (ticks / frequency) * 1'000'000'000 +
+                   (ticks % frequency) * 1'000'000'000 / frequency;
+        }
+
+        inline std::int64_t
+        to_ticks(std::int64_t ns) const noexcept {
+            const auto frequency = (std::int64_t)_frequency;
+            return (ns / 1'000'000'000) * frequency +
+                   (ns % 1'000'000'000) * frequency / 1'000'000'000;
+        }
+
+        inline double
+        to_ms(std::int64_t ticks) const noexcept {
+            return to_ns(ticks) / 1E6;
+        }
+
+    private:
+        std::uint64_t _frequency{ 1 };
+    };
+
+    /** Cheapest monotonic clock of the machine: the invariant TSC when the
+     *  cpu has one (calibrated against QPC once), QPC otherwise. */
+    class tick_clock_t {
+    public:
+        static inline const tick_clock_t&
+        instance() {
+            static const tick_clock_t clock;
+            return clock;
+        }
+
+        inline std::int64_t
+        now() const noexcept {
+#if defined(_M_X64) || defined(_M_IX86)
+            if (_use_tsc) {
+                return (std::int64_t)__rdtsc();
+            }
+#endif
+            return qpc();
+        }
+
+        inline const tick_converter_t&
+        converter() const noexcept {
+            return _converter;
+        }
+
+        inline std::uint64_t
+        frequency() const noexcept {
+            return _converter.frequency();
+        }
+
+        inline bool
+        uses_tsc() const noexcept {
+            return _use_tsc;
+        }
+
+        /** How far this clock moved away from QPC since calibration.
+         *  Stays at a few us on an invariant TSC. */
+        inline std::int64_t
+        drift_ns() const noexcept {
+            const auto elapsed_qpc   = _qpc.to_ns(qpc() - _qpc_anchor);
+            const auto elapsed_ticks = _converter.to_ns(now() - _tick_anchor);
+            return elapsed_ticks - elapsed_qpc;
+        }
+
+        static inline std::int64_t
+        qpc() noexcept {
+            LARGE_INTEGER counter;
+            (void)QueryPerformanceCounter(&counter);
+            return counter.QuadPart;
+        }
+
+        static inline std::uint64_t
+        qpc_frequency() noexcept {
+            LARGE_INTEGER frequency;
+            (void)QueryPerformanceFrequency(&frequency);
+            return frequency.QuadPart;
+        }
+
+    private:
+        tick_clock_t() {
+            _qpc       = tick_converter_t{ qpc_frequency() };
+            _converter = _qpc;
+#if defined(_M_X64) || defined(_M_IX86)
+            _use_tsc = has_invariant_tsc() && calibrate_tsc();
+#endif
+            _qpc_anchor  = qpc();
+            _tick_anchor = now();
+        }
+
+#if defined(_M_X64) || defined(_M_IX86)
+        static inline bool
+        has_invariant_tsc() noexcept {
+            int regs[4]{};
+            __cpuid(regs, 0x80000000);
+            if ((unsigned)regs[0] < 0x80000007u) {
+                return false;
+            }
+            __cpuid(regs, 0x80000007);
+            return (regs[3] & (1 << 8)) != 0;
+        }
+
+        inline bool
+        calibrate_tsc() noexcept {
+            // ~10 ms of QPC is plenty for a ppm level estimate
+            const auto qpc_start = qpc();
+            const auto tsc_start = __rdtsc();
+            const auto qpc_wait  = _qpc.to_ticks(10'000'000);
+            std::int64_t qpc_end;
+            while ((qpc_end = qpc()) - qpc_start < qpc_wait) {}
+            const auto tsc_end = __rdtsc();
+            const auto elapsed_ns = _qpc.to_ns(qpc_end - qpc_start);
+            if (elapsed_ns <= 0 || tsc_end <= tsc_start) {
+                return false;
+            }
+            const auto frequency = (double)(tsc_end - tsc_start) * 1E9 / elapsed_ns;
+            _converter = tick_converter_t{ (std::uint64_t)frequency };
+            return true;
+        }
+#endif
+
+        tick_converter_t                          _converter;
+        tick_converter_t                          _qpc;
+        std::int64_t                              _qpc_anchor{ 0 };
+        std::int64_t                              _tick_anchor{ 0 };
+        bool                                      _use_tsc{ false };
+    };
+
+    /** ETW stamps events with QPC (Wnode.ClientContext = 1). Converts those
+     *  stamps to durations and to wall clock time, anchored when created. */
+    class event_clock_t {
+    public:
+        event_clock_t()
+            : _converter{ tick_clock_t::qpc_frequency() } {
+            anchor();
+        }
+
+        /** Re-reads the QPC/system time pair, e.g. after a clock change. */
+        inline void
+        anchor() noexcept {
+            FILETIME now;
+            _qpc_anchor = tick_clock_t::qpc();
+            ::GetSystemTimePreciseAsFileTime(&now);
+            const auto filetime = (std::int64_t)(((std::uint64_t)now.dwHighDateTime << 32) | now.dwLowDateTime);
+            // 100ns intervals since 1601-01-01
+            _unix_ns_anchor = (filetime - 116444736000000000ll) * 100;
+        }
+
+        inline const tick_converter_t&
+        converter() const noexcept {
+            return _converter;
+        }
+
+        inline std::uint64_t
+        frequency() const noexcept {
+            return _converter.frequency();
+        }
+
+        inline double
+        interval_ms(std::int64_t from, std::int64_t to) const noexcept {
+            return _converter.to_ms(to - from);
+        }
+
+        /** Nanoseconds since the unix epoch of an event timestamp. */
+        inline std::int64_t
+        to_unix_ns(std::int64_t timestamp) const noexcept {
+            return _unix_ns_anchor + _converter.to_ns(timestamp - _qpc_anchor);
+        }
+
+    private:
+        tick_converter_t                          _converter;
+        std::int64_t                              _qpc_anchor{ 0 };
+        std::int64_t                              _unix_ns_anchor{ 0 };
+    };
+}
@@ -0,0 +1,615 @@
+#pragma once
+
+#include "clock.h"
+#include "instrumentation.h"
+#include "memory_budget.h"
+#include "network_event.h"
+#include "timing_wheel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace performance {
+
+    /** Connection lifecycles of one process, counters only grow. */
+    struct connection_stats_t {
+        std::uint32_t       pid{ 0 };
+        std::size_t         opened{ 0 };        // connect + accept
+        std::size_t         accepted{ 0 };
+        std::size_t         closed{ 0 };        // disconnected, in the histograms
+        std::size_t         failed{ 0 };
+        std::size_t         short_lived{ 0 };   // closed within the short lived threshold
+        std::size_t         expired{ 0 };       // forgotten without a disconnect
+        std::int64_t        bytes{ 0 };         // sent + received by the closed ones
+        std::int64_t        last_timestamp{ 0 };// of its last event
+        latency_histogram_t lifetime_us;        // log2 buckets of microseconds
+        latency_histogram_t bytes_per_connection;
+    };
+
+    enum class flow_end_reason_t : std::uint8_t {
+        closed,         // disconnected
+        expired,        // idle for the idle timeout
+        reused,         // its tuple connected again, the disconnect was lost
+    };
+
+    inline const char*
+    to_string(flow_end_reason_t reason) noexcept {
+        switch (reason) {
+        case flow_end_reason_t::closed:  return "closed";
+        case flow_end_reason_t::expired: return "expired";
+        case flow_end_reason_t::reused:  return "reused";
+        }
+        return "unknown";
+    }
+
+    /** The final record of a tcp connection or udp pseudo-flow, saddr and
+     *  sport are the local end. */
+    struct flow_end_t {
+        flow_key_t          key;
+        std::uint32_t       pid{ 0 };
+        flow_end_reason_t   reason{ flow_end_reason_t::closed };
+        std::int64_t        start{ 0 };         // event ticks of its first event
+        std::int64_t        last{ 0 };          // and of its last one
+        std::int64_t        duration_ns{ 0 };
+        std::int64_t        bytes{ 0 };         // sent + received
+        std::int64_t        packets{ 0 };
+    };
+
+    /** Per second rates between two connection_stats_t of a process. */
+    struct connection_churn_t {
+        std::uint32_t       pid{ 0 };
+        double              opened_per_s{ 0 };
+        double              closed_per_s{ 0 };
+        double              failed_per_s{ 0 };
+        double              short_lived_ratio{ 0 };     // of the closed ones
+    };
+
+    inline connection_churn_t
+    connection_churn(const connection_stats_t& current, const connection_stats_t& previous, double interval_s) noexcept {
+        connection_churn_t churn;
+        churn.pid = current.pid;
+        if (interval_s <= 0) {
+            return churn;
+        }
+        const auto closed      = current.closed - previous.closed;
+        churn.opened_per_s     = (current.opened - previous.opened) / interval_s;
+        churn.closed_per_s     = closed / interval_s;
+        churn.failed_per_s     = (current.failed - previous.failed) / interval_s;
+        churn.short_lived_ratio = closed ? (double)(current.short_lived - previous.short_lived) / closed : 0.0;
+        return churn;
+    }
+
+    /** Follows every tcp connection from connect/accept to disconnect and
+     *  accounts its lifetime and bytes to its process.
+     *
+     *  State is bounded: at most capacity live connections, keyed by their
+     *  4-tuple, and max_pids processes. The processes live in a pool
+     *  charged to @p account; at max_pids, or when the budget refuses
+     *  memory, the least recently active eighth is evicted and folded into
+     *  other_pid, so the totals over every process stay exact.
+     *  Connections without events for idle_timeout are expired, so lost
+     *  disconnects don't pile up; connections opened before tracking began
+     *  are ignored. Connection failures carry no tuple, only the failure
+     *  code, so they are counted per process and per code.
+     *
+     *  Expiry runs on a timing_wheel_t driven by the event timestamps, one
+     *  timer per connection: an event only updates the connection's last
+     *  activity, the timer checks it when it fires and either sets itself
+     *  to the new deadline or expires the connection. No table is ever
+     *  scanned and an event handles at most timers_per_event timers.
+     *  With set_flow_ends() every connection that ends leaves a
+     *  flow_end_t, and udp, which has no connect or disconnect, is followed
+     *  too: a pseudo-flow per 4-tuple from its first event until it was
+     *  idle for udp_idle_timeout, in at most half the capacity.
+     *
+     *  Lifetimes need the connect and the disconnect: with every_nth
+     *  sampling most connections expire, with flow sampling they are exact
+     *  for the sampled flows. */
+    class connection_tracker_t {
+    public:
+        static constexpr std::uint32_t other_pid = std::numeric_limits<std::uint32_t>::max() - 1;
+
+        /** @p converter is the tick rate of the event timestamps. */
+        connection_tracker_t(const tick_converter_t& converter,
+                             std::size_t capacity = 65536,
+                             std::size_t max_pids = 1024,
+                             std::chrono::nanoseconds short_lived = std::chrono::seconds{ 1 },
+                             std::chrono::nanoseconds idle_timeout = std::chrono::minutes{ 10 },
+                             std::chrono::nanoseconds udp_idle_timeout = std::chrono::seconds{ 30 },
+                             memory_account_t* account = nullptr)
+            : _converter{ converter }
+            , _max_pids{ max_pids }
+            , _account{ account }
+            , _short_lived_ticks{ converter.to_ticks(short_lived.count()) }
+            , _idle_ticks{ std::max<std::int64_t>(converter.to_ticks(idle_timeout.count()), 1) }
+            , _udp_idle_ticks{ std::max<std::int64_t>(converter.to_ticks(udp_idle_timeout.count()), 1) }
+            , _pids{ 0, std::hash<std::uint32_t>{}, std::equal_to<std::uint32_t>{},
+                     pid_allocator_t{ std::make_shared<memory_pool_t>(account) } }
+            // expiry to about a thousandth of the shorter timeout
+            , _wheel{ std::max<std::int64_t>(std::min(_idle_ticks, _udp_idle_ticks) / 1024, 1), fixed_size(capacity) / 4 * 3 } {
+            const auto size = fixed_size(capacity);
+            _bits = 4;
+            while ((std::size_t{ 1 } << _bits) < size) {
+                _bits++;
+            }
+            _mask      = size - 1;
+            _limit     = size - size / 4;
+            _udp_limit = _limit / 2;
+            _slots     = std::make_unique<slot_t[]>(size);
+            _other.pid = other_pid;
+            if (_account) {
+                // the live connections and their timers are fixed arrays
+                _account->charge(fixed_bytes());
+            }
+        }
+
+        ~connection_tracker_t() noexcept {
+            if (_account) {
+                _account->release(fixed_bytes() + _max_flow_ends * sizeof(flow_end_t));
+            }
+        }
+
+        /** Keeps a flow_end_t for every connection and udp pseudo-flow that
+         *  ends, up to @p max_pending until drain_flow_ends(), the rest are
+         *  only counted. 0, the default, keeps none and ignores udp. Call
+         *  before the first event. */
+        inline void
+        set_flow_ends(std::size_t max_pending) {
+            std::lock_guard<std::mutex> lock{ _mtx };
+            if (_account) {
+                _account->release(_max_flow_ends * sizeof(flow_end_t));
+                _account->charge(max_pending * sizeof(flow_end_t));
+            }
+            _max_flow_ends = max_pending;
+            _flow_ends.reserve(max_pending);
+        }
+
+        /** Moves the flow ends since the previous call into @p out. */
+        inline void
+        drain_flow_ends(std::vector<flow_end_t>& out) {
+            std::lock_guard<std::mutex> lock{ _mtx };
+            out.clear();
+            out.swap(_flow_ends);
+            _flow_ends.reserve(_max_flow_ends);
+        }
+
+        /** Flow ends not kept because max_pending were already waiting. */
+        inline std::size_t
+        flow_ends_dropped() const {
+            std::lock_guard<std::mutex> lock{ _mtx };
+            return _flow_ends_dropped;
+        }
+
+        /** Accounts a tcp event, and a udp send or receive when flow ends
+         *  are kept; others are ignored. */
+        inline void
+        add(const network_event_t& e) {
+            if (e.type == EVENT_TRACE_TYPE_CONNFAIL) {
+                return;
+            }
+            if (e.protocol == protocol_t::udp && (!_max_flow_ends ||
+                (e.type != EVENT_TRACE_TYPE_SEND && e.type != EVENT_TRACE_TYPE_RECEIVE))) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock{ _mtx };
+            _now = std::max(_now, e.timestamp);
+            _wheel.advance(_now, [this](std::uint32_t index) { return on_timer(index); }, timers_per_event);
+            const auto key   = make_key(e);
+            auto       index = find(key);
+            if (e.protocol == protocol_t::udp) {
+                if (index == npos) {
+                    index = _udp_size < _udp_limit ? insert(key, e) : npos;
+                    if (index == npos) {
+                        _untracked++;
+                        return;
+                    }
+                    _udp_size++;
+                }
+                count(index, e);
+                return;
+            }
+            switch (e.type) {
+            case EVENT_TRACE_TYPE_CONNECT:
+            case EVENT_TRACE_TYPE_ACCEPT:
+            {
+                auto& stats = stats_of(e.pid);
+                stats.opened++;
+                stats.accepted += e.type == EVENT_TRACE_TYPE_ACCEPT;
+                if (index != npos) {
+                    // the disconnect was lost, the tuple is reused
+                    stats_of(_slots[index].pid).expired++;
+                    end(index, flow_end_reason_t::reused);
+                    _wheel.cancel(_slots[index].timer);
+                    erase(index);
+                }
+                if (insert(key, e) == npos) {
+                    _untracked++;
+                }
+                return;
+            }
+            case EVENT_TRACE_TYPE_DISCONNECT:
+                if (index != npos) {
+                    close(index, e.timestamp);
+                }
+                return;
+            case EVENT_TRACE_TYPE_SEND:
+            case EVENT_TRACE_TYPE_RECEIVE:
+                if (index != npos) {
+                    count(index, e);
+                }
+                return;
+            default:
+                if (index != npos) {
+                    _slots[index].last = e.timestamp;
+                }
+                return;
+            }
+        }
+
+        /** Accounts a connection failure of @p pid with the event's FailureCode. */
+        inline void
+        add_failure(std::uint32_t pid, std::uint16_t code) {
+            std::lock_guard<std::mutex> lock{ _mtx };
+            stats_of(pid).failed++;
+            auto it = std::find_if(_failure_codes.begin(), _failure_codes.end(),
+                                   [code](const auto& entry) { return entry.first == code; });
+            if (it != _failure_codes.end()) {
+                it->second++;
+            }
+            else if (_failure_codes.size() < max_failure_codes) {
+                _failure_codes.emplace_back(code, 1);
+            }
+        }
+
+        /** Copies the stats of every process, other_pid last if used. */
+        inline void
+        snapshot(std::vector<connection_stats_t>& out) const {
+            std::lock_guard<std::mutex> lock{ _mtx };
+            out.clear();
+            out.reserve(_pids.size() + 1);
+            for (const auto& [pid, stats] : _pids) {
+                out.push_back(stats);
+            }
+            if (_other.opened || _other.failed) {
+                out.push_back(_other);
+            }
+        }
+
+        /** Failures per FailureCode, of the first max_failure_codes codes
+         *  seen; later codes only count in their process. */
+        inline std::vector<std::pair<std::uint16_t, std::size_t>>
+        failure_codes() const {
+            std::lock_guard<std::mutex> lock{ _mtx };
+            return _failure_codes;
+        }
+
+        /** Connections and udp pseudo-flows followed now. */
+        inline std::size_t
+        live() const {
+            std::lock_guard<std::mutex> lock{ _mtx };
+            return _size;
+        }
+
+        /** Connections and udp pseudo-flows not followed because there was
+         *  no room for them. */
+        inline std::size_t
+        untracked() const {
+            std::lock_guard<std::mutex> lock{ _mtx };
+            return _untracked;
+        }
+
+        static constexpr std::size_t max_failure_codes = 32;
+
+    private:
+        static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+        // a burst of entries due at once is spread over the next events
+        static constexpr std::size_t timers_per_event = 64;
+
+        using pid_allocator_t = pool_allocator_t<std::pair<const std::uint32_t, connection_stats_t>>;
+        using pid_map_t       = std::unordered_map<std::uint32_t, connection_stats_t,
+                                                   std::hash<std::uint32_t>, std::equal_to<std::uint32_t>, pid_allocator_t>;
+
+        /** Both ends, the lower one first. */
+        struct key_t {
+            std::uint64_t   addresses{ 0 };
+            std::uint64_t   ports{ 0 };     // + 1, 0 for an empty slot; udp_flag for udp
+
+            inline bool
+            operator == (const key_t& other) const noexcept {
+                return addresses == other.addresses && ports == other.ports;
+            }
+        };
+
+        static constexpr std::uint64_t udp_flag = std::uint64_t{ 1 } << 40;
+
+        struct slot_t {
+            key_t                       key;
+            std::uint32_t               pid{ 0 };
+            timing_wheel_t::timer_t     timer{ timing_wheel_t::none };
+            std::int64_t                start{ 0 };
+            std::int64_t                last{ 0 };
+            std::int64_t                bytes{ 0 };
+            std::uint32_t               packets{ 0 };
+            bool                        local_low{ false };    // saddr is the lower end of the key
+        };
+
+        static inline std::size_t
+        fixed_size(std::size_t capacity) noexcept {
+            std::size_t size = 16;
+            while (size < capacity + capacity / 4) {
+                size <<= 1;
+            }
+            return size;
+        }
+
+        inline std::size_t
+        fixed_bytes() const noexcept {
+            return (_mask + 1) * sizeof(slot_t) + timing_wheel_t::bytes(_limit);
+        }
+
+        static inline std::uint64_t
+        end_of(std::uint32_t address, std::uint16_t port) noexcept {
+            return ((std::uint64_t)address << 16) | port;
+        }
+
+        /** The same for both directions of the connection. */
+        static inline key_t
+        make_key(const network_event_t& e) noexcept {
+            const auto a = end_of(e.saddr, e.sport);
+            const auto b = end_of(e.daddr, e.dport);
+            const auto low  = std::min(a, b);
+            const auto high = std::max(a, b);
+            return { (low >> 16) << 32 | (high >> 16),
+                     ((low & 0xFFFF) << 16 | (high & 0xFFFF)) + 1 + (e.protocol == protocol_t::udp ? udp_flag : 0) };
+        }
+
+        static inline bool
+        is_udp(const key_t& key) noexcept {
+            return key.ports & udp_flag;
+        }
+
+        inline std::size_t
+        home(const key_t& key) const noexcept {
+            const auto h = key.addresses * 0x9E3779B97F4A7C15ull ^ key.ports * 0xC2B2AE3D27D4EB4Full;
+            return (std::size_t)(h >> (64 - _bits));
+        }
+
+        inline std::size_t
+        find(const key_t& key) const noexcept {
+            for (auto index = home(key);; index = (index + 1) & _mask) {
+                if (_slots[index].key == key) return index;
+                if (!_slots[index].key.ports) return npos;
+            }
+        }
+
+        /** A new entry for the first event @p e of its flow, with its
+         *  timer; npos when the table is full. */
+        inline std::size_t
+        insert(const key_t& key, const network_event_t& e) noexcept {
+            if (_size >= _limit) {
+                return npos;
+            }
+            auto index = home(key);
+            while (_slots[index].key.ports) {
+                index = (index + 1) & _mask;
+            }
+            auto& slot     = _slots[index];
+            slot.key       = key;
+            slot.pid       = e.pid;
+            slot.start     = e.timestamp;
+            slot.last      = e.timestamp;
+            slot.local_low = end_of(e.saddr, e.sport) <= end_of(e.daddr, e.dport);
+            // never grows: there are as many timers as the table holds
+            slot.timer     = _wheel.schedule(e.timestamp + idle_ticks(key), (std::uint32_t)index);
+            _size++;
+            return index;
+        }
+
+        inline std::int64_t
+        idle_ticks(const key_t& key) const noexcept {
+            return is_udp(key) ? _udp_idle_ticks : _idle_ticks;
+        }
+
+        inline void
+        count(std::size_t index, const network_event_t& e) noexcept {
+            auto& slot = _slots[index];
+            slot.bytes += e.size;
+            slot.packets++;
+            slot.last = std::max(slot.last, e.timestamp);
+        }
+
+        inline void
+        close(std::size_t index, std::int64_t timestamp) {
+            auto& slot = _slots[index];
+            auto& stats = stats_of(slot.pid);
+            slot.last = std::max(slot.last, timestamp);
+            const auto lifetime = slot.last - slot.start;
+            stats.closed++;
+            stats.short_lived += lifetime < _short_lived_ticks;
+            stats.bytes       += slot.bytes;
+            stats.lifetime_us.buckets[latency_histogram_t::bucket(_converter.to_ns(lifetime) / 1000)]++;
+            stats.bytes_per_connection.buckets[latency_histogram_t::bucket(slot.bytes)]++;
+            end(index, flow_end_reason_t::closed);
+            _wheel.cancel(slot.timer);
+            erase(index);
+        }
+
+        /** The timer of the entry at @p index fired: expires it when idle
+         *  since, the new deadline otherwise. */
+        inline std::int64_t
+        on_timer(std::uint32_t index) {
+            const auto& slot     = _slots[index];
+            const auto  deadline = slot.last + idle_ticks(slot.key);
+            if (deadline > _now) {
+                return deadline;
+            }
+            if (!is_udp(slot.key)) {
+                stats_of(slot.pid).expired++;
+            }
+            end(index, flow_end_reason_t::expired);
+            erase(index);
+            return timing_wheel_t::release;
+        }
+
+        /** Keeps the flow_end_t of the entry at @p index, when asked to. */
+        inline void
+        end(std::size_t index, flow_end_reason_t reason) noexcept {
+            if (!_max_flow_ends) {
+                return;
+            }
+            if (_flow_ends.size() >= _max_flow_ends) {
+                _flow_ends_dropped++;
+                return;
+            }
+            const auto& slot  = _slots[index];
+            const auto  low   = (std::uint32_t)(slot.key.addresses >> 32);
+            const auto  high  = (std::uint32_t)slot.key.addresses;
+            const auto  ports = (std::uint32_t)((slot.key.ports & ~udp_flag) - 1);
+            auto& out = _flow_ends.emplace_back();
+            out.key.protocol = is_udp(slot.key) ? protocol_t::udp : protocol_t::tcp;
+            out.key.saddr    = slot.local_low ? low : high;
+            out.key.daddr    = slot.local_low ? high : low;
+            out.key.sport    = (std::uint16_t)(slot.local_low ? ports >> 16 : ports);
+            out.key.dport    = (std::uint16_t)(slot.local_low ? ports : ports >> 16);
+            out.pid          = slot.pid;
+            out.reason       = reason;
+            out.start        = slot.start;
+            out.last         = slot.last;
+            out.duration_ns  = _converter.to_ns(slot.last - slot.start);
+            out.bytes        = slot.bytes;
+            out.packets      = slot.packets;
+        }
+
+        /** Backward shift deletion of the entry at @p index, whose timer
+         *  is gone already. */
+        inline void
+        erase(std::size_t index) noexcept {
+            _udp_size -= is_udp(_slots[index].key);
+            auto hole = index;
+            for (auto next = (hole + 1) & _mask; _slots[next].key.ports; next = (next + 1) & _mask) {
+                const auto wanted = home(_slots[next].key);
+                // entries whose home lies in (hole, next] must stay
+                const bool stays = hole <= next ? (hole < wanted && wanted <= next)
+                                                : (hole < wanted || wanted <= next);
+                if (stays) {
+                    continue;
+                }
+                _slots[hole] = _slots[next];
+                _wheel.set_value(_slots[hole].timer, (std::uint32_t)hole);
+                hole = next;
+            }
+            _slots[hole] = slot_t{};
+            _size--;
+        }
+
+        inline connection_stats_t&
+        stats_of(std::uint32_t pid) {
+            auto& stats = find_or_insert(pid);
+            stats.last_timestamp = _now;
+            return stats;
+        }
+
+        inline connection_stats_t&
+        find_or_insert(std::uint32_t pid) {
+            const auto it = _pids.find(pid);
+            if (it != _pids.end()) {
+                return it->second;
+            }
+            if (_pids.size() >= _max_pids) {
+                evict();
+            }
+            for (int attempt = 0; attempt < 2; attempt++) {
+                try {
+                    auto& stats = _pids[pid];
+                    stats.pid = pid;
+                    return stats;
+                }
+                catch (const std::bad_alloc&) {
+                    if (attempt || !evict()) {
+                        break;
+                    }
+                }
+            }
+            if (_account) {
+                _account->count_refused();
+            }
+            return _other;
+        }
+
+        /** Folds the least recently active eighth of the processes into _other. */
+        inline bool
+        evict() {
+            if (_pids.empty()) {
+                return false;
+            }
+            _last_seen.clear();
+            for (const auto& [pid, stats] : _pids) {
+                _last_seen.push_back(stats.last_timestamp);
+            }
+            const auto n = std::max<std::size_t>(_last_seen.size() / 8, 1);
+            std::nth_element(_last_seen.begin(), _last_seen.begin() + (n - 1), _last_seen.end());
+            const auto oldest = _last_seen[n - 1];
+            std::size_t evicted{ 0 };
+            for (auto it = _pids.begin(); it != _pids.end() && evicted < n;) {
+                if (it->second.last_timestamp > oldest) {
+                    ++it;
+                    continue;
+                }
+                fold(it->second);
+                it = _pids.erase(it);
+                evicted++;
+            }
+            if (_account) {
+                _account->count_evicted(evicted);
+            }
+            return true;
+        }
+
+        inline void
+        fold(const connection_stats_t& stats) noexcept {
+            _other.opened      += stats.opened;
+            _other.accepted    += stats.accepted;
+            _other.closed      += stats.closed;
+            _other.failed      += stats.failed;
+            _other.short_lived += stats.short_lived;
+            _other.expired     += stats.expired;
+            _other.bytes       += stats.bytes;
+            _other.last_timestamp = std::max(_other.last_timestamp, stats.last_timestamp);
+            for (std::size_t ii = 0; ii < latency_histogram_t::n_of_buckets; ii++) {
+                _other.lifetime_us.buckets[ii]          += stats.lifetime_us.buckets[ii];
+                _other.bytes_per_connection.buckets[ii] += stats.bytes_per_connection.buckets[ii];
+            }
+        }
+
+        mutable std::mutex                                      _mtx;
+        tick_converter_t                                        _converter;
+        std::size_t                                             _max_pids;
+        memory_account_t*                                       _account;
+        std::int64_t                                            _short_lived_ticks;
+        std::int64_t                                            _idle_ticks;
+        std::int64_t                                            _udp_idle_ticks;
+        std::int64_t                                            _now{ 0 };
+        std::size_t                                             _mask{ 0 };
+        std::size_t                                             _bits{ 0 };
+        std::size_t                                             _limit{ 0 };
+        std::size_t                                             _udp_limit{ 0 };
+        std::size_t                                             _size{ 0 };
+        std::size_t                                             _udp_size{ 0 };
+        std::size_t                                             _untracked{ 0 };
+        std::unique_ptr<slot_t[]>                               _slots;
+        pid_map_t                                               _pids;
+        timing_wheel_t                                          _wheel;
+        std::size_t                                             _max_flow_ends{ 0 };
+        std::vector<flow_end_t>                                 _flow_ends;
+        std::size_t                                             _flow_ends_dropped{ 0 };
+        connection_stats_t                                      _other;
+        std::vector<std::int64_t>                               _last_seen;
+        std::vector<std::pair<std::uint16_t, std::size_t>>      _failure_codes;
+    };
+}
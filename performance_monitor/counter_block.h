@@ -0,0 +1,253 @@
+#pragma once
+
+#include <intrin.h>
+#include <immintrin.h>
+
+// MSVC compiles any intrinsic, gcc/clang only for an enabled target
+#if defined(_MSC_VER)
+#define PERFORMANCE_AVX2
+#else
+#define PERFORMANCE_AVX2 __attribute__((target("avx2")))
+#endif
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <utility>
+
+namespace performance {
+
+    /** Zero filled array aligned and padded to whole cache lines, so
+     *  kernels can run full vectors over the tail. */
+    template <class value_t>
+    class column_t {
+    public:
+        static constexpr std::size_t alignment = 64;
+        static constexpr std::size_t per_line  = alignment / sizeof(value_t);
+
+        column_t() = default;
+        explicit column_t(std::size_t size)
+            : _size{ size }
+            , _padded{ (size + per_line - 1) / per_line * per_line } {
+            _data = static_cast<value_t*>(::operator new[](_padded * sizeof(value_t), std::align_val_t{ alignment }));
+            std::memset((void*)_data, 0, _padded * sizeof(value_t));
+        }
+        column_t(const column_t&) = delete;
+        column_t(column_t&& other) noexcept {
+            *this = std::move(other);
+        }
+        column_t& operator = (const column_t&) = delete;
+        column_t& operator = (column_t&& other) noexcept {
+            std::swap(_data, other._data);
+            std::swap(_size, other._size);
+            std::swap(_padded, other._padded);
+            return *this;
+        }
+        ~column_t() noexcept {
+            if (_data) {
+                ::operator delete[]((void*)_data, std::align_val_t{ alignment });
+            }
+        }
+
+        inline value_t*       data() noexcept       { return _data; }
+        inline const value_t* data() const noexcept { return _data; }
+        inline value_t&       operator [] (std::size_t index) noexcept       { return _data[index]; }
+        inline const value_t& operator [] (std::size_t index) const noexcept { return _data[index]; }
+        inline std::size_t    size() const noexcept   { return _size; }
+        inline std::size_t    padded() const noexcept { return _padded; }
+
+    private:
+        value_t*                                  _data{ nullptr };
+        std::size_t                               _size{ 0 };
+        std::size_t                               _padded{ 0 };
+    };
+
+    /** Traffic counters of many entities (processes, flows), one column
+     *  per counter. Counters are updated one entity at a time by the trace
+     *  thread and read a whole column at a time per interval. */
+    class counter_block_t {
+    public:
+        enum counter_t : std::size_t {
+            connections,
+            pkg_sent,
+            pkg_recv,
+            bytes_sent,
+            bytes_recv,
+            retransmissions,
+            last_timestamp,
+            n_of_counters,
+        };
+
+        counter_block_t() = default;
+        explicit counter_block_t(std::size_t size) {
+            for (auto& column : _columns) {
+                column = column_t<std::int64_t>{ size };
+            }
+        }
+
+        inline volatile std::int64_t*
+        column(counter_t counter) noexcept {
+            return _columns[counter].data();
+        }
+
+        inline const std::int64_t*
+        column(counter_t counter) const noexcept {
+            return _columns[counter].data();
+        }
+
+        inline std::size_t
+        size() const noexcept {
+            return _columns[0].size();
+        }
+
+        inline std::size_t
+        padded() const noexcept {
+            return _columns[0].padded();
+        }
+
+        /** Copies every column of @p other, of the same size. */
+        inline void
+        copy_from(const counter_block_t& other) noexcept {
+            for (std::size_t ii = 0; ii < n_of_counters; ii++) {
+                std::memcpy(_columns[ii].data(), other._columns[ii].data(), padded() * sizeof(std::int64_t));
+            }
+        }
+
+    private:
+        column_t<std::int64_t>                    _columns[n_of_counters];
+    };
+
+    /** Per second rates of a counter_block_t interval, see interval_rates(). */
+    struct rate_block_t {
+        column_t<double>                          sent;         // bytes
+        column_t<double>                          recv;         // bytes
+        column_t<double>                          packets;      // sent + received
+        column_t<double>                          retransmissions;
+        column_t<std::uint64_t>                   above;        // bit per entity, bytes/s over the threshold
+
+        rate_block_t() = default;
+        explicit rate_block_t(std::size_t size)
+            : sent{ size }, recv{ size }, packets{ size }, retransmissions{ size }
+            , above{ (size + 63) / 64 } {}
+
+        inline bool
+        is_above(std::size_t index) const noexcept {
+            return (above[index / 64] >> (index % 64)) & 1;
+        }
+    };
+
+    namespace detail {
+
+        inline void
+        interval_rates_scalar(const counter_block_t& current, const counter_block_t& previous,
+                              double scale, double threshold, rate_block_t& out,
+                              std::size_t first, std::size_t last) noexcept {
+            using counter_t = counter_block_t::counter_t;
+            const auto delta = [&](counter_t counter, std::size_t ii) {
+                return std::max<std::int64_t>(current.column(counter)[ii] - previous.column(counter)[ii], 0);
+            };
+            for (auto ii = first; ii < last; ii++) {
+                const double sent = delta(counter_t::bytes_sent, ii) * scale;
+                const double recv = delta(counter_t::bytes_recv, ii) * scale;
+                out.sent[ii]            = sent;
+                out.recv[ii]            = recv;
+                out.packets[ii]         = (delta(counter_t::pkg_sent, ii) + delta(counter_t::pkg_recv, ii)) * scale;
+                out.retransmissions[ii] = delta(counter_t::retransmissions, ii) * scale;
+                out.above[ii / 64]     |= (std::uint64_t)(sent + recv > threshold) << (ii % 64);
+            }
+        }
+
+        /** max(a - b, 0) as doubles, exact below 2^52. */
+        PERFORMANCE_AVX2 inline __m256d
+        delta_pd(const std::int64_t* a, const std::int64_t* b) noexcept {
+            const auto magic = _mm256_set1_epi64x(0x4330000000000000ll);     // 2^52
+            auto delta = _mm256_sub_epi64(_mm256_load_si256((const __m256i*)a), _mm256_load_si256((const __m256i*)b));
+            delta = _mm256_andnot_si256(_mm256_cmpgt_epi64(_mm256_setzero_si256(), delta), delta);
+            return _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(delta, magic)), _mm256_castsi256_pd(magic));
+        }
+
+        PERFORMANCE_AVX2 inline void
+        interval_rates_avx2(const counter_block_t& current, const counter_block_t& previous,
+                            double scale, double threshold, rate_block_t& out) noexcept {
+            using counter_t = counter_block_t::counter_t;
+            const auto column = [](const counter_block_t& block, counter_t counter) { return block.column(counter); };
+            const auto* sent_a = column(current, counter_t::bytes_sent);
+            const auto* sent_b = column(previous, counter_t::bytes_sent);
+            const auto* recv_a = column(current, counter_t::bytes_recv);
+            const auto* recv_b = column(previous, counter_t::bytes_recv);
+            const auto* pkgs_a = column(current, counter_t::pkg_sent);
+            const auto* pkgs_b = column(previous, counter_t::pkg_sent);
+            const auto* pkgr_a = column(current, counter_t::pkg_recv);
+            const auto* pkgr_b = column(previous, counter_t::pkg_recv);
+            const auto* retx_a = column(current, counter_t::retransmissions);
+            const auto* retx_b = column(previous, counter_t::retransmissions);
+            const auto  factor = _mm256_set1_pd(scale);
+            const auto  limit  = _mm256_set1_pd(threshold);
+            const auto  padded = current.padded();
+            std::uint64_t bits{ 0 };
+            for (std::size_t ii = 0; ii < padded; ii += 4) {
+                const auto sent = _mm256_mul_pd(delta_pd(sent_a + ii, sent_b + ii), factor);
+                const auto recv = _mm256_mul_pd(delta_pd(recv_a + ii, recv_b + ii), factor);
+                const auto pkts = _mm256_mul_pd(_mm256_add_pd(delta_pd(pkgs_a + ii, pkgs_b + ii),
+                                                              delta_pd(pkgr_a + ii, pkgr_b + ii)), factor);
+                const auto retx = _mm256_mul_pd(delta_pd(retx_a + ii, retx_b + ii), factor);
+                _mm256_store_pd(out.sent.data() + ii, sent);
+                _mm256_store_pd(out.recv.data() + ii, recv);
+                _mm256_store_pd(out.packets.data() + ii, pkts);
+                _mm256_store_pd(out.retransmissions.data() + ii, retx);
+                const auto over = _mm256_cmp_pd(_mm256_add_pd(sent, recv), limit, _CMP_GT_OQ);
+                bits |= (std::uint64_t)_mm256_movemask_pd(over) << (ii % 64);
+                if (ii % 64 == 60) {
+                    out.above[ii / 64] = bits;
+                    bits = 0;
+                }
+            }
+            if (padded % 64) {
+                out.above[padded / 64] = bits;
+            }
+        }
+
+        inline bool
+        has_avx2() noexcept {
+#if defined(_MSC_VER)
+            static const bool supported = []() {
+                int info[4];
+                __cpuid(info, 0);
+                if (info[0] < 7) return false;
+                __cpuid(info, 1);
+                const bool osxsave = (info[2] & (1 << 27)) != 0;
+                const bool avx     = (info[2] & (1 << 28)) != 0;
+                if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) return false;
+                __cpuidex(info, 7, 0);
+                return (info[1] & (1 << 5)) != 0;
+            }();
+            return supported;
+#else
+            return __builtin_cpu_supports("avx2");
+#endif
+        }
+    }
+
+    /** Rates of every entity between @p previous and @p current, @p scale
+     *  is 1 / seconds between them, in one pass over the columns. Sets the
+     *  above bit of the entities moving more than @p threshold bytes/s.
+     *  Counters going backwards (a reused entity) count as 0. Uses AVX2
+     *  when the cpu has it. */
+    inline void
+    interval_rates(const counter_block_t& current, const counter_block_t& previous,
+                   double scale, double threshold, rate_block_t& out, bool allow_simd = true) noexcept {
+        std::memset(out.above.data(), 0, out.above.padded() * sizeof(std::uint64_t));
+        if (allow_simd && detail::has_avx2()) {
+            detail::interval_rates_avx2(current, previous, scale, threshold, out);
+            // the padding is zero, but a negative threshold would flag it
+            for (auto ii = current.size(); ii < current.padded(); ii++) {
+                out.above[ii / 64] &= ~(std::uint64_t{ 1 } << (ii % 64));
+            }
+        }
+        else {
+            detail::interval_rates_scalar(current, previous, scale, threshold, out, 0, current.size());
+        }
+    }
+}
@@ -0,0 +1,447 @@
+#pragma once
+
+#include "network_event.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace performance {
+
+    /** Predicate over network_event_t, compiled from an expression like
+     *
+     *      dport == 443 && size > 1400 && pid in {1234, 5678}
+     *      daddr == 10.0.0.0/8 || !(protocol == udp)
+     *      type in {send, recv} && sport >= 49152
+     *
+     *  Fields: pid tid size connid daddr saddr dport sport protocol type.
+     *  Addresses and ports compare in host order. Operators: == != < <= >
+     *  >= in, && || ! and parentheses.
+     *
+     *  Every comparison becomes a range test lo <= field <= hi and the
+     *  boolean structure becomes jumps between them, so evaluating is a
+     *  loop over a few flat instructions without a stack. */
+    class event_filter_t {
+    public:
+        /** nullopt, with the reason on std::cerr, for an invalid expression. */
+        static inline std::optional<event_filter_t>
+        compile(std::string_view expression) {
+            try {
+                return compile_or_throw(expression);
+            }
+            catch (std::exception& err) {
+                std::cerr << "Invalid filter \"" << expression << "\": " << err.what() << "\n";
+                return std::nullopt;
+            }
+        }
+
+        static inline event_filter_t
+        compile_or_throw(std::string_view expression) {
+            parser_t parser{ expression };
+            auto tree = parser.parse();
+            event_filter_t filter;
+            filter._expression = std::string{ expression };
+            filter._entry      = filter.emit(*tree, accept, reject);
+            return filter;
+        }
+
+        inline bool
+        matches(const network_event_t& e) const noexcept {
+            auto pc = _entry;
+            const auto* program = _program.data();
+            while (pc < reject) {
+                const auto& ins   = program[pc];
+                const auto  value = load(e, ins);
+                // unsigned wrap around turns the range test into one compare
+                pc = (value - ins.lo) <= ins.width ? ins.on_true : ins.on_false;
+            }
+            return pc == accept;
+        }
+
+        inline const std::string&
+        expression() const noexcept {
+            return _expression;
+        }
+
+        inline std::size_t
+        size() const noexcept {
+            return _program.size();
+        }
+
+    private:
+        static constexpr std::uint16_t accept = std::numeric_limits<std::uint16_t>::max();
+        static constexpr std::uint16_t reject = accept - 1;
+
+        struct field_t {
+            const char*     name;
+            std::uint8_t    offset;
+            std::uint8_t    size;
+            bool            network_order;
+        };
+
+        static inline const field_t*
+        find_field(std::string_view name) noexcept {
+            static const field_t fields[] = {
+                { "pid",      (std::uint8_t)offsetof(network_event_t, pid),      4, false },
+                { "tid",      (std::uint8_t)offsetof(network_event_t, tid),      4, false },
+                { "size",     (std::uint8_t)offsetof(network_event_t, size),     4, false },
+                { "connid",   (std::uint8_t)offsetof(network_event_t, connid),   4, false },
+                { "daddr",    (std::uint8_t)offsetof(network_event_t, daddr),    4, true  },
+                { "saddr",    (std::uint8_t)offsetof(network_event_t, saddr),    4, true  },
+                { "dport",    (std::uint8_t)offsetof(network_event_t, dport),    2, true  },
+                { "sport",    (std::uint8_t)offsetof(network_event_t, sport),    2, true  },
+                { "protocol", (std::uint8_t)offsetof(network_event_t, protocol), 1, false },
+                { "type",     (std::uint8_t)offsetof(network_event_t, type),     1, false },
+            };
+            for (const auto& field : fields) {
+                if (name == field.name) return &field;
+            }
+            return nullptr;
+        }
+
+        /** Loads 8 bytes around the field, byte swapped for network order,
+         *  so every field is read the same way without branching on it. */
+        struct instruction_t {
+            std::uint64_t   lo;
+            std::uint64_t   width;      // hi - lo
+            std::uint64_t   mask;
+            std::uint8_t    offset;
+            std::uint8_t    shift;
+            bool            network_order;
+            std::uint16_t   on_true;
+            std::uint16_t   on_false;
+        };
+
+        static inline std::uint64_t
+        load(const network_event_t& e, const instruction_t& ins) noexcept {
+            std::uint64_t word;
+            std::memcpy(&word, (const std::uint8_t*)&e + ins.offset, sizeof(word));
+            word = ins.network_order ? byteswap(word) : word;
+            return (word >> ins.shift) & ins.mask;
+        }
+
+        static inline std::uint64_t
+        byteswap(std::uint64_t value) noexcept {
+#ifdef _MSC_VER
+            return _byteswap_uint64(value);
+#else
+            return __builtin_bswap64(value);
+#endif
+        }
+
+        static inline instruction_t
+        make_instruction(const field_t& field) noexcept {
+            static_assert(sizeof(network_event_t) >= sizeof(std::uint64_t));
+            instruction_t ins{};
+            ins.offset        = (std::uint8_t)std::min<std::size_t>(field.offset, sizeof(network_event_t) - sizeof(std::uint64_t));
+            ins.network_order = field.network_order;
+            ins.mask          = (std::uint64_t{ 1 } << (8 * field.size)) - 1;
+            const auto first  = field.offset - ins.offset;
+            ins.shift         = (std::uint8_t)(8 * (field.network_order ? sizeof(std::uint64_t) - first - field.size : first));
+            return ins;
+        }
+
+        struct node_t {
+            enum class kind_t { test, all, any, negate };
+            kind_t                               kind{ kind_t::test };
+            const field_t*                       field{ nullptr };
+            std::uint64_t                        lo{ 0 };
+            std::uint64_t                        hi{ 0 };
+            std::vector<std::unique_ptr<node_t>> children;
+        };
+
+        /** Emits @p node so it continues at @p if_true or @p if_false,
+         *  returns its first instruction. */
+        inline std::uint16_t
+        emit(const node_t& node, std::uint16_t if_true, std::uint16_t if_false) {
+            switch (node.kind) {
+            case node_t::kind_t::negate:
+                return emit(*node.children[0], if_false, if_true);
+            case node_t::kind_t::all: {
+                // built back to front: every child falls through to the next
+                auto next = if_true;
+                for (auto it = node.children.rbegin(); it != node.children.rend(); ++it) {
+                    next = emit(**it, next, if_false);
+                }
+                return next;
+            }
+            case node_t::kind_t::any: {
+                auto next = if_false;
+                for (auto it = node.children.rbegin(); it != node.children.rend(); ++it) {
+                    next = emit(**it, if_true, next);
+                }
+                return next;
+            }
+            case node_t::kind_t::test:
+                break;
+            }
+            if (_program.size() >= reject) {
+                throw std::invalid_argument("expression too long");
+            }
+            auto ins     = make_instruction(*node.field);
+            ins.lo       = node.lo;
+            ins.width    = node.hi - node.lo;
+            ins.on_true  = if_true;
+            ins.on_false = if_false;
+            _program.push_back(ins);
+            return (std::uint16_t)(_program.size() - 1);
+        }
+
+        class parser_t {
+        public:
+            explicit parser_t(std::string_view text) : _text{ text } {}
+
+            inline std::unique_ptr<node_t>
+            parse() {
+                auto node = parse_any();
+                skip_spaces();
+                if (_position != _text.size()) {
+                    fail("unexpected text");
+                }
+                return node;
+            }
+
+        private:
+            inline std::unique_ptr<node_t>
+            parse_any() {
+                return parse_list(node_t::kind_t::any, "||", [this]() { return parse_all(); });
+            }
+
+            inline std::unique_ptr<node_t>
+            parse_all() {
+                return parse_list(node_t::kind_t::all, "&&", [this]() { return parse_unary(); });
+            }
+
+            template <class next_t>
+            inline std::unique_ptr<node_t>
+            parse_list(node_t::kind_t kind, std::string_view op, next_t&& next) {
+                auto first = next();
+                if (!accept_token(op)) {
+                    return first;
+                }
+                auto node  = std::make_unique<node_t>();
+                node->kind = kind;
+                node->children.push_back(std::move(first));
+                do {
+                    node->children.push_back(next());
+                } while (accept_token(op));
+                return node;
+            }
+
+            inline std::unique_ptr<node_t>
+            parse_unary() {
+                if (accept_token("!")) {
+                    return negate(parse_unary());
+                }
+                if (accept_token("(")) {
+                    auto node = parse_any();
+                    expect(")");
+                    return node;
+                }
+                return parse_comparison();
+            }
+
+            inline std::unique_ptr<node_t>
+            parse_comparison() {
+                const auto name  = word();
+                const auto* field = find_field(name);
+                if (!field) {
+                    fail("unknown field '" + std::string{ name } + "'");
+                }
+                if (accept_token("in")) {
+                    if (!accept_token("{")) {
+                        return test(field, value(field));
+                    }
+                    auto node  = std::make_unique<node_t>();
+                    node->kind = node_t::kind_t::any;
+                    do {
+                        node->children.push_back(test(field, value(field)));
+                    } while (accept_token(","));
+                    expect("}");
+                    return node;
+                }
+                for (auto op : { "==", "!=", "<=", ">=", "<", ">" }) {
+                    if (!accept_token(op)) {
+                        continue;
+                    }
+                    const auto range = value(field);
+                    const auto max   = field->size == 1 ? 0xFFull : field->size == 2 ? 0xFFFFull : 0xFFFFFFFFull;
+                    const std::string_view name_of_op{ op };
+                    if (name_of_op == "==") return test(field, range);
+                    if (name_of_op == "!=") return negate(test(field, range));
+                    if (range.first != range.second) {
+                        fail("ranges only compare with ==, != or in");
+                    }
+                    const auto v = range.first;
+                    if (name_of_op == "<=") return test(field, { 0, v });
+                    if (name_of_op == ">=") return test(field, { v, max });
+                    if (name_of_op == "<")  return v == 0   ? never(field) : test(field, { 0, v - 1 });
+                    return v >= max ? never(field) : test(field, { v + 1, max });
+                }
+                fail("expected a comparison");
+                return nullptr;
+            }
+
+            /** A number, a keyword or an address, optionally with a /prefix. */
+            inline std::pair<std::uint64_t, std::uint64_t>
+            value(const field_t* field) {
+                skip_spaces();
+                const auto start = _position;
+                while (_position < _text.size() &&
+                       (std::isalnum((unsigned char)_text[_position]) || _text[_position] == '.' || _text[_position] == '/')) {
+                    _position++;
+                }
+                const auto token = _text.substr(start, _position - start);
+                if (token.empty()) {
+                    fail("expected a value");
+                }
+                if (auto keyword = keyword_value(token)) {
+                    return { *keyword, *keyword };
+                }
+                if (token.find('.') != std::string_view::npos) {
+                    if (field->size != 4 || !field->network_order) {
+                        fail("addresses only compare with daddr or saddr");
+                    }
+                    return address(token);
+                }
+                return { number(token), number(token) };
+            }
+
+            inline std::pair<std::uint64_t, std::uint64_t>
+            address(std::string_view token) {
+                const auto slash  = token.find('/');
+                const auto dotted = token.substr(0, slash);
+                std::uint64_t addr{ 0 };
+                std::size_t   parts{ 0 }, start{ 0 };
+                while (start <= dotted.size()) {
+                    auto end = dotted.find('.', start);
+                    if (end == std::string_view::npos) end = dotted.size();
+                    const auto part = number(dotted.substr(start, end - start));
+                    if (part > 255 || ++parts > 4) fail("invalid address");
+                    addr  = (addr << 8) | part;
+                    start = end + 1;
+                }
+                if (parts != 4) fail("invalid address");
+                const auto prefix = slash == std::string_view::npos ? 32 : number(token.substr(slash + 1));
+                if (prefix > 32) fail("invalid prefix");
+                const auto host_bits = (std::uint64_t{ 1 } << (32 - prefix)) - 1;
+                return { addr & ~host_bits & 0xFFFFFFFFull, (addr & ~host_bits & 0xFFFFFFFFull) | host_bits };
+            }
+
+            inline std::uint64_t
+            number(std::string_view token) {
+                std::uint64_t value{ 0 };
+                const auto [end, error] = std::from_chars(token.data(), token.data() + token.size(), value);
+                if (error != std::errc{} || end != token.data() + token.size()) {
+                    fail("invalid number '" + std::string{ token } + "'");
+                }
+                return value;
+            }
+
+            static inline std::optional<std::uint64_t>
+            keyword_value(std::string_view token) noexcept {
+                if (token == "tcp")        return (std::uint64_t)protocol_t::tcp;
+                if (token == "udp")        return (std::uint64_t)protocol_t::udp;
+                if (token == "send")       return EVENT_TRACE_TYPE_SEND;
+                if (token == "recv" ||
+                    token == "receive")    return EVENT_TRACE_TYPE_RECEIVE;
+                if (token == "connect")    return EVENT_TRACE_TYPE_CONNECT;
+                if (token == "disconnect") return EVENT_TRACE_TYPE_DISCONNECT;
+                if (token == "retransmit") return EVENT_TRACE_TYPE_RETRANSMIT;
+                if (token == "accept")     return EVENT_TRACE_TYPE_ACCEPT;
+                if (token == "reconnect")  return EVENT_TRACE_TYPE_RECONNECT;
+                if (token == "connfail")   return EVENT_TRACE_TYPE_CONNFAIL;
+                return std::nullopt;
+            }
+
+            static inline std::unique_ptr<node_t>
+            test(const field_t* field, std::pair<std::uint64_t, std::uint64_t> range) {
+                auto node   = std::make_unique<node_t>();
+                node->field = field;
+                node->lo    = range.first;
+                node->hi    = range.second;
+                return node;
+            }
+
+            /** A test nothing passes, e.g. size < 0. */
+            static inline std::unique_ptr<node_t>
+            never(const field_t* field) {
+                return negate(test(field, { 0, std::numeric_limits<std::uint64_t>::max() }));
+            }
+
+            static inline std::unique_ptr<node_t>
+            negate(std::unique_ptr<node_t> child) {
+                auto node  = std::make_unique<node_t>();
+                node->kind = node_t::kind_t::negate;
+                node->children.push_back(std::move(child));
+                return node;
+            }
+
+            inline std::string_view
+            word() {
+                skip_spaces();
+                const auto start = _position;
+                while (_position < _text.size() && std::isalpha((unsigned char)_text[_position])) {
+                    _position++;
+                }
+                if (start == _position) {
+                    fail("expected a field");
+                }
+                return _text.substr(start, _position - start);
+            }
+
+            inline bool
+            accept_token(std::string_view token) {
+                skip_spaces();
+                if (_text.substr(_position, token.size()) != token) {
+                    return false;
+                }
+                // "in" must not be the start of a longer word, "<" not of "<="
+                const auto next = _position + token.size();
+                if (next < _text.size() &&
+                    ((std::isalpha((unsigned char)token.back()) && std::isalnum((unsigned char)_text[next])) ||
+                     ((token == "<" || token == ">" || token == "!") && _text[next] == '='))) {
+                    return false;
+                }
+                _position = next;
+                return true;
+            }
+
+            inline void
+            expect(std::string_view token) {
+                if (!accept_token(token)) {
+                    fail("expected '" + std::string{ token } + "'");
+                }
+            }
+
+            inline void
+            skip_spaces() noexcept {
+                while (_position < _text.size() && std::isspace((unsigned char)_text[_position])) {
+                    _position++;
+                }
+            }
+
+            [[noreturn]] inline void
+            fail(const std::string& what) const {
+                throw std::invalid_argument(what + " at " + std::to_string(_position));
+            }
+
+            std::string_view                      _text;
+            std::size_t                           _position{ 0 };
+        };
+
+        std::string                               _expression;
+        std::vector<instruction_t>                _program;
+        std::uint16_t                             _entry{ accept };
+    };
+}
@@ -2,7 +2,7 @@
 #include "session_trace_handler.h"
 #include <optional>
 #include <functional>
-#include <future>
+#include <atomic>
 
 #include <evntcons.h>
 #include <tdh.h>
@@ -29,9 +29,6 @@ namespace performance {
 
         ~event_logger_file_t() noexcept {
             close();
-            if (_thread.joinable()) {
-                _thread.join();
-            }
         }
 
         inline void
@@ -57,37 +54,72 @@ namespace performance {
             return true;
         }
 
+        /** Delivers the events of the open trace on the calling thread,
+         *  returns once the session stops or the trace is closed. False
+         *  when the trace couldn't be processed. */
         inline bool
-        process() noexcept(false){
-            _thread = std::thread([this](){
-                try {
-                    if (_trace_is_open) {
-                        auto status = ::ProcessTrace(&_trace_handle, 1, NULL, NULL);
-                        if (ERROR_SUCCESS != status) {
-                            throw std::runtime_error("Failed to ProcessTrace: " + session_trace_handler_t::get_last_error_as_string());
-                        }
-                    }
-                    else {
-                        throw std::runtime_error("Trace handle isn't open");
-                    }
-                }
-                catch (std::exception &err) {
-                    _failed_to_process = true;
-                    std::cerr << err.what();
-                }
-            });
-            std::this_thread::sleep_for(std::chrono::milliseconds{ 200 });
-            return _thread.joinable() && !_failed_to_process;
+        process() {
+            _thread_id = ::GetCurrentThreadId();
+            if (!_trace_is_open) {
+                std::cerr << "Trace handle isn't open";
+                return false;
+            }
+            // close() may reset the member meanwhile
+            trace_handle_t handle = _trace_handle;
+            auto status = ::ProcessTrace(&handle, 1, NULL, NULL);
+            if (ERROR_SUCCESS != status && ERROR_CANCELLED != status) {
+                std::cerr << "Failed to ProcessTrace: " << session_trace_handler_t::get_last_error_as_string();
+                return false;
+            }
+            return true;
+        }
+
+        /** Events ETW dropped before we could read them, as of the last buffer. */
+        inline std::size_t
+        events_lost() const noexcept {
+            return _events_lost;
+        }
+
+        inline std::size_t
+        buffers_read() const noexcept {
+            return _buffers_read;
         }
 
+        /** User + kernel time spent by the thread that last called process(). */
+        inline std::int64_t
+        thread_cpu_ns() const noexcept {
+            const DWORD thread_id = _thread_id;
+            if (!thread_id) {
+                return 0;
+            }
+            auto handle = ::OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE, thread_id);
+            if (!handle) {
+                return 0;
+            }
+            FILETIME creation, exit, kernel, user;
+            const bool valid = ::GetThreadTimes(handle, &creation, &exit, &kernel, &user);
+            ::CloseHandle(handle);
+            if (!valid) {
+                return 0;
+            }
+            const auto to_100ns = [](const FILETIME& time) {
+                return (std::int64_t)(((std::uint64_t)time.dwHighDateTime << 32) | time.dwLowDateTime);
+            };
+            return (to_100ns(kernel) + to_100ns(user)) * 100;
+        }
+
+        /** Closes the trace, process() returns once the buffers it holds
+         *  are delivered. True when nothing was open. */
         inline bool
         close() noexcept {
-            if (_trace_is_open) {
-                auto status = ::CloseTrace(_trace_handle);
-                return ERROR_SUCCESS != status;
+            if (!_trace_is_open) {
+                return true;
             }
+            auto status = ::CloseTrace(_trace_handle);
             _trace_is_open = false;
-            return true;
+            _trace_handle  = INVALID_PROCESSTRACE_HANDLE;
+            // still processing, it ends after the current buffers
+            return ERROR_SUCCESS == status || ERROR_CTX_CLOSE_PENDING == status;
         }
 
     private:
@@ -103,13 +135,13 @@ namespace performance {
 
             //_e_log_file.LogFileName         = _log_path.data();
             _e_log_file.LoggerName          = _session_name.data();
-            // real time mode and use EventRecordCallback
-            _e_log_file.ProcessTraceMode    = PROCESS_TRACE_MODE_REAL_TIME | PROCESS_TRACE_MODE_EVENT_RECORD;
+            // real time mode, events are delivered as EVENT_TRACE (see event_t)
+            _e_log_file.ProcessTraceMode    = PROCESS_TRACE_MODE_REAL_TIME;
             // register buffer callback
-            //_e_log_file.BufferCallback      = &this->buffer_callback;
+            _e_log_file.BufferCallback      = &buffer_callback;
             // register record callback function
             _e_log_file.EventCallback       = &event_callback;
-            _e_log_file.Context             = NULL;
+            _e_log_file.Context             = this;
 
             _trace_handle = ::OpenTrace(&_e_log_file);
             if (_trace_handle == INVALID_PROCESSTRACE_HANDLE) {
@@ -118,10 +150,14 @@ namespace performance {
             _trace_is_open = true;
         }
 
-        /*PEVENT_TRACE_LOGFILEA
-        buffer_callback(PEVENT_RECORD pEvent) {
-
-        }*/
+        static inline ULONG WINAPI
+        buffer_callback(PEVENT_TRACE_LOGFILE log_file) {
+            auto& self = *(event_logger_file_t*)log_file->Context;
+            self._events_lost  = log_file->EventsLost;
+            self._buffers_read = log_file->BuffersRead;
+            // keep processing
+            return TRUE;
+        }
 
         std::optional_ref<const session_trace_handler_t> _session{ std::nullopt };
         event_trace_logfile_t                            _e_log_file{};
@@ -129,9 +165,49 @@ namespace performance {
         std::string                                      _session_name;
         std::string                                      _log_path;
         static std::vector<callback_t>                   _callbacks;
-        bool                                             _trace_is_open{ false };
-        bool                                             _failed_to_process{ false };
-        std::thread                                      _thread;
+        volatile std::size_t                             _events_lost{ 0 };
+        volatile std::size_t                             _buffers_read{ 0 };
+        std::atomic<bool>                                _trace_is_open{ false };
+        std::atomic<DWORD>                               _thread_id{ 0 };
+    };
+
+    /** The session and the real time consumer of it, as driven by
+     *  trace_lifecycle_t. stop() stops the session before closing the
+     *  trace: ProcessTrace then returns at once instead of draining what
+     *  the session still buffers. */
+    class etw_trace_backend_t {
+    public:
+        etw_trace_backend_t(session_trace_handler_t& session, event_logger_file_t& logger)
+            : _session{ session }
+            , _logger{ logger } {
+            _logger.set_session_handler(_session);
+        }
+
+        inline void
+        set_provider(const uuid_t& provider_guid) noexcept {
+            _provider_guid = provider_guid;
+        }
+
+        inline bool
+        start() {
+            return _session.start(_provider_guid) && _logger.open();
+        }
+
+        inline bool
+        process() {
+            return _logger.process();
+        }
+
+        inline void
+        stop() {
+            (void)_session.stop();
+            (void)_logger.close();
+        }
+
+    private:
+        session_trace_handler_t&                         _session;
+        event_logger_file_t&                             _logger;
+        uuid_t                                           _provider_guid{};
     };
 
     inline void WINAPI
@@ -0,0 +1,331 @@
+#pragma once
+
+#include "counter_block.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace performance {
+
+    /** Counters of one process of a host, as sent to a collector, in
+     *  counter_block_t order. host_pid carries the host's totals. */
+    struct fleet_row_t {
+        static constexpr std::size_t   n_of_counters = counter_block_t::last_timestamp;
+        static constexpr std::uint32_t host_pid      = std::numeric_limits<std::uint32_t>::max();
+
+        std::uint32_t                             pid{ 0 };
+        std::array<std::int64_t, n_of_counters>   counters{};
+    };
+
+    /** Frames of the fleet protocol, little endian:
+     *
+     *      length:u32                      bytes after length
+     *      'H' version:u8 name             once per connection, name is the rest,
+     *                                      see valid_host()
+     *      'K' | 'D' timestamp_ns:zigzag n:varint row*n
+     *      row: pid:varint changed:u8 value:zigzag*popcount(changed)
+     *
+     *  'K' (key) frames carry every row with absolute values, 'D' (delta)
+     *  frames only the rows that changed, each changed counter as the
+     *  difference to its previous value. Pids ascend and are sent as the
+     *  difference to the previous pid; the timestamp of a 'D' frame is the
+     *  difference to the previous frame's. Varints are LEB128. */
+    namespace fleet {
+        static constexpr std::uint8_t  version        = 1;
+        static constexpr std::size_t   max_frame_size = 16 * 1024 * 1024;
+        static constexpr char          hello_frame    = 'H';
+        static constexpr char          key_frame      = 'K';
+        static constexpr char          delta_frame    = 'D';
+        static constexpr std::size_t   max_host_size  = 64;
+
+        /** Host names are up to 64 letters, digits, _ - and ., like group
+         *  and alert names: they come from the network and end up in the
+         *  collector's output. */
+        inline bool
+        valid_host(std::string_view name) noexcept {
+            return !name.empty() && name.size() <= max_host_size &&
+                   std::all_of(name.begin(), name.end(), [](char c) {
+                       return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+                              c == '_' || c == '-' || c == '.';
+                   });
+        }
+
+        inline void
+        put_varint(std::vector<char>& out, std::uint64_t value) {
+            while (value >= 0x80) {
+                out.push_back((char)(value | 0x80));
+                value >>= 7;
+            }
+            out.push_back((char)value);
+        }
+
+        inline void
+        put_signed(std::vector<char>& out, std::int64_t value) {
+            put_varint(out, ((std::uint64_t)value << 1) ^ (std::uint64_t)(value >> 63));
+        }
+
+        /** False when the varint runs past @p end or over 64 bits. */
+        inline bool
+        get_varint(const char*& in, const char* end, std::uint64_t& value) noexcept {
+            value = 0;
+            for (unsigned shift = 0; shift < 64 && in < end; shift += 7) {
+                const auto byte = (std::uint8_t)*in++;
+                value |= (std::uint64_t)(byte & 0x7F) << shift;
+                if (!(byte & 0x80)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        inline bool
+        get_signed(const char*& in, const char* end, std::int64_t& value) noexcept {
+            std::uint64_t raw;
+            if (!get_varint(in, end, raw)) {
+                return false;
+            }
+            value = (std::int64_t)(raw >> 1) ^ -(std::int64_t)(raw & 1);
+            return true;
+        }
+    }
+
+    /** Sender side of one connection to a collector. Remembers what it
+     *  sent, so an interval costs a few bytes per process that moved. */
+    class fleet_encoder_t {
+    public:
+        /** Appends the hello frame, the first frame of every connection. */
+        inline void
+        hello(std::string_view host, std::vector<char>& out) {
+            const auto start = begin(out);
+            out.push_back(fleet::hello_frame);
+            out.push_back((char)fleet::version);
+            out.insert(out.end(), host.begin(), host.end());
+            end(out, start);
+        }
+
+        /** Appends a frame of @p rows, sorted by pid in place. The first
+         *  frame after reset() is a key frame, so is the next one once
+         *  too many of the remembered processes are gone. */
+        inline void
+        encode(std::int64_t timestamp_ns, std::vector<fleet_row_t>& rows, std::vector<char>& out) {
+            if (_last.size() > 2 * rows.size() + 1024) {
+                reset();
+            }
+            std::sort(rows.begin(), rows.end(),
+                      [](const fleet_row_t& a, const fleet_row_t& b) { return a.pid < b.pid; });
+            const bool key   = _key;
+            const auto start = begin(out);
+            out.push_back(key ? fleet::key_frame : fleet::delta_frame);
+            fleet::put_signed(out, key ? timestamp_ns : timestamp_ns - _timestamp);
+            // the count isn't known up front, leave room for the largest
+            const auto count_at = out.size();
+            out.resize(out.size() + 5);
+            std::uint32_t n{ 0 }, last_pid{ 0 };
+            for (const auto& row : rows) {
+                auto& previous = _last[row.pid];
+                std::uint8_t changed{ 0 };
+                for (std::size_t ii = 0; ii < fleet_row_t::n_of_counters; ii++) {
+                    changed |= (std::uint8_t)(key || row.counters[ii] != previous[ii]) << ii;
+                }
+                if (!changed) {
+                    continue;
+                }
+                fleet::put_varint(out, row.pid - last_pid);
+                out.push_back((char)changed);
+                for (std::size_t ii = 0; ii < fleet_row_t::n_of_counters; ii++) {
+                    if (changed & (1 << ii)) {
+                        fleet::put_signed(out, row.counters[ii] - (key ? 0 : previous[ii]));
+                    }
+                }
+                previous = row.counters;
+                last_pid = row.pid;
+                n++;
+            }
+            // fixed width varint, padded with continuation bits
+            for (std::size_t ii = 0; ii < 5; ii++) {
+                out[count_at + ii] = (char)(((n >> (7 * ii)) & 0x7F) | (ii < 4 ? 0x80 : 0));
+            }
+            end(out, start);
+            _key       = false;
+            _timestamp = timestamp_ns;
+        }
+
+        /** Starts over with a key frame, after a reconnect. */
+        inline void
+        reset() noexcept {
+            _key = true;
+            _last.clear();
+        }
+
+    private:
+        static inline std::size_t
+        begin(std::vector<char>& out) {
+            const auto start = out.size();
+            out.resize(start + sizeof(std::uint32_t));
+            return start;
+        }
+
+        static inline void
+        end(std::vector<char>& out, std::size_t start) noexcept {
+            const auto length = (std::uint32_t)(out.size() - start - sizeof(std::uint32_t));
+            std::memcpy(out.data() + start, &length, sizeof(length));
+        }
+
+        using counters_t = std::array<std::int64_t, fleet_row_t::n_of_counters>;
+
+        bool                                                  _key{ true };
+        std::int64_t                                          _timestamp{ 0 };
+        std::unordered_map<std::uint32_t, counters_t>         _last;
+    };
+
+    /** Collector side of one connection: reassembles frames out of
+     *  whatever the socket delivered and turns deltas back into absolute
+     *  counters. At most max_pids processes are followed, rows of later
+     *  ones are skipped. */
+    class fleet_decoder_t {
+    public:
+        explicit fleet_decoder_t(std::size_t max_pids = 65536)
+            : _max_pids{ max_pids } {}
+
+        /** Decodes every whole frame of @p data and keeps the rest for the
+         *  next call. Calls on_hello(std::string_view host) and
+         *  on_frame(std::int64_t timestamp_ns, bool key, const std::vector<fleet_row_t>&)
+         *  with the rows of the frame, every process of the host in a key
+         *  frame. Returns false on a malformed frame or a host name that
+         *  isn't fleet::valid_host(), the connection is useless after that. */
+        template <class hello_t, class frame_t>
+        inline bool
+        feed(const char* data, std::size_t size, hello_t&& on_hello, frame_t&& on_frame) {
+            const char* in  = data;
+            const char* end = data + size;
+            if (!_pending.empty()) {
+                _pending.insert(_pending.end(), data, data + size);
+                in  = _pending.data();
+                end = _pending.data() + _pending.size();
+            }
+            while (end - in >= (std::ptrdiff_t)sizeof(std::uint32_t)) {
+                std::uint32_t length;
+                std::memcpy(&length, in, sizeof(length));
+                if (!length || length > fleet::max_frame_size) {
+                    return false;
+                }
+                if ((std::size_t)(end - in) < sizeof(length) + length) {
+                    break;
+                }
+                in += sizeof(length);
+                if (!decode(in, in + length, on_hello, on_frame)) {
+                    return false;
+                }
+                in += length;
+            }
+            // keep the partial frame, in the buffer or out of it
+            if (!_pending.empty()) {
+                _pending.erase(_pending.begin(), _pending.begin() + (in - _pending.data()));
+            }
+            else {
+                _pending.assign(in, end);
+            }
+            return true;
+        }
+
+        /** Hosts that send the hello frame again start over. */
+        inline void
+        reset() noexcept {
+            _hello = false;
+            _last.clear();
+            _pending.clear();
+        }
+
+        inline std::size_t
+        skipped() const noexcept {
+            return _skipped;
+        }
+
+    private:
+        using counters_t = std::array<std::int64_t, fleet_row_t::n_of_counters>;
+
+        template <class hello_t, class frame_t>
+        inline bool
+        decode(const char* in, const char* end, hello_t& on_hello, frame_t& on_frame) {
+            const char type = *in++;
+            if (type == fleet::hello_frame) {
+                if (in == end || (std::uint8_t)*in++ != fleet::version) {
+                    return false;
+                }
+                const std::string_view name{ in, (std::size_t)(end - in) };
+                if (!fleet::valid_host(name)) {
+                    return false;
+                }
+                _hello = true;
+                _last.clear();
+                on_hello(name);
+                return true;
+            }
+            if (!_hello || (type != fleet::key_frame && type != fleet::delta_frame)) {
+                return false;
+            }
+            const bool   key = type == fleet::key_frame;
+            std::int64_t timestamp;
+            std::uint64_t n;
+            if (!fleet::get_signed(in, end, timestamp) || !fleet::get_varint(in, end, n) ||
+                n > (std::uint64_t)(end - in) / 2) {
+                return false;
+            }
+            _timestamp = key ? timestamp : _timestamp + timestamp;
+            if (key) {
+                _last.clear();
+            }
+            _rows.clear();
+            std::uint64_t pid{ 0 };
+            for (std::uint64_t row = 0; row < n; row++) {
+                std::uint64_t delta;
+                if (!fleet::get_varint(in, end, delta) || in == end) {
+                    return false;
+                }
+                pid += delta;
+                const auto changed = (std::uint8_t)*in++;
+                if (pid > std::numeric_limits<std::uint32_t>::max() || changed >> fleet_row_t::n_of_counters) {
+                    return false;
+                }
+                auto it = _last.find((std::uint32_t)pid);
+                if (it == _last.end() && _last.size() < _max_pids) {
+                    it = _last.emplace((std::uint32_t)pid, counters_t{}).first;
+                }
+                fleet_row_t out;
+                out.pid = (std::uint32_t)pid;
+                for (std::size_t ii = 0; ii < fleet_row_t::n_of_counters; ii++) {
+                    std::int64_t value{ 0 };
+                    if ((changed & (1 << ii)) && !fleet::get_signed(in, end, value)) {
+                        return false;
+                    }
+                    if (it != _last.end()) {
+                        auto& last = it->second[ii];
+                        last = key ? value : last + value;
+                        out.counters[ii] = last;
+                    }
+                }
+                if (it == _last.end()) {
+                    _skipped++;
+                    continue;
+                }
+                _rows.push_back(out);
+            }
+            on_frame(_timestamp, key, (const std::vector<fleet_row_t>&)_rows);
+            return true;
+        }
+
+        std::size_t                                           _max_pids;
+        bool                                                  _hello{ false };
+        std::int64_t                                          _timestamp{ 0 };
+        std::size_t                                           _skipped{ 0 };
+        std::vector<char>                                     _pending;
+        std::vector<fleet_row_t>                              _rows;
+        std::unordered_map<std::uint32_t, counters_t>         _last;
+    };
+}
@@ -0,0 +1,241 @@
+#pragma once
+
+#include "counter_block.h"
+#include "fleet_codec.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace performance {
+
+    /** Process @p pid of host @p host, pid is fleet_row_t::host_pid for
+     *  the host's totals. */
+    struct fleet_key_t {
+        std::uint32_t   host{ 0 };
+        std::uint32_t   pid{ 0 };
+    };
+
+    struct fleet_host_t {
+        std::string     name;
+        std::int64_t    timestamp_ns{ 0 };  // of its last frame, by its clock
+        std::size_t     frames{ 0 };
+        bool            connected{ false };
+        std::unordered_map<std::uint32_t, std::uint32_t> slots;     // pid -> slot
+    };
+
+    /** Counters and rates of every process of every host reporting to a
+     *  collector, one slot each, by column like pid_table_t.
+     *
+     *  Rates are computed when a frame arrives, from the difference to
+     *  the host's previous frame over the host's own clock, so hosts
+     *  needn't report in step with the collector. Processes missing from
+     *  a delta frame didn't move and drop to 0; processes missing from a
+     *  key frame are gone and free their slot. Rows that don't fit are
+     *  counted in untracked(). Hosts keep their id for the table's
+     *  lifetime, at most max_hosts of them. Single threaded. */
+    class fleet_table_t {
+    public:
+        using counter_t = counter_block_t::counter_t;
+
+        static constexpr std::uint32_t no_host = std::numeric_limits<std::uint32_t>::max();
+
+        explicit fleet_table_t(std::size_t capacity = 1 << 20, std::size_t max_hosts = 4096)
+            : _max_hosts{ max_hosts }
+            , _counters{ capacity }
+            , _rates{ capacity }
+            , _keys(capacity)
+            , _generations(capacity) {
+            _free.reserve(capacity);
+            for (auto ii = capacity; ii > 0; ii--) {
+                _free.push_back((std::uint32_t)(ii - 1));
+            }
+        }
+
+        /** Id of the host called @p name, the same one again after a
+         *  reconnect. no_host for a new name once there are max_hosts. */
+        inline std::uint32_t
+        host(std::string_view name) {
+            const auto it = _host_ids.find(std::string{ name });
+            if (it != _host_ids.end()) {
+                return it->second;
+            }
+            if (_hosts.size() >= _max_hosts) {
+                return no_host;
+            }
+            const auto id = (std::uint32_t)_hosts.size();
+            _hosts.emplace_back().name = name;
+            _host_ids.emplace(std::string{ name }, id);
+            return id;
+        }
+
+        inline void
+        set_connected(std::uint32_t host, bool connected) noexcept {
+            _hosts[host].connected = connected;
+        }
+
+        /** Applies a frame of @p host, see fleet_decoder_t. */
+        inline void
+        apply(std::uint32_t host, std::int64_t timestamp_ns, bool key, const std::vector<fleet_row_t>& rows) {
+            auto& state = _hosts[host];
+            // the first frame of a host only sets the baseline
+            const double scale = state.frames && timestamp_ns > state.timestamp_ns
+                               ? 1E9 / (double)(timestamp_ns - state.timestamp_ns) : 0.0;
+            const auto generation = (std::uint32_t)++state.frames;
+            for (const auto& row : rows) {
+                const auto it    = state.slots.find(row.pid);
+                const bool added = it == state.slots.end();
+                if (added && _free.empty()) {
+                    _untracked++;
+                    continue;
+                }
+                const auto index = added ? claim(state, { host, row.pid }) : it->second;
+                update(index, row, scale, added);
+                _counters.column(counter_t::last_timestamp)[index] = timestamp_ns;
+                _generations[index] = generation;
+            }
+            // absent from a delta frame: idle, absent from a key frame: gone
+            for (auto it = state.slots.begin(); it != state.slots.end();) {
+                const auto index = it->second;
+                if (_generations[index] == generation) {
+                    ++it;
+                    continue;
+                }
+                clear_rates(index);
+                if (key) {
+                    release(index);
+                    it = state.slots.erase(it);
+                }
+                else {
+                    ++it;
+                }
+            }
+            state.timestamp_ns = timestamp_ns;
+        }
+
+        /** Frees every slot of @p host and forgets its rates, its name
+         *  keeps the id. */
+        inline void
+        forget(std::uint32_t host) {
+            auto& state = _hosts[host];
+            for (const auto& [pid, index] : state.slots) {
+                clear_rates(index);
+                release(index);
+            }
+            state.slots.clear();
+            state.frames = 0;
+        }
+
+        inline const std::vector<fleet_host_t>&
+        hosts() const noexcept {
+            return _hosts;
+        }
+
+        inline const counter_block_t&
+        counters() const noexcept {
+            return _counters;
+        }
+
+        /** Per second rates of the last frame, is_above() for the slots
+         *  that moved. */
+        inline const rate_block_t&
+        rates() const noexcept {
+            return _rates;
+        }
+
+        /** Host and pid of the slot at @p index, valid while in use. */
+        inline fleet_key_t
+        key(std::size_t index) const noexcept {
+            return _keys[index];
+        }
+
+        /** Slot of the totals of @p host, capacity() when unknown. */
+        inline std::size_t
+        host_slot(std::uint32_t host) const noexcept {
+            const auto& slots = _hosts[host].slots;
+            const auto  it    = slots.find(fleet_row_t::host_pid);
+            return it == slots.end() ? capacity() : it->second;
+        }
+
+        inline std::size_t
+        capacity() const noexcept {
+            return _keys.size();
+        }
+
+        inline std::size_t
+        size() const noexcept {
+            return capacity() - _free.size();
+        }
+
+        inline std::size_t
+        untracked() const noexcept {
+            return _untracked;
+        }
+
+    private:
+        inline std::uint32_t
+        claim(fleet_host_t& state, fleet_key_t key) {
+            const auto index = _free.back();
+            _free.pop_back();
+            _keys[index] = key;
+            state.slots.emplace(key.pid, index);
+            return index;
+        }
+
+        inline void
+        release(std::uint32_t index) {
+            for (std::size_t ii = 0; ii < counter_block_t::n_of_counters; ii++) {
+                _counters.column((counter_t)ii)[index] = 0;
+            }
+            _free.push_back(index);
+        }
+
+        inline void
+        update(std::size_t index, const fleet_row_t& row, double scale, bool added) noexcept {
+            const auto delta = [&](counter_t counter) -> double {
+                // a new process counts from 0, counters going backwards
+                // (a restarted monitor) as 0
+                const auto previous = added ? 0 : _counters.column(counter)[index];
+                return (double)std::max<std::int64_t>(row.counters[counter] - previous, 0) * scale;
+            };
+            _rates.sent[index]            = delta(counter_t::bytes_sent);
+            _rates.recv[index]            = delta(counter_t::bytes_recv);
+            _rates.packets[index]         = delta(counter_t::pkg_sent) + delta(counter_t::pkg_recv);
+            _rates.retransmissions[index] = delta(counter_t::retransmissions);
+            const bool moved = _rates.sent[index] + _rates.recv[index] + _rates.packets[index] > 0;
+            set_above(index, moved);
+            for (std::size_t ii = 0; ii < fleet_row_t::n_of_counters; ii++) {
+                _counters.column((counter_t)ii)[index] = row.counters[ii];
+            }
+        }
+
+        inline void
+        clear_rates(std::size_t index) noexcept {
+            _rates.sent[index]            = 0;
+            _rates.recv[index]            = 0;
+            _rates.packets[index]         = 0;
+            _rates.retransmissions[index] = 0;
+            set_above(index, false);
+        }
+
+        inline void
+        set_above(std::size_t index, bool above) noexcept {
+            const auto bit = std::uint64_t{ 1 } << (index % 64);
+            _rates.above[index / 64] = above ? _rates.above[index / 64] | bit : _rates.above[index / 64] & ~bit;
+        }
+
+        std::size_t                                           _max_hosts;
+        counter_block_t                                       _counters;
+        rate_block_t                                          _rates;
+        std::vector<fleet_key_t>                              _keys;
+        std::vector<std::uint32_t>                            _generations;
+        std::vector<std::uint32_t>                            _free;
+        std::vector<fleet_host_t>                             _hosts;
+        std::unordered_map<std::string, std::uint32_t>        _host_ids;
+        std::size_t                                           _untracked{ 0 };
+    };
+}
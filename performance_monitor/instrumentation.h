@@ -0,0 +1,110 @@
+#pragma once
+
+#include <windows.h>
+
+#if defined(_M_X64)
+#include <intrin.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+
+namespace performance {
+
+    #pragma pack (push, 1)
+    /** log2 buckets of nanoseconds: bucket n counts samples in [2^n, 2^(n+1)). */
+    struct latency_histogram_t {
+        static constexpr std::size_t n_of_buckets = 32;
+
+        std::size_t     buckets[n_of_buckets]{};
+
+        latency_histogram_t() = default;
+        latency_histogram_t(const volatile latency_histogram_t& obj) {
+            for (std::size_t ii = 0; ii < n_of_buckets; ii++) {
+                buckets[ii] = obj.buckets[ii];
+            }
+        }
+
+        static inline std::size_t
+        bucket(std::int64_t ns) noexcept {
+            if (ns <= 1) return 0;
+#if defined(_M_X64)
+            unsigned long index;
+            _BitScanReverse64(&index, (unsigned __int64)ns);
+            return std::min<std::size_t>(index, n_of_buckets - 1);
+#else
+            std::size_t index = 0;
+            while (ns > 1 && index < n_of_buckets - 1) {
+                ns >>= 1;
+                index++;
+            }
+            return index;
+#endif
+        }
+
+        inline std::size_t
+        count() const noexcept {
+            std::size_t total{ 0 };
+            for (auto value : buckets) total += value;
+            return total;
+        }
+
+        /** Upper bound, in ns, of the bucket holding the @p p quantile (0..1). */
+        inline std::int64_t
+        percentile(double p) const noexcept {
+            const auto total = count();
+            if (!total) return 0;
+            const auto target = (std::size_t)(p * total);
+            std::size_t seen{ 0 };
+            for (std::size_t ii = 0; ii < n_of_buckets; ii++) {
+                seen += buckets[ii];
+                if (seen > target) {
+                    return (std::int64_t)1 << (ii + 1);
+                }
+            }
+            return (std::int64_t)1 << n_of_buckets;
+        }
+    };
+
+    /** What the monitor itself costs and loses. */
+    struct event_stats_t {
+        std::size_t     events_delivered{ 0 };  // handed to us by ETW
+        std::size_t     events_used{ 0 };       // passed the filters
+        std::size_t     events_sampled_out{ 0 };// skipped by sampling, also filtered
+        std::size_t     events_decoded{ 0 };    // decoded for subscribers/analyzers
+        std::size_t     events_dropped{ 0 };    // malformed or overflowed a subscriber
+        std::size_t     events_lost{ 0 };       // never reached us, reported by ETW
+        std::size_t     buffers_read{ 0 };
+        std::size_t     buffers_lost{ 0 };
+        std::int64_t    consumer_lag_ns{ 0 };   // event timestamp to callback, sampled
+        std::int64_t    max_consumer_lag_ns{ 0 };
+        std::int64_t    trace_thread_cpu_ns{ 0 };
+        std::int64_t    time_to_first_event_ns{ 0 };   // session (re)start to its first event
+        std::size_t     trace_restarts{ 0 };    // after the session ended on its own
+        latency_histogram_t callback_latency;
+
+        event_stats_t() = default;
+        event_stats_t(const volatile event_stats_t& obj)
+            : callback_latency{ obj.callback_latency } {
+            events_delivered = obj.events_delivered;
+            events_used = obj.events_used;
+            events_sampled_out = obj.events_sampled_out;
+            events_decoded = obj.events_decoded;
+            events_dropped = obj.events_dropped;
+            events_lost = obj.events_lost;
+            buffers_read = obj.buffers_read;
+            buffers_lost = obj.buffers_lost;
+            consumer_lag_ns = obj.consumer_lag_ns;
+            max_consumer_lag_ns = obj.max_consumer_lag_ns;
+            trace_thread_cpu_ns = obj.trace_thread_cpu_ns;
+            time_to_first_event_ns = obj.time_to_first_event_ns;
+            trace_restarts = obj.trace_restarts;
+        }
+
+        inline std::size_t
+        events_filtered() const noexcept {
+            return events_delivered - events_used;
+        }
+    };
+    #pragma pack (pop)
+}
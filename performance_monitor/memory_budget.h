@@ -0,0 +1,378 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string_view>
+#include <vector>
+
+namespace performance {
+
+    /** Memory of one table as of now, see memory_budget_t::usage(). */
+    struct memory_usage_t {
+        const char*     name{ "" };
+        std::size_t     bytes{ 0 };
+        std::size_t     peak_bytes{ 0 };
+        std::size_t     evicted{ 0 };   // entries folded into the table's other
+        std::size_t     refused{ 0 };   // entries that went to other right away
+    };
+
+    class memory_budget_t;
+
+    /** The share of a memory_budget_t used by one table. Charged by the
+     *  table itself or by a pool_allocator_t, from any thread. */
+    class memory_account_t {
+    public:
+        memory_account_t(memory_budget_t& budget, const char* name) noexcept
+            : _budget{ budget }
+            , _name{ name } {}
+        memory_account_t(const memory_account_t&) = delete;
+
+        /** Charges @p bytes unless the budget would go over its limit. */
+        inline bool
+        try_charge(std::size_t bytes) noexcept;
+
+        /** Charges @p bytes even over the limit, for memory already taken. */
+        inline void
+        charge(std::size_t bytes) noexcept;
+
+        inline void
+        release(std::size_t bytes) noexcept;
+
+        /** Whether @p bytes more would still be within the limit. */
+        inline bool
+        fits(std::size_t bytes) const noexcept;
+
+        inline void
+        count_evicted(std::size_t entries = 1) noexcept {
+            _evicted.fetch_add(entries, std::memory_order_relaxed);
+        }
+
+        inline void
+        count_refused() noexcept {
+            _refused.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        inline std::size_t
+        bytes() const noexcept {
+            return _bytes.load(std::memory_order_relaxed);
+        }
+
+        inline memory_usage_t
+        usage() const noexcept {
+            memory_usage_t usage;
+            usage.name       = _name;
+            usage.bytes      = _bytes.load(std::memory_order_relaxed);
+            usage.peak_bytes = _peak_bytes.load(std::memory_order_relaxed);
+            usage.evicted    = _evicted.load(std::memory_order_relaxed);
+            usage.refused    = _refused.load(std::memory_order_relaxed);
+            return usage;
+        }
+
+    private:
+        inline void
+        add(std::size_t bytes) noexcept {
+            const auto now = _bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+            auto peak = _peak_bytes.load(std::memory_order_relaxed);
+            while (now > peak && !_peak_bytes.compare_exchange_weak(peak, now, std::memory_order_relaxed)) {}
+        }
+
+        memory_budget_t&                          _budget;
+        const char*                               _name;
+        std::atomic<std::size_t>                  _bytes{ 0 };
+        std::atomic<std::size_t>                  _peak_bytes{ 0 };
+        std::atomic<std::size_t>                  _evicted{ 0 };
+        std::atomic<std::size_t>                  _refused{ 0 };
+    };
+
+    /** A cap on the memory of the monitor's tables, shared by all of them.
+     *
+     *  Growing tables try_charge() what they add, pools a chunk at a time.
+     *  When that fails the table evicts its least recently used entries
+     *  into its "other" entry and tries again, or folds the new entry into
+     *  other right away: totals stay correct, only the detail is lost.
+     *  Fixed size tables charge() their arrays once, so the tables that
+     *  grow share what they leave. */
+    class memory_budget_t {
+    public:
+        static constexpr std::size_t unlimited = std::numeric_limits<std::size_t>::max();
+
+        explicit memory_budget_t(std::size_t limit = unlimited) noexcept
+            : _limit{ limit } {}
+        memory_budget_t(const memory_budget_t&) = delete;
+
+        /** The account of table @p name, created on first use. @p name
+         *  must outlive the budget. */
+        inline memory_account_t*
+        account(const char* name) {
+            std::lock_guard<std::mutex> lock{ _mtx };
+            for (const auto& account : _accounts) {
+                if (std::string_view{ account->usage().name } == name) {
+                    return account.get();
+                }
+            }
+            _accounts.push_back(std::make_unique<memory_account_t>(*this, name));
+            return _accounts.back().get();
+        }
+
+        /** Takes effect on the next charge, tables evict as they grow. */
+        inline void
+        set_limit(std::size_t limit) noexcept {
+            _limit.store(limit, std::memory_order_relaxed);
+        }
+
+        inline std::size_t
+        limit() const noexcept {
+            return _limit.load(std::memory_order_relaxed);
+        }
+
+        inline std::size_t
+        used() const noexcept {
+            return _used.load(std::memory_order_relaxed);
+        }
+
+        /** Every account, in the order they were created. */
+        inline std::vector<memory_usage_t>
+        usage() const {
+            std::lock_guard<std::mutex> lock{ _mtx };
+            std::vector<memory_usage_t> out;
+            out.reserve(_accounts.size());
+            for (const auto& account : _accounts) {
+                out.push_back(account->usage());
+            }
+            return out;
+        }
+
+    private:
+        friend class memory_account_t;
+
+        inline bool
+        try_charge(std::size_t bytes) noexcept {
+            const auto limit = _limit.load(std::memory_order_relaxed);
+            auto used = _used.load(std::memory_order_relaxed);
+            do {
+                if (bytes > limit || used > limit - bytes) {
+                    return false;
+                }
+            } while (!_used.compare_exchange_weak(used, used + bytes, std::memory_order_relaxed));
+            return true;
+        }
+
+        inline void
+        charge(std::size_t bytes) noexcept {
+            _used.fetch_add(bytes, std::memory_order_relaxed);
+        }
+
+        inline void
+        release(std::size_t bytes) noexcept {
+            _used.fetch_sub(bytes, std::memory_order_relaxed);
+        }
+
+        inline bool
+        fits(std::size_t bytes) const noexcept {
+            const auto limit = _limit.load(std::memory_order_relaxed);
+            return bytes <= limit && _used.load(std::memory_order_relaxed) <= limit - bytes;
+        }
+
+        std::atomic<std::size_t>                  _limit;
+        std::atomic<std::size_t>                  _used{ 0 };
+        mutable std::mutex                        _mtx;
+        std::vector<std::unique_ptr<memory_account_t>> _accounts;
+    };
+
+    inline bool
+    memory_account_t::try_charge(std::size_t bytes) noexcept {
+        if (!_budget.try_charge(bytes)) {
+            return false;
+        }
+        add(bytes);
+        return true;
+    }
+
+    inline void
+    memory_account_t::charge(std::size_t bytes) noexcept {
+        _budget.charge(bytes);
+        add(bytes);
+    }
+
+    inline void
+    memory_account_t::release(std::size_t bytes) noexcept {
+        _budget.release(bytes);
+        _bytes.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+
+    inline bool
+    memory_account_t::fits(std::size_t bytes) const noexcept {
+        return _budget.fits(bytes);
+    }
+
+    /** Fixed size blocks carved out of chunks, for the nodes of one
+     *  container. Freed blocks go to a free list and are reused, chunks are
+     *  kept until the pool goes: under churn the memory of a table stops
+     *  growing once it held its largest number of entries. Throws
+     *  std::bad_alloc when the account refuses a new chunk, which the
+     *  containers pass on with their state unchanged. Not thread safe,
+     *  like the containers using it. */
+    class memory_pool_t {
+    public:
+        static constexpr std::size_t blocks_per_chunk = 256;
+
+        explicit memory_pool_t(memory_account_t* account = nullptr) noexcept
+            : _account{ account } {}
+        memory_pool_t(const memory_pool_t&) = delete;
+
+        ~memory_pool_t() noexcept {
+            for (auto& chunk : _chunks) {
+                ::operator delete(chunk.data);
+                if (_account) {
+                    _account->release(chunk.bytes);
+                }
+            }
+        }
+
+        /** One block of @p size bytes, or any larger allocation. */
+        inline void*
+        allocate(std::size_t size) {
+            size = round(size);
+            if (size > max_block) {
+                return allocate_large(size);
+            }
+            auto& free = _free[size / alignment - 1];
+            if (!free) {
+                add_chunk(size, free);
+            }
+            auto* block = free;
+            free = block->next;
+            return block;
+        }
+
+        inline void
+        deallocate(void* pointer, std::size_t size) noexcept {
+            size = round(size);
+            if (size > max_block) {
+                ::operator delete(pointer);
+                if (_account) {
+                    _account->release(size);
+                }
+                return;
+            }
+            auto* block = static_cast<block_t*>(pointer);
+            block->next = _free[size / alignment - 1];
+            _free[size / alignment - 1] = block;
+        }
+
+    private:
+        static constexpr std::size_t alignment = alignof(std::max_align_t);
+        static constexpr std::size_t max_block = 16 * alignment;
+
+        struct block_t {
+            block_t*    next;
+        };
+
+        struct chunk_t {
+            void*       data;
+            std::size_t bytes;
+        };
+
+        static inline std::size_t
+        round(std::size_t size) noexcept {
+            return std::max<std::size_t>((size + alignment - 1) / alignment * alignment, alignment);
+        }
+
+        inline void
+        add_chunk(std::size_t size, block_t*& free) {
+            const auto bytes = size * blocks_per_chunk;
+            if (_account && !_account->try_charge(bytes)) {
+                throw std::bad_alloc{};
+            }
+            char* data;
+            try {
+                _chunks.reserve(_chunks.size() + 1);
+                data = static_cast<char*>(::operator new(bytes));
+            }
+            catch (...) {
+                // the charge is only kept with the chunk
+                if (_account) {
+                    _account->release(bytes);
+                }
+                throw;
+            }
+            _chunks.push_back({ data, bytes });
+            for (std::size_t ii = blocks_per_chunk; ii > 0; ii--) {
+                auto* block = reinterpret_cast<block_t*>(data + (ii - 1) * size);
+                block->next = free;
+                free = block;
+            }
+        }
+
+        inline void*
+        allocate_large(std::size_t size) {
+            if (_account && !_account->try_charge(size)) {
+                throw std::bad_alloc{};
+            }
+            try {
+                return ::operator new(size);
+            }
+            catch (...) {
+                if (_account) {
+                    _account->release(size);
+                }
+                throw;
+            }
+        }
+
+        memory_account_t*                         _account;
+        std::vector<chunk_t>                      _chunks;
+        block_t*                                  _free[max_block / alignment]{};
+    };
+
+    /** std allocator over a shared memory_pool_t: single objects come out
+     *  of the pool, arrays (hash buckets) are charged to its account. */
+    template <class T>
+    class pool_allocator_t {
+    public:
+        using value_type = T;
+
+        explicit pool_allocator_t(std::shared_ptr<memory_pool_t> pool) noexcept
+            : _pool{ std::move(pool) } {}
+
+        template <class U>
+        pool_allocator_t(const pool_allocator_t<U>& other) noexcept
+            : _pool{ other.pool() } {}
+
+        inline T*
+        allocate(std::size_t n) {
+            return static_cast<T*>(_pool->allocate(n * sizeof(T)));
+        }
+
+        inline void
+        deallocate(T* pointer, std::size_t n) noexcept {
+            _pool->deallocate(pointer, n * sizeof(T));
+        }
+
+        inline const std::shared_ptr<memory_pool_t>&
+        pool() const noexcept {
+            return _pool;
+        }
+
+        template <class U>
+        inline bool
+        operator == (const pool_allocator_t<U>& other) const noexcept {
+            return _pool == other.pool();
+        }
+
+        template <class U>
+        inline bool
+        operator != (const pool_allocator_t<U>& other) const noexcept {
+            return _pool != other.pool();
+        }
+
+    private:
+        std::shared_ptr<memory_pool_t>            _pool;
+    };
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "tcpip.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/** Bounds checked access to the MOF payloads of tcpip.h.
+ *
+ *  Each layout is described once by a schema: the packed struct of
+ *  tcpip.h, the first event version with that layout and one field_t per
+ *  member, at its offsetof(). A view_t checks MofLength and the event
+ *  version once, against the whole layout, and reads fields straight out
+ *  of the payload; reading a field of an invalid view gives 0 instead of
+ *  touching the payload. */
+namespace mof {
+
+    /** A @p value_t at byte @p offset_v of a layout. */
+    template <class value_t, std::size_t offset_v>
+    struct field_t {
+        using value_type = value_t;
+        static constexpr std::size_t offset = offset_v;
+        static constexpr std::size_t end    = offset_v + sizeof(value_t);
+    };
+
+    template <class layout_t, std::uint16_t version_v>
+    struct schema_t {
+        using layout_type = layout_t;
+        static constexpr std::size_t   length        = sizeof(layout_t);
+        static constexpr std::uint16_t version       = version_v;   // older versions had other layouts
+        static constexpr bool          has_endpoints = false;
+    };
+
+    /** The fields every IPv4 tcp/udp layout has, addresses and ports in
+     *  network order. */
+    template <class layout_t, std::uint16_t version_v>
+    struct endpoints_schema_t : schema_t<layout_t, version_v> {
+        static constexpr bool has_endpoints = true;
+        static constexpr field_t<std::uint32_t, offsetof(layout_t, PID)>    pid{};
+        static constexpr field_t<std::uint32_t, offsetof(layout_t, size)>   size{};
+        static constexpr field_t<std::uint32_t, offsetof(layout_t, daddr)>  daddr{};
+        static constexpr field_t<std::uint32_t, offsetof(layout_t, saddr)>  saddr{};
+        static constexpr field_t<std::uint16_t, offsetof(layout_t, dport)>  dport{};
+        static constexpr field_t<std::uint16_t, offsetof(layout_t, sport)>  sport{};
+        static constexpr field_t<std::uint32_t, offsetof(layout_t, seqnum)> seqnum{};
+        static constexpr field_t<std::uint32_t, offsetof(layout_t, connid)> connid{};
+    };
+
+    template <class layout_t, std::uint16_t version_v>
+    struct fail_schema_base_t : schema_t<layout_t, version_v> {
+        static constexpr field_t<std::uint16_t, offsetof(layout_t, Proto)>       proto{};
+        static constexpr field_t<std::uint16_t, offsetof(layout_t, FailureCode)> failure_code{};
+    };
+
+    /** The payload of one event read through schema @p schema_t, whose
+     *  fields are members of the view: view[view.size]. */
+    template <class schema_t>
+    class view_t : public schema_t {
+    public:
+        using schema_type = schema_t;
+
+        view_t(const void* data, std::size_t length, std::uint16_t version) noexcept
+            : _data{ data && length >= schema_t::length && version >= schema_t::version
+                   ? static_cast<const std::uint8_t*>(data) : nullptr } {}
+
+        explicit view_t(const EVENT_TRACE* e) noexcept
+            : view_t{ e->MofData, e->MofLength, e->Header.Class.Version } {}
+
+        /** Whether the payload holds the whole layout. */
+        inline explicit
+        operator bool() const noexcept {
+            return _data != nullptr;
+        }
+
+        template <class value_t, std::size_t offset_v>
+        inline value_t
+        operator [] (field_t<value_t, offset_v>) const noexcept {
+            static_assert(field_t<value_t, offset_v>::end <= schema_t::length, "field out of the layout");
+            value_t value{};
+            if (_data) {
+                std::memcpy(&value, _data + offset_v, sizeof(value));
+            }
+            return value;
+        }
+
+    private:
+        const std::uint8_t*                       _data;
+    };
+
+    namespace tcp {
+        struct group1_schema_t : endpoints_schema_t<TcpIp_TypeGroup1, 2> {};
+
+        struct group2_schema_t : endpoints_schema_t<TcpIp_TypeGroup2, 2> {
+            static constexpr field_t<std::uint16_t, offsetof(TcpIp_TypeGroup2, mss)>         mss{};
+            static constexpr field_t<std::uint16_t, offsetof(TcpIp_TypeGroup2, sackopt)>     sackopt{};
+            static constexpr field_t<std::uint16_t, offsetof(TcpIp_TypeGroup2, tsopt)>       tsopt{};
+            static constexpr field_t<std::uint16_t, offsetof(TcpIp_TypeGroup2, wsopt)>       wsopt{};
+            static constexpr field_t<std::uint32_t, offsetof(TcpIp_TypeGroup2, rcvwin)>      rcvwin{};
+            static constexpr field_t<std::int16_t,  offsetof(TcpIp_TypeGroup2, rcvwinscale)> rcvwinscale{};
+            static constexpr field_t<std::int16_t,  offsetof(TcpIp_TypeGroup2, sndwinscale)> sndwinscale{};
+        };
+
+        struct send_schema_t : endpoints_schema_t<TcpIp_SendIPV4, 2> {
+            static constexpr field_t<std::uint32_t, offsetof(TcpIp_SendIPV4, startime)>      startime{};
+            static constexpr field_t<std::uint32_t, offsetof(TcpIp_SendIPV4, endtime)>       endtime{};
+        };
+
+        struct fail_schema_t : fail_schema_base_t<TcpIp_Fail, 2> {};
+
+        using group1_view_t = view_t<group1_schema_t>;  // disconnect, receive, reconnect, retransmit
+        using group2_view_t = view_t<group2_schema_t>;  // connect, accept
+        using send_view_t   = view_t<send_schema_t>;
+        using fail_view_t   = view_t<fail_schema_t>;
+
+        static_assert(sizeof(TcpIp_TypeGroup1) == 28, "TcpIp_TypeGroup1 layout");
+        static_assert(sizeof(TcpIp_TypeGroup2) == 44, "TcpIp_TypeGroup2 layout");
+        static_assert(sizeof(TcpIp_SendIPV4) == 36, "TcpIp_SendIPV4 layout");
+        static_assert(sizeof(TcpIp_Fail) == 4, "TcpIp_Fail layout");
+    }
+
+    namespace udp {
+        struct group1_schema_t : endpoints_schema_t<UdpIp_TypeGroup1, 2> {};
+        struct fail_schema_t : fail_schema_base_t<UdpIp_Fail, 2> {};
+
+        using group1_view_t = view_t<group1_schema_t>;  // send, receive
+        using fail_view_t   = view_t<fail_schema_t>;
+
+        // the sampler and the tcp group 1 view read either layout
+        static_assert(sizeof(UdpIp_TypeGroup1) == sizeof(tcp::TcpIp_TypeGroup1), "UdpIp_TypeGroup1 layout");
+        static_assert(group1_schema_t::daddr.offset == tcp::group1_schema_t::daddr.offset &&
+                      group1_schema_t::dport.offset == tcp::group1_schema_t::dport.offset, "UdpIp_TypeGroup1 layout");
+    }
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "event_logger_file.h"
+#include "mof_schema.h"
+
+#include <cinttypes>
+
+namespace performance {
+
+    enum class protocol_t : std::uint8_t {
+        tcp = 6,
+        udp = 17,
+    };
+
+    /** One tcp/udp event decoded out of its MOF payload.
+     *  Addresses are kept in network order, as delivered by ETW. */
+    #pragma pack (push, 1)
+    struct network_event_t {
+        std::int64_t    timestamp{ 0 };
+        std::uint32_t   pid{ 0 };
+        std::uint32_t   tid{ 0 };
+        std::uint32_t   size{ 0 };
+        std::uint32_t   daddr{ 0 };
+        std::uint32_t   saddr{ 0 };
+        std::uint32_t   connid{ 0 };
+        std::uint16_t   dport{ 0 };
+        std::uint16_t   sport{ 0 };
+        protocol_t      protocol{ protocol_t::tcp };
+        std::uint8_t    type{ 0 };
+    };
+    #pragma pack (pop)
+
+    struct flow_key_t {
+        std::uint32_t   saddr{ 0 };
+        std::uint32_t   daddr{ 0 };
+        std::uint16_t   sport{ 0 };
+        std::uint16_t   dport{ 0 };
+        protocol_t      protocol{ protocol_t::tcp };
+
+        flow_key_t() = default;
+        explicit flow_key_t(const network_event_t& e)
+            : saddr{ e.saddr }, daddr{ e.daddr }, sport{ e.sport }, dport{ e.dport }, protocol{ e.protocol } {}
+
+        inline bool
+        operator == (const flow_key_t& other) const noexcept {
+            return saddr == other.saddr && daddr == other.daddr &&
+                   sport == other.sport && dport == other.dport && protocol == other.protocol;
+        }
+    };
+
+    struct flow_key_hash_t {
+        inline std::size_t
+        operator () (const flow_key_t& key) const noexcept {
+            std::uint64_t h = ((std::uint64_t)key.saddr << 32 | key.daddr) * 0x9E3779B97F4A7C15ull;
+            h ^= ((std::uint64_t)key.sport << 24 | (std::uint64_t)key.dport << 8 | (std::uint8_t)key.protocol) * 0xC2B2AE3D27D4EB4Full;
+            return (std::size_t)(h ^ (h >> 29));
+        }
+    };
+
+    /** Calls @p f with the schema of the payload of a @p protocol event of
+     *  @p type, see mof_schema.h. */
+    template <class function_t>
+    inline decltype(auto)
+    with_schema(protocol_t protocol, std::uint8_t type, function_t&& f) {
+        if (protocol == protocol_t::udp) {
+            return type == EVENT_TRACE_TYPE_CONNFAIL ? f(mof::udp::fail_schema_t{})
+                                                     : f(mof::udp::group1_schema_t{});
+        }
+        switch (type) {
+        case EVENT_TRACE_TYPE_CONNFAIL:
+            return f(mof::tcp::fail_schema_t{});
+        case EVENT_TRACE_TYPE_CONNECT:
+        case EVENT_TRACE_TYPE_ACCEPT:
+            return f(mof::tcp::group2_schema_t{});
+        case EVENT_TRACE_TYPE_SEND:
+            return f(mof::tcp::send_schema_t{});
+        default:
+            return f(mof::tcp::group1_schema_t{});
+        }
+    }
+
+    /** Whether the payload of @p e holds the whole layout of its type, in
+     *  a version with that layout. */
+    inline bool
+    payload_fits(const event_t e, protocol_t protocol) noexcept {
+        return with_schema(protocol, e->Header.Class.Type, [e](auto schema) {
+            return (bool)mof::view_t<decltype(schema)>{ e };
+        });
+    }
+
+    /** Fills @p out from @p e. Returns false when the payload doesn't fit
+     *  the layout of its event type, see payload_fits(). */
+    inline bool
+    decode_network_event(const event_t e, protocol_t protocol, network_event_t& out) noexcept {
+        out           = network_event_t{};
+        out.timestamp = e->Header.TimeStamp.QuadPart;
+        out.tid       = e->Header.ThreadId;
+        out.protocol  = protocol;
+        out.type      = e->Header.Class.Type;
+
+        return with_schema(protocol, out.type, [e, &out](auto schema) {
+            const mof::view_t<decltype(schema)> view{ e };
+            if (!view) {
+                return false;
+            }
+            if constexpr (decltype(schema)::has_endpoints) {
+                out.pid    = view[view.pid];
+                out.size   = view[view.size];
+                out.daddr  = view[view.daddr];
+                out.saddr  = view[view.saddr];
+                out.dport  = view[view.dport];
+                out.sport  = view[view.sport];
+                out.connid = view[view.connid];
+            }
+            return true;
+        });
+    }
+}
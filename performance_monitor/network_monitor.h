@@ -2,10 +2,25 @@
 
 #include "session_trace_handler.h"
 #include "event_logger_file.h"
+#include "instrumentation.h"
+#include "memory_budget.h"
+#include "address_classifier.h"
+#include "burst_analyzer.h"
+#include "connection_tracker.h"
+#include "event_filter.h"
+#include "network_event.h"
+#include "pid_table.h"
+#include "published.h"
+#include "sampler.h"
+#include "snapshot_stream.h"
 #include "tcpip.h"
+#include "thread_table.h"
 #include "timestamp.h"
+#include "trace_lifecycle.h"
 #include <evntrace.h>
 
+#include <atomic>
+
 
 namespace performance {
     #pragma pack (push, 1)
@@ -64,6 +79,40 @@ namespace performance {
     };
     #pragma pack (pop)
 
+    /** Counters of a sampling monitor with their 95% confidence bounds,
+     *  exact (margin 0) while the rate stays 1. */
+    struct traffic_estimates_t {
+        std::uint32_t   sampling_rate{ 1 };
+        estimate_t      tcp_pkg_sent;
+        estimate_t      tcp_pkg_recv;
+        estimate_t      tcp_bytes_sent;
+        estimate_t      tcp_bytes_recv;
+        estimate_t      tcp_retransmissions;
+        estimate_t      udp_pkg_sent;
+        estimate_t      udp_pkg_recv;
+        estimate_t      udp_bytes_sent;
+        estimate_t      udp_bytes_recv;
+    };
+
+    struct network_snapshot_t {
+        tcp_data_t      tcp;
+        udp_data_t      udp;
+        event_stats_t   stats;
+        traffic_estimates_t estimates;
+    };
+
+    /** What network_monitor_t publishes for readers on other threads, see
+     *  publish_view(). */
+    struct monitor_view_t {
+        std::int64_t                        timestamp_ns{ 0 };  // unix
+        network_snapshot_t                  snapshot;
+        std::vector<pid_data_t>             pids;
+        std::vector<thread_data_t>          threads;
+        std::vector<connection_stats_t>     connections;
+    };
+
+    using event_subscription_t = subscription_t<network_event_t>;
+
     class network_monitor_t {
     public:
         /** Please, see https://docs.microsoft.com/en-us/windows/win32/etw/nt-kernel-logger-constants */
@@ -76,105 +125,287 @@ namespace performance {
                                   0x4988,
                                   0xa0, 0x05, 0x2d, 0xf0, 0xb7, 0xc8, 0x0f, 0x80 };
 
-        network_monitor_t() {};
-        ~network_monitor_t() {};
+        /** Pass as pid to start() to monitor every process, see pid_table(). */
+        static constexpr std::uint32_t all_pids = pid_table_t::empty_pid;
+
+        network_monitor_t() {
+            _pid_table.set_memory_account(_budget.account("pids"));
+            _thread_table.set_memory_account(_budget.account("threads"));
+        };
+        ~network_monitor_t() {
+            // the executor first: a buffer control step still queued or
+            // running could otherwise start the session again once stopped
+            _stopping.store(true, std::memory_order_release);
+            {
+                std::lock_guard<std::mutex> lock{ _subscribers_mtx };
+                for (auto& subscriber : _subscribers) {
+                    subscriber->close();
+                }
+            }
+            if (_executor) {
+                _executor->stop();
+            }
+            // no more events while everything else goes away
+            (void)_trace.stop();
+        };
 
         inline bool
-        start(const uuid_t& provider_guid, const short pid) {
+        start(const uuid_t& provider_guid, const std::uint32_t pid) {
             _pid = pid;
-            if (_session.start(provider_guid)) {
-                _elogger.set_session_handler(_session);
-                _elogger.add_callback([this](auto e) { event_callback(e); });
-                if (_elogger.open()) {
-                    return _elogger.process();
+            return start_trace(provider_guid);
+        }
+
+        /** Monitors the processes in @p pids, counted per process in
+         *  pid_table(). The list can change later with set_pids(). */
+        inline bool
+        start(const uuid_t& provider_guid, const std::vector<std::uint32_t>& pids) {
+            _pid = all_pids;
+            publish_pids(pids);
+            return start_trace(provider_guid);
+        }
+
+        /** Replaces the monitored processes of a monitor started with a list
+         *  of pids, without restarting the trace session. */
+        inline void
+        set_pids(const std::vector<std::uint32_t>& pids) {
+            publish_pids(pids);
+        }
+
+        /** Only events matching @p filter are counted, analyzed and handed
+         *  to subscribers, nullopt counts every event again. */
+        inline void
+        set_filter(std::optional<event_filter_t> filter) {
+            std::lock_guard<std::mutex> lock{ _filter_mtx };
+            if (!filter) {
+                _filter.store(nullptr, std::memory_order_release);
+                return;
+            }
+            _filters.push_back(std::make_unique<const event_filter_t>(std::move(*filter)));
+            _filter.store(_filters.back().get(), std::memory_order_release);
+        }
+
+        /** Counts traffic per group of remote endpoints from now on, nullopt
+         *  stops. Can be called at any time: the trace thread keeps using
+         *  the previous classifier until it sees the new one. A group keeps
+         *  its counters across classifiers by name, see group_counters(). */
+        inline void
+        set_groups(std::optional<address_classifier_t> classifier) {
+            std::lock_guard<std::mutex> lock{ _groups_mtx };
+            if (!classifier) {
+                _classifier.store(nullptr, std::memory_order_release);
+                return;
+            }
+            std::vector<std::uint16_t> ids;
+            for (const auto& name : classifier->names()) {
+                auto it = std::find(_group_names.begin(), _group_names.end(), name);
+                if (it == _group_names.end() && _group_names.size() < _group_counters.size()) {
+                    it = _group_names.insert(_group_names.end(), name);
                 }
+                if (it == _group_names.end()) {
+                    std::cerr << "Too many address groups, " << name << " counts as none\n";
+                    ids.push_back(address_classifier_t::none);
+                    continue;
+                }
+                ids.push_back((std::uint16_t)(it - _group_names.begin()));
             }
-            return false;
+            classifier->renumber(ids);
+            _classifiers.push_back(std::make_unique<const address_classifier_t>(std::move(*classifier)));
+            _classifier.store(_classifiers.back().get(), std::memory_order_release);
+        }
+
+        /** Traffic counters per address group, indexed like group_names(). */
+        inline const counter_block_t&
+        group_counters() const noexcept {
+            return _group_counters;
+        }
+
+        /** Every group name seen so far, "none" first. */
+        inline std::vector<std::string>
+        group_names() const {
+            std::lock_guard<std::mutex> lock{ _groups_mtx };
+            return _group_names;
         }
 
         inline void WINAPI
         event_callback(__in event_t e) {
+            const auto start = _clock.now();
+            const auto n_of_events = InterlockedIncrementSizeT(&(_event_stats.events_delivered));
+            if ((n_of_events & (lag_sample_rate - 1)) == 0) {
+                const auto lag = _event_clock.converter().to_ns(tick_clock_t::qpc() - e->Header.TimeStamp.QuadPart);
+                _event_stats.consumer_lag_ns = lag;
+                if (lag > _event_stats.max_consumer_lag_ns) {
+                    _event_stats.max_consumer_lag_ns = lag;
+                }
+            }
+            _trace.notify_delivery();
+            handle_event(e);
+            const auto bucket = latency_histogram_t::bucket((std::int64_t)((_clock.now() - start) * _ns_per_tick));
+            InterlockedIncrementSizeT(&(_event_stats.callback_latency.buckets[bucket]));
+        }
+
+    private:
+        inline bool
+        start_trace(const uuid_t& provider_guid) {
+            _thread_table.set_idle_ticks((std::int64_t)(_event_clock.frequency() * thread_idle_s));
+            _pid_table.set_idle_ticks((std::int64_t)(_event_clock.frequency() * pid_idle_s));
+            _elogger.add_callback([this](auto e) { event_callback(e); });
+            _backend.set_provider(provider_guid);
+            return _trace.start();
+        }
+
+        inline bool
+        is_monitored(std::uint32_t pid) const noexcept {
+            if (_pid != all_pids) {
+                return pid == _pid;
+            }
+            const auto* pids = _pids.load(std::memory_order_acquire);
+            return !pids || std::binary_search(pids->begin(), pids->end(), pid);
+        }
+
+        /** The trace thread reads the list without locking, replaced lists are
+         *  kept until the monitor is destroyed. Lists change rarely. */
+        inline void
+        publish_pids(std::vector<std::uint32_t> pids) {
+            std::sort(pids.begin(), pids.end());
+            std::lock_guard<std::mutex> lock{ _pids_mtx };
+            _pid_lists.push_back(std::make_unique<const std::vector<std::uint32_t>>(std::move(pids)));
+            _pids.store(_pid_lists.back().get(), std::memory_order_release);
+        }
+
+        inline void
+        handle_event(const event_t e) {
             using namespace mof;
-            // filter by pid
-            short& e_pid = *(short*) (e->MofData);
-            if (e_pid != _pid)
+            if (!is_tcpip(e) && !is_udpip(e))
+                return;
+            const auto protocol = is_tcpip(e) ? protocol_t::tcp : protocol_t::udp;
+            // every field read below lies within the layout of the event type
+            if (!payload_fits(e, protocol)) {
+                InterlockedIncrementSizeT(&(_event_stats.events_dropped));
+                return;
+            }
+            // filter by pid, every tcp/udp payload starts with it except
+            // failures, which only carry a code: they run on the connecting
+            // process
+            const tcp::group1_view_t payload{ e };
+            const std::uint32_t e_pid = e->Header.Class.Type == EVENT_TRACE_TYPE_CONNFAIL
+                                      ? e->Header.ProcessId
+                                      : payload[payload.pid];
+            if (!is_monitored(e_pid))
+                return;
+            // sampled out events aren't even decoded
+            const auto weight = _sampler.weight(e->MofData, e->MofLength);
+            if (!weight) {
+                InterlockedIncrementSizeT(&(_event_stats.events_sampled_out));
                 return;
-            if (is_tcpip(e)) {
-                InterlockedIncrementSizeT(&(_tcp_data.packages));
+            }
+            // a filter needs the decoded event, publish reuses it
+            network_event_t  decoded;
+            network_event_t* filtered{ nullptr };
+            if (const auto* filter = _filter.load(std::memory_order_acquire)) {
+                (void)decode_network_event(e, protocol, decoded);
+                if (!filter->matches(decoded))
+                    return;
+                filtered = &decoded;
+            }
+            if (protocol == protocol_t::tcp) {
+                InterlockedIncrementSizeT(&(_event_stats.events_used));
+                if (_pid == all_pids) {
+                    account_pid(e, e_pid, weight);
+                }
+                account_thread(e, e_pid, weight);
+                account_group(e, weight);
+                InterlockedExchangeAddSizeT(&(_tcp_data.packages), weight);
                 switch (e->Header.Class.Type) {
                 case EVENT_TRACE_TYPE_CONNECT:
                 {
-                    tcp::connect_t& conn = *((tcp::connect_t*) e->MofData);
-                    InterlockedIncrementSizeT(&(_tcp_data.connections));
-                    _tcp_data.max_seg_size = conn.mss;
+                    const tcp::group2_view_t conn{ e };
+                    InterlockedExchangeAddSizeT(&(_tcp_data.connections), weight);
+                    _tcp_data.max_seg_size = conn[conn.mss];
                     break;
                 }
                 case EVENT_TRACE_TYPE_DISCONNECT:
-                {
-                    tcp::disconnect_t& conn = *((tcp::disconnect_t*) e->MofData);
-                    InterlockedDecrementSizeT(&(_tcp_data.connections));
-                    InterlockedIncrementSizeT(&(_tcp_data.connections_lost));
+                    // a connect sampled at a lower rate, or not seen at all,
+                    // must not wrap the count, only the trace thread writes it
+                    InterlockedExchangeAddSizeT(&(_tcp_data.connections),
+                                                (std::size_t)0 - std::min<std::size_t>((std::size_t)_tcp_data.connections, weight));
+                    InterlockedExchangeAddSizeT(&(_tcp_data.connections_lost), weight);
                     break;
-                }
                 case EVENT_TRACE_TYPE_ACCEPT:
                 case EVENT_TRACE_TYPE_RECONNECT:
                     break;
                 case EVENT_TRACE_TYPE_RETRANSMIT:
-                {
-                    tcp::retransmit_t& conn = *((tcp::retransmit_t*) e->MofData);
-                    InterlockedIncrement64(&(_tcp_data.retransmissions));
+                    InterlockedAdd64(&(_tcp_data.retransmissions), weight);
+                    _tcp_variance.add_count(sampling_variance_t::retransmissions, weight);
                     break;
-                }
                 case EVENT_TRACE_TYPE_RECEIVE:
                 {
-                    tcp::receive_t& recv = *((tcp::receive_t*) e->MofData);
-                    InterlockedIncrementSizeT(&(_tcp_data.pkg_recv));
-                    InterlockedAdd64(&(_tcp_data.bytes_recv), recv.size);
+                    const tcp::group1_view_t recv{ e };
+                    InterlockedExchangeAddSizeT(&(_tcp_data.pkg_recv), weight);
+                    InterlockedAdd64(&(_tcp_data.bytes_recv), (std::int64_t)weight * recv[recv.size]);
+                    _tcp_variance.add_packet(sampling_variance_t::pkg_recv, sampling_variance_t::bytes_recv, weight, recv[recv.size]);
                     break;
                 }
                 case EVENT_TRACE_TYPE_SEND:
                 {
-                    tcp::receive_t& send = *((tcp::receive_t*) e->MofData);
-                    InterlockedIncrementSizeT(&(_tcp_data.pkg_sent));
-                    InterlockedAdd64(&(_tcp_data.bytes_recv), send.size);
+                    const tcp::send_view_t send{ e };
+                    InterlockedExchangeAddSizeT(&(_tcp_data.pkg_sent), weight);
+                    InterlockedAdd64(&(_tcp_data.bytes_sent), (std::int64_t)weight * send[send.size]);
+                    _tcp_variance.add_packet(sampling_variance_t::pkg_sent, sampling_variance_t::bytes_sent, weight, send[send.size]);
                     break;
                 }
                 case EVENT_TRACE_TYPE_CONNFAIL:
-                    InterlockedIncrementSizeT(&(_tcp_data.connections_lost));
+                {
+                    const tcp::fail_view_t fail{ e };
+                    InterlockedExchangeAddSizeT(&(_tcp_data.connections_lost), weight);
+                    if (_connection_tracker) {
+                        _connection_tracker->add_failure(e_pid, fail[fail.failure_code]);
+                    }
+                    break;
+                }
                 }
                 _tcp_data.last_timestamp =
                     std::max(e->Header.TimeStamp.QuadPart, (int64_t)_tcp_data.last_timestamp);
+                publish(e, protocol_t::tcp, filtered);
             }
-            else if (is_udpip(e)) {
+            else {
+                InterlockedIncrementSizeT(&(_event_stats.events_used));
+                if (_pid == all_pids) {
+                    account_pid(e, e_pid, weight);
+                }
+                account_thread(e, e_pid, weight);
+                account_group(e, weight);
                 switch (e->Header.Class.Type) {
                 case EVENT_TRACE_TYPE_RECEIVE:
                 {
-                    udp::receive_t& recv = *((udp::receive_t*) e->MofData);
-                    InterlockedIncrementSizeT(&(_udp_data.pkg_recv));
-                    InterlockedAdd64(&(_udp_data.bytes_recv), recv.size);
+                    const udp::group1_view_t recv{ e };
+                    InterlockedExchangeAddSizeT(&(_udp_data.pkg_recv), weight);
+                    InterlockedAdd64(&(_udp_data.bytes_recv), (std::int64_t)weight * recv[recv.size]);
+                    _udp_variance.add_packet(sampling_variance_t::pkg_recv, sampling_variance_t::bytes_recv, weight, recv[recv.size]);
                     break;
                 }
                 case EVENT_TRACE_TYPE_SEND:
                 {
-                    udp::receive_t& send = *((udp::receive_t*) e->MofData);
-                    InterlockedIncrementSizeT(&(_udp_data.pkg_sent));
-                    InterlockedAdd64(&(_udp_data.bytes_recv), send.size);
+                    const udp::group1_view_t send{ e };
+                    InterlockedExchangeAddSizeT(&(_udp_data.pkg_sent), weight);
+                    InterlockedAdd64(&(_udp_data.bytes_sent), (std::int64_t)weight * send[send.size]);
+                    _udp_variance.add_packet(sampling_variance_t::pkg_sent, sampling_variance_t::bytes_sent, weight, send[send.size]);
                     break;
                 }
                 case EVENT_TRACE_TYPE_CONNFAIL:
-                    InterlockedIncrementSizeT(&(_udp_data.connections_lost));
+                    InterlockedExchangeAddSizeT(&(_udp_data.connections_lost), weight);
                     break;
                 }
                 _udp_data.last_timestamp =
                     std::max(e->Header.TimeStamp.QuadPart, (int64_t)_udp_data.last_timestamp);
+                publish(e, protocol_t::udp, filtered);
             }
         }
 
+    public:
         tcp_data_t
         tcp_data() const noexcept {
             tcp_data_t data = _tcp_data;
-            auto last_ts = _last_tcp_data.last_timestamp;
-            data.interval_ms = (data.last_timestamp - last_ts) / (double)_timestamp.frequency() * 1E6;
+            data.interval_ms = interval_ms(_last_tcp_data.last_timestamp, data.last_timestamp);
             _last_tcp_data = data;
             return data;
         }
@@ -182,14 +413,483 @@ namespace performance {
         udp_data_t
         udp_data() const noexcept {
             auto data = _udp_data;
-            auto last_ts = _last_udp_data.last_timestamp;
-            data.interval_ms = (data.last_timestamp - last_ts) / (double)_timestamp.frequency() * 1E6;
+            data.interval_ms = interval_ms(_last_udp_data.last_timestamp, data.last_timestamp);
             _last_udp_data = data;
             return data;
         }
 
+        /** Current counters. Unlike tcp_data()/udp_data() it doesn't move the
+         *  interval reference, so any number of consumers can call it. */
+        network_snapshot_t
+        snapshot() const noexcept {
+            network_snapshot_t data{ _tcp_data, _udp_data, event_stats() };
+            data.estimates = estimates(data.tcp, data.udp);
+            return data;
+        }
+
+        /** Completes with the counters @p interval from now, interval_ms
+         *  measured from the counters at the time of the call. Completes
+         *  right away once the monitor is going away. */
+        inline async_result_t<network_snapshot_t>
+        next_snapshot(std::chrono::milliseconds interval) {
+            async_result_t<network_snapshot_t> result;
+            const auto first    = snapshot();
+            const auto complete = [this, result, first]() {
+                auto data = snapshot();
+                data.tcp.interval_ms = interval_ms(first.tcp.last_timestamp, data.tcp.last_timestamp);
+                data.udp.interval_ms = interval_ms(first.udp.last_timestamp, data.udp.last_timestamp);
+                result.set_value(data, _executor);
+            };
+            if (!executor()->post_at(async_executor_t::clock_t::now() + interval, complete)) {
+                complete();
+            }
+            return result;
+        }
+
+        /** Stream of decoded tcp/udp events for the monitored pid. Every
+         *  subscriber has its own queue of @p capacity events, slow ones lose
+         *  their oldest events instead of stalling the trace thread. */
+        inline std::shared_ptr<event_subscription_t>
+        subscribe(std::size_t capacity = 4096) {
+            auto subscriber = std::make_shared<event_subscription_t>(executor(), capacity);
+            std::lock_guard<std::mutex> lock{ _subscribers_mtx };
+            _subscribers.push_back(subscriber);
+            InterlockedIncrementSizeT(&_n_of_subscribers);
+            return subscriber;
+        }
+
+        inline void
+        unsubscribe(const std::shared_ptr<event_subscription_t>& subscriber) {
+            std::lock_guard<std::mutex> lock{ _subscribers_mtx };
+            auto it = std::find(_subscribers.begin(), _subscribers.end(), subscriber);
+            if (it != _subscribers.end()) {
+                (*it)->close();
+                _subscribers.erase(it);
+                InterlockedDecrementSizeT(&_n_of_subscribers);
+            }
+        }
+
+        /** The monitor's own overhead and losses. events_delivered vs.
+         *  events_used is what the pid filter of the consumer discards; lost
+         *  events, dropped events and consumer lag growing together mean the
+         *  monitor can't keep up. */
+        event_stats_t
+        event_stats() const noexcept {
+            event_stats_t stats = _event_stats;
+            if (auto session = _session.query()) {
+                stats.events_lost  = session->events_lost;
+                stats.buffers_lost = session->log_buffers_lost + session->real_time_buffers_lost;
+            }
+            stats.events_lost        = std::max(stats.events_lost, _elogger.events_lost());
+            stats.buffers_read        = _elogger.buffers_read();
+            stats.trace_thread_cpu_ns = _elogger.thread_cpu_ns();
+            stats.time_to_first_event_ns = _trace.time_to_first_event_ns();
+            stats.trace_restarts      = _trace.restarts();
+            std::lock_guard<std::mutex> lock{ _subscribers_mtx };
+            for (const auto& subscriber : _subscribers) {
+                stats.events_dropped += subscriber->dropped();
+            }
+            return stats;
+        }
+
+        /** Buffer tuning of the trace session, call before start(). */
+        inline void
+        set_session_config(const session_config_t& config) {
+            _session.set_config(config);
+        }
+
+        inline const session_config_t&
+        session_config() const noexcept {
+            return _session.config();
+        }
+
+        /** Lets @p controller resize the session buffers every @p period,
+         *  from the losses and consumer lag seen since the last period. */
+        inline void
+        enable_buffer_control(std::unique_ptr<buffer_controller_t> controller,
+                              std::chrono::milliseconds period = std::chrono::seconds{ 1 }) {
+            {
+                std::lock_guard<std::mutex> lock{ _controller_mtx };
+                _buffer_controller = std::move(controller);
+            }
+            schedule_buffer_control(period);
+        }
+
+        /** One step of the buffer controller, see enable_buffer_control(). */
+        inline void
+        adjust_buffers() {
+            std::lock_guard<std::mutex> lock{ _controller_mtx };
+            if (!_buffer_controller) return;
+            const auto session = _session.query();
+            if (!session) return;
+            buffer_sample_t sample;
+            sample.events_lost       = std::max(session->events_lost, _elogger.events_lost());
+            sample.buffers_lost      = session->log_buffers_lost + session->real_time_buffers_lost;
+            sample.consumer_lag_ns   = _event_stats.consumer_lag_ns;
+            sample.number_of_buffers = session->number_of_buffers;
+            sample.free_buffers      = session->free_buffers;
+            const auto decision = _buffer_controller->decide(_session.config(), sample);
+            switch (decision.action) {
+            case buffer_action_t::update:
+                (void)_session.update_buffers(decision.config);
+                break;
+            case buffer_action_t::restart:
+                if (!restart_session(decision.config)) {
+                    std::cerr << "Failed to restart the trace session with new buffers";
+                }
+                break;
+            case buffer_action_t::none:
+                break;
+            }
+        }
+
+        inline trace_state_t
+        trace_state() const noexcept {
+            return _trace.state();
+        }
+
+        /** Waits at most @p timeout for the first event of the session,
+         *  false when it didn't come or the session failed. */
+        inline bool
+        wait_ready(std::chrono::milliseconds timeout) const {
+            return _trace.wait_ready(timeout);
+        }
+
+        /** Caps the memory of the per process, per thread, per flow and per
+         *  connection tables at @p bytes, see memory_budget_t. The process
+         *  and thread tables are fixed, the flow and connection tables share
+         *  what they leave. Can be called at any time. */
+        inline void
+        set_memory_budget(std::size_t bytes) noexcept {
+            _budget.set_limit(bytes);
+        }
+
+        /** Bytes, peak and evictions of every table. */
+        inline std::vector<memory_usage_t>
+        memory_usage() const {
+            return _budget.usage();
+        }
+
+        inline const memory_budget_t&
+        memory_budget() const noexcept {
+            return _budget;
+        }
+
+        /** Tracks peak bytes/packets in sliding windows of the given lengths,
+         *  per process and per flow. Call before start(). */
+        inline void
+        enable_burst_analysis(const std::vector<std::chrono::nanoseconds>& windows) {
+            _burst_analyzer = std::make_unique<burst_analyzer_t>(windows, _event_clock.converter(), 4096, _budget.account("flows"));
+        }
+
+        /** nullptr unless enable_burst_analysis() was called. */
+        inline burst_analyzer_t*
+        burst_analyzer() noexcept {
+            return _burst_analyzer.get();
+        }
+
+        /** Follows tcp connections from connect to disconnect, see
+         *  connection_tracker_t. With @p max_flow_ends, udp pseudo-flows
+         *  too, and the final record of each is kept until drained. Call
+         *  before start(). */
+        inline void
+        enable_connection_tracking(std::size_t capacity = 65536, std::size_t max_flow_ends = 0) {
+            _connection_tracker = std::make_unique<connection_tracker_t>(_event_clock.converter(), capacity, 1024,
+                                                                         std::chrono::seconds{ 1 }, std::chrono::minutes{ 10 },
+                                                                         std::chrono::seconds{ 30 },
+                                                                         _budget.account("connections"));
+            _connection_tracker->set_flow_ends(max_flow_ends);
+        }
+
+        /** nullptr unless enable_connection_tracking() was called. */
+        inline const connection_tracker_t*
+        connection_tracker() const noexcept {
+            return _connection_tracker.get();
+        }
+
+        inline connection_tracker_t*
+        connection_tracker() noexcept {
+            return _connection_tracker.get();
+        }
+
+        /** Converts event timestamps (last_timestamp, burst peaks...) to
+         *  durations and wall clock time. */
+        inline const event_clock_t&
+        event_clock() const noexcept {
+            return _event_clock;
+        }
+
+        /** Per process counters, only filled when monitoring all_pids. */
+        inline const pid_table_t&
+        pid_table() const noexcept {
+            return _pid_table;
+        }
+
+        /** Keeps only a sample of the events, counted with the weight that
+         *  keeps totals unbiased, see sampler_t and estimates(). An adaptive
+         *  config is re-evaluated every @p period. */
+        inline void
+        set_sampling(const sampling_config_t& config,
+                     std::chrono::milliseconds period = std::chrono::seconds{ 1 }) {
+            bool schedule{ false };
+            {
+                std::lock_guard<std::mutex> lock{ _sampler_mtx };
+                _sampler.set_config(config);
+                schedule = config.adaptive() && !_sampling_scheduled;
+                _sampling_scheduled = _sampling_scheduled || schedule;
+            }
+            if (schedule) {
+                schedule_sampling_control(period);
+            }
+        }
+
+        inline std::uint32_t
+        sampling_rate() const noexcept {
+            return _sampler.rate();
+        }
+
+        /** Totals with confidence bounds, exact while nothing was sampled. */
+        inline traffic_estimates_t
+        estimates() const noexcept {
+            return estimates(tcp_data_t{ _tcp_data }, udp_data_t{ _udp_data });
+        }
+
+        /** Per thread counters of the monitored processes. */
+        inline const thread_table_t&
+        thread_table() const noexcept {
+            return _thread_table;
+        }
+
+        /** Copies the counters and the process, thread and connection
+         *  tables into a new monitor_view_t for views(). The copy reuses
+         *  the buffers of versions no reader holds anymore. Any thread. */
+        inline std::uint64_t
+        publish_view() {
+            std::lock_guard<std::mutex> lock{ _views_mtx };
+            auto& view = _views.prepare();
+            view.timestamp_ns = _event_clock.to_unix_ns(tick_clock_t::qpc());
+            view.snapshot     = snapshot();
+            _pid_table.snapshot(view.pids);
+            _thread_table.snapshot(view.threads);
+            if (_connection_tracker) {
+                _connection_tracker->snapshot(view.connections);
+            }
+            return _views.publish();
+        }
+
+        /** Calls publish_view() every @p period on the monitor's executor. */
+        inline void
+        enable_view_publication(std::chrono::milliseconds period = std::chrono::seconds{ 1 }) {
+            schedule_view_publication(period);
+        }
+
+        /** The published views: every consumer thread reads them through
+         *  its own reader_t, without locks and without slowing the others. */
+        inline published_t<monitor_view_t>&
+        views() noexcept {
+            return _views;
+        }
+
     private:
 
+        inline traffic_estimates_t
+        estimates(const tcp_data_t& tcp, const udp_data_t& udp) const noexcept {
+            using counter_t = sampling_variance_t;
+            traffic_estimates_t data;
+            data.sampling_rate       = _sampler.rate();
+            data.tcp_pkg_sent        = _tcp_variance.estimate(counter_t::pkg_sent, (double)tcp.pkg_sent);
+            data.tcp_pkg_recv        = _tcp_variance.estimate(counter_t::pkg_recv, (double)tcp.pkg_recv);
+            data.tcp_bytes_sent      = _tcp_variance.estimate(counter_t::bytes_sent, (double)tcp.bytes_sent);
+            data.tcp_bytes_recv      = _tcp_variance.estimate(counter_t::bytes_recv, (double)tcp.bytes_recv);
+            data.tcp_retransmissions = _tcp_variance.estimate(counter_t::retransmissions, (double)tcp.retransmissions);
+            data.udp_pkg_sent        = _udp_variance.estimate(counter_t::pkg_sent, (double)udp.pkg_sent);
+            data.udp_pkg_recv        = _udp_variance.estimate(counter_t::pkg_recv, (double)udp.pkg_recv);
+            data.udp_bytes_sent      = _udp_variance.estimate(counter_t::bytes_sent, (double)udp.bytes_sent);
+            data.udp_bytes_recv      = _udp_variance.estimate(counter_t::bytes_recv, (double)udp.bytes_recv);
+            return data;
+        }
+
+        inline void
+        schedule_sampling_control(std::chrono::milliseconds period) {
+            executor()->post_at(async_executor_t::clock_t::now() + period, [this, period]() {
+                // the executor runs what is left when it stops, timers too
+                if (_stopping.load(std::memory_order_acquire)) return;
+                const auto stats = event_stats();
+                {
+                    std::lock_guard<std::mutex> lock{ _sampler_mtx };
+                    (void)_sampler.adapt(stats.events_lost - _sampling_events_lost,
+                                         std::chrono::nanoseconds{ stats.consumer_lag_ns });
+                }
+                _sampling_events_lost = stats.events_lost;
+                schedule_sampling_control(period);
+            });
+        }
+
+        inline void
+        schedule_view_publication(std::chrono::milliseconds period) {
+            executor()->post_at(async_executor_t::clock_t::now() + period, [this, period]() {
+                if (_stopping.load(std::memory_order_acquire)) return;
+                (void)publish_view();
+                schedule_view_publication(period);
+            });
+        }
+
+        inline void
+        schedule_buffer_control(std::chrono::milliseconds period) {
+            executor()->post_at(async_executor_t::clock_t::now() + period, [this, period]() {
+                if (_stopping.load(std::memory_order_acquire)) return;
+                adjust_buffers();
+                schedule_buffer_control(period);
+            });
+        }
+
+        /** Events are lost while the new session starts, only worth it when
+         *  the old one already loses them. Nothing to do once the monitor
+         *  is going away. */
+        inline bool
+        restart_session(const session_config_t& config) {
+            if (_stopping.load(std::memory_order_acquire)) {
+                return true;
+            }
+            (void)_trace.stop();
+            _session.set_config(config);
+            return _trace.start();
+        }
+
+        static inline std::int64_t
+        payload_size(const event_t e) noexcept {
+            // every tcp/udp payload but failures starts with pid and size,
+            // the udp layout is the same
+            const mof::tcp::group1_view_t payload{ e };
+            return payload[payload.size];
+        }
+
+        /** Counts the event in the group of its remote endpoint, daddr and
+         *  dport of every IPv4 payload. */
+        inline void
+        account_group(const event_t e, std::uint32_t weight) noexcept {
+            using counter_t = counter_block_t::counter_t;
+            const auto* classifier = _classifier.load(std::memory_order_acquire);
+            const mof::tcp::group1_view_t payload{ e };
+            if (!classifier || !payload) {
+                return;
+            }
+            const auto group = classifier->classify_network(payload[payload.daddr], payload[payload.dport]);
+            const auto add   = [&](counter_t counter, std::int64_t value) {
+                InterlockedAdd64(&_group_counters.column(counter)[group], value);
+            };
+            const auto size = payload_size(e) * weight;
+            switch (e->Header.Class.Type) {
+            case EVENT_TRACE_TYPE_SEND:
+                add(counter_t::pkg_sent, weight);
+                add(counter_t::bytes_sent, size);
+                break;
+            case EVENT_TRACE_TYPE_RECEIVE:
+                add(counter_t::pkg_recv, weight);
+                add(counter_t::bytes_recv, size);
+                break;
+            case EVENT_TRACE_TYPE_RETRANSMIT:
+                add(counter_t::retransmissions, weight);
+                break;
+            case EVENT_TRACE_TYPE_CONNECT:
+            case EVENT_TRACE_TYPE_ACCEPT:
+                add(counter_t::connections, weight);
+                break;
+            }
+            _group_counters.column(counter_t::last_timestamp)[group] = e->Header.TimeStamp.QuadPart;
+        }
+
+        /** Counts the event @p weight times, see sampler_t. */
+        inline void
+        account_pid(const event_t e, std::uint32_t pid, std::uint32_t weight) noexcept {
+            using counter_t = pid_table_t::counter_t;
+            const auto index = _pid_table.index_of(pid, e->Header.TimeStamp.QuadPart);
+            const auto size  = payload_size(e) * weight;
+            switch (e->Header.Class.Type) {
+            case EVENT_TRACE_TYPE_SEND:
+                _pid_table.add(index, counter_t::pkg_sent, weight);
+                _pid_table.add(index, counter_t::bytes_sent, size);
+                break;
+            case EVENT_TRACE_TYPE_RECEIVE:
+                _pid_table.add(index, counter_t::pkg_recv, weight);
+                _pid_table.add(index, counter_t::bytes_recv, size);
+                break;
+            case EVENT_TRACE_TYPE_RETRANSMIT:
+                _pid_table.add(index, counter_t::retransmissions, weight);
+                break;
+            case EVENT_TRACE_TYPE_CONNECT:
+            case EVENT_TRACE_TYPE_ACCEPT:
+                _pid_table.add(index, counter_t::connections, weight);
+                break;
+            case EVENT_TRACE_TYPE_DISCONNECT:
+                _pid_table.add(index, counter_t::connections,
+                               -std::min<std::int64_t>(_pid_table.get(index, counter_t::connections), weight));
+                break;
+            }
+            _pid_table.set(index, counter_t::last_timestamp, e->Header.TimeStamp.QuadPart);
+        }
+
+        /** The header's thread is the one the stack ran on: the sender for
+         *  sends, often an arbitrary or system thread for receives. */
+        inline void
+        account_thread(const event_t e, std::uint32_t pid, std::uint32_t weight) noexcept {
+            auto& data = _thread_table.at(pid, e->Header.ThreadId, e->Header.TimeStamp.QuadPart);
+            const auto size = payload_size(e) * weight;
+            switch (e->Header.Class.Type) {
+            case EVENT_TRACE_TYPE_SEND:
+                data.pkg_sent += weight;
+                data.bytes_sent += size;
+                break;
+            case EVENT_TRACE_TYPE_RECEIVE:
+                data.pkg_recv += weight;
+                data.bytes_recv += size;
+                break;
+            case EVENT_TRACE_TYPE_RETRANSMIT:
+                data.retransmissions += weight;
+                break;
+            }
+            data.last_timestamp = e->Header.TimeStamp.QuadPart;
+        }
+
+        inline double
+        interval_ms(std::int64_t from, std::int64_t to) const noexcept {
+            return _event_clock.interval_ms(from, to);
+        }
+
+        inline void
+        publish(const event_t e, protocol_t protocol, const network_event_t* filtered) {
+            if (!_n_of_subscribers && !_burst_analyzer && !_connection_tracker) return;
+            network_event_t decoded;
+            if (filtered) {
+                decoded = *filtered;
+            }
+            else if (!decode_network_event(e, protocol, decoded)) {
+                InterlockedIncrementSizeT(&(_event_stats.events_dropped));
+                return;
+            }
+            InterlockedIncrementSizeT(&(_event_stats.events_decoded));
+            if (_burst_analyzer) {
+                _burst_analyzer->add(decoded);
+            }
+            if (_connection_tracker) {
+                _connection_tracker->add(decoded);
+            }
+            if (!_n_of_subscribers) return;
+            std::lock_guard<std::mutex> lock{ _subscribers_mtx };
+            for (auto& subscriber : _subscribers) {
+                subscriber->push(decoded);
+            }
+        }
+
+        inline const std::shared_ptr<async_executor_t>&
+        executor() {
+            std::lock_guard<std::mutex> lock{ _executor_mtx };
+            if (!_executor) {
+                _executor = std::make_shared<async_executor_t>();
+            }
+            return _executor;
+        }
+
         inline bool
         is_tcpip(const event_t e) const noexcept {
             return ::IsEqualGUID(_tcpip_guid, e->Header.Guid);
@@ -200,14 +900,54 @@ namespace performance {
             return ::IsEqualGUID(_udpip_guid, e->Header.Guid);
         }
 
-        short                                     _pid{ std::numeric_limits<short>::max() };
-        timestamp_t                               _timestamp;
+        std::uint32_t                             _pid{ std::numeric_limits<std::uint32_t>::max() };
+        static constexpr std::size_t              lag_sample_rate = 64;
+        static constexpr std::size_t              thread_idle_s = 30;
+        static constexpr std::size_t              pid_idle_s    = 300;
+        event_clock_t                             _event_clock;
+        const tick_clock_t&                       _clock{ tick_clock_t::instance() };
+        const double                              _ns_per_tick{ 1E9 / _clock.frequency() };
         volatile tcp_data_t                       _tcp_data;
         volatile udp_data_t                       _udp_data;
+        volatile event_stats_t                    _event_stats;
+        memory_budget_t                           _budget;        // outlives the tables charging it
+        pid_table_t                               _pid_table;
+        thread_table_t                            _thread_table;
+        sampler_t                                 _sampler;
+        sampling_variance_t                       _tcp_variance;
+        sampling_variance_t                       _udp_variance;
+        std::mutex                                _sampler_mtx;
+        bool                                      _sampling_scheduled{ false };
+        std::size_t                               _sampling_events_lost{ 0 };
+        std::unique_ptr<burst_analyzer_t>         _burst_analyzer;
+        std::unique_ptr<connection_tracker_t>     _connection_tracker;
+        std::unique_ptr<buffer_controller_t>      _buffer_controller;
+        std::atomic<const std::vector<std::uint32_t>*> _pids{ nullptr };
+        std::vector<std::unique_ptr<const std::vector<std::uint32_t>>> _pid_lists;
+        std::mutex                                _pids_mtx;
+        std::atomic<const event_filter_t*>        _filter{ nullptr };
+        std::vector<std::unique_ptr<const event_filter_t>> _filters;  // kept like _pid_lists
+        std::mutex                                _filter_mtx;
+        std::atomic<const address_classifier_t*>  _classifier{ nullptr };
+        std::vector<std::unique_ptr<const address_classifier_t>> _classifiers;  // kept like _pid_lists
+        counter_block_t                           _group_counters{ address_classifier_t::max_groups + 1 };
+        std::vector<std::string>                  _group_names{ "none" };
+        mutable std::mutex                        _groups_mtx;
+        std::mutex                                _controller_mtx;
+        std::atomic<bool>                         _stopping{ false };
+        published_t<monitor_view_t>               _views;
+        std::mutex                                _views_mtx;
         mutable tcp_data_t                        _last_tcp_data;
         mutable udp_data_t                        _last_udp_data;
+        std::mutex                                _executor_mtx;
+        std::shared_ptr<async_executor_t>         _executor;
+        mutable std::mutex                        _subscribers_mtx;
+        std::vector<std::shared_ptr<event_subscription_t>> _subscribers;
+        volatile std::size_t                      _n_of_subscribers{ 0 };
         session_trace_handler_t                   _session;
         event_logger_file_t                       _elogger;
+        etw_trace_backend_t                       _backend{ _session, _elogger };
+        trace_lifecycle_t<etw_trace_backend_t>    _trace{ _backend };  // stopped before the session goes
     };
 }
 
@@ -0,0 +1,761 @@
+#pragma once
+
+#include "alert_rules.h"
+#include "burst_analyzer.h"
+#include "connection_tracker.h"
+#include "network_monitor.h"
+#include "pid_table.h"
+#include "process_monitor.h"
+#include "thread_table.h"
+
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+namespace performance {
+
+    enum class output_format_t {
+        jsonl,
+        csv,
+        binary,
+    };
+
+    /** One row of output: a kind and up to max_fields named values.
+     *  Lives on the stack, the sinks only format it. Names longer than
+     *  max_name_size and texts longer than max_text_size, once escaped
+     *  for the format, are cut: a row always fits the writer's
+     *  max_record_size. */
+    struct output_record_t {
+        static constexpr std::size_t max_fields    = 24;
+        static constexpr std::size_t max_name_size = 32;
+        static constexpr std::size_t max_text_size = 128;
+
+        enum class kind_t : std::uint8_t {
+            snapshot = 1,
+            pid      = 2,
+            flow     = 3,
+            flow_totals = 4,
+            thread   = 5,
+            alert    = 6,
+            connections = 7,
+            group    = 8,
+            host     = 9,
+            host_pid = 10,
+            memory   = 11,
+            flow_end = 12,
+            process  = 13,
+            n_of_kinds
+        };
+
+        enum class type_t : std::uint8_t {
+            integer,
+            real,
+            ipv4,       // network order, as in network_event_t
+            text,       // escaped by the sinks, must outlive the record
+        };
+
+        struct field_t {
+            const char*     name;
+            type_t          type;
+            union {
+                std::int64_t    integer;
+                double          real;
+                const char*     text;
+            };
+        };
+
+        kind_t                               kind;
+        std::size_t                          size{ 0 };
+        std::array<field_t, max_fields>      fields;
+
+        explicit output_record_t(kind_t k) noexcept : kind{ k } {}
+
+        inline output_record_t&
+        add(const char* name, std::int64_t value, type_t type = type_t::integer) noexcept {
+            auto& field   = fields[size++];
+            field.name    = name;
+            field.type    = type;
+            field.integer = value;
+            return *this;
+        }
+
+        inline output_record_t&
+        add(const char* name, double value) noexcept {
+            auto& field = fields[size++];
+            field.name  = name;
+            field.type  = type_t::real;
+            field.real  = value;
+            return *this;
+        }
+
+        inline output_record_t&
+        add_text(const char* name, const char* value) noexcept {
+            auto& field = fields[size++];
+            field.name  = name;
+            field.type  = type_t::text;
+            field.text  = value;
+            return *this;
+        }
+
+        inline const char*
+        kind_name() const noexcept {
+            switch (kind) {
+            case kind_t::snapshot: return "snapshot";
+            case kind_t::pid:      return "pid";
+            case kind_t::flow:     return "flow";
+            case kind_t::flow_totals: return "flow_totals";
+            case kind_t::thread:   return "thread";
+            case kind_t::alert:    return "alert";
+            case kind_t::connections: return "connections";
+            case kind_t::group:    return "group";
+            case kind_t::host:     return "host";
+            case kind_t::host_pid: return "host_pid";
+            case kind_t::memory:   return "memory";
+            case kind_t::flow_end: return "flow_end";
+            case kind_t::process:  return "process";
+            case kind_t::n_of_kinds: break;
+            }
+            return "unknown";
+        }
+    };
+
+    /** Collects formatted rows in a batch and writes full batches from its
+     *  own thread, one fwrite each. Two buffers of batch_size are allocated
+     *  up front and swapped, the producer only waits when the writer is
+     *  still busy with the previous batch. */
+    class batch_writer_t {
+    public:
+        /** Upper bound of a single formatted row. */
+        static constexpr std::size_t max_record_size = 4096;
+
+        batch_writer_t(std::FILE* file, bool owns_file, std::size_t batch_size = 1024 * 1024)
+            : _file{ file }
+            , _owns_file{ owns_file }
+            , _batch_size{ std::max(batch_size, max_record_size) } {
+            // our batches are the buffering
+            (void)std::setvbuf(_file, nullptr, _IONBF, 0);
+            for (auto& buffer : _buffers) {
+                buffer.resize(_batch_size + max_record_size);
+            }
+            _thread = std::thread([this]() { run(); });
+        }
+
+        ~batch_writer_t() noexcept {
+            flush();
+            {
+                std::lock_guard<std::mutex> lock{ _mtx };
+                _running = false;
+            }
+            _cv.notify_all();
+            if (_thread.joinable()) {
+                _thread.join();
+            }
+            if (_owns_file) {
+                std::fclose(_file);
+            }
+        }
+
+        /** Room for at most max_record_size bytes, valid until commit(). */
+        inline char*
+        reserve() {
+            if (_size >= _batch_size) {
+                submit();
+            }
+            return _buffers[_current].data() + _size;
+        }
+
+        inline void
+        commit(char* end) noexcept {
+            _size = (std::size_t)(end - _buffers[_current].data());
+        }
+
+        /** Hands the current batch to the writer thread, doesn't wait for it. */
+        inline void
+        submit() {
+            if (!_size) return;
+            std::unique_lock<std::mutex> lock{ _mtx };
+            _cv.wait(lock, [this]() { return !_pending; });
+            _pending      = true;
+            _pending_size = _size;
+            _current     ^= 1;
+            _size         = 0;
+            lock.unlock();
+            _cv.notify_all();
+        }
+
+        /** Submits and waits until everything reached the file. */
+        inline void
+        flush() {
+            submit();
+            std::unique_lock<std::mutex> lock{ _mtx };
+            _cv.wait(lock, [this]() { return !_pending; });
+            (void)std::fflush(_file);
+        }
+
+        inline bool
+        failed() const noexcept {
+            return _failed;
+        }
+
+    private:
+        inline void
+        run() {
+            std::unique_lock<std::mutex> lock{ _mtx };
+            while (true) {
+                _cv.wait(lock, [this]() { return _pending || !_running; });
+                if (!_pending) {
+                    return;
+                }
+                // the producer only touches the other buffer meanwhile
+                const auto& buffer = _buffers[_current ^ 1];
+                const auto  size   = _pending_size;
+                lock.unlock();
+                if (std::fwrite(buffer.data(), 1, size, _file) != size) {
+                    _failed = true;
+                }
+                lock.lock();
+                _pending = false;
+                _cv.notify_all();
+            }
+        }
+
+        std::FILE*                                _file;
+        bool                                      _owns_file;
+        std::size_t                               _batch_size;
+        std::vector<char>                         _buffers[2];
+        std::size_t                               _current{ 0 };
+        std::size_t                               _size{ 0 };
+        std::size_t                               _pending_size{ 0 };
+        bool                                      _pending{ false };
+        bool                                      _running{ true };
+        volatile bool                             _failed{ false };
+        std::mutex                                _mtx;
+        std::condition_variable                   _cv;
+        std::thread                               _thread;
+    };
+
+    /** Streams interval snapshots, per process and per flow rows. Formatting
+     *  is done with std::to_chars straight into the writer's batch, so a row
+     *  costs no heap allocation. Not thread safe, one producer per sink. */
+    class output_sink_t {
+    public:
+        using kind_t = output_record_t::kind_t;
+        using type_t = output_record_t::type_t;
+
+        static constexpr std::size_t n_of_kinds = (std::size_t)kind_t::n_of_kinds;
+        static_assert(n_of_kinds <= 256, "the binary sink writes kinds as one byte");
+
+        // the widest row is json with every field a text: per field a
+        // comma, the name and the text with their quotes and a colon
+        static_assert(32 + output_record_t::max_fields * (4 + output_record_t::max_name_size + output_record_t::max_text_size)
+                          <= batch_writer_t::max_record_size,
+                      "a record may not fit max_record_size");
+
+        output_sink_t(std::FILE* file, bool owns_file)
+            : _writer{ file, owns_file } {}
+        virtual ~output_sink_t() = default;
+
+        inline void
+        write(std::int64_t timestamp_ns, const network_snapshot_t& snapshot) {
+            output_record_t record{ kind_t::snapshot };
+            record.add("timestamp_ns", timestamp_ns)
+                  .add("tcp_connections", (std::int64_t)snapshot.tcp.connections)
+                  .add("tcp_connections_lost", (std::int64_t)snapshot.tcp.connections_lost)
+                  .add("tcp_pkg_sent", (std::int64_t)snapshot.tcp.pkg_sent)
+                  .add("tcp_pkg_recv", (std::int64_t)snapshot.tcp.pkg_recv)
+                  .add("tcp_bytes_sent", snapshot.tcp.bytes_sent)
+                  .add("tcp_bytes_recv", snapshot.tcp.bytes_recv)
+                  .add("tcp_retransmissions", snapshot.tcp.retransmissions)
+                  .add("tcp_interval_ms", (double)snapshot.tcp.interval_ms)
+                  .add("udp_pkg_sent", (std::int64_t)snapshot.udp.pkg_sent)
+                  .add("udp_pkg_recv", (std::int64_t)snapshot.udp.pkg_recv)
+                  .add("udp_bytes_sent", snapshot.udp.bytes_sent)
+                  .add("udp_bytes_recv", snapshot.udp.bytes_recv)
+                  .add("udp_interval_ms", (double)snapshot.udp.interval_ms)
+                  .add("events_delivered", (std::int64_t)snapshot.stats.events_delivered)
+                  .add("events_used", (std::int64_t)snapshot.stats.events_used)
+                  .add("events_lost", (std::int64_t)snapshot.stats.events_lost)
+                  .add("events_dropped", (std::int64_t)snapshot.stats.events_dropped)
+                  .add("sampling_rate", (std::int64_t)snapshot.estimates.sampling_rate)
+                  .add("tcp_bytes_sent_margin", snapshot.estimates.tcp_bytes_sent.margin)
+                  .add("tcp_bytes_recv_margin", snapshot.estimates.tcp_bytes_recv.margin)
+                  .add("udp_bytes_sent_margin", snapshot.estimates.udp_bytes_sent.margin)
+                  .add("udp_bytes_recv_margin", snapshot.estimates.udp_bytes_recv.margin);
+            format(record);
+        }
+
+        inline void
+        write(std::int64_t timestamp_ns, const pid_data_t& data) {
+            output_record_t record{ kind_t::pid };
+            record.add("timestamp_ns", timestamp_ns)
+                  .add("pid", (std::int64_t)data.pid)
+                  .add("connections", (std::int64_t)data.connections)
+                  .add("pkg_sent", (std::int64_t)data.pkg_sent)
+                  .add("pkg_recv", (std::int64_t)data.pkg_recv)
+                  .add("bytes_sent", data.bytes_sent)
+                  .add("bytes_recv", data.bytes_recv)
+                  .add("retransmissions", data.retransmissions);
+            format(record);
+        }
+
+        inline void
+        write(std::int64_t timestamp_ns, const thread_data_t& data) {
+            output_record_t record{ kind_t::thread };
+            record.add("timestamp_ns", timestamp_ns)
+                  .add("pid", (std::int64_t)data.pid)
+                  .add("tid", (std::int64_t)data.tid)
+                  .add("pkg_sent", (std::int64_t)data.pkg_sent)
+                  .add("pkg_recv", (std::int64_t)data.pkg_recv)
+                  .add("bytes_sent", data.bytes_sent)
+                  .add("bytes_recv", data.bytes_recv)
+                  .add("retransmissions", data.retransmissions);
+            format(record);
+        }
+
+        inline void
+        write(std::int64_t timestamp_ns, const flow_key_t& key, const burst_stats_t& stats) {
+            output_record_t record{ kind_t::flow };
+            record.add("timestamp_ns", timestamp_ns)
+                  .add("protocol", (std::int64_t)key.protocol)
+                  .add("saddr", (std::int64_t)key.saddr, type_t::ipv4)
+                  .add("sport", (std::int64_t)port(key.sport))
+                  .add("daddr", (std::int64_t)key.daddr, type_t::ipv4)
+                  .add("dport", (std::int64_t)port(key.dport))
+                  .add("window_ns", stats.window_ns)
+                  .add("peak_bytes", stats.peak_bytes)
+                  .add("peak_packets", stats.peak_packets)
+                  .add("bytes", stats.bytes)
+                  .add("packets", stats.packets)
+                  .add("peak_to_average", stats.peak_to_average);
+            format(record);
+        }
+
+        inline void
+        write(std::int64_t timestamp_ns, const connection_stats_t& stats) {
+            output_record_t record{ kind_t::connections };
+            record.add("timestamp_ns", timestamp_ns)
+                  .add("pid", (std::int64_t)stats.pid)
+                  .add("opened", (std::int64_t)stats.opened)
+                  .add("accepted", (std::int64_t)stats.accepted)
+                  .add("closed", (std::int64_t)stats.closed)
+                  .add("failed", (std::int64_t)stats.failed)
+                  .add("short_lived", (std::int64_t)stats.short_lived)
+                  .add("expired", (std::int64_t)stats.expired)
+                  .add("bytes", stats.bytes)
+                  .add("lifetime_p50_us", stats.lifetime_us.percentile(0.5))
+                  .add("lifetime_p99_us", stats.lifetime_us.percentile(0.99))
+                  .add("bytes_per_connection_p50", stats.bytes_per_connection.percentile(0.5));
+            format(record);
+        }
+
+        /** Entity @p index of @p counters, an address group's by default. */
+        inline void
+        write(std::int64_t timestamp_ns, const char* name, const counter_block_t& counters, std::size_t index) {
+            using counter_t = counter_block_t::counter_t;
+            output_record_t record{ kind_t::group };
+            record.add("timestamp_ns", timestamp_ns)
+                  .add_text("group", name)
+                  .add("connections", counters.column(counter_t::connections)[index])
+                  .add("pkg_sent", counters.column(counter_t::pkg_sent)[index])
+                  .add("pkg_recv", counters.column(counter_t::pkg_recv)[index])
+                  .add("bytes_sent", counters.column(counter_t::bytes_sent)[index])
+                  .add("bytes_recv", counters.column(counter_t::bytes_recv)[index])
+                  .add("retransmissions", counters.column(counter_t::retransmissions)[index]);
+            format(record);
+        }
+
+        inline void
+        write(std::int64_t timestamp_ns, const memory_usage_t& usage) {
+            output_record_t record{ kind_t::memory };
+            record.add("timestamp_ns", timestamp_ns)
+                  .add_text("table", usage.name)
+                  .add("bytes", (std::int64_t)usage.bytes)
+                  .add("peak_bytes", (std::int64_t)usage.peak_bytes)
+                  .add("evicted", (std::int64_t)usage.evicted)
+                  .add("refused", (std::int64_t)usage.refused);
+            format(record);
+        }
+
+        /** A connection or udp pseudo-flow that ended, @p timestamp_ns of
+         *  its last event. */
+        inline void
+        write(std::int64_t timestamp_ns, const flow_end_t& end) {
+            output_record_t record{ kind_t::flow_end };
+            record.add("timestamp_ns", timestamp_ns)
+                  .add("protocol", (std::int64_t)end.key.protocol)
+                  .add("saddr", (std::int64_t)end.key.saddr, type_t::ipv4)
+                  .add("sport", (std::int64_t)port(end.key.sport))
+                  .add("daddr", (std::int64_t)end.key.daddr, type_t::ipv4)
+                  .add("dport", (std::int64_t)port(end.key.dport))
+                  .add("pid", (std::int64_t)end.pid)
+                  .add_text("reason", to_string(end.reason))
+                  .add("duration_ns", end.duration_ns)
+                  .add("bytes", end.bytes)
+                  .add("packets", end.packets);
+            format(record);
+        }
+
+        /** A process_monitor_t sample, times in ns rather than 100ns. */
+        inline void
+        write(std::int64_t timestamp_ns, const process_data_t& data) {
+            output_record_t record{ kind_t::process };
+            record.add("timestamp_ns", timestamp_ns)
+                  .add("pid", (std::int64_t)data.pid)
+                  .add_text("name", data.name)
+                  .add("user_time_ns", data.user_time * 100)
+                  .add("kernel_time_ns", data.kernel_time * 100)
+                  .add("working_set", (std::int64_t)data.working_set)
+                  .add("private_bytes", (std::int64_t)data.private_bytes)
+                  .add("context_switches", (std::int64_t)data.context_switches)
+                  .add("threads", (std::int64_t)data.threads)
+                  .add("handles", (std::int64_t)data.handles)
+                  .add("page_faults", (std::int64_t)data.page_faults)
+                  .add("hard_faults", (std::int64_t)data.hard_faults)
+                  .add("interval_ms", (double)data.interval_ms);
+            format(record);
+        }
+
+        inline void
+        write(const alert_t& alert) {
+            output_record_t record{ kind_t::alert };
+            record.add("timestamp_ns", alert.timestamp_ns)
+                  .add_text("rule", alert.rule->name.c_str())
+                  .add_text("state", alert.state == alert_state_t::fired ? "fired" : "cleared")
+                  .add_text("scope", alert_rule_t::scope_name(alert.rule->scope))
+                  .add("pid", (std::int64_t)alert.pid)
+                  .add("protocol", (std::int64_t)alert.flow.protocol)
+                  .add("saddr", (std::int64_t)alert.flow.saddr, type_t::ipv4)
+                  .add("sport", (std::int64_t)port(alert.flow.sport))
+                  .add("daddr", (std::int64_t)alert.flow.daddr, type_t::ipv4)
+                  .add("dport", (std::int64_t)port(alert.flow.dport))
+                  .add("value", alert.value)
+                  .add("threshold", alert.state == alert_state_t::fired ? alert.rule->threshold : alert.rule->clear);
+            format(record);
+        }
+
+        /** Any other row. */
+        inline void
+        write(const output_record_t& record) {
+            format(record);
+        }
+
+        /** Lets the writer thread write what was buffered so far, call at
+         *  the end of every interval. */
+        inline void
+        submit() {
+            _writer.submit();
+        }
+
+        inline void
+        flush() {
+            _writer.flush();
+        }
+
+        inline bool
+        failed() const noexcept {
+            return _writer.failed();
+        }
+
+    protected:
+        virtual void
+        format(const output_record_t& record) = 0;
+
+        static inline char*
+        append(char* out, const char* str) noexcept {
+            const auto length = std::strlen(str);
+            std::memcpy(out, str, length);
+            return out + length;
+        }
+
+        static inline char*
+        append(char* out, char c) noexcept {
+            *out = c;
+            return out + 1;
+        }
+
+        /** At most @p max bytes of @p str, not cutting an UTF-8 sequence. */
+        static inline std::size_t
+        cut(const char* str, std::size_t max) noexcept {
+            std::size_t length = 0;
+            while (length < max && str[length]) {
+                length++;
+            }
+            if (str[length]) {
+                // back to the start of the sequence that didn't fit
+                while (length > 0 && ((unsigned char)str[length] & 0xC0) == 0x80) {
+                    length--;
+                }
+            }
+            return length;
+        }
+
+        static inline char*
+        append_name(char* out, const char* name) noexcept {
+            const auto length = cut(name, output_record_t::max_name_size);
+            std::memcpy(out, name, length);
+            return out + length;
+        }
+
+        /** @p text as a json string, quotes included. */
+        static inline char*
+        append_json(char* out, const char* text) noexcept {
+            static constexpr char hex[] = "0123456789abcdef";
+            const auto* start = out;
+            out = append(out, '"');
+            for (const char* in = text; *in; in++) {
+                const auto c    = (unsigned char)*in;
+                const auto size = c == '"' || c == '\\' ? 2 : c < 0x20 ? 6 : 1;
+                const auto room = (std::size_t)(output_record_t::max_text_size - 1 - (out - start));
+                if ((std::size_t)size > room || ((c & 0xC0) == 0xC0 && cut(in, room) == 0)) {
+                    break;
+                }
+                if (c == '"' || c == '\\') {
+                    out = append(out, '\\');
+                    out = append(out, (char)c);
+                }
+                else if (c < 0x20) {
+                    out = append(out, "\\u00");
+                    out = append(out, hex[c >> 4]);
+                    out = append(out, hex[c & 0xF]);
+                }
+                else {
+                    out = append(out, (char)c);
+                }
+            }
+            return append(out, '"');
+        }
+
+        /** @p text as a csv field, quoted and with doubled quotes when it
+         *  holds a separator, a quote or a line break. */
+        static inline char*
+        append_csv(char* out, const char* text) noexcept {
+            const auto length = cut(text, output_record_t::max_text_size);
+            if (std::strcspn(text, ",\"\r\n") >= length) {
+                std::memcpy(out, text, length);
+                return out + length;
+            }
+            const auto* start = out;
+            out = append(out, '"');
+            for (const char* in = text; *in; in++) {
+                const auto size = *in == '"' ? 2 : 1;
+                const auto room = (std::size_t)(output_record_t::max_text_size - 1 - (out - start));
+                if ((std::size_t)size > room || (((unsigned char)*in & 0xC0) == 0xC0 && cut(in, room) == 0)) {
+                    break;
+                }
+                if (*in == '"') {
+                    out = append(out, '"');
+                }
+                out = append(out, *in);
+            }
+            return append(out, '"');
+        }
+
+        static inline char*
+        append_value(char* out, const output_record_t::field_t& field, const char* not_finite) noexcept {
+            switch (field.type) {
+            case type_t::integer:
+                return std::to_chars(out, out + 24, field.integer).ptr;
+            case type_t::real:
+                if (!std::isfinite(field.real)) {
+                    return append(out, not_finite);
+                }
+                return std::to_chars(out, out + 32, field.real).ptr;
+            case type_t::ipv4:
+                for (int ii = 0; ii < 4; ii++) {
+                    if (ii) out = append(out, '.');
+                    out = std::to_chars(out, out + 3, (field.integer >> (8 * ii)) & 0xFF).ptr;
+                }
+                return out;
+            case type_t::text:
+                return append_json(out, field.text);
+            }
+            return out;
+        }
+
+        static inline std::uint16_t
+        port(std::uint16_t network_order) noexcept {
+            return (std::uint16_t)((network_order >> 8) | (network_order << 8));
+        }
+
+        batch_writer_t                            _writer;
+    };
+
+    /** {"kind":"pid","timestamp_ns":...,"pid":...} per line. */
+    class jsonl_sink_t : public output_sink_t {
+    public:
+        using output_sink_t::output_sink_t;
+
+    protected:
+        inline void
+        format(const output_record_t& record) override {
+            auto* out = _writer.reserve();
+            out = append(out, "{\"kind\":\"");
+            out = append(out, record.kind_name());
+            out = append(out, '"');
+            for (std::size_t ii = 0; ii < record.size; ii++) {
+                const auto& field = record.fields[ii];
+                out = append(out, ",\"");
+                out = append_name(out, field.name);
+                out = append(out, "\":");
+                if (field.type == type_t::ipv4) {
+                    out = append(out, '"');
+                    out = append_value(out, field, "null");
+                    out = append(out, '"');
+                }
+                else {
+                    out = append_value(out, field, "null");
+                }
+            }
+            out = append(out, "}\n");
+            _writer.commit(out);
+        }
+    };
+
+    /** Rows start with their kind; every kind gets a header line, written
+     *  before its first row. */
+    class csv_sink_t : public output_sink_t {
+    public:
+        using output_sink_t::output_sink_t;
+
+    protected:
+        inline void
+        format(const output_record_t& record) override {
+            auto* out = _writer.reserve();
+            const auto kind = (std::size_t)record.kind;
+            if (!_header_written[kind]) {
+                _header_written[kind] = true;
+                out = append(out, "kind");
+                for (std::size_t ii = 0; ii < record.size; ii++) {
+                    out = append(out, ',');
+                    out = append_name(out, record.fields[ii].name);
+                }
+                out = append(out, '\n');
+            }
+            out = append(out, record.kind_name());
+            for (std::size_t ii = 0; ii < record.size; ii++) {
+                const auto& field = record.fields[ii];
+                out = append(out, ',');
+                out = field.type == type_t::text ? append_csv(out, field.text)
+                                                 : append_value(out, field, "");
+            }
+            out = append(out, '\n');
+            _writer.commit(out);
+        }
+
+    private:
+        bool                                      _header_written[n_of_kinds]{};
+    };
+
+    /** Little endian records:
+     *    'S' kind:u8 n:u8 (type:u8 name_length:u8 name)*n  once per kind
+     *    'R' kind:u8 n:u8 value:8 bytes*n                   every row
+     *  The stream starts with the magic "PWB1". Integers and addresses are
+     *  int64, reals are IEEE doubles, texts are length:u8 followed by the
+     *  bytes instead of 8 bytes. */
+    class binary_sink_t : public output_sink_t {
+    public:
+        binary_sink_t(std::FILE* file, bool owns_file)
+            : output_sink_t{ file, owns_file } {
+            auto* out = _writer.reserve();
+            out = append(out, "PWB1");
+            _writer.commit(out);
+        }
+
+    protected:
+        inline void
+        format(const output_record_t& record) override {
+            auto* out = _writer.reserve();
+            const auto kind = (std::size_t)record.kind;
+            if (!_schema_written[kind]) {
+                _schema_written[kind] = true;
+                out = append(out, 'S');
+                out = append(out, (char)record.kind);
+                out = append(out, (char)record.size);
+                for (std::size_t ii = 0; ii < record.size; ii++) {
+                    const auto& field  = record.fields[ii];
+                    const auto  length = cut(field.name, output_record_t::max_name_size);
+                    out = append(out, (char)field.type);
+                    out = append(out, (char)length);
+                    std::memcpy(out, field.name, length);
+                    out += length;
+                }
+            }
+            out = append(out, 'R');
+            out = append(out, (char)record.kind);
+            out = append(out, (char)record.size);
+            for (std::size_t ii = 0; ii < record.size; ii++) {
+                const auto& field = record.fields[ii];
+                if (field.type == type_t::text) {
+                    const auto length = cut(field.text, output_record_t::max_text_size);
+                    out = append(out, (char)length);
+                    std::memcpy(out, field.text, length);
+                    out += length;
+                    continue;
+                }
+                // the union is 8 bytes either way
+                std::memcpy(out, &field.integer, sizeof(std::int64_t));
+                out += sizeof(std::int64_t);
+            }
+            _writer.commit(out);
+        }
+
+    private:
+        bool                                      _schema_written[n_of_kinds]{};
+    };
+
+    /** Opens @p path ("-" for stdout) and returns a sink of @p format,
+     *  nullptr when the file can't be opened. */
+    inline std::unique_ptr<output_sink_t>
+    make_output_sink(output_format_t format, const std::filesystem::path& path) {
+        const bool binary = format == output_format_t::binary;
+        std::FILE* file   = nullptr;
+        bool owns_file    = false;
+        if (path == "-") {
+            file = stdout;
+#if defined(_WIN32)
+            if (binary) {
+                (void)_setmode(_fileno(stdout), _O_BINARY);
+            }
+#endif
+        }
+        else {
+            file      = std::fopen(path.string().c_str(), binary ? "wb" : "w");
+            owns_file = true;
+        }
+        if (!file) {
+            std::cerr << "Failed to open " << path << " for output";
+            return nullptr;
+        }
+        switch (format) {
+        case output_format_t::jsonl:  return std::make_unique<jsonl_sink_t>(file, owns_file);
+        case output_format_t::csv:    return std::make_unique<csv_sink_t>(file, owns_file);
+        case output_format_t::binary: return std::make_unique<binary_sink_t>(file, owns_file);
+        }
+        return nullptr;
+    }
+
+    /** "jsonl", "csv" or "binary". */
+    inline std::optional<output_format_t>
+    parse_output_format(std::string_view name) noexcept {
+        if (name == "jsonl") return output_format_t::jsonl;
+        if (name == "csv")    return output_format_t::csv;
+        if (name == "binary") return output_format_t::binary;
+        return std::nullopt;
+    }
+}
@@ -0,0 +1,272 @@
+#pragma once
+
+#include "counter_block.h"
+#include "memory_budget.h"
+
+#include <windows.h>
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+namespace performance {
+
+    #pragma pack (push, 1)
+    struct pid_data_t {
+        std::uint32_t   pid{ 0 };
+        std::size_t     connections{ 0 };
+        std::size_t     pkg_sent{ 0 };
+        std::size_t     pkg_recv{ 0 };
+        std::int64_t    bytes_sent{ 0 };
+        std::int64_t    bytes_recv{ 0 };
+        std::int64_t    retransmissions{ 0 };
+        std::int64_t    last_timestamp{ 0 };
+
+        pid_data_t() = default;
+        pid_data_t(const volatile pid_data_t& obj) {
+            pid = obj.pid;
+            connections = obj.connections;
+            pkg_sent = obj.pkg_sent;
+            pkg_recv = obj.pkg_recv;
+            bytes_sent = obj.bytes_sent;
+            bytes_recv = obj.bytes_recv;
+            retransmissions = obj.retransmissions;
+            last_timestamp = obj.last_timestamp;
+        }
+    };
+    #pragma pack (pop)
+
+    /** Fixed capacity open addressing table of per process counters.
+     *  Written by the trace thread, read concurrently by anyone: a process
+     *  keeps its slot while it has events, entries never move.
+     *
+     *  Processes idle for the idle period are evicted when a new process
+     *  needs a slot, every idle period, or sooner once the table is 3/4
+     *  full: their counters are folded into other() and the slot becomes a
+     *  tombstone, reused by a later process. A pid is looked for in at most
+     *  max_probe slots from its home, pids that don't fit there go to
+     *  other() too, so the totals over every process stay exact and a miss
+     *  costs the same on a full table.
+     *
+     *  A reader copying a slot while it's evicted may see it zeroed, in that
+     *  one copy. Counters are stored by column (counter_block_t) so rates of
+     *  every process are computed in one vectorized pass, see
+     *  interval_rates(). Slot capacity() holds other(). */
+    class pid_table_t {
+    public:
+        using counter_t = counter_block_t::counter_t;
+
+        static constexpr std::uint32_t empty_pid = std::numeric_limits<std::uint32_t>::max();
+        static constexpr std::uint32_t other_pid = empty_pid - 1;
+        static constexpr std::uint32_t evicted_pid = empty_pid - 2;
+        static constexpr std::size_t   max_probe = 32;
+
+        explicit pid_table_t(std::size_t capacity = 32768) {
+            std::size_t size = 16;
+            while (size < capacity) size <<= 1;
+            _mask     = size - 1;
+            _keys     = std::make_unique<volatile LONG[]>(size + 1);
+            _counters = counter_block_t{ size + 1 };
+            for (std::size_t ii = 0; ii < size; ii++) {
+                _keys[ii] = (LONG)empty_pid;
+            }
+            _keys[size] = (LONG)other_pid;
+        }
+
+        /** Processes without events for @p ticks of event time are evicted. */
+        inline void
+        set_idle_ticks(std::int64_t ticks) noexcept {
+            _idle_ticks = ticks;
+        }
+
+        /** Slot of @p pid, inserting it if needed, capacity() when it doesn't
+         *  fit. @p timestamp is the event time, it drives eviction. Trace
+         *  thread only. */
+        inline std::size_t
+        index_of(std::uint32_t pid, std::int64_t timestamp) noexcept {
+            auto free = capacity();
+            auto index = hash(pid) & _mask;
+            for (std::size_t probe = 0; probe < max_probe; probe++, index = (index + 1) & _mask) {
+                const auto key = (std::uint32_t)_keys[index];
+                if (key == pid) {
+                    return index;
+                }
+                if (key == empty_pid || key == evicted_pid) {
+                    free = free == capacity() ? index : free;
+                    if (key == empty_pid) break;
+                }
+            }
+            if (should_sweep(timestamp)) {
+                sweep(timestamp);
+                free = first_free(pid);
+            }
+            if (free == capacity()) {
+                return capacity();
+            }
+            // evicted slots were zeroed, the counters start from there
+            set(free, counter_t::last_timestamp, timestamp);
+            InterlockedExchange(&_keys[free], (LONG)pid);
+            InterlockedIncrementSizeT(&_size);
+            return free;
+        }
+
+        inline void
+        add(std::size_t index, counter_t counter, std::int64_t value) noexcept {
+            InterlockedAdd64(&_counters.column(counter)[index], value);
+        }
+
+        inline void
+        set(std::size_t index, counter_t counter, std::int64_t value) noexcept {
+            _counters.column(counter)[index] = value;
+        }
+
+        inline std::int64_t
+        get(std::size_t index, counter_t counter) const noexcept {
+            return _counters.column(counter)[index];
+        }
+
+        inline pid_data_t
+        other() const noexcept {
+            return slot(capacity());
+        }
+
+        inline std::size_t
+        capacity() const noexcept {
+            return _mask + 1;
+        }
+
+        inline std::size_t
+        size() const noexcept {
+            return _size;
+        }
+
+        /** Processes evicted since the start. */
+        inline std::size_t
+        evicted() const noexcept {
+            return _evicted;
+        }
+
+        /** Charges the keys and counters to @p account, they never grow.
+         *  Evictions are counted there too. */
+        inline void
+        set_memory_account(memory_account_t* account) noexcept {
+            _account = account;
+            account->charge((capacity() + 1) * (sizeof(LONG) + counter_block_t::n_of_counters * sizeof(std::int64_t)));
+        }
+
+        /** Pid of the slot at @p index, empty_pid or evicted_pid for unused slots. */
+        inline std::uint32_t
+        key(std::size_t index) const noexcept {
+            return (std::uint32_t)_keys[index];
+        }
+
+        /** Whether the slot at @p index holds a process, other() included. */
+        inline bool
+        used(std::size_t index) const noexcept {
+            const auto pid = key(index);
+            return pid != empty_pid && pid != evicted_pid;
+        }
+
+        /** Every counter, capacity() + 1 entities. */
+        inline const counter_block_t&
+        counters() const noexcept {
+            return _counters;
+        }
+
+        /** Copies the slot at @p index, see key() for unused slots. Slot
+         *  indexes are stable while a process has events, so they can be
+         *  used to match samples. */
+        inline pid_data_t
+        slot(std::size_t index) const noexcept {
+            pid_data_t data;
+            data.pid             = key(index);
+            data.connections     = (std::size_t)get(index, counter_t::connections);
+            data.pkg_sent        = (std::size_t)get(index, counter_t::pkg_sent);
+            data.pkg_recv        = (std::size_t)get(index, counter_t::pkg_recv);
+            data.bytes_sent      = get(index, counter_t::bytes_sent);
+            data.bytes_recv      = get(index, counter_t::bytes_recv);
+            data.retransmissions = get(index, counter_t::retransmissions);
+            data.last_timestamp  = get(index, counter_t::last_timestamp);
+            return data;
+        }
+
+        /** Appends every used slot to @p out. */
+        inline void
+        snapshot(std::vector<pid_data_t>& out) const {
+            out.clear();
+            out.reserve(size());
+            for (std::size_t ii = 0; ii <= _mask; ii++) {
+                if (used(ii)) {
+                    const auto data = slot(ii);
+                    out.push_back(data);
+                }
+            }
+        }
+
+    private:
+        static inline std::size_t
+        hash(std::uint32_t pid) noexcept {
+            // windows pids are multiples of 4
+            return (std::size_t)(pid >> 2) * 0x9E3779B1u;
+        }
+
+        /** First unused slot within max_probe of @p pid's home, capacity() if none. */
+        inline std::size_t
+        first_free(std::uint32_t pid) const noexcept {
+            auto index = hash(pid) & _mask;
+            for (std::size_t probe = 0; probe < max_probe; probe++, index = (index + 1) & _mask) {
+                if (!used(index)) {
+                    return index;
+                }
+            }
+            return capacity();
+        }
+
+        inline bool
+        should_sweep(std::int64_t timestamp) const noexcept {
+            const auto since = timestamp - _last_sweep;
+            return since >= _idle_ticks ||
+                   (_size >= capacity() - capacity() / 4 && since >= _idle_ticks / 16);
+        }
+
+        /** Evicts every process idle since @p timestamp - idle ticks. */
+        inline void
+        sweep(std::int64_t timestamp) noexcept {
+            _last_sweep = timestamp;
+            const auto oldest = timestamp - _idle_ticks;
+            for (std::size_t ii = 0; ii <= _mask; ii++) {
+                const auto last = get(ii, counter_t::last_timestamp);
+                if (!used(ii) || last >= oldest) {
+                    continue;
+                }
+                // readers stop matching the pid before its counters go
+                InterlockedExchange(&_keys[ii], (LONG)evicted_pid);
+                for (std::size_t cc = 0; cc < counter_block_t::n_of_counters; cc++) {
+                    const auto counter = (counter_t)cc;
+                    if (counter != counter_t::last_timestamp) {
+                        add(capacity(), counter, get(ii, counter));
+                    }
+                    set(ii, counter, 0);
+                }
+                if (last > get(capacity(), counter_t::last_timestamp)) {
+                    set(capacity(), counter_t::last_timestamp, last);
+                }
+                InterlockedDecrementSizeT(&_size);
+                _evicted++;
+                if (_account) {
+                    _account->count_evicted();
+                }
+            }
+        }
+
+        std::size_t                               _mask{ 0 };
+        std::unique_ptr<volatile LONG[]>          _keys;
+        counter_block_t                           _counters;
+        std::int64_t                              _idle_ticks{ std::numeric_limits<std::int64_t>::max() };
+        std::int64_t                              _last_sweep{ 0 };
+        volatile std::size_t                      _size{ 0 };
+        volatile std::size_t                      _evicted{ 0 };
+        memory_account_t*                         _account{ nullptr };
+    };
+}
@@ -0,0 +1,276 @@
+#pragma once
+
+#pragma comment(lib, "ntdll.lib")
+#include "clock.h"
+#include <winternl.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+/** Layouts returned by NtQuerySystemInformation(SystemProcessInformation).
+ *  winternl.h only documents them as reserved fields. */
+namespace nt {
+
+    struct system_thread_information_t {
+        LARGE_INTEGER   KernelTime;
+        LARGE_INTEGER   UserTime;
+        LARGE_INTEGER   CreateTime;
+        ULONG           WaitTime;
+        PVOID           StartAddress;
+        HANDLE          UniqueProcess;
+        HANDLE          UniqueThread;
+        LONG            Priority;
+        LONG            BasePriority;
+        ULONG           ContextSwitches;
+        ULONG           ThreadState;
+        ULONG           WaitReason;
+    };
+
+    struct system_process_information_t {
+        ULONG           NextEntryOffset;
+        ULONG           NumberOfThreads;
+        LARGE_INTEGER   WorkingSetPrivateSize;
+        ULONG           HardFaultCount;
+        ULONG           NumberOfThreadsHighWatermark;
+        ULONGLONG       CycleTime;
+        LARGE_INTEGER   CreateTime;
+        LARGE_INTEGER   UserTime;
+        LARGE_INTEGER   KernelTime;
+        UNICODE_STRING  ImageName;
+        LONG            BasePriority;
+        HANDLE          UniqueProcessId;
+        HANDLE          InheritedFromUniqueProcessId;
+        ULONG           HandleCount;
+        ULONG           SessionId;
+        ULONG_PTR       UniqueProcessKey;
+        SIZE_T          PeakVirtualSize;
+        SIZE_T          VirtualSize;
+        ULONG           PageFaultCount;
+        SIZE_T          PeakWorkingSetSize;
+        SIZE_T          WorkingSetSize;
+        SIZE_T          QuotaPeakPagedPoolUsage;
+        SIZE_T          QuotaPagedPoolUsage;
+        SIZE_T          QuotaPeakNonPagedPoolUsage;
+        SIZE_T          QuotaNonPagedPoolUsage;
+        SIZE_T          PagefileUsage;
+        SIZE_T          PeakPagefileUsage;
+        SIZE_T          PrivatePageCount;
+        LARGE_INTEGER   ReadOperationCount;
+        LARGE_INTEGER   WriteOperationCount;
+        LARGE_INTEGER   OtherOperationCount;
+        LARGE_INTEGER   ReadTransferCount;
+        LARGE_INTEGER   WriteTransferCount;
+        LARGE_INTEGER   OtherTransferCount;
+        system_thread_information_t Threads[1];
+    };
+
+    constexpr NTSTATUS status_info_length_mismatch = (NTSTATUS)0xC0000004L;
+}
+
+namespace performance {
+    #pragma pack (push, 1)
+    struct process_data_t {
+        std::uint32_t   pid{ 0 };
+        char            name[64]{};
+        std::int64_t    user_time{ 0 };         // 100ns units
+        std::int64_t    kernel_time{ 0 };       // 100ns units
+        std::size_t     working_set{ 0 };       // bytes
+        std::size_t     private_bytes{ 0 };
+        std::size_t     context_switches{ 0 };
+        std::size_t     threads{ 0 };
+        std::size_t     handles{ 0 };
+        std::size_t     page_faults{ 0 };
+        std::size_t     hard_faults{ 0 };
+        std::double_t   interval_ms{ 0 };
+        std::int64_t    last_timestamp{ 0 };
+    };
+    #pragma pack (pop)
+
+    /** Samples cpu, memory, thread and fault counters of a set of processes
+     *  (or all of them). A single NtQuerySystemInformation call returns every
+     *  process, it is read into a buffer kept across samples and parsed in
+     *  place, so a steady state sample doesn't allocate. */
+    class process_monitor_t {
+    public:
+        process_monitor_t() = default;
+        ~process_monitor_t() noexcept {
+            stop();
+        }
+
+        /** Samples every @p interval on a background thread.
+         *  An empty @p pids samples every process. */
+        inline bool
+        start(std::chrono::milliseconds interval, const std::vector<std::uint32_t>& pids = {}) {
+            stop();
+            set_pids(pids);
+            if (!sample()) {
+                return false;
+            }
+            _running = true;
+            _thread  = std::thread([this, interval]() {
+                std::unique_lock<std::mutex> lock{ _thread_mtx };
+                while (!_cv.wait_for(lock, interval, [this]() { return !_running; })) {
+                    (void)sample();
+                }
+            });
+            return true;
+        }
+
+        inline void
+        stop() noexcept {
+            {
+                std::lock_guard<std::mutex> lock{ _thread_mtx };
+                _running = false;
+            }
+            _cv.notify_all();
+            if (_thread.joinable()) {
+                _thread.join();
+            }
+        }
+
+        inline void
+        set_pids(std::vector<std::uint32_t> pids) {
+            std::sort(pids.begin(), pids.end());
+            std::lock_guard<std::mutex> lock{ _pids_mtx };
+            _pids = std::move(pids);
+        }
+
+        /** Takes one sample of all selected processes. Safe while started,
+         *  samples are taken one at a time. */
+        inline bool
+        sample() {
+            std::lock_guard<std::mutex> lock{ _sample_mtx };
+            try {
+                query();
+                parse();
+            }
+            catch (std::exception& err) {
+                std::cerr << "Failed to sample processes: " << err.what();
+                return false;
+            }
+            return true;
+        }
+
+        inline std::optional<process_data_t>
+        process_data(std::uint32_t pid) const {
+            std::lock_guard<std::mutex> lock{ _data_mtx };
+            auto it = std::lower_bound(_front.begin(), _front.end(), pid,
+                                       [](const process_data_t& data, std::uint32_t pid) { return data.pid < pid; });
+            if (it == _front.end() || it->pid != pid) {
+                return std::nullopt;
+            }
+            return *it;
+        }
+
+        /** Calls @p callback with every process of the last sample, sorted by pid. */
+        template <class callback_t>
+        inline void
+        for_each(callback_t&& callback) const {
+            std::lock_guard<std::mutex> lock{ _data_mtx };
+            for (const auto& data : _front) {
+                callback(data);
+            }
+        }
+
+        inline std::size_t
+        size() const {
+            std::lock_guard<std::mutex> lock{ _data_mtx };
+            return _front.size();
+        }
+
+    private:
+
+        inline void
+        query() {
+            if (_buffer.empty()) {
+                _buffer.resize(1024 * 1024);
+            }
+            ULONG    needed{ 0 };
+            NTSTATUS status;
+            while ((status = ::NtQuerySystemInformation(SystemProcessInformation,
+                                                        _buffer.data(),
+                                                        (ULONG)(_buffer.size() * sizeof(_buffer[0])),
+                                                        &needed)) == nt::status_info_length_mismatch) {
+                // processes come and go between calls, keep some slack
+                _buffer.resize((needed + needed / 4) / sizeof(_buffer[0]) + 1);
+            }
+            if (status < 0) {
+                throw std::runtime_error("NtQuerySystemInformation failed: " + std::to_string(status));
+            }
+        }
+
+        inline void
+        parse() {
+            std::lock_guard<std::mutex> pids_lock{ _pids_mtx };
+            const auto now = _clock.now();
+            _back.clear();
+
+            auto* entry = (const std::uint8_t*)_buffer.data();
+            while (true) {
+                const auto& info = *(const nt::system_process_information_t*)entry;
+                const auto  pid  = (std::uint32_t)(ULONG_PTR)info.UniqueProcessId;
+                if (_pids.empty() || std::binary_search(_pids.begin(), _pids.end(), pid)) {
+                    _back.emplace_back();
+                    auto& data          = _back.back();
+                    data.pid            = pid;
+                    data.user_time      = info.UserTime.QuadPart;
+                    data.kernel_time    = info.KernelTime.QuadPart;
+                    data.working_set    = info.WorkingSetSize;
+                    data.private_bytes  = info.PagefileUsage;
+                    data.threads        = info.NumberOfThreads;
+                    data.handles        = info.HandleCount;
+                    data.page_faults    = info.PageFaultCount;
+                    data.hard_faults    = info.HardFaultCount;
+                    data.last_timestamp = now;
+                    for (ULONG ii = 0; ii < info.NumberOfThreads; ii++) {
+                        data.context_switches += info.Threads[ii].ContextSwitches;
+                    }
+                    const auto length = std::min<std::size_t>(info.ImageName.Length / sizeof(wchar_t),
+                                                              sizeof(data.name) - 1);
+                    for (std::size_t ii = 0; ii < length; ii++) {
+                        const auto c = info.ImageName.Buffer[ii];
+                        data.name[ii] = c < 0x80 ? (char)c : '?';
+                    }
+                }
+                if (info.NextEntryOffset == 0) {
+                    break;
+                }
+                entry += info.NextEntryOffset;
+            }
+            std::sort(_back.begin(), _back.end(),
+                      [](const process_data_t& a, const process_data_t& b) { return a.pid < b.pid; });
+
+            std::lock_guard<std::mutex> data_lock{ _data_mtx };
+            const auto interval_ms = _last_sample ? _clock.converter().to_ms(now - _last_sample) : 0.0;
+            for (auto& data : _back) {
+                data.interval_ms = interval_ms;
+            }
+            _last_sample = now;
+            std::swap(_front, _back);
+        }
+
+        // ULONGLONG keeps the entries 8 bytes aligned
+        std::vector<ULONGLONG>                    _buffer;
+        std::vector<process_data_t>               _front;
+        std::vector<process_data_t>               _back;
+        std::vector<std::uint32_t>                _pids;
+        std::int64_t                              _last_sample{ 0 };
+        const tick_clock_t&                       _clock{ tick_clock_t::instance() };
+        std::mutex                                _sample_mtx;    // _buffer and _back
+        mutable std::mutex                        _data_mtx;
+        std::mutex                                _pids_mtx;
+        std::mutex                                _thread_mtx;
+        std::condition_variable                   _cv;
+        bool                                      _running{ false };
+        std::thread                               _thread;
+    };
+}
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace performance {
+
+    /** One writer publishes immutable versions of a T, any number of
+     *  threads read the latest one without locks, epoch based.
+     *
+     *  Every reader thread registers a reader_t, which owns a slot of its
+     *  own cache line. read() stores the current epoch in the slot and
+     *  loads the current version: two atomics, no matter how many readers
+     *  there are, and readers never write anything the others read. The
+     *  view_t it returns pins that version until it goes.
+     *
+     *  publish() swaps in the version filled through prepare() and retires
+     *  the previous one in a new epoch. A retired version is reused by a
+     *  later prepare() once no slot holds an epoch from before it retired,
+     *  contents and all: fill it with clear() and the like and its vectors
+     *  keep their capacity, so steady publishing allocates nothing. A
+     *  reader holding a view for long only makes the writer allocate more
+     *  versions, it never blocks it.
+     *
+     *  prepare() and publish() come from one thread at a time. A reader
+     *  holds one view at a time: a second read() pins the newer version
+     *  only. */
+    template <class T>
+    class published_t {
+        struct version_t {
+            T               value{};
+            std::uint64_t   number{ 0 };
+            std::uint64_t   retired{ 0 };   // epoch
+        };
+
+        struct alignas(64) slot_t {
+            std::atomic<std::uint64_t>  epoch{ idle };
+            std::atomic<bool>           used{ false };
+        };
+
+    public:
+        static constexpr std::size_t max_readers = 64;
+
+        /** The version read, valid while the view lives. Empty before the
+         *  first publish(). */
+        class view_t {
+        public:
+            view_t(view_t&& other) noexcept
+                : _slot{ other._slot }
+                , _version{ other._version } {
+                other._slot = nullptr;
+            }
+            view_t(const view_t&) = delete;
+            view_t& operator = (const view_t&) = delete;
+
+            ~view_t() noexcept {
+                if (_slot) {
+                    _slot->epoch.store(idle, std::memory_order_release);
+                }
+            }
+
+            inline explicit
+            operator bool() const noexcept {
+                return _version != nullptr;
+            }
+
+            inline const T&
+            operator * () const noexcept {
+                return _version->value;
+            }
+
+            inline const T*
+            operator -> () const noexcept {
+                return &_version->value;
+            }
+
+            /** Counts publish() calls, 0 when empty. */
+            inline std::uint64_t
+            version() const noexcept {
+                return _version ? _version->number : 0;
+            }
+
+        private:
+            friend class published_t;
+
+            view_t(slot_t* slot, const version_t* version) noexcept
+                : _slot{ slot }
+                , _version{ version } {}
+
+            slot_t*                 _slot;
+            const version_t*        _version;
+        };
+
+        /** A reader thread's slot, taken for its lifetime, its views go
+         *  first. Throws std::length_error past max_readers. */
+        class reader_t {
+        public:
+            explicit reader_t(published_t& published)
+                : _published{ published }
+                , _slot{ published.acquire() } {}
+            reader_t(const reader_t&) = delete;
+
+            ~reader_t() noexcept {
+                _published.release(_slot);
+            }
+
+            inline view_t
+            read() noexcept {
+                return _published.read(*_slot);
+            }
+
+        private:
+            published_t&            _published;
+            slot_t*                 _slot;
+        };
+
+        published_t() = default;
+        published_t(const published_t&) = delete;
+
+        /** The buffer of the next version, holding what an older version
+         *  held. Throws std::bad_alloc when a new one is needed and there's
+         *  no memory. */
+        inline T&
+        prepare() {
+            if (!_pending) {
+                reclaim();
+                if (!_free.empty()) {
+                    _pending = std::move(_free.back());
+                    _free.pop_back();
+                }
+                else {
+                    _pending = std::make_unique<version_t>();
+                    _allocated++;
+                }
+            }
+            return _pending->value;
+        }
+
+        /** Makes the prepared version the one readers get, returns its number. */
+        inline std::uint64_t
+        publish() {
+            (void)prepare();
+            _retired.reserve(_retired.size() + 1);
+            _pending->number = ++_published;
+            // seq_cst with read(): a reader either sees the new version or
+            // its slot holds an epoch from before the old one retired
+            (void)_current.exchange(_pending.get(), std::memory_order_seq_cst);
+            auto previous = std::move(_owned);
+            _owned = std::move(_pending);
+            if (previous) {
+                previous->retired = _epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+                _retired.push_back(std::move(previous));
+            }
+            return _owned->number;
+        }
+
+        /** Versions ever allocated, the current one included. */
+        inline std::size_t
+        allocated() const noexcept {
+            return _allocated;
+        }
+
+        /** Retired versions still pinned by a reader, as of the last prepare(). */
+        inline std::size_t
+        retired() const noexcept {
+            return _retired.size();
+        }
+
+    private:
+        static constexpr std::uint64_t idle = 0;
+
+        inline view_t
+        read(slot_t& slot) noexcept {
+            slot.epoch.store(_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+            return view_t{ &slot, _current.load(std::memory_order_seq_cst) };
+        }
+
+        /** Moves the versions no reader can still hold to the free list. */
+        inline void
+        reclaim() {
+            auto oldest = std::numeric_limits<std::uint64_t>::max();
+            for (const auto& slot : _slots) {
+                const auto epoch = slot.epoch.load(std::memory_order_seq_cst);
+                if (epoch != idle) {
+                    oldest = std::min(oldest, epoch);
+                }
+            }
+            auto it = std::partition(_retired.begin(), _retired.end(),
+                                     [oldest](const auto& version) { return version->retired > oldest; });
+            _free.reserve(_free.size() + (_retired.end() - it));
+            std::move(it, _retired.end(), std::back_inserter(_free));
+            _retired.erase(it, _retired.end());
+        }
+
+        inline slot_t*
+        acquire() {
+            for (auto& slot : _slots) {
+                bool used{ false };
+                if (slot.used.compare_exchange_strong(used, true, std::memory_order_acq_rel)) {
+                    return &slot;
+                }
+            }
+            throw std::length_error("too many readers");
+        }
+
+        inline void
+        release(slot_t* slot) noexcept {
+            slot->epoch.store(idle, std::memory_order_release);
+            slot->used.store(false, std::memory_order_release);
+        }
+
+        slot_t                                    _slots[max_readers];
+        std::atomic<std::uint64_t>                _epoch{ 1 };
+        std::atomic<const version_t*>             _current{ nullptr };
+        std::unique_ptr<version_t>                _owned;     // the current version
+        std::unique_ptr<version_t>                _pending;
+        std::vector<std::unique_ptr<version_t>>   _retired;
+        std::vector<std::unique_ptr<version_t>>   _free;
+        std::uint64_t                             _published{ 0 };
+        std::size_t                               _allocated{ 0 };
+    };
+}
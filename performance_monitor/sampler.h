@@ -0,0 +1,242 @@
+#pragma once
+
+#include "network_event.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace performance {
+
+    enum class sampling_mode_t : std::uint8_t {
+        none,
+        every_nth,  // deterministic 1 in rate events
+        flow_hash,  // every event of 1 in rate flows
+    };
+
+    /** Rates are powers of two. The rate adapts between rate and max_rate
+     *  when max_rate is larger. */
+    struct sampling_config_t {
+        sampling_mode_t             mode{ sampling_mode_t::none };
+        std::uint32_t               rate{ 1 };
+        std::uint32_t               max_rate{ 1 };
+        std::chrono::nanoseconds    max_lag{ std::chrono::milliseconds{ 100 } };
+        std::chrono::nanoseconds    quiet_lag{ std::chrono::milliseconds{ 10 } };
+        std::size_t                 quiet_samples{ 30 };
+
+        inline bool
+        adaptive() const noexcept {
+            return mode != sampling_mode_t::none && max_rate > rate;
+        }
+    };
+
+    /** "none", "every <rate> [<max rate>]" or "flow <rate> [<max rate>]",
+     *  nullopt when invalid. Rates round up to a power of two. */
+    inline std::optional<sampling_config_t>
+    parse_sampling_config(std::string_view text) {
+        const auto round_up = [](std::uint64_t value) {
+            std::uint32_t rate = 1;
+            while (rate < value && rate < (1u << 30)) rate <<= 1;
+            return rate;
+        };
+        const auto next_word = [&text]() {
+            while (!text.empty() && text.front() == ' ') text.remove_prefix(1);
+            const auto end  = std::min(text.find(' '), text.size());
+            const auto word = text.substr(0, end);
+            text.remove_prefix(end);
+            return word;
+        };
+        sampling_config_t config;
+        const auto mode = next_word();
+        if (mode == "none") {
+            return next_word().empty() ? std::optional{ config } : std::nullopt;
+        }
+        if (mode == "every")     config.mode = sampling_mode_t::every_nth;
+        else if (mode == "flow") config.mode = sampling_mode_t::flow_hash;
+        else                     return std::nullopt;
+        try {
+            const auto rate = next_word();
+            if (rate.empty()) return std::nullopt;
+            config.rate     = round_up(std::stoull(std::string{ rate }));
+            const auto max_rate = next_word();
+            config.max_rate = max_rate.empty() ? config.rate
+                                               : std::max(config.rate, round_up(std::stoull(std::string{ max_rate })));
+        }
+        catch (std::exception&) {
+            return std::nullopt;
+        }
+        return next_word().empty() ? std::optional{ config } : std::nullopt;
+    }
+
+    /** An estimated total and the half width of its 95% confidence interval. */
+    struct estimate_t {
+        double          value{ 0 };
+        double          margin{ 0 };
+
+        inline double low()  const noexcept { return value - margin; }
+        inline double high() const noexcept { return value + margin; }
+    };
+
+    /** Variance of the totals estimated from sampled events.
+     *
+     *  Each kept event counts weight times (Horvitz-Thompson), so totals
+     *  stay unbiased while the rate changes, and adds w (w - 1) x^2 to the
+     *  variance of the total of x. That assumes events are kept
+     *  independently: for flow sampling the bounds are optimistic when a
+     *  few flows carry most of the traffic. Written by the trace thread. */
+    struct sampling_variance_t {
+        enum counter_t : std::size_t {
+            pkg_sent,
+            pkg_recv,
+            bytes_sent,
+            bytes_recv,
+            retransmissions,
+            n_of_counters,
+        };
+
+        volatile double values[n_of_counters]{};
+
+        inline void
+        add_packet(counter_t packets, counter_t bytes, std::uint32_t weight, std::int64_t size) noexcept {
+            if (weight <= 1) return;
+            const double w = (double)weight * (weight - 1);
+            values[packets] = values[packets] + w;
+            values[bytes]   = values[bytes] + w * (double)size * (double)size;
+        }
+
+        inline void
+        add_count(counter_t counter, std::uint32_t weight) noexcept {
+            if (weight <= 1) return;
+            values[counter] = values[counter] + (double)weight * (weight - 1);
+        }
+
+        inline estimate_t
+        estimate(counter_t counter, double value) const noexcept {
+            return { value, 1.96 * std::sqrt((double)values[counter]) };
+        }
+    };
+
+    /** Decides which events are kept and what they weigh. The mode and
+     *  the rate may change at any time, the decision is made on the trace
+     *  thread, which reads only those two. set_config() and adapt() come
+     *  from one thread at a time. */
+    class sampler_t {
+    public:
+        inline void
+        set_config(const sampling_config_t& config) noexcept {
+            _config = config;
+            _quiet  = 0;
+            // a trace thread seeing the new rate sees the new mode too
+            _mode.store(config.mode, std::memory_order_relaxed);
+            _rate.store(config.mode == sampling_mode_t::none ? 1 : config.rate, std::memory_order_release);
+        }
+
+        inline const sampling_config_t&
+        config() const noexcept {
+            return _config;
+        }
+
+        inline std::uint32_t
+        rate() const noexcept {
+            return _rate.load(std::memory_order_acquire);
+        }
+
+        /** Weight of the event whose tcp/udp payload is @p mof, 0 to skip it.
+         *  Every IPv4 payload starts with pid, size, daddr, saddr, dport and
+         *  sport, shorter ones (failures) are always kept. */
+        inline std::uint32_t
+        weight(const void* mof, std::size_t length) noexcept {
+            const auto rate = this->rate();
+            if (rate == 1) {
+                return 1;
+            }
+            if (_mode.load(std::memory_order_relaxed) == sampling_mode_t::every_nth) {
+                return next(rate);
+            }
+            if (length < 20) {
+                return 1;
+            }
+            std::uint32_t addr[2];
+            std::uint16_t port[2];
+            std::memcpy(addr, (const std::uint8_t*)mof + 8, sizeof(addr));
+            std::memcpy(port, (const std::uint8_t*)mof + 16, sizeof(port));
+            return keep_flow(rate, addr[0], addr[1], port[0], port[1]);
+        }
+
+        /** The same decision for an already decoded event, to replay captures. */
+        inline std::uint32_t
+        weight(const network_event_t& e) noexcept {
+            const auto rate = this->rate();
+            if (rate == 1) {
+                return 1;
+            }
+            if (_mode.load(std::memory_order_relaxed) == sampling_mode_t::every_nth) {
+                return next(rate);
+            }
+            if (e.type == EVENT_TRACE_TYPE_CONNFAIL) {
+                return 1;
+            }
+            return keep_flow(rate, e.daddr, e.saddr, e.dport, e.sport);
+        }
+
+        /** One step of the adaptive rate: doubles it while events are lost
+         *  or the consumer lags, halves it after quiet_samples quiet steps.
+         *  Returns the new rate. */
+        inline std::uint32_t
+        adapt(std::size_t new_events_lost, std::chrono::nanoseconds lag) noexcept {
+            auto rate = this->rate();
+            if (!_config.adaptive()) {
+                return rate;
+            }
+            if (new_events_lost > 0 || lag > _config.max_lag) {
+                _quiet = 0;
+                rate   = std::min(rate * 2, _config.max_rate);
+            }
+            else if (lag < _config.quiet_lag && ++_quiet >= _config.quiet_samples) {
+                _quiet = 0;
+                rate   = std::max(rate / 2, _config.rate);
+            }
+            _rate.store(rate, std::memory_order_release);
+            return rate;
+        }
+
+        /** The flow hash, the same for every event of a 4-tuple. */
+        static inline std::uint64_t
+        flow_hash(std::uint32_t daddr, std::uint32_t saddr, std::uint16_t dport, std::uint16_t sport) noexcept {
+            auto h = (((std::uint64_t)daddr << 32) | saddr) ^ ((((std::uint64_t)dport << 16) | sport) * 0x9E3779B97F4A7C15ull);
+            h ^= h >> 33;
+            h *= 0xFF51AFD7ED558CCDull;
+            h ^= h >> 33;
+            return h;
+        }
+
+    private:
+        inline std::uint32_t
+        next(std::uint32_t rate) noexcept {
+            if (++_count < rate) {
+                return 0;
+            }
+            _count = 0;
+            return rate;
+        }
+
+        static inline std::uint32_t
+        keep_flow(std::uint32_t rate, std::uint32_t daddr, std::uint32_t saddr,
+                  std::uint16_t dport, std::uint16_t sport) noexcept {
+            // a flow kept at some rate is kept at every lower one
+            return (flow_hash(daddr, saddr, dport, sport) & (rate - 1)) == 0 ? rate : 0;
+        }
+
+        sampling_config_t                         _config;
+        std::atomic<sampling_mode_t>              _mode{ sampling_mode_t::none };
+        std::atomic<std::uint32_t>                _rate{ 1 };
+        std::uint32_t                             _count{ 0 };
+        std::size_t                               _quiet{ 0 };
+    };
+}
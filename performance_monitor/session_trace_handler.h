@@ -1,17 +1,20 @@
 #pragma once
 
 #pragma comment(lib, "rpcrt4.lib")
-#define NOMINMAX
 #include <windows.h>
 #include <stdio.h>
 #include <conio.h>
 #include <strsafe.h>
 #include <wmistr.h>
 #include <evntrace.h>
+#include "buffer_controller.h"
 
+#include <algorithm>
 #include <filesystem>
 #include <exception>
 #include <iostream>
+#include <mutex>
+#include <optional>
 #include <string>
 
 namespace std {
@@ -30,6 +33,15 @@ namespace performance {
     using trace_handle_t = TRACEHANDLE;
     using event_trace_properties_t = EVENT_TRACE_PROPERTIES;
 
+    struct session_stats_t {
+        std::size_t     events_lost{ 0 };
+        std::size_t     buffers_written{ 0 };
+        std::size_t     log_buffers_lost{ 0 };
+        std::size_t     real_time_buffers_lost{ 0 };
+        std::size_t     number_of_buffers{ 0 };
+        std::size_t     free_buffers{ 0 };
+    };
+
     class session_trace_handler_t {
     public:
 
@@ -43,8 +55,11 @@ namespace performance {
             stop();
         }
 
+        /** start(), stop(), update_buffers() and query() may come from
+         *  different threads, they are serialized. */
         inline bool
         start(const uuid_t& provider_id) {
+            std::lock_guard<std::mutex> lock{ _mtx };
             try {
                 _provider_guid = provider_id;
                 start();
@@ -54,7 +69,7 @@ namespace performance {
             }
             catch (std::exception& err) {
                 std::cerr << err.what();
-                stop();
+                stop_session();
                 return false;
             }
             return true;
@@ -62,39 +77,86 @@ namespace performance {
 
         inline bool
         stop() {
-            bool no_errors{ true };
-            if (_session_handle && _session_handle != INVALID_PROCESSTRACE_HANDLE) {
-                if (_session_enabled) {
-                    auto status = EnableTraceEx2(_session_handle,
-                                                 (LPCGUID)& _provider_guid,
-                                                 EVENT_CONTROL_CODE_DISABLE_PROVIDER,
-                                                 TRACE_LEVEL_INFORMATION,
-                                                 0,
-                                                 0,
-                                                 0,
-                                                 NULL);
-                    if (ERROR_SUCCESS != status) {
-                        std::cerr << "EnableTraceEx2(disable) failed: " << get_last_error_as_string();
-                        no_errors = false;
-                    }
-                }
-                auto status = ControlTrace(_session_handle,
-                                           _session_name.data(),
-                                           event_trace_properties(),
-                                           EVENT_TRACE_CONTROL_STOP);
-                if (ERROR_SUCCESS != status) {
-                    std::cerr << "ControlTrace(stop) failed: " << get_last_error_as_string();
-                    no_errors = false;
-                }
-                status = ::StopTrace(_session_handle, _session_name.data(), event_trace_properties());
-                if (ERROR_SUCCESS != status) {
-                    std::cerr << "Unable to stop trace: " << get_last_error_as_string();
-                    no_errors = false;
-                }
+            std::lock_guard<std::mutex> lock{ _mtx };
+            return stop_session();
+        }
+
+        /** Buffer sizes used by the next start(). */
+        inline void
+        set_config(const session_config_t& config) {
+            _config = config;
+        }
+
+        inline const session_config_t&
+        config() const noexcept {
+            return _config;
+        }
+
+        /** Applies maximum_buffers and flush_timer_s of @p config to the
+         *  running session (ControlTrace UPDATE). The buffer size and the
+         *  minimum number of buffers only change with a new session. */
+        inline bool
+        update_buffers(const session_config_t& config) {
+            std::lock_guard<std::mutex> lock{ _mtx };
+            if (!_session_enabled) return false;
+            const auto session_name_size = _session_name.size() + 1;
+            const auto buffer_size       = sizeof(event_trace_properties_t) + session_name_size;
+            auto buffer = std::make_unique<byte[]>(buffer_size);
+            memset(buffer.get(), 0, buffer_size);
+            auto& props               = *(event_trace_properties_t*)buffer.get();
+            props.Wnode.BufferSize    = (uint32_t)buffer_size;
+            props.Wnode.Guid          = _session_guid;
+            props.LoggerNameOffset    = (uint32_t)sizeof(EVENT_TRACE_PROPERTIES);
+            props.LogFileNameOffset   = 0;  // keep the current one
+            props.MaximumBuffers      = config.maximum_buffers;
+            props.FlushTimer          = config.flush_timer_s;
+            // kernel sessions clear the flags that aren't given again
+            props.EnableFlags         = EVENT_TRACE_FLAG_NETWORK_TCPIP;
+            auto status = ControlTrace(_session_handle,
+                                       _session_name.data(),
+                                       &props,
+                                       EVENT_TRACE_CONTROL_UPDATE);
+            if (ERROR_SUCCESS != status) {
+                std::cerr << "ControlTrace(update) failed: " << get_last_error_as_string();
+                return false;
             }
-            _session_handle         = INVALID_PROCESSTRACE_HANDLE;
-            _event_trace_properties = nullptr;
-            return no_errors;
+            _config.maximum_buffers = config.maximum_buffers;
+            _config.flush_timer_s   = config.flush_timer_s;
+            return true;
+        }
+
+        /** Loss and buffer counters kept by ETW for the whole session. */
+        inline std::optional<session_stats_t>
+        query() const {
+            std::lock_guard<std::mutex> lock{ _mtx };
+            if (!_session_enabled) {
+                return std::nullopt;
+            }
+            // ControlTrace writes the names back, leave room for them
+            const auto session_name_size = _session_name.size() + 1;
+            const auto log_name_size     = _log_trace_file_path.string().size() + 1;
+            const auto buffer_size       = sizeof(event_trace_properties_t) + session_name_size + log_name_size;
+            auto buffer = std::make_unique<byte[]>(buffer_size);
+            memset(buffer.get(), 0, buffer_size);
+            auto& props             = *(event_trace_properties_t*)buffer.get();
+            props.Wnode.BufferSize  = (uint32_t)buffer_size;
+            props.LoggerNameOffset  = (uint32_t)sizeof(EVENT_TRACE_PROPERTIES);
+            props.LogFileNameOffset = (uint32_t)(sizeof(EVENT_TRACE_PROPERTIES) + session_name_size);
+            auto status = ControlTrace(_session_handle,
+                                       _session_name.data(),
+                                       &props,
+                                       EVENT_TRACE_CONTROL_QUERY);
+            if (ERROR_SUCCESS != status) {
+                return std::nullopt;
+            }
+            session_stats_t stats;
+            stats.events_lost            = props.EventsLost;
+            stats.buffers_written        = props.BuffersWritten;
+            stats.log_buffers_lost       = props.LogBuffersLost;
+            stats.real_time_buffers_lost = props.RealTimeBuffersLost;
+            stats.number_of_buffers      = props.NumberOfBuffers;
+            stats.free_buffers           = props.FreeBuffers;
+            return stats;
         }
 
         inline trace_handle_t
@@ -102,11 +164,6 @@ namespace performance {
             return _session_handle;
         }
 
-        inline event_trace_properties_t*
-        event_trace_properties() const noexcept {
-            return (event_trace_properties_t*)(_event_trace_properties.get());
-        }
-
         inline void
         set_session_name(const std::string_view session_name) {
             if (_session_enabled) return;
@@ -174,6 +231,48 @@ namespace performance {
 
     private:
 
+        inline event_trace_properties_t*
+        event_trace_properties() const noexcept {
+            return (event_trace_properties_t*)(_event_trace_properties.get());
+        }
+
+        inline bool
+        stop_session() {
+            bool no_errors{ true };
+            if (_session_handle && _session_handle != INVALID_PROCESSTRACE_HANDLE) {
+                if (_session_enabled) {
+                    auto status = EnableTraceEx2(_session_handle,
+                                                 (LPCGUID)& _provider_guid,
+                                                 EVENT_CONTROL_CODE_DISABLE_PROVIDER,
+                                                 TRACE_LEVEL_INFORMATION,
+                                                 0,
+                                                 0,
+                                                 0,
+                                                 NULL);
+                    if (ERROR_SUCCESS != status) {
+                        std::cerr << "EnableTraceEx2(disable) failed: " << get_last_error_as_string();
+                        no_errors = false;
+                    }
+                }
+                auto status = ControlTrace(_session_handle,
+                                           _session_name.data(),
+                                           event_trace_properties(),
+                                           EVENT_TRACE_CONTROL_STOP);
+                if (ERROR_SUCCESS != status) {
+                    std::cerr << "ControlTrace(stop) failed: " << get_last_error_as_string();
+                    no_errors = false;
+                }
+                status = ::StopTrace(_session_handle, _session_name.data(), event_trace_properties());
+                if (ERROR_SUCCESS != status) {
+                    std::cerr << "Unable to stop trace: " << get_last_error_as_string();
+                    no_errors = false;
+                }
+            }
+            _session_handle         = INVALID_PROCESSTRACE_HANDLE;
+            _event_trace_properties = nullptr;
+            _session_enabled        = false;
+            return no_errors;
+        }
 
         inline void
         start() {
@@ -202,10 +301,13 @@ namespace performance {
             session_props.Wnode.ClientContext = 1; //QPC clock resolution
             session_props.Wnode.Guid          = _session_guid;
             session_props.LogFileMode         = EVENT_TRACE_REAL_TIME_MODE;
-            session_props.MaximumFileSize     = 1;  // 1 MB
+            session_props.BufferSize          = _config.buffer_size_kb;
+            session_props.MinimumBuffers      = _config.minimum_buffers;
+            session_props.MaximumBuffers      = std::max(_config.maximum_buffers, _config.minimum_buffers);
+            session_props.FlushTimer          = _config.flush_timer_s;
             session_props.LoggerNameOffset    = (uint32_t)sizeof(EVENT_TRACE_PROPERTIES);
             session_props.LogFileNameOffset   = (uint32_t)sizeof(EVENT_TRACE_PROPERTIES) + (uint32_t)session_name_size;
-            session_props.EnableFlags         = EVENT_TRACE_FLAG_NETWORK_TCPIP | EVENT_TRACE_FLAG_DISK_FILE_IO | EVENT_TRACE_FLAG_DISK_IO;
+            session_props.EnableFlags         = EVENT_TRACE_FLAG_NETWORK_TCPIP;
             StringCbCopyA(
                 (STRSAFE_LPSTR)((char*)_event_trace_properties.get() + session_props.LogFileNameOffset),
                 log_name_size,
@@ -215,20 +317,51 @@ namespace performance {
             auto status = StartTrace((PTRACEHANDLE)& _session_handle,
                                      _session_name.data(),
                                      event_trace_properties());
+            if (ERROR_ALREADY_EXISTS == status) {
+                // left behind by a process that didn't stop it, take it over
+                stop_stale_session(buffer_size);
+                status = StartTrace((PTRACEHANDLE)& _session_handle,
+                                    _session_name.data(),
+                                    event_trace_properties());
+            }
             if (ERROR_SUCCESS != status) {
                 throw std::runtime_error("Unable to start trace: " + get_last_error_as_string());
             }
-            status = EnableTraceEx2(_session_handle,
-                                    (LPGUID)&_provider_guid,
-                                    EVENT_CONTROL_CODE_ENABLE_PROVIDER,
-                                    TRACE_LEVEL_INFORMATION,
-                                    0, 0, 0, NULL);
+            enable_provider();
+            _session_enabled = true;
+        }
+
+        /** Stops another session with our name. @p buffer_size bytes are
+         *  enough for the properties ControlTrace writes back. */
+        inline void
+        stop_stale_session(std::size_t buffer_size) {
+            auto buffer = std::make_unique<byte[]>(buffer_size);
+            memset(buffer.get(), 0, buffer_size);
+            auto& props            = *(event_trace_properties_t*)buffer.get();
+            props.Wnode.BufferSize = (uint32_t)buffer_size;
+            props.LoggerNameOffset = (uint32_t)sizeof(EVENT_TRACE_PROPERTIES);
+            auto status = ControlTrace(0, _session_name.data(), &props, EVENT_TRACE_CONTROL_STOP);
+            if (ERROR_SUCCESS != status) {
+                std::cerr << "Failed to stop stale session " << _session_name << ": " << get_last_error_as_string();
+            }
+        }
+
+        /** The events come from the kernel flags of the session, which
+         *  take no scope filters: every process reaches the consumer and
+         *  event_callback filters by pid. */
+        inline void
+        enable_provider() {
+            auto status = EnableTraceEx2(_session_handle,
+                                         (LPGUID)&_provider_guid,
+                                         EVENT_CONTROL_CODE_ENABLE_PROVIDER,
+                                         TRACE_LEVEL_INFORMATION,
+                                         0, 0, 0, NULL);
             if (ERROR_SUCCESS != status) {
                 throw std::runtime_error("Unable to enable trace: " + get_last_error_as_string());
             }
-            _session_enabled = true;
         }
 
+        session_config_t                             _config;
         bool                                         _session_enabled{ false };
         trace_handle_t                               _session_handle{ INVALID_PROCESSTRACE_HANDLE };
         std::unique_ptr<byte[]>                      _event_trace_properties{nullptr};
@@ -236,6 +369,7 @@ namespace performance {
         uuid_t                                       _provider_guid{ create_guid() };
         std::filesystem::path                        _log_trace_file_path;
         std::string                                  _session_name;
+        mutable std::mutex                           _mtx;
     };
 }
 
@@ -0,0 +1,337 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace performance {
+
+    /** Single thread that runs continuations and timers for the async API,
+     *  so consumer code never runs on the trace thread. */
+    class async_executor_t {
+    public:
+        using clock_t = std::chrono::steady_clock;
+        using task_t  = std::function<void()>;
+
+        async_executor_t() {
+            _thread = std::thread([this]() { run(); });
+        }
+
+        ~async_executor_t() noexcept {
+            stop();
+        }
+
+        /** Runs the tasks still queued right away, timers included, and
+         *  joins the thread, so no async_result_t is left pending. While it
+         *  runs them only posts due now are taken, later ones are ignored:
+         *  tasks that schedule themselves again end. */
+        inline void
+        stop() noexcept {
+            const bool own_thread = _thread.get_id() == std::this_thread::get_id();
+            {
+                std::lock_guard<std::mutex> lock{ _mtx };
+                _running = false;
+                if (own_thread) {
+                    // nobody would run them
+                    _tasks = {};
+                }
+            }
+            _cv.notify_all();
+            if (own_thread) {
+                // last owner released from one of our own tasks
+                _thread.detach();
+            }
+            else if (_thread.joinable()) {
+                _thread.join();
+            }
+        }
+
+        /** False when the executor stopped and @p task won't run. */
+        inline bool
+        post(task_t task) {
+            return post_at(clock_t::now(), std::move(task));
+        }
+
+        inline bool
+        post_at(clock_t::time_point deadline, task_t task) {
+            {
+                std::lock_guard<std::mutex> lock{ _mtx };
+                if (_exited || (!_running && deadline > clock_t::now())) return false;
+                _tasks.push(timed_task_t{ deadline, _sequence++, std::move(task) });
+            }
+            _cv.notify_one();
+            return true;
+        }
+
+    private:
+        struct timed_task_t {
+            clock_t::time_point deadline;
+            std::uint64_t       sequence;
+            task_t              task;
+
+            bool operator > (const timed_task_t& other) const noexcept {
+                return deadline != other.deadline ? deadline > other.deadline
+                                                  : sequence > other.sequence;
+            }
+        };
+
+        inline void
+        run() {
+            std::unique_lock<std::mutex> lock{ _mtx };
+            while (_running || !_tasks.empty()) {
+                if (_tasks.empty()) {
+                    _cv.wait(lock);
+                    continue;
+                }
+                if (_running && _tasks.top().deadline > clock_t::now()) {
+                    _cv.wait_until(lock, _tasks.top().deadline);
+                    continue;
+                }
+                auto task = std::move(const_cast<timed_task_t&>(_tasks.top()).task);
+                _tasks.pop();
+                lock.unlock();
+                try {
+                    task();
+                }
+                catch (std::exception& err) {
+                    std::cerr << "Async task failed: " << err.what();
+                }
+                lock.lock();
+            }
+            _exited = true;
+        }
+
+        std::mutex                                  _mtx;
+        std::condition_variable                     _cv;
+        std::priority_queue<timed_task_t,
+                            std::vector<timed_task_t>,
+                            std::greater<timed_task_t>> _tasks;
+        std::uint64_t                               _sequence{ 0 };
+        bool                                        _running{ true };
+        bool                                        _exited{ false };
+        std::thread                                 _thread;
+    };
+
+    /** Result of an async operation. Can be waited with get() or chained
+     *  with then(), any number of times. Continuations run on the executor
+     *  that completes the result, or right away on the completing thread
+     *  once that executor stopped. */
+    template <class T>
+    class async_result_t {
+        struct state_t {
+            std::mutex                          mtx;
+            std::condition_variable             cv;
+            std::optional<T>                    value;
+            std::vector<std::function<void()>>  continuations;
+            std::shared_ptr<async_executor_t>   executor;
+        };
+    public:
+        async_result_t() : _state{ std::make_shared<state_t>() } {}
+
+        inline bool
+        ready() const {
+            std::lock_guard<std::mutex> lock{ _state->mtx };
+            return _state->value.has_value();
+        }
+
+        inline T
+        get() const {
+            std::unique_lock<std::mutex> lock{ _state->mtx };
+            _state->cv.wait(lock, [this]() { return _state->value.has_value(); });
+            return *_state->value;
+        }
+
+        inline void
+        then(std::function<void(const T&)> callback) const {
+            auto state = _state;
+            on_ready([state, callback]() { callback(*state->value); });
+        }
+
+        inline void
+        set_value(T value, const std::shared_ptr<async_executor_t>& executor) const {
+            std::vector<std::function<void()>> continuations;
+            {
+                std::lock_guard<std::mutex> lock{ _state->mtx };
+                _state->value    = std::move(value);
+                _state->executor = executor;
+                continuations.swap(_state->continuations);
+            }
+            _state->cv.notify_all();
+            for (auto& continuation : continuations) {
+                run(executor, std::move(continuation));
+            }
+        }
+
+    private:
+        inline void
+        on_ready(std::function<void()> continuation) const {
+            std::shared_ptr<async_executor_t> executor;
+            {
+                std::lock_guard<std::mutex> lock{ _state->mtx };
+                if (!_state->value.has_value()) {
+                    _state->continuations.push_back(std::move(continuation));
+                    return;
+                }
+                executor = _state->executor;
+            }
+            run(executor, std::move(continuation));
+        }
+
+        static inline void
+        run(const std::shared_ptr<async_executor_t>& executor, std::function<void()> continuation) {
+            if (!executor->post(continuation)) {
+                continuation();
+            }
+        }
+
+        std::shared_ptr<state_t> _state;
+    };
+
+    /** Bounded per-consumer queue fed by the trace thread.
+     *  push() never blocks: when the consumer falls behind the oldest items
+     *  are overwritten and counted in dropped(). */
+    template <class T>
+    class subscription_t : public std::enable_shared_from_this<subscription_t<T>> {
+    public:
+        using batch_t = std::vector<T>;
+
+        subscription_t(std::shared_ptr<async_executor_t> executor, std::size_t capacity)
+            : _executor{ executor }
+            , _ring(std::max<std::size_t>(capacity, 1)) {}
+
+        /** Called from the trace thread only. */
+        inline void
+        push(const T& item) {
+            bool wake_up{ false };
+            {
+                std::lock_guard<std::mutex> lock{ _mtx };
+                if (_closed) return;
+                if (_size == _ring.size()) {
+                    _head = (_head + 1) % _ring.size();
+                    _size--;
+                    _dropped++;
+                }
+                _ring[(_head + _size) % _ring.size()] = item;
+                _size++;
+                wake_up  = _waiting;
+                _waiting = false;
+            }
+            if (wake_up) {
+                post_complete_pending();
+            }
+            _cv.notify_one();
+        }
+
+        /** Blocking pull of up to @p max items. Returns false on timeout or
+         *  when the subscription was closed with nothing left to read. */
+        inline bool
+        pop_batch(batch_t& out, std::size_t max, std::chrono::milliseconds timeout) {
+            std::unique_lock<std::mutex> lock{ _mtx };
+            if (!_cv.wait_for(lock, timeout, [this]() { return _size > 0 || _closed; })) {
+                return false;
+            }
+            return take(out, max) > 0;
+        }
+
+        /** Completes with the next non empty batch (or an empty one once closed). */
+        inline async_result_t<batch_t>
+        next_batch(std::size_t max = 1024) {
+            async_result_t<batch_t> result;
+            batch_t                 batch;
+            {
+                std::lock_guard<std::mutex> lock{ _mtx };
+                if (_size == 0 && !_closed) {
+                    _pending.push_back({ result, max });
+                    _waiting = true;
+                    return result;
+                }
+                take(batch, max);
+            }
+            result.set_value(std::move(batch), _executor);
+            return result;
+        }
+
+        /** Completes every pending next_batch() with what is left, right
+         *  away rather than on the executor, which may be stopping. */
+        inline void
+        close() {
+            {
+                std::lock_guard<std::mutex> lock{ _mtx };
+                _closed = true;
+            }
+            _cv.notify_all();
+            complete_pending();
+        }
+
+        inline std::size_t
+        dropped() const {
+            std::lock_guard<std::mutex> lock{ _mtx };
+            return _dropped;
+        }
+
+    private:
+        struct pending_t {
+            async_result_t<batch_t> result;
+            std::size_t             max;
+        };
+
+        inline std::size_t
+        take(batch_t& out, std::size_t max) {
+            const auto count = std::min(max, _size);
+            out.clear();
+            out.reserve(count);
+            for (std::size_t ii = 0; ii < count; ii++) {
+                out.push_back(_ring[_head]);
+                _head = (_head + 1) % _ring.size();
+            }
+            _size -= count;
+            return count;
+        }
+
+        inline void
+        post_complete_pending() {
+            _executor->post([weak = this->weak_from_this()]() {
+                if (auto self = weak.lock()) {
+                    self->complete_pending();
+                }
+            });
+        }
+
+        inline void
+        complete_pending() {
+            std::vector<std::pair<async_result_t<batch_t>, batch_t>> ready;
+            {
+                std::lock_guard<std::mutex> lock{ _mtx };
+                while (!_pending.empty() && (_size > 0 || _closed)) {
+                    batch_t batch;
+                    take(batch, _pending.front().max);
+                    ready.emplace_back(_pending.front().result, std::move(batch));
+                    _pending.erase(_pending.begin());
+                }
+                _waiting = !_pending.empty();
+            }
+            for (auto& [result, batch] : ready) {
+                result.set_value(std::move(batch), _executor);
+            }
+        }
+
+        std::shared_ptr<async_executor_t> _executor;
+        mutable std::mutex              _mtx;
+        std::condition_variable         _cv;
+        std::vector<T>                  _ring;
+        std::size_t                     _head{ 0 };
+        std::size_t                     _size{ 0 };
+        std::size_t                     _dropped{ 0 };
+        bool                            _waiting{ false };
+        bool                            _closed{ false };
+        std::vector<pending_t>          _pending;
+    };
+}
@@ -53,11 +53,11 @@ namespace mof {
             std::uint16_t sackopt;
             std::uint16_t tsopt;
             std::uint16_t wsopt;
-            std::uint16_t rcvwin;
+            std::uint32_t rcvwin;
             std::int16_t  rcvwinscale;
             std::int16_t  sndwinscale;
             std::uint32_t seqnum;
-            std::uint16_t connid;
+            std::uint32_t connid;
         };
 
         struct TcpIp_SendIPV4 {
@@ -0,0 +1,288 @@
+#pragma once
+
+#include "memory_budget.h"
+
+#include <windows.h>
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+namespace performance {
+
+    #pragma pack (push, 1)
+    struct thread_data_t {
+        std::uint32_t   pid{ 0 };
+        std::uint32_t   tid{ 0 };
+        std::size_t     pkg_sent{ 0 };
+        std::size_t     pkg_recv{ 0 };
+        std::int64_t    bytes_sent{ 0 };
+        std::int64_t    bytes_recv{ 0 };
+        std::int64_t    retransmissions{ 0 };
+        std::int64_t    last_timestamp{ 0 };
+
+        thread_data_t() = default;
+        thread_data_t(const volatile thread_data_t& obj) {
+            pid = obj.pid;
+            tid = obj.tid;
+            pkg_sent = obj.pkg_sent;
+            pkg_recv = obj.pkg_recv;
+            bytes_sent = obj.bytes_sent;
+            bytes_recv = obj.bytes_recv;
+            retransmissions = obj.retransmissions;
+            last_timestamp = obj.last_timestamp;
+        }
+    };
+    #pragma pack (pop)
+
+    /** Fixed capacity open addressing table of per (pid, tid) counters.
+     *
+     *  Unlike pid_table_t, threads come and go by the thousands, so idle
+     *  entries are evicted: every idle period, or sooner once the table is
+     *  3/4 full, the writer sweeps out threads without events for that
+     *  long. Deleting shifts the following entries of the probe chain back,
+     *  so chains stay short without tombstones. Evicted threads, and the
+     *  ones that don't fit after a sweep, are folded into other(), so the
+     *  totals over every thread stay exact.
+     *
+     *  Written by the trace thread only. Readers copy slots under a per
+     *  slot sequence number, odd while the writer moves or frees it. */
+    class thread_table_t {
+    public:
+        static constexpr std::uint64_t empty_key = std::numeric_limits<std::uint64_t>::max();
+        static constexpr std::uint32_t other_pid = std::numeric_limits<std::uint32_t>::max() - 1;
+
+        explicit thread_table_t(std::size_t capacity = 16384) {
+            std::size_t size = 16;
+            _bits = 4;
+            while (size < capacity) {
+                size <<= 1;
+                _bits++;
+            }
+            _mask  = size - 1;
+            _slots = std::make_unique<slot_t[]>(size);
+            _other.data.pid = other_pid;
+        }
+
+        /** Threads idle for @p ticks of event time are evicted. */
+        inline void
+        set_idle_ticks(std::int64_t ticks) noexcept {
+            _idle_ticks = ticks;
+        }
+
+        /** Counters of @p pid / @p tid, inserting them if needed. @p timestamp
+         *  is the event time, it drives eviction. Trace thread only. */
+        inline volatile thread_data_t&
+        at(std::uint32_t pid, std::uint32_t tid, std::int64_t timestamp) noexcept {
+            const auto key = make_key(pid, tid);
+            auto index = home(key);
+            for (;; index = (index + 1) & _mask) {
+                auto& slot = _slots[index];
+                if (slot.key == key) {
+                    return slot.data;
+                }
+                if (slot.key == empty_key) {
+                    break;
+                }
+            }
+            if (should_sweep(timestamp)) {
+                sweep(timestamp);
+                // entries moved, find the chain's end again
+                index = home(key);
+                while (_slots[index].key != empty_key) {
+                    index = (index + 1) & _mask;
+                }
+            }
+            if (_size >= capacity() - capacity() / 8) {
+                return _other.data;
+            }
+            auto& slot = _slots[index];
+            slot.seq.fetch_add(1, std::memory_order_acq_rel);
+            thread_data_t data;
+            data.pid            = pid;
+            data.tid            = tid;
+            data.last_timestamp = timestamp;
+            slot.key = key;
+            store(slot.data, data);
+            slot.seq.fetch_add(1, std::memory_order_release);
+            _size++;
+            return slot.data;
+        }
+
+        inline thread_data_t
+        other() const noexcept {
+            return _other.data;
+        }
+
+        inline std::size_t
+        capacity() const noexcept {
+            return _mask + 1;
+        }
+
+        /** Charges the slot array to @p account, evictions are counted there too. */
+        inline void
+        set_memory_account(memory_account_t* account) noexcept {
+            _account = account;
+            _account->charge(capacity() * sizeof(slot_t));
+        }
+
+        inline std::size_t
+        size() const noexcept {
+            return _size;
+        }
+
+        /** Threads evicted since the start. */
+        inline std::size_t
+        evicted() const noexcept {
+            return _evicted;
+        }
+
+        /** Copies the threads of @p pid, or of every process by default,
+         *  to @p out. A thread being moved by a sweep may be missed or seen
+         *  twice, only in that one snapshot. */
+        inline void
+        snapshot(std::vector<thread_data_t>& out,
+                 std::uint32_t pid = std::numeric_limits<std::uint32_t>::max()) const {
+            out.clear();
+            for (std::size_t ii = 0; ii <= _mask; ii++) {
+                const auto& slot = _slots[ii];
+                for (int attempt = 0; attempt < 4; attempt++) {
+                    const auto before = slot.seq.load(std::memory_order_acquire);
+                    if (before & 1) {
+                        continue;
+                    }
+                    const auto key = slot.key;
+                    if (key == empty_key) {
+                        break;
+                    }
+                    thread_data_t data = slot.data;
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (slot.seq.load(std::memory_order_relaxed) != before) {
+                        continue;
+                    }
+                    if (pid == std::numeric_limits<std::uint32_t>::max() || data.pid == pid) {
+                        out.push_back(data);
+                    }
+                    break;
+                }
+            }
+        }
+
+    private:
+        struct slot_t {
+            std::atomic<std::uint32_t> seq{ 0 };
+            volatile std::uint64_t     key{ empty_key };
+            volatile thread_data_t     data;
+        };
+
+        static inline std::uint64_t
+        make_key(std::uint32_t pid, std::uint32_t tid) noexcept {
+            return ((std::uint64_t)pid << 32) | tid;
+        }
+
+        inline std::size_t
+        home(std::uint64_t key) const noexcept {
+            // pids and tids are multiples of 4, the high bits mix them all
+            return (std::size_t)((key * 0x9E3779B97F4A7C15ull) >> (64 - _bits));
+        }
+
+        inline bool
+        should_sweep(std::int64_t timestamp) const noexcept {
+            const auto since = timestamp - _last_sweep;
+            return since >= _idle_ticks ||
+                   (_size >= capacity() - capacity() / 4 && since >= _idle_ticks / 16);
+        }
+
+        /** Evicts every thread idle since @p timestamp - idle ticks. */
+        inline void
+        sweep(std::int64_t timestamp) noexcept {
+            _last_sweep = timestamp;
+            const auto oldest = timestamp - _idle_ticks;
+            // start after an empty slot so no chain wraps around the start
+            std::size_t start = 0;
+            while (_slots[start].key != empty_key) {
+                start++;
+            }
+            for (std::size_t step = 1; step <= _mask; step++) {
+                const auto index = (start + step) & _mask;
+                // a deleted entry is replaced by a later one of its chain, check it again
+                while (_slots[index].key != empty_key && _slots[index].data.last_timestamp < oldest) {
+                    fold(_slots[index].data);
+                    erase(index);
+                    _evicted++;
+                    if (_account) {
+                        _account->count_evicted();
+                    }
+                }
+            }
+        }
+
+        inline void
+        fold(const volatile thread_data_t& data) noexcept {
+            auto& other = _other.data;
+            other.pkg_sent        += data.pkg_sent;
+            other.pkg_recv        += data.pkg_recv;
+            other.bytes_sent      += data.bytes_sent;
+            other.bytes_recv      += data.bytes_recv;
+            other.retransmissions += data.retransmissions;
+            if (data.last_timestamp > other.last_timestamp) {
+                other.last_timestamp = data.last_timestamp;
+            }
+        }
+
+        /** Backward shift deletion of the entry at @p index. */
+        inline void
+        erase(std::size_t index) noexcept {
+            auto hole = index;
+            for (auto next = (hole + 1) & _mask; _slots[next].key != empty_key; next = (next + 1) & _mask) {
+                const auto wanted = home(_slots[next].key);
+                // entries whose home lies in (hole, next] must stay
+                const bool stays = hole <= next ? (hole < wanted && wanted <= next)
+                                                : (hole < wanted || wanted <= next);
+                if (stays) {
+                    continue;
+                }
+                move(next, hole);
+                hole = next;
+            }
+            auto& slot = _slots[hole];
+            slot.seq.fetch_add(1, std::memory_order_acq_rel);
+            slot.key = empty_key;
+            slot.seq.fetch_add(1, std::memory_order_release);
+            _size--;
+        }
+
+        inline void
+        move(std::size_t from, std::size_t to) noexcept {
+            auto& target = _slots[to];
+            target.seq.fetch_add(1, std::memory_order_acq_rel);
+            target.key = _slots[from].key;
+            store(target.data, thread_data_t{ _slots[from].data });
+            target.seq.fetch_add(1, std::memory_order_release);
+        }
+
+        static inline void
+        store(volatile thread_data_t& to, const thread_data_t& from) noexcept {
+            to.pid = from.pid;
+            to.tid = from.tid;
+            to.pkg_sent = from.pkg_sent;
+            to.pkg_recv = from.pkg_recv;
+            to.bytes_sent = from.bytes_sent;
+            to.bytes_recv = from.bytes_recv;
+            to.retransmissions = from.retransmissions;
+            to.last_timestamp = from.last_timestamp;
+        }
+
+        std::size_t                               _mask{ 0 };
+        std::size_t                               _bits{ 0 };
+        std::unique_ptr<slot_t[]>                 _slots;
+        slot_t                                    _other;
+        std::int64_t                              _idle_ticks{ std::numeric_limits<std::int64_t>::max() };
+        std::int64_t                              _last_sweep{ 0 };
+        volatile std::size_t                      _size{ 0 };
+        volatile std::size_t                      _evicted{ 0 };
+        memory_account_t*                         _account{ nullptr };
+    };
+}
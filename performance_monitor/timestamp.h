@@ -1,61 +1,50 @@
 #pragma once
 
-#include <Windows.h>
+#include "clock.h"
 namespace performance {
+    /** Stopwatch over tick_clock_t. Reading it costs one clock read and a
+     *  multiply, the frequency is inverted once. */
     class timestamp_t {
-        LARGE_INTEGER StartingTime;
-        LARGE_INTEGER FrequencyLI;
-        double Frequency;
-        mutable LARGE_INTEGER EndingTime;
+        const tick_clock_t* Clock;
+        double SecondsPerTick;
+        int64_t StartingTime{ 0 };
 
     public:
-        timestamp_t() {
-            (void)QueryPerformanceFrequency(&FrequencyLI);
-            Frequency = (double)FrequencyLI.QuadPart;
+        timestamp_t()
+            : Clock{ &tick_clock_t::instance() }
+            , SecondsPerTick{ 1.0 / Clock->frequency() } {
             now();
         }
 
         inline uint64_t
         frequency() const noexcept {
-            return FrequencyLI.QuadPart;
+            return Clock->frequency();
+        }
+
+        inline int64_t
+        ticks() const noexcept {
+            return Clock->now();
         }
 
         inline void
         now() noexcept {
-            (void)QueryPerformanceCounter(&StartingTime);
+            StartingTime = Clock->now();
         }
 
         inline double
         sec() const noexcept {
-            (void)QueryPerformanceCounter(&EndingTime);
-            return (EndingTime.QuadPart - StartingTime.QuadPart) / Frequency;
+            return (Clock->now() - StartingTime) * SecondsPerTick;
         }
 
         inline double
         ms() const noexcept {
-            (void)QueryPerformanceCounter(&EndingTime);
-            return (EndingTime.QuadPart - StartingTime.QuadPart) * 1E3 / Frequency;
+            return (Clock->now() - StartingTime) * SecondsPerTick * 1E3;
         }
 
         inline double
         us() const noexcept {
-            (void)QueryPerformanceCounter(&EndingTime);
-            return (EndingTime.QuadPart - StartingTime.QuadPart) * 1E6 / Frequency;
+            return (Clock->now() - StartingTime) * SecondsPerTick * 1E6;
         }
-
-        // Activity to be timed
-
-
-
-        //
-        // We now have the elapsed number of ticks, along with the
-        // number of ticks-per-second. We use these values
-        // to convert to the number of elapsed microseconds.
-        // To guard against loss-of-precision, we convert
-        // to microseconds *before* dividing by ticks-per-second.
-        //
-
     };
 
 }
-
@@ -0,0 +1,282 @@
+#pragma once
+
+#if defined(_M_X64)
+#include <intrin.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace performance {
+
+    /** Timers on event time, in a hierarchical timing wheel: levels of 64
+     *  buckets, each 8 times coarser than the one below. A timer goes to
+     *  the finest level that reaches its deadline, rounded up to that
+     *  level's granularity, and fires from there: it never fires early and
+     *  at most about an eighth of its delay late. Timers never move between
+     *  levels, so schedule(), cancel() and firing are O(1) and a timer
+     *  costs nothing until it's due; advance() jumps over empty buckets
+     *  and handles at most its limit, so many timers due at once are
+     *  spread over several calls.
+     *
+     *  Time is in event ticks, counted in units of the resolution rounded
+     *  down to a power of two. Deadlines past when scheduled fire with the
+     *  next unit, deadlines further than horizon units wait in the top
+     *  level and are placed again when it turns.
+     *
+     *  A timer is a 16 byte node holding a value of the owner, typically
+     *  the index of its entry. For idle expiry don't reschedule on every
+     *  event: keep the entry's last activity and, when its timer fires,
+     *  return its new deadline from the callback if it was active since.
+     *  Call advance() before the first schedule(). Not thread safe. */
+    class timing_wheel_t {
+    public:
+        using timer_t = std::uint32_t;
+
+        static constexpr timer_t       none    = std::numeric_limits<timer_t>::max();
+        static constexpr std::int64_t  release = std::numeric_limits<std::int64_t>::min();
+
+        static constexpr std::size_t   slots   = 64;
+        static constexpr std::size_t   bits    = 3;    // per level
+        static constexpr std::size_t   levels  = 6;
+        static constexpr std::uint64_t horizon = (std::uint64_t)(slots - 1) << (bits * (levels - 1));
+
+        /** @p capacity timers are allocated up front, more grow the wheel. */
+        explicit timing_wheel_t(std::int64_t resolution_ticks, std::size_t capacity = 0) {
+            while (_shift < 62 && (std::int64_t{ 2 } << _shift) <= resolution_ticks) {
+                _shift++;
+            }
+            _nodes.reserve(n_of_buckets + capacity);
+            _nodes.resize(n_of_buckets);
+            for (timer_t bucket = 0; bucket < n_of_buckets; bucket++) {
+                _nodes[bucket].next = _nodes[bucket].prev = bucket;
+            }
+        }
+
+        /** Fires at @p deadline, event ticks, with @p value. Throws
+         *  std::bad_alloc past the capacity when out of memory. */
+        inline timer_t
+        schedule(std::int64_t deadline, std::uint32_t value) {
+            timer_t timer = _free;
+            if (timer != none) {
+                _free = _nodes[timer].next;
+            }
+            else {
+                timer = (timer_t)_nodes.size();
+                _nodes.emplace_back();
+            }
+            _nodes[timer].value = value;
+            set_deadline(timer, deadline);
+            link(timer);
+            _size++;
+            return timer;
+        }
+
+        /** Moves @p timer to @p deadline. */
+        inline void
+        reschedule(timer_t timer, std::int64_t deadline) noexcept {
+            unlink(timer);
+            set_deadline(timer, deadline);
+            link(timer);
+        }
+
+        inline void
+        cancel(timer_t timer) noexcept {
+            unlink(timer);
+            free(timer);
+        }
+
+        /** For owners whose entries move, @p timer follows its entry. */
+        inline void
+        set_value(timer_t timer, std::uint32_t value) noexcept {
+            _nodes[timer].value = value;
+        }
+
+        /** Fires the timers due up to @p now, event ticks, unit by unit.
+         *  @p on_expired(value) returns the timer's next deadline, or
+         *  release to free it; it may schedule and cancel other timers.
+         *  At most @p limit timers are handled, the next call goes on with
+         *  the rest. Returns the number handled: fired, or only placed
+         *  again when beyond the horizon. */
+        template <class callback_t>
+        inline std::size_t
+        advance(std::int64_t now, callback_t&& on_expired,
+                std::size_t limit = std::numeric_limits<std::size_t>::max()) {
+            const auto target = (std::uint64_t)std::max<std::int64_t>(now, 0) >> _shift;
+            // what a previous call left of the current unit
+            auto handled = expire(on_expired, limit);
+            while (handled < limit && _now < target) {
+                if (!_size) {
+                    _now = target;
+                    break;
+                }
+                const auto next = next_event();
+                if (next > target) {
+                    _now = target;
+                    break;
+                }
+                _now = next;
+                handled += expire(on_expired, limit - handled);
+            }
+            return handled;
+        }
+
+        /** Timers scheduled. */
+        inline std::size_t
+        size() const noexcept {
+            return _size;
+        }
+
+        /** Bytes taken by @p capacity timers. */
+        static constexpr std::size_t
+        bytes(std::size_t capacity) noexcept {
+            return (n_of_buckets + capacity) * sizeof(node_t);
+        }
+
+    private:
+        static constexpr timer_t n_of_buckets = (timer_t)(slots * levels);
+
+        /** A timer, or the head of a bucket's circular list. */
+        struct node_t {
+            std::uint32_t   deadline{ 0 };  // units, low 32 bits
+            timer_t         next{ none };
+            timer_t         prev{ none };
+            std::uint32_t   value{ 0 };
+        };
+
+        static inline std::size_t
+        first_bit(std::uint64_t word) noexcept {
+#if defined(_M_X64)
+            unsigned long index;
+            _BitScanForward64(&index, (unsigned __int64)word);
+            return index;
+#else
+            std::size_t index = 0;
+            while (!(word & 1)) {
+                word >>= 1;
+                index++;
+            }
+            return index;
+#endif
+        }
+
+        inline void
+        set_deadline(timer_t timer, std::int64_t deadline) noexcept {
+            // rounded up, so a timer never fires before its deadline
+            const auto ticks = (std::uint64_t)std::max<std::int64_t>(deadline, 0);
+            const auto due   = (ticks >> _shift) + ((ticks & ((std::uint64_t{ 1 } << _shift) - 1)) != 0);
+            _nodes[timer].deadline = (std::uint32_t)std::min<std::uint64_t>(due, _now + std::numeric_limits<std::int32_t>::max());
+        }
+
+        /** Units until @p timer is due, 0 or less when it is. */
+        inline std::int64_t
+        remaining(timer_t timer) const noexcept {
+            return (std::int32_t)(_nodes[timer].deadline - (std::uint32_t)_now);
+        }
+
+        /** Into the bucket of the first level whose 63 buckets ahead reach
+         *  the deadline, rounded up to the start of a bucket. */
+        inline void
+        link(timer_t timer) noexcept {
+            const auto due = _now + (std::uint64_t)std::max<std::int64_t>(remaining(timer), 1);
+            std::size_t   level = 0;
+            std::uint64_t block = due;
+            for (; level < levels; level++) {
+                const auto shift = bits * level;
+                block = (due + (std::uint64_t{ 1 } << shift) - 1) >> shift;
+                if (block - (_now >> shift) < slots) {
+                    break;
+                }
+            }
+            if (level == levels) {
+                level = levels - 1;
+                block = (_now >> (bits * level)) + slots - 1;
+            }
+            const auto bucket = (timer_t)(level * slots + (block & (slots - 1)));
+            auto& node = _nodes[timer];
+            auto& head = _nodes[bucket];
+            node.prev = head.prev;
+            node.next = bucket;
+            _nodes[head.prev].next = timer;
+            head.prev = timer;
+            _occupied[level] |= std::uint64_t{ 1 } << (bucket % slots);
+        }
+
+        inline void
+        unlink(timer_t timer) noexcept {
+            const auto& node = _nodes[timer];
+            _nodes[node.prev].next = node.next;
+            _nodes[node.next].prev = node.prev;
+            // left alone with its head: the bucket is empty now
+            if (node.prev == node.next && node.prev < n_of_buckets) {
+                _occupied[node.prev / slots] &= ~(std::uint64_t{ 1 } << (node.prev % slots));
+            }
+        }
+
+        inline void
+        free(timer_t timer) noexcept {
+            _nodes[timer].next = _free;
+            _free = timer;
+            _size--;
+        }
+
+        /** The first unit after _now at which a bucket of any level starts. */
+        inline std::uint64_t
+        next_event() const noexcept {
+            auto next = std::numeric_limits<std::uint64_t>::max();
+            for (std::size_t level = 0; level < levels; level++) {
+                if (!_occupied[level]) {
+                    continue;
+                }
+                // the buckets after the current one, in turn order
+                const auto current = (_now >> (bits * level)) + 1;
+                const auto shift   = current & (slots - 1);
+                const auto turn    = shift ? (_occupied[level] >> shift) | (_occupied[level] << (slots - shift))
+                                           : _occupied[level];
+                next = std::min(next, (current + first_bit(turn)) << (bits * level));
+            }
+            return next;
+        }
+
+        /** Fires the buckets starting at _now, the finest first. */
+        template <class callback_t>
+        inline std::size_t
+        expire(callback_t& on_expired, std::size_t limit) {
+            std::size_t handled{ 0 };
+            for (std::size_t level = 0; level < levels && handled < limit; level++) {
+                const auto shift = bits * level;
+                if (_now & ((std::uint64_t{ 1 } << shift) - 1)) {
+                    break;
+                }
+                const auto bucket = (timer_t)(level * slots + ((_now >> shift) & (slots - 1)));
+                while (handled < limit && _nodes[bucket].next != bucket) {
+                    const auto timer = _nodes[bucket].next;
+                    unlink(timer);
+                    handled++;
+                    if (remaining(timer) > 0) {
+                        // was beyond the horizon
+                        link(timer);
+                        continue;
+                    }
+                    const auto deadline = on_expired(_nodes[timer].value);
+                    if (deadline == release) {
+                        free(timer);
+                        continue;
+                    }
+                    set_deadline(timer, deadline);
+                    link(timer);
+                }
+            }
+            return handled;
+        }
+
+        std::vector<node_t>                       _nodes;
+        std::uint64_t                             _occupied[levels]{};
+        timer_t                                   _free{ none };
+        std::size_t                               _size{ 0 };
+        std::size_t                               _shift{ 0 };
+        std::uint64_t                             _now{ 0 };
+    };
+}
@@ -0,0 +1,281 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+namespace performance {
+
+    enum class trace_state_t : std::uint8_t {
+        stopped,
+        starting,       // session up, no event delivered yet
+        running,        // events are being delivered
+        restarting,     // processing ended on its own, starting over
+        stopping,
+        failed          // didn't start, or gave up restarting
+    };
+
+    inline const char*
+    to_string(trace_state_t state) noexcept {
+        switch (state) {
+        case trace_state_t::stopped:    return "stopped";
+        case trace_state_t::starting:   return "starting";
+        case trace_state_t::running:    return "running";
+        case trace_state_t::restarting: return "restarting";
+        case trace_state_t::stopping:   return "stopping";
+        case trace_state_t::failed:     return "failed";
+        }
+        return "unknown";
+    }
+
+    /** Starts, watches and stops a trace session on its own thread.
+     *
+     *  @p backend_t opens and closes the session, the thread only waits
+     *  for it:
+     *
+     *      bool start();       session up and ready to be processed
+     *      bool process();     delivers events until the session ends
+     *      void stop();        ends process() from any thread, releases
+     *                          the session, also after a failed start()
+     *
+     *  The consumer calls notify_delivery() for every event: the first one
+     *  after a start resolves ready() and gives time_to_first_event_ns(),
+     *  so nobody has to guess when processing really began. When process()
+     *  returns without stop() (the session was stopped from outside, or
+     *  failed) the session is started again after a backoff, doubling up
+     *  to max_backoff, until max_failures starts in a row delivered
+     *  nothing. stop() waits at most its timeout for the thread. */
+    template <class backend_t>
+    class trace_lifecycle_t {
+    public:
+        using clock_t = std::chrono::steady_clock;
+
+        static constexpr std::chrono::milliseconds min_backoff{ 100 };
+        static constexpr std::chrono::milliseconds max_backoff{ 5000 };
+        static constexpr std::size_t               max_failures{ 10 };
+
+        explicit trace_lifecycle_t(backend_t& backend)
+            : _backend{ backend } {}
+        trace_lifecycle_t(const trace_lifecycle_t&) = delete;
+
+        ~trace_lifecycle_t() noexcept {
+            (void)stop();
+            if (_thread.joinable()) {
+                _thread.join();
+            }
+        }
+
+        /** Starts the session and the thread processing it, false when
+         *  the session didn't start. True right away when already started. */
+        inline bool
+        start() {
+            std::unique_lock<std::mutex> lock{ _mtx };
+            if (_thread.joinable() && !_exited) {
+                // a stop() that timed out leaves a thread on its way out
+                return _state != trace_state_t::stopping && _state != trace_state_t::failed;
+            }
+            if (_thread.joinable()) {
+                _thread.join();
+            }
+            _stop_requested = false;
+            _exited         = false;
+            _failures       = 0;
+            _restarts       = 0;
+            _ready          = {};
+            _ready_future   = _ready.get_future().share();
+            _ready_set      = false;
+            if (!start_backend()) {
+                _backend.stop();
+                _state = trace_state_t::failed;
+                settle_ready(false);
+                return false;
+            }
+            _thread = std::thread([this]() { run(); });
+            return true;
+        }
+
+        /** Ends processing and releases the session. False when the thread
+         *  didn't finish within @p timeout, it's joined by the next start()
+         *  or the destructor then. */
+        inline bool
+        stop(std::chrono::milliseconds timeout = std::chrono::seconds{ 2 }) {
+            std::unique_lock<std::mutex> lock{ _mtx };
+            if (!_thread.joinable()) {
+                return true;
+            }
+            if (_exited) {
+                // gave up restarting, the state stays failed
+                lock.unlock();
+                _thread.join();
+                return true;
+            }
+            if (!_stop_requested) {
+                _stop_requested = true;
+                _state          = trace_state_t::stopping;
+                _cv.notify_all();
+                // under the lock, so a restart can't bring the session back
+                _backend.stop();
+            }
+            if (_thread.get_id() == std::this_thread::get_id()) {
+                // from an event callback, the thread ends on its own
+                return false;
+            }
+            if (!_cv.wait_for(lock, timeout, [this]() { return _exited; })) {
+                std::cerr << "Trace thread didn't end within " << timeout.count() << " ms\n";
+                return false;
+            }
+            lock.unlock();
+            _thread.join();
+            return true;
+        }
+
+        /** Called by the consumer for every event, one relaxed load unless
+         *  it's the first one since the session (re)started. */
+        inline void
+        notify_delivery() noexcept {
+            if (_awaiting.load(std::memory_order_relaxed)) {
+                first_delivery();
+            }
+        }
+
+        /** True once the first event after start() came, false when the
+         *  session failed or was stopped before. */
+        inline std::shared_future<bool>
+        ready() const {
+            std::lock_guard<std::mutex> lock{ _mtx };
+            return _ready_future;
+        }
+
+        /** Waits at most @p timeout for ready(), false when it timed out,
+         *  failed or was never started. */
+        inline bool
+        wait_ready(std::chrono::milliseconds timeout) const {
+            const auto ready = this->ready();
+            return ready.valid() &&
+                   ready.wait_for(timeout) == std::future_status::ready &&
+                   ready.get();
+        }
+
+        inline trace_state_t
+        state() const noexcept {
+            std::lock_guard<std::mutex> lock{ _mtx };
+            return _state;
+        }
+
+        /** From the last (re)start of the session to its first event, 0
+         *  until an event came. */
+        inline std::int64_t
+        time_to_first_event_ns() const noexcept {
+            return _time_to_first_event_ns.load(std::memory_order_relaxed);
+        }
+
+        /** Restarts since start(). */
+        inline std::size_t
+        restarts() const noexcept {
+            std::lock_guard<std::mutex> lock{ _mtx };
+            return _restarts;
+        }
+
+    private:
+        inline bool
+        start_backend() {
+            _state      = trace_state_t::starting;
+            _started_at = clock_t::now();
+            _time_to_first_event_ns.store(0, std::memory_order_relaxed);
+            _awaiting.store(true, std::memory_order_relaxed);
+            return _backend.start();
+        }
+
+        inline void
+        first_delivery() noexcept {
+            std::lock_guard<std::mutex> lock{ _mtx };
+            if (!_awaiting.load(std::memory_order_relaxed)) {
+                return;
+            }
+            _awaiting.store(false, std::memory_order_relaxed);
+            _time_to_first_event_ns.store(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(clock_t::now() - _started_at).count(),
+                std::memory_order_relaxed);
+            _failures = 0;
+            if (_state == trace_state_t::starting) {
+                _state = trace_state_t::running;
+            }
+            settle_ready(true);
+        }
+
+        inline void
+        settle_ready(bool ready) noexcept {
+            if (!_ready_set) {
+                _ready_set = true;
+                _ready.set_value(ready);
+            }
+        }
+
+        inline void
+        run() {
+            auto backoff = min_backoff;
+            bool started = true;
+            while (true) {
+                if (started && !_backend.process()) {
+                    std::cerr << "Trace processing failed\n";
+                }
+                std::unique_lock<std::mutex> lock{ _mtx };
+                if (_stop_requested) {
+                    break;
+                }
+                if (_failures == 0) {
+                    // delivered since the last start, back off from scratch
+                    backoff = min_backoff;
+                }
+                if (++_failures >= max_failures) {
+                    std::cerr << "Trace session failed " << _failures << " times in a row, giving up\n";
+                    _state = trace_state_t::failed;
+                    _backend.stop();
+                    break;
+                }
+                _state = trace_state_t::restarting;
+                _awaiting.store(false, std::memory_order_relaxed);
+                if (_cv.wait_for(lock, backoff, [this]() { return _stop_requested; })) {
+                    break;
+                }
+                backoff = std::min(backoff * 2, max_backoff);
+                _backend.stop();
+                started = start_backend();
+                _restarts++;
+                if (!started) {
+                    _state = trace_state_t::restarting;
+                }
+            }
+            std::lock_guard<std::mutex> lock{ _mtx };
+            if (_state != trace_state_t::failed) {
+                _state = trace_state_t::stopped;
+            }
+            _awaiting.store(false, std::memory_order_relaxed);
+            settle_ready(false);
+            _exited = true;
+            _cv.notify_all();
+        }
+
+        backend_t&                                  _backend;
+        mutable std::mutex                          _mtx;
+        std::condition_variable                     _cv;
+        std::thread                                 _thread;
+        trace_state_t                               _state{ trace_state_t::stopped };
+        bool                                        _stop_requested{ false };
+        bool                                        _exited{ false };
+        std::size_t                                 _failures{ 0 };
+        std::size_t                                 _restarts{ 0 };
+        clock_t::time_point                         _started_at{};
+        std::atomic<bool>                           _awaiting{ false };
+        std::atomic<std::int64_t>                   _time_to_first_event_ns{ 0 };
+        std::promise<bool>                          _ready;
+        std::shared_future<bool>                    _ready_future;
+        bool                                        _ready_set{ false };
+    };
+}
@@ -1,6 +1,5 @@
 #pragma once
 
-#define NOMINMAX
 #include <Windows.h>
 
 #include <algorithm>
@@ -253,13 +252,13 @@ namespace console {
 
         bool                               _created{ false };
         bool                               _activated{ false };
-        std::int16_t                       _lines{ 50 };
+        std::int16_t                       _lines{ 64 };
         std::int16_t                       _columns{ 50 };
         std::int16_t                       _x{ 0 };
         std::int16_t                       _y{ 0 };
         WORD                               _attr{ color_t::WHITE };
         //std::vector<CHAR_INFO*>            _grid;
-        CHAR_INFO                          _grid[50][50] = {{}};
+        CHAR_INFO                          _grid[64][50] = {{}};
         handle_t                           _handle{ INVALID_HANDLE_VALUE };
         handle_t                           _old_handle{ INVALID_HANDLE_VALUE };
         CONSOLE_SCREEN_BUFFER_INFO         _info{};
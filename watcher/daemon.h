@@ -0,0 +1,385 @@
+#pragma once
+
+// winsock first, before network_monitor.h brings in windows.h
+#include "fleet_reporter.h"
+
+#include <performance_monitor/alert_rules.h>
+#include <performance_monitor/capture.h>
+#include <performance_monitor/network_monitor.h>
+#include <performance_monitor/output_sink.h>
+#include <performance_monitor/process_monitor.h>
+
+#include "daemon_config.h"
+
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace watcher {
+
+    /** Runs without a console: monitors the processes of a config file and
+     *  streams their rows to the configured sinks. The file is checked for
+     *  changes every second and applied to the running trace session;
+     *  process names are re-resolved every resolve_interval so restarted
+     *  services are picked up. Alert rules are evaluated every interval,
+     *  alerts go to std::cerr and every sink. With report, the counters
+     *  also go to a collector. */
+    class daemon_t {
+        using clock_t = std::chrono::steady_clock;
+    public:
+        explicit daemon_t(std::filesystem::path config_path)
+            : _config_path{ std::move(config_path) } {}
+
+        inline int
+        run(const volatile bool& running) {
+            auto config = daemon_config_t::load(_config_path);
+            if (!config) {
+                return EXIT_FAILURE;
+            }
+            _config      = std::move(*config);
+            _config_time = last_write_time();
+            open_outputs();
+            update_reporter();
+
+            // process names are resolved from samples of every process
+            if (!_processes.start(_config.resolve_interval)) {
+                return EXIT_FAILURE;
+            }
+            _pids = resolve();
+            _alerts.on_alert([this](const perf::alert_t& alert) { report(alert); });
+            _alerts.set_rules(_config.alerts);
+            if (has_flow_alerts()) {
+                _monitor.enable_burst_analysis({ std::chrono::milliseconds{ 10 } });
+            }
+            if (_config.connections || _config.flow_ends) {
+                _monitor.enable_connection_tracking(65536, _config.flow_ends ? max_flow_ends : 0);
+            }
+            update_filter();
+            update_groups();
+            update_memory_budget();
+            _monitor.set_sampling(_config.sampling);
+            _monitor.set_session_config(_config.session);
+            _monitor.enable_buffer_control(std::make_unique<perf::adaptive_buffer_controller_t>(_config.session));
+            if (!_monitor.start(perf::session_trace_handler_t::create_guid(), _pids)) {
+                std::cerr << "Failed to start monitor\n";
+                return EXIT_FAILURE;
+            }
+            update_capture();
+
+            auto next_sample  = clock_t::now() + _config.interval;
+            auto next_resolve = clock_t::now() + _config.resolve_interval;
+            auto next_reload  = clock_t::now() + std::chrono::seconds{ 1 };
+            while (running) {
+                const auto now = clock_t::now();
+                if (now >= next_sample) {
+                    sample();
+                    next_sample = std::max(next_sample + _config.interval, now);
+                }
+                if (now >= next_resolve) {
+                    update_pids(resolve());
+                    next_resolve = now + _config.resolve_interval;
+                }
+                if (now >= next_reload) {
+                    reload();
+                    next_reload = now + std::chrono::seconds{ 1 };
+                }
+                std::this_thread::sleep_until(std::min({ next_sample, next_resolve, next_reload }));
+            }
+            for (auto& sink : _sinks) {
+                sink->flush();
+            }
+            return EXIT_SUCCESS;
+        }
+
+    private:
+        /** Flow ends kept per interval, the rest only counted. */
+        static constexpr std::size_t max_flow_ends = 65536;
+
+        inline void
+        sample() {
+            if (_sinks.empty() && _alerts.rules().empty() && !_reporter) {
+                return;
+            }
+            // the same version the monitor's other readers get
+            (void)_monitor.publish_view();
+            const auto  view     = _view_reader.read();
+            const auto  now      = view->timestamp_ns;
+            const auto& snapshot = view->snapshot;
+            if (auto* tracker = _monitor.connection_tracker()) {
+                tracker->drain_flow_ends(_flow_ends);
+            }
+            for (auto& sink : _sinks) {
+                sink->write(now, snapshot);
+                for (const auto& row : view->pids) {
+                    if (std::binary_search(_pids.begin(), _pids.end(), row.pid)) {
+                        sink->write(now, row);
+                    }
+                }
+                for (const auto& row : view->threads) {
+                    if (std::binary_search(_pids.begin(), _pids.end(), row.pid)) {
+                        sink->write(now, row);
+                    }
+                }
+                for (const auto& row : view->connections) {
+                    if (std::binary_search(_pids.begin(), _pids.end(), row.pid)) {
+                        sink->write(now, row);
+                    }
+                }
+                for (const auto& row : _flow_ends) {
+                    if (std::binary_search(_pids.begin(), _pids.end(), row.pid)) {
+                        sink->write(_monitor.event_clock().to_unix_ns(row.last), row);
+                    }
+                }
+                write_processes(*sink, now);
+                write_groups(*sink, now);
+                for (const auto& table : _monitor.memory_usage()) {
+                    sink->write(now, table);
+                }
+            }
+            evaluate_alerts(*view);
+            for (auto& sink : _sinks) {
+                sink->submit();
+            }
+            if (_reporter) {
+                _monitored.clear();
+                for (const auto& row : view->pids) {
+                    if (std::binary_search(_pids.begin(), _pids.end(), row.pid)) {
+                        _monitored.push_back(row);
+                    }
+                }
+                _reporter->report(now, snapshot, _monitored);
+            }
+        }
+
+        /** Rows of the monitored processes from the last name resolution
+         *  sample, so they repeat until the next one. */
+        inline void
+        write_processes(perf::output_sink_t& sink, std::int64_t now) {
+            _processes.for_each([&](const perf::process_data_t& data) {
+                if (std::binary_search(_pids.begin(), _pids.end(), data.pid)) {
+                    sink.write(now, data);
+                }
+            });
+        }
+
+        /** Rows of the configured groups, plus none once there are groups. */
+        inline void
+        write_groups(perf::output_sink_t& sink, std::int64_t now) {
+            if (_config.groups.empty()) {
+                return;
+            }
+            const auto  names    = _monitor.group_names();
+            const auto& counters = _monitor.group_counters();
+            for (std::size_t ii = 0; ii < names.size(); ii++) {
+                const bool configured = ii == perf::address_classifier_t::none ||
+                    std::any_of(_config.groups.begin(), _config.groups.end(),
+                                [&](const perf::address_group_t& group) { return group.name == names[ii]; });
+                if (configured) {
+                    sink.write(now, names[ii].c_str(), counters, ii);
+                }
+            }
+        }
+
+        /** Feeds the interval's counters to the alert rules. */
+        inline void
+        evaluate_alerts(const perf::monitor_view_t& view) {
+            if (_alerts.rules().empty()) {
+                return;
+            }
+            _alerts.observe(view.snapshot.tcp);
+            _alerts.observe(view.snapshot.udp);
+            for (const auto& row : view.pids) {
+                if (std::binary_search(_pids.begin(), _pids.end(), row.pid)) {
+                    _alerts.observe(row);
+                }
+            }
+            if (auto* bursts = _monitor.burst_analyzer()) {
+                bursts->report([](std::uint32_t, const perf::burst_stats_t&) {},
+                               [this](const perf::flow_key_t& key, const perf::burst_stats_t& stats) {
+                                   _alerts.observe(key, stats);
+                               });
+            }
+            (void)_alerts.evaluate(view.timestamp_ns);
+        }
+
+        inline void
+        report(const perf::alert_t& alert) {
+            std::cerr << "alert " << alert.rule->name
+                      << (alert.state == perf::alert_state_t::fired ? " fired" : " cleared")
+                      << ", " << perf::alert_rule_t::scope_name(alert.rule->scope);
+            if (alert.rule->scope == perf::alert_scope_t::pid) {
+                std::cerr << " " << alert.pid;
+            }
+            std::cerr << " at " << alert.value << ": " << alert.rule->text << "\n";
+            for (auto& sink : _sinks) {
+                sink->write(alert);
+            }
+        }
+
+        inline bool
+        has_flow_alerts() const noexcept {
+            return std::any_of(_config.alerts.begin(), _config.alerts.end(),
+                               [](const perf::alert_rule_t& rule) { return rule.scope == perf::alert_scope_t::flow; });
+        }
+
+        /** Configured pids plus the current pids of the configured names. */
+        inline std::vector<std::uint32_t>
+        resolve() const {
+            auto pids = _config.pids;
+            if (!_config.processes.empty()) {
+                _processes.for_each([&](const perf::process_data_t& data) {
+                    for (const auto& pattern : _config.processes) {
+                        if (daemon_config_t::matches(pattern, data.name)) {
+                            pids.push_back(data.pid);
+                            break;
+                        }
+                    }
+                });
+            }
+            std::sort(pids.begin(), pids.end());
+            pids.erase(std::unique(pids.begin(), pids.end()), pids.end());
+            return pids;
+        }
+
+        inline void
+        update_pids(std::vector<std::uint32_t> pids) {
+            if (pids == _pids) {
+                return;
+            }
+            _pids = std::move(pids);
+            _monitor.set_pids(_pids);
+        }
+
+        /** Applies a changed config file. The session buffers are only read
+         *  at start, everything else changes in place. */
+        inline void
+        reload() {
+            const auto time = last_write_time();
+            if (time == _config_time) {
+                return;
+            }
+            _config_time = time;
+            auto config = daemon_config_t::load(_config_path);
+            if (!config) {
+                std::cerr << "Keeping the previous config\n";
+                return;
+            }
+            const bool outputs_changed = config->outputs != _config.outputs;
+            const bool resolve_changed = config->resolve_interval != _config.resolve_interval;
+            const bool capture_changed = config->capture != _config.capture;
+            const bool filter_changed  = config->filter != _config.filter;
+            const bool sampling_changed = config->sampling.mode != _config.sampling.mode ||
+                                          config->sampling.rate != _config.sampling.rate ||
+                                          config->sampling.max_rate != _config.sampling.max_rate;
+            const bool report_changed = config->report != _config.report || config->host != _config.host;
+            const bool groups_changed = !std::equal(config->groups.begin(), config->groups.end(),
+                                                    _config.groups.begin(), _config.groups.end(),
+                                                    [](const perf::address_group_t& a, const perf::address_group_t& b) {
+                                                        return a.text == b.text;
+                                                    });
+            const bool alerts_changed = !std::equal(config->alerts.begin(), config->alerts.end(),
+                                                    _config.alerts.begin(), _config.alerts.end(),
+                                                    [](const perf::alert_rule_t& a, const perf::alert_rule_t& b) {
+                                                        return a.text == b.text;
+                                                    });
+            _config = std::move(*config);
+            if (outputs_changed) {
+                open_outputs();
+            }
+            if (report_changed) {
+                update_reporter();
+            }
+            if (resolve_changed) {
+                (void)_processes.start(_config.resolve_interval);
+            }
+            if (capture_changed) {
+                update_capture();
+            }
+            if (filter_changed) {
+                update_filter();
+            }
+            if (sampling_changed) {
+                _monitor.set_sampling(_config.sampling);
+            }
+            if (groups_changed) {
+                update_groups();
+            }
+            update_memory_budget();
+            if (alerts_changed) {
+                _alerts.set_rules(_config.alerts);
+                if (has_flow_alerts() && !_monitor.burst_analyzer()) {
+                    std::cerr << "Flow alerts need a restart\n";
+                }
+            }
+            update_pids(resolve());
+        }
+
+        inline void
+        update_capture() {
+            _capture.stop();
+            if (!_config.capture.empty()) {
+                (void)_capture.start(_monitor, _config.capture);
+            }
+        }
+
+        inline void
+        update_filter() {
+            _monitor.set_filter(_config.filter.empty() ? std::nullopt
+                                                       : perf::event_filter_t::compile(_config.filter));
+        }
+
+        inline void
+        update_memory_budget() {
+            _monitor.set_memory_budget(_config.table_memory_kb ? _config.table_memory_kb * 1024
+                                                               : perf::memory_budget_t::unlimited);
+        }
+
+        /** Builds the classifier aside and swaps it in, events keep flowing. */
+        inline void
+        update_groups() {
+            _monitor.set_groups(_config.groups.empty() ? std::nullopt
+                                                       : perf::address_classifier_t::build(_config.groups));
+        }
+
+        inline void
+        open_outputs() {
+            _sinks.clear();
+            for (const auto& output : _config.outputs) {
+                if (auto sink = perf::make_output_sink(output.format, output.path)) {
+                    _sinks.push_back(std::move(sink));
+                }
+            }
+        }
+
+        inline void
+        update_reporter() {
+            _reporter.reset();
+            if (!_config.report.empty()) {
+                _reporter = std::make_unique<fleet_reporter_t>(_config.report, _config.host);
+            }
+        }
+
+        inline std::filesystem::file_time_type
+        last_write_time() const {
+            std::error_code error;
+            return std::filesystem::last_write_time(_config_path, error);
+        }
+
+        std::filesystem::path                           _config_path;
+        daemon_config_t                                 _config;
+        std::filesystem::file_time_type                 _config_time;
+        std::vector<std::unique_ptr<perf::output_sink_t>> _sinks;
+        std::vector<std::uint32_t>                      _pids;
+        std::vector<perf::pid_data_t>                   _monitored;
+        std::vector<perf::flow_end_t>                   _flow_ends;
+        perf::process_monitor_t                         _processes;
+        perf::network_monitor_t                         _monitor;
+        perf::published_t<perf::monitor_view_t>::reader_t _view_reader{ _monitor.views() };
+        perf::capture_writer_t                          _capture;
+        perf::alert_engine_t                            _alerts;
+        std::unique_ptr<fleet_reporter_t>               _reporter;
+    };
+}
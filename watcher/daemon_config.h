@@ -0,0 +1,244 @@
+#pragma once
+
+#include <performance_monitor/address_classifier.h>
+#include <performance_monitor/alert_rules.h>
+#include <performance_monitor/buffer_controller.h>
+#include <performance_monitor/event_filter.h>
+#include <performance_monitor/fleet_codec.h>
+#include <performance_monitor/output_sink.h>
+#include <performance_monitor/sampler.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace watcher {
+    namespace perf = performance;
+
+    struct output_config_t {
+        perf::output_format_t   format{ perf::output_format_t::jsonl };
+        std::string             path;
+
+        inline bool
+        operator == (const output_config_t& other) const noexcept {
+            return format == other.format && path == other.path;
+        }
+    };
+
+    /** Everything the daemon reads from its config file:
+     *
+     *      # comment
+     *      pid             = 1234
+     *      process         = w3wp*.exe         ? and * wildcards, any case
+     *      interval_ms     = 1000
+     *      resolve_ms      = 5000              re-resolves process names, samples their process rows
+     *      output          = jsonl C:\logs\network.jsonl
+     *      output          = csv -             - is stdout
+     *      capture         = D:\network.pwc    every event, for --analyze
+     *      filter          = dport == 443 && daddr in 10.0.0.0/8
+     *      sampling        = flow 16 1024      none | every | flow <rate> [<max rate>]
+     *      alert           = retx: pid.retransmissions rate > 50 for 10s clear 10
+     *      connections     = on                lifecycles per process, read once, at start
+     *      flow_ends       = on                a record per connection and udp flow that ended, implies connections
+     *      group           = database: 10.1.0.0/16 port 5432   remote endpoints, see address_group_t
+     *      report          = collector:9400    every interval, to watcher.exe --collect
+     *      host            = web-01            name to report as, the computer name by default
+     *      buffer_size_kb  = 64                read once, at start
+     *      minimum_buffers = 16
+     *      maximum_buffers = 64
+     *      max_memory_kb   = 65536
+     *      table_memory_kb = 65536             per process/flow/connection tables, 0 for no cap
+     *
+     *  pid, process, output, alert and group may repeat, see alert_rule_t
+     *  for the rules. */
+    struct daemon_config_t {
+        std::vector<std::uint32_t>  pids;
+        std::vector<std::string>    processes;
+        std::chrono::milliseconds   interval{ 1000 };
+        std::chrono::milliseconds   resolve_interval{ 5000 };
+        std::vector<output_config_t> outputs;
+        std::string                 capture;
+        std::string                 filter;         // empty keeps every event
+        perf::sampling_config_t     sampling;
+        std::vector<perf::alert_rule_t> alerts;
+        bool                        connections{ false };
+        bool                        flow_ends{ false };
+        std::vector<perf::address_group_t> groups;
+        std::string                 report;         // host:port of a collector, empty for none
+        std::string                 host;
+        perf::session_config_t      session;
+        std::size_t                 table_memory_kb{ 0 };   // 0 for no cap
+
+        /** nullopt, with the reason on std::cerr, when the file can't be
+         *  read or has an invalid line. */
+        static inline std::optional<daemon_config_t>
+        load(const std::filesystem::path& path) {
+            std::ifstream file{ path };
+            if (!file) {
+                std::cerr << "Unable to open config " << path << "\n";
+                return std::nullopt;
+            }
+            daemon_config_t config;
+            std::string     line;
+            std::size_t     line_number{ 0 };
+            try {
+                while (std::getline(file, line)) {
+                    line_number++;
+                    config.parse_line(trim(line));
+                }
+            }
+            catch (std::exception& err) {
+                std::cerr << path << ":" << line_number << ": " << err.what() << "\n";
+                return std::nullopt;
+            }
+            if (config.pids.empty() && config.processes.empty()) {
+                std::cerr << path << ": no pid or process to monitor\n";
+                return std::nullopt;
+            }
+            return config;
+        }
+
+        /** Whether two process names match, @p pattern may use ? and *. */
+        static inline bool
+        matches(std::string_view pattern, std::string_view name) noexcept {
+            std::size_t p{ 0 }, n{ 0 }, star{ std::string_view::npos }, retry{ 0 };
+            while (n < name.size()) {
+                if (p < pattern.size() &&
+                    (pattern[p] == '?' || std::tolower((unsigned char)pattern[p]) == std::tolower((unsigned char)name[n]))) {
+                    p++;
+                    n++;
+                }
+                else if (p < pattern.size() && pattern[p] == '*') {
+                    star  = p++;
+                    retry = n;
+                }
+                else if (star != std::string_view::npos) {
+                    p = star + 1;
+                    n = ++retry;
+                }
+                else {
+                    return false;
+                }
+            }
+            while (p < pattern.size() && pattern[p] == '*') {
+                p++;
+            }
+            return p == pattern.size();
+        }
+
+    private:
+        inline void
+        parse_line(std::string_view line) {
+            if (line.empty() || line[0] == '#') {
+                return;
+            }
+            const auto equal = line.find('=');
+            if (equal == std::string_view::npos) {
+                throw std::invalid_argument("expected key = value");
+            }
+            const auto key   = trim(line.substr(0, equal));
+            const auto value = trim(line.substr(equal + 1));
+            if (value.empty()) {
+                throw std::invalid_argument("missing value");
+            }
+            const auto number = [&value]() { return std::stoull(std::string{ value }); };
+            if (key == "pid") {
+                pids.push_back((std::uint32_t)number());
+            }
+            else if (key == "process") {
+                processes.emplace_back(value);
+            }
+            else if (key == "interval_ms") {
+                interval = std::chrono::milliseconds{ std::max<std::uint64_t>(number(), 1) };
+            }
+            else if (key == "resolve_ms") {
+                resolve_interval = std::chrono::milliseconds{ std::max<std::uint64_t>(number(), 1) };
+            }
+            else if (key == "output") {
+                const auto space  = value.find(' ');
+                const auto format = perf::parse_output_format(value.substr(0, space));
+                if (!format || space == std::string_view::npos) {
+                    throw std::invalid_argument("expected output = <jsonl | csv | binary> <path | ->");
+                }
+                outputs.push_back({ *format, std::string{ trim(value.substr(space + 1)) } });
+            }
+            else if (key == "capture") {
+                capture = value;
+            }
+            else if (key == "filter") {
+                (void)perf::event_filter_t::compile_or_throw(value);
+                filter = value;
+            }
+            else if (key == "sampling") {
+                const auto config = perf::parse_sampling_config(value);
+                if (!config) {
+                    throw std::invalid_argument("expected sampling = none | every <rate> [<max rate>] | flow <rate> [<max rate>]");
+                }
+                sampling = *config;
+            }
+            else if (key == "alert") {
+                alerts.push_back(perf::alert_rule_t::parse_or_throw(value));
+            }
+            else if (key == "group") {
+                groups.push_back(perf::address_group_t::parse_or_throw(value));
+            }
+            else if (key == "report") {
+                const auto colon = value.rfind(':');
+                if (colon == std::string_view::npos || colon == 0 || colon + 1 == value.size() ||
+                    value.find_first_not_of("0123456789", colon + 1) != std::string_view::npos) {
+                    throw std::invalid_argument("expected report = <host>:<port>");
+                }
+                report = value;
+            }
+            else if (key == "host") {
+                if (!perf::fleet::valid_host(value)) {
+                    throw std::invalid_argument("host names are up to 64 letters, digits, _ - and .");
+                }
+                host = value;
+            }
+            else if (key == "connections") {
+                if (value != "on" && value != "off") {
+                    throw std::invalid_argument("expected connections = on | off");
+                }
+                connections = value == "on";
+            }
+            else if (key == "flow_ends") {
+                if (value != "on" && value != "off") {
+                    throw std::invalid_argument("expected flow_ends = on | off");
+                }
+                flow_ends = value == "on";
+            }
+            else if (key == "buffer_size_kb") {
+                session.buffer_size_kb = (std::uint32_t)number();
+            }
+            else if (key == "minimum_buffers") {
+                session.minimum_buffers = (std::uint32_t)number();
+            }
+            else if (key == "maximum_buffers") {
+                session.maximum_buffers = (std::uint32_t)number();
+            }
+            else if (key == "max_memory_kb") {
+                session.max_memory_kb = (std::uint32_t)number();
+            }
+            else if (key == "table_memory_kb") {
+                table_memory_kb = (std::size_t)number();
+            }
+            else {
+                throw std::invalid_argument("unknown key " + std::string{ key });
+            }
+        }
+
+        static inline std::string_view
+        trim(std::string_view str) noexcept {
+            while (!str.empty() && std::isspace((unsigned char)str.front())) str.remove_prefix(1);
+            while (!str.empty() && std::isspace((unsigned char)str.back()))  str.remove_suffix(1);
+            return str;
+        }
+    };
+}
@@ -0,0 +1,319 @@
+#pragma once
+
+// before anything includes windows.h, which would pull in winsock 1
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+
+#include <performance_monitor/fleet_table.h>
+#include <performance_monitor/output_sink.h>
+
+#include "top_view.h"
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace watcher {
+    namespace perf = performance;
+
+    /** Receives the frames of many fleet_reporter_t, one per host, and
+     *  merges them into a fleet_table_t. Every interval each host's
+     *  totals and the top K processes of the whole fleet go to the sink,
+     *  a summary line to std::cerr. One thread polls every connection. */
+    class fleet_collector_t {
+        using clock_t = std::chrono::steady_clock;
+    public:
+        fleet_collector_t(std::uint16_t port,
+                          std::chrono::milliseconds interval,
+                          std::unique_ptr<perf::output_sink_t> sink,
+                          std::size_t k = 20)
+            : _port{ port }
+            , _interval{ interval }
+            , _sink{ std::move(sink) }
+            , _k{ k }
+            , _buffer(256 * 1024) {}
+        fleet_collector_t(const fleet_collector_t&) = delete;
+        ~fleet_collector_t() noexcept {
+            for (auto& connection : _connections) {
+                ::closesocket(connection.socket);
+            }
+            if (_listener != INVALID_SOCKET) ::closesocket(_listener);
+            if (_started) ::WSACleanup();
+        }
+
+        inline int
+        run(const volatile bool& running) {
+            if (!listen()) {
+                return EXIT_FAILURE;
+            }
+            auto next_report = clock_t::now() + _interval;
+            while (running) {
+                poll(next_report);
+                const auto now = clock_t::now();
+                if (now >= next_report) {
+                    report(now);
+                    next_report = std::max(next_report + _interval, now);
+                }
+            }
+            if (_sink) {
+                _sink->flush();
+            }
+            return EXIT_SUCCESS;
+        }
+
+    private:
+        static constexpr std::uint32_t no_host = perf::fleet_table_t::no_host;
+
+        struct connection_t {
+            SOCKET                  socket{ INVALID_SOCKET };
+            perf::fleet_decoder_t   decoder;
+            std::uint32_t           host{ no_host };
+        };
+
+        struct host_state_t {
+            clock_t::time_point     last_frame;
+            bool                    connected{ false };
+        };
+
+        inline bool
+        listen() {
+            WSADATA data;
+            if (::WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+                std::cerr << "WSAStartup failed\n";
+                return false;
+            }
+            _started  = true;
+            _listener = ::socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
+            // IPv4 senders too
+            DWORD v6_only = 0;
+            (void)::setsockopt(_listener, IPPROTO_IPV6, IPV6_V6ONLY, (const char*)&v6_only, sizeof(v6_only));
+            sockaddr_in6 address{};
+            address.sin6_family = AF_INET6;
+            address.sin6_addr   = in6addr_any;
+            address.sin6_port   = htons(_port);
+            u_long non_blocking = 1;
+            if (_listener == INVALID_SOCKET ||
+                ::bind(_listener, (const sockaddr*)&address, sizeof(address)) != 0 ||
+                ::listen(_listener, SOMAXCONN) != 0 ||
+                ::ioctlsocket(_listener, FIONBIO, &non_blocking) != 0) {
+                std::cerr << "Unable to listen on port " << _port << ": " << ::WSAGetLastError() << "\n";
+                return false;
+            }
+            std::cerr << "Collecting on port " << _port << "\n";
+            return true;
+        }
+
+        /** Waits for data until @p deadline and reads what came. */
+        inline void
+        poll(clock_t::time_point deadline) {
+            _fds.clear();
+            _fds.push_back({ _listener, POLLRDNORM, 0 });
+            for (const auto& connection : _connections) {
+                _fds.push_back({ connection.socket, POLLRDNORM, 0 });
+            }
+            const auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock_t::now());
+            const auto ready   = ::WSAPoll(_fds.data(), (ULONG)_fds.size(), (INT)std::max<std::int64_t>(timeout.count(), 0));
+            if (ready <= 0) {
+                return;
+            }
+            const auto start = clock_t::now();
+            // back to front, so closing one doesn't move the ones still to check
+            for (auto ii = _fds.size() - 1; ii > 0; ii--) {
+                if (_fds[ii].revents && !receive(_connections[ii - 1])) {
+                    disconnect(ii - 1);
+                }
+            }
+            if (_fds[0].revents & POLLRDNORM) {
+                accept();
+            }
+            _busy += clock_t::now() - start;
+        }
+
+        inline void
+        accept() {
+            while (true) {
+                const auto socket = ::accept(_listener, nullptr, nullptr);
+                if (socket == INVALID_SOCKET) {
+                    return;
+                }
+                u_long non_blocking = 1;
+                (void)::ioctlsocket(socket, FIONBIO, &non_blocking);
+                _connections.emplace_back().socket = socket;
+            }
+        }
+
+        /** Reads and applies what arrived, false to close the connection. */
+        inline bool
+        receive(connection_t& connection) {
+            // the decoder only passes valid names, see fleet::valid_host()
+            const auto on_hello = [&](std::string_view name) {
+                const auto host = _table.host(name);
+                if (host == no_host) {
+                    std::cerr << "Too many hosts, dropping " << name << "\n";
+                    return false;
+                }
+                if (host >= _hosts.size()) {
+                    _hosts.resize(host + 1);
+                }
+                if (_hosts[host].connected && connection.host != host) {
+                    std::cerr << "Host " << name << " is already connected, dropping the new connection\n";
+                    return false;
+                }
+                if (connection.host != no_host && connection.host != host) {
+                    // renamed
+                    _hosts[connection.host].connected = false;
+                    _table.set_connected(connection.host, false);
+                }
+                connection.host = host;
+                _hosts[host].connected  = true;
+                _hosts[host].last_frame = clock_t::now();
+                _table.set_connected(host, true);
+                return true;
+            };
+            bool accepted{ true };
+            const auto on_frame = [&](std::int64_t timestamp_ns, bool key, const std::vector<perf::fleet_row_t>& rows) {
+                if (!accepted) {
+                    return;
+                }
+                _table.apply(connection.host, timestamp_ns, key, rows);
+                _hosts[connection.host].last_frame = clock_t::now();
+                _frames++;
+            };
+            // a few reads per poll, so one busy host can't starve the others
+            for (int reads = 0; reads < 4; reads++) {
+                const auto n = ::recv(connection.socket, _buffer.data(), (int)_buffer.size(), 0);
+                if (n == 0 || (n < 0 && ::WSAGetLastError() != WSAEWOULDBLOCK)) {
+                    return false;
+                }
+                if (n < 0) {
+                    return true;
+                }
+                _bytes += n;
+                const bool valid = connection.decoder.feed(_buffer.data(), (std::size_t)n,
+                                                           [&](std::string_view name) { accepted = accepted && on_hello(name); },
+                                                           on_frame);
+                if (!valid || !accepted) {
+                    return false;
+                }
+                if (n < (int)_buffer.size()) {
+                    return true;
+                }
+            }
+            return true;
+        }
+
+        inline void
+        disconnect(std::size_t index) {
+            auto& connection = _connections[index];
+            ::closesocket(connection.socket);
+            if (connection.host != no_host && _hosts[connection.host].connected) {
+                _hosts[connection.host].connected = false;
+                _table.set_connected(connection.host, false);
+            }
+            _connections.erase(_connections.begin() + index);
+        }
+
+        /** Writes the interval's rows, forgets hosts gone for forget_after intervals. */
+        inline void
+        report(clock_t::time_point now) {
+            const auto timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            const auto& rates = _table.rates();
+            const auto& hosts = _table.hosts();
+            std::size_t connected{ 0 };
+            double      bytes_per_s{ 0 };
+            for (std::uint32_t host = 0; host < hosts.size(); host++) {
+                auto& state = _hosts[host];
+                connected += state.connected;
+                if (!state.connected && !hosts[host].slots.empty() && now - state.last_frame > forget_after * _interval) {
+                    _table.forget(host);
+                }
+                const auto slot = _table.host_slot(host);
+                if (slot == _table.capacity()) {
+                    continue;
+                }
+                bytes_per_s += rates.sent[slot] + rates.recv[slot];
+                if (!_sink) {
+                    continue;
+                }
+                perf::output_record_t record{ perf::output_record_t::kind_t::host };
+                record.add("timestamp_ns", timestamp)
+                      .add_text("host", hosts[host].name.c_str())
+                      .add("connected", (std::int64_t)state.connected)
+                      .add("processes", (std::int64_t)hosts[host].slots.size() - 1)
+                      .add("last_frame_ms", (std::int64_t)std::chrono::duration_cast<std::chrono::milliseconds>(now - state.last_frame).count())
+                      .add("sent_per_s", rates.sent[slot])
+                      .add("recv_per_s", rates.recv[slot])
+                      .add("pkts_per_s", rates.packets[slot])
+                      .add("retx_per_s", rates.retransmissions[slot]);
+                _sink->write(record);
+            }
+            // top K processes of the fleet, like top_view_t
+            _rows.clear();
+            for (std::size_t ii = 0; ii < _table.capacity(); ii++) {
+                if (!rates.above[ii / 64]) {
+                    // a whole word of idle slots
+                    ii |= 63;
+                    continue;
+                }
+                const auto key = _table.key(ii);
+                if (!rates.is_above(ii) || key.pid == perf::fleet_row_t::host_pid) {
+                    continue;
+                }
+                top_row_t row;
+                row.host       = key.host;
+                row.pid        = key.pid;
+                row.sent_per_s = rates.sent[ii];
+                row.recv_per_s = rates.recv[ii];
+                row.pkts_per_s = rates.packets[ii];
+                row.retx_per_s = rates.retransmissions[ii];
+                _rows.push_back(row);
+            }
+            rank_top(_rows, _k, sort_key_t::bytes);
+            for (std::size_t ii = 0; _sink && ii < std::min(_k, _rows.size()); ii++) {
+                const auto& row = _rows[ii];
+                perf::output_record_t record{ perf::output_record_t::kind_t::host_pid };
+                record.add("timestamp_ns", timestamp)
+                      .add_text("host", hosts[row.host].name.c_str())
+                      .add("pid", (std::int64_t)row.pid)
+                      .add("sent_per_s", row.sent_per_s)
+                      .add("recv_per_s", row.recv_per_s)
+                      .add("pkts_per_s", row.pkts_per_s)
+                      .add("retx_per_s", row.retx_per_s);
+                _sink->write(record);
+            }
+            if (_sink) {
+                _sink->submit();
+            }
+            std::cerr << connected << "/" << hosts.size() << " hosts, "
+                      << _table.size() << " processes, "
+                      << _frames << " frames, "
+                      << _bytes / 1024 << " KiB in, "
+                      << std::chrono::duration_cast<std::chrono::milliseconds>(_busy).count() << " ms busy, fleet "
+                      << (std::int64_t)(bytes_per_s / 1024) << " KiB/s\n";
+            _frames = 0;
+            _bytes  = 0;
+            _busy   = {};
+        }
+
+        static constexpr int forget_after = 60;
+
+        std::uint16_t                             _port;
+        std::chrono::milliseconds                 _interval;
+        std::unique_ptr<perf::output_sink_t>      _sink;
+        std::size_t                               _k;
+        bool                                      _started{ false };
+        SOCKET                                    _listener{ INVALID_SOCKET };
+        std::vector<connection_t>                 _connections;
+        std::vector<WSAPOLLFD>                    _fds;
+        std::vector<char>                         _buffer;
+        perf::fleet_table_t                       _table;
+        std::vector<host_state_t>                 _hosts;
+        std::vector<top_row_t>                    _rows;
+        std::size_t                               _frames{ 0 };
+        std::int64_t                              _bytes{ 0 };
+        clock_t::duration                         _busy{};
+    };
+}
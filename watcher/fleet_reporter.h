@@ -0,0 +1,219 @@
+#pragma once
+
+// before anything includes windows.h, which would pull in winsock 1
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+
+#include <performance_monitor/fleet_codec.h>
+#include <performance_monitor/network_monitor.h>
+#include <performance_monitor/pid_table.h>
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace watcher {
+    namespace perf = performance;
+
+    /** Sends the counters of every interval to a collector, see
+     *  fleet_collector_t. Never blocks the caller: connecting and sending
+     *  are non blocking, an interval is skipped while the previous frame
+     *  is still on its way and the connection is dropped once too much
+     *  piles up. Every (re)connect starts with a hello and a key frame. */
+    class fleet_reporter_t {
+    public:
+        static constexpr std::size_t max_pending = 4 * 1024 * 1024;
+
+        /** @p collector is host:port, @p host the name to report as, the
+         *  computer name when empty. */
+        fleet_reporter_t(std::string_view collector, std::string host = {})
+            : _host{ std::move(host) } {
+            WSADATA data;
+            _started = ::WSAStartup(MAKEWORD(2, 2), &data) == 0;
+            const auto colon = collector.rfind(':');
+            _address = std::string{ collector.substr(0, colon) };
+            _port    = colon == std::string_view::npos ? std::string{} : std::string{ collector.substr(colon + 1) };
+            if (_host.empty()) {
+                char name[256]{};
+                _host = ::gethostname(name, sizeof(name)) == 0 ? name : "unknown";
+            }
+            if (!perf::fleet::valid_host(_host)) {
+                std::cerr << "Host name " << _host << " isn't valid, collectors will drop it\n";
+            }
+        }
+        fleet_reporter_t(const fleet_reporter_t&) = delete;
+        ~fleet_reporter_t() noexcept {
+            close();
+            if (_started) ::WSACleanup();
+        }
+
+        /** The monitored processes plus the host's totals out of @p snapshot. */
+        inline void
+        report(std::int64_t timestamp_ns,
+               const perf::network_snapshot_t& snapshot,
+               const std::vector<perf::pid_data_t>& rows) {
+            using counter_t = perf::counter_block_t::counter_t;
+            _rows.clear();
+            for (const auto& data : rows) {
+                auto& row = _rows.emplace_back();
+                row.pid = data.pid;
+                row.counters[counter_t::connections]     = (std::int64_t)data.connections;
+                row.counters[counter_t::pkg_sent]        = (std::int64_t)data.pkg_sent;
+                row.counters[counter_t::pkg_recv]        = (std::int64_t)data.pkg_recv;
+                row.counters[counter_t::bytes_sent]      = data.bytes_sent;
+                row.counters[counter_t::bytes_recv]      = data.bytes_recv;
+                row.counters[counter_t::retransmissions] = data.retransmissions;
+            }
+            auto& totals = _rows.emplace_back();
+            totals.pid = perf::fleet_row_t::host_pid;
+            totals.counters[counter_t::connections]     = (std::int64_t)snapshot.tcp.connections;
+            totals.counters[counter_t::pkg_sent]        = (std::int64_t)(snapshot.tcp.pkg_sent + snapshot.udp.pkg_sent);
+            totals.counters[counter_t::pkg_recv]        = (std::int64_t)(snapshot.tcp.pkg_recv + snapshot.udp.pkg_recv);
+            totals.counters[counter_t::bytes_sent]      = snapshot.tcp.bytes_sent + snapshot.udp.bytes_sent;
+            totals.counters[counter_t::bytes_recv]      = snapshot.tcp.bytes_recv + snapshot.udp.bytes_recv;
+            totals.counters[counter_t::retransmissions] = snapshot.tcp.retransmissions;
+            report(timestamp_ns, _rows);
+        }
+
+        /** Sends @p rows, sorted by pid in place, as one frame. */
+        inline void
+        report(std::int64_t timestamp_ns, std::vector<perf::fleet_row_t>& rows) {
+            if (!ready() || !flush()) {
+                _skipped++;
+                return;
+            }
+            if (!_pending.empty()) {
+                // the previous frame is still on its way
+                _skipped++;
+                return;
+            }
+            _encoder.encode(timestamp_ns, rows, _pending);
+            (void)flush();
+            _frames++;
+        }
+
+        inline bool
+        connected() const noexcept {
+            return _socket != INVALID_SOCKET && !_connecting;
+        }
+
+        inline const std::string&
+        host() const noexcept {
+            return _host;
+        }
+
+        /** Intervals sent and skipped (not connected or behind). */
+        inline std::size_t
+        frames() const noexcept {
+            return _frames;
+        }
+
+        inline std::size_t
+        skipped() const noexcept {
+            return _skipped;
+        }
+
+    private:
+        /** Whether the connection is up, starts it otherwise. */
+        inline bool
+        ready() {
+            if (_socket == INVALID_SOCKET) {
+                connect();
+                return false;
+            }
+            if (!_connecting) {
+                return true;
+            }
+            WSAPOLLFD fd{ _socket, POLLWRNORM, 0 };
+            if (::WSAPoll(&fd, 1, 0) <= 0) {
+                return false;
+            }
+            if (fd.revents & (POLLERR | POLLHUP)) {
+                close();
+                return false;
+            }
+            _connecting = false;
+            _encoder.reset();
+            _encoder.hello(_host, _pending);
+            return true;
+        }
+
+        inline void
+        connect() {
+            addrinfo hints{};
+            hints.ai_family   = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            hints.ai_protocol = IPPROTO_TCP;
+            addrinfo* address = nullptr;
+            if (::getaddrinfo(_address.c_str(), _port.c_str(), &hints, &address) != 0 || !address) {
+                if (!_warned) {
+                    std::cerr << "Unable to resolve collector " << _address << ":" << _port << "\n";
+                    _warned = true;
+                }
+                return;
+            }
+            _socket = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+            u_long non_blocking = 1;
+            if (_socket == INVALID_SOCKET || ::ioctlsocket(_socket, FIONBIO, &non_blocking) != 0) {
+                ::freeaddrinfo(address);
+                close();
+                return;
+            }
+            const BOOL no_delay = TRUE;
+            (void)::setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&no_delay, sizeof(no_delay));
+            const auto result = ::connect(_socket, address->ai_addr, (int)address->ai_addrlen);
+            ::freeaddrinfo(address);
+            if (result != 0 && ::WSAGetLastError() != WSAEWOULDBLOCK) {
+                close();
+                return;
+            }
+            _connecting = true;
+            _pending.clear();
+        }
+
+        /** Sends what the socket takes, false once the connection is gone. */
+        inline bool
+        flush() {
+            std::size_t sent{ 0 };
+            while (sent < _pending.size()) {
+                const auto n = ::send(_socket, _pending.data() + sent, (int)(_pending.size() - sent), 0);
+                if (n > 0) {
+                    sent += n;
+                    continue;
+                }
+                if (n < 0 && ::WSAGetLastError() == WSAEWOULDBLOCK && _pending.size() <= max_pending) {
+                    break;
+                }
+                close();
+                return false;
+            }
+            _pending.erase(_pending.begin(), _pending.begin() + sent);
+            return true;
+        }
+
+        inline void
+        close() noexcept {
+            if (_socket != INVALID_SOCKET) {
+                ::closesocket(_socket);
+            }
+            _socket     = INVALID_SOCKET;
+            _connecting = false;
+            _pending.clear();
+        }
+
+        bool                                      _started{ false };
+        bool                                      _warned{ false };
+        std::string                               _address;
+        std::string                               _port;
+        std::string                               _host;
+        SOCKET                                    _socket{ INVALID_SOCKET };
+        bool                                      _connecting{ false };
+        perf::fleet_encoder_t                     _encoder;
+        std::vector<char>                         _pending;
+        std::vector<perf::fleet_row_t>            _rows;
+        std::size_t                               _frames{ 0 };
+        std::size_t                               _skipped{ 0 };
+    };
+}
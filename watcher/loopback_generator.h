@@ -0,0 +1,189 @@
+#pragma once
+
+// before anything includes windows.h, which would pull in winsock 1
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace watcher {
+
+    /** Traffic of one loopback_generator_t::run(). */
+    struct loopback_traffic_t {
+        std::uint32_t   connections{ 0 };   // one message stream each
+        std::uint32_t   messages{ 0 };      // per connection
+        std::uint32_t   message_size{ 1024 };
+        std::uint32_t   datagrams{ 0 };
+        std::uint32_t   datagram_size{ 512 };
+        std::uint64_t   bytes_per_s{ 0 };   // 0 as fast as possible
+    };
+
+    /** What actually went through the sockets. */
+    struct loopback_result_t {
+        std::int64_t    tcp_bytes_sent{ 0 };
+        std::int64_t    tcp_bytes_recv{ 0 };
+        std::int64_t    udp_bytes_sent{ 0 };
+        std::int64_t    udp_bytes_recv{ 0 };
+        std::uint32_t   tcp_sends{ 0 };         // send() calls, a segment at most each
+        std::uint32_t   udp_datagrams_sent{ 0 };
+        std::uint32_t   udp_datagrams_recv{ 0 };
+        std::uint32_t   connections{ 0 };
+        double          seconds{ 0 };
+    };
+
+    /** Deterministic TCP and UDP traffic over 127.0.0.1, from and to this
+     *  process, so a monitor of this process can be checked against the
+     *  exact byte counts. Connections are opened and closed for every
+     *  stream to exercise connect/accept/disconnect too. */
+    class loopback_generator_t {
+    public:
+        loopback_generator_t() = default;
+        loopback_generator_t(const loopback_generator_t&) = delete;
+        ~loopback_generator_t() noexcept {
+            if (_listener != INVALID_SOCKET) ::closesocket(_listener);
+            if (_udp_server != INVALID_SOCKET) ::closesocket(_udp_server);
+            if (_started) ::WSACleanup();
+        }
+
+        inline bool
+        start() {
+            WSADATA data;
+            if (::WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+                std::cerr << "WSAStartup failed\n";
+                return false;
+            }
+            _started    = true;
+            _listener   = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            _udp_server = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+            if (_listener == INVALID_SOCKET || _udp_server == INVALID_SOCKET ||
+                !bind_loopback(_listener, _tcp_address) || ::listen(_listener, SOMAXCONN) != 0 ||
+                !bind_loopback(_udp_server, _udp_address)) {
+                std::cerr << "Failed to open loopback sockets: " << ::WSAGetLastError() << "\n";
+                return false;
+            }
+            // a lost datagram must not hang the receiver
+            DWORD timeout_ms = 200;
+            (void)::setsockopt(_udp_server, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout_ms, sizeof(timeout_ms));
+            return true;
+        }
+
+        /** Generates @p traffic and returns once every byte was received. */
+        inline loopback_result_t
+        run(const loopback_traffic_t& traffic) {
+            loopback_result_t result;
+            const auto start = std::chrono::steady_clock::now();
+            std::atomic<std::int64_t>  tcp_recv{ 0 }, udp_recv{ 0 };
+            std::atomic<std::uint32_t> udp_datagrams{ 0 };
+
+            std::thread server([&]() {
+                std::vector<char> buffer(64 * 1024);
+                for (std::uint32_t ii = 0; ii < traffic.connections; ii++) {
+                    const auto client = ::accept(_listener, nullptr, nullptr);
+                    if (client == INVALID_SOCKET) break;
+                    int n;
+                    while ((n = ::recv(client, buffer.data(), (int)buffer.size(), 0)) > 0) {
+                        tcp_recv += n;
+                    }
+                    ::closesocket(client);
+                }
+            });
+            std::thread udp_server([&]() {
+                std::vector<char> buffer(64 * 1024);
+                const auto expected = (std::int64_t)traffic.datagrams * traffic.datagram_size;
+                while (udp_recv < expected) {
+                    const auto n = ::recv(_udp_server, buffer.data(), (int)buffer.size(), 0);
+                    if (n <= 0) break;
+                    udp_recv += n;
+                    udp_datagrams++;
+                }
+            });
+
+            std::vector<char> message(std::max(traffic.message_size, traffic.datagram_size), 'x');
+            pacer_t pacer{ traffic.bytes_per_s };
+            for (std::uint32_t ii = 0; ii < traffic.connections; ii++) {
+                const auto client = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+                if (client == INVALID_SOCKET ||
+                    ::connect(client, (const sockaddr*)&_tcp_address, sizeof(_tcp_address)) != 0) {
+                    std::cerr << "Loopback connect failed: " << ::WSAGetLastError() << "\n";
+                    if (client != INVALID_SOCKET) ::closesocket(client);
+                    break;
+                }
+                result.connections++;
+                for (std::uint32_t mm = 0; mm < traffic.messages; mm++) {
+                    result.tcp_bytes_sent += send_all(client, message.data(), traffic.message_size, result.tcp_sends);
+                    pacer.wait(traffic.message_size);
+                }
+                ::shutdown(client, SD_SEND);
+                ::closesocket(client);
+            }
+            const auto udp_client = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+            for (std::uint32_t ii = 0; ii < traffic.datagrams && udp_client != INVALID_SOCKET; ii++) {
+                const auto n = ::sendto(udp_client, message.data(), (int)traffic.datagram_size, 0,
+                                        (const sockaddr*)&_udp_address, sizeof(_udp_address));
+                result.udp_bytes_sent     += n > 0 ? n : 0;
+                result.udp_datagrams_sent += n > 0;
+                pacer.wait(traffic.datagram_size);
+            }
+            if (udp_client != INVALID_SOCKET) ::closesocket(udp_client);
+
+            server.join();
+            udp_server.join();
+            result.tcp_bytes_recv = tcp_recv;
+            result.udp_bytes_recv = udp_recv;
+            result.udp_datagrams_recv = udp_datagrams;
+            result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            return result;
+        }
+
+    private:
+        /** Spreads sends to average bytes_per_s. */
+        struct pacer_t {
+            std::uint64_t                           bytes_per_s;
+            std::chrono::steady_clock::time_point   start{ std::chrono::steady_clock::now() };
+            std::uint64_t                           bytes{ 0 };
+
+            inline void
+            wait(std::uint64_t sent) {
+                bytes += sent;
+                if (!bytes_per_s) return;
+                std::this_thread::sleep_until(start + std::chrono::microseconds{ bytes * 1000000 / bytes_per_s });
+            }
+        };
+
+        static inline bool
+        bind_loopback(SOCKET socket, sockaddr_in& address) {
+            address = sockaddr_in{};
+            address.sin_family      = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            address.sin_port        = 0;
+            int length = sizeof(address);
+            return ::bind(socket, (const sockaddr*)&address, sizeof(address)) == 0 &&
+                   ::getsockname(socket, (sockaddr*)&address, &length) == 0;
+        }
+
+        static inline std::int64_t
+        send_all(SOCKET socket, const char* data, std::uint32_t size, std::uint32_t& sends) {
+            std::int64_t sent{ 0 };
+            while (sent < size) {
+                const auto n = ::send(socket, data + sent, (int)(size - sent), 0);
+                if (n <= 0) break;
+                sent += n;
+                sends++;
+            }
+            return sent;
+        }
+
+        bool                                      _started{ false };
+        SOCKET                                    _listener{ INVALID_SOCKET };
+        SOCKET                                    _udp_server{ INVALID_SOCKET };
+        sockaddr_in                               _tcp_address{};
+        sockaddr_in                               _udp_address{};
+    };
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdio>
+
+namespace watcher {
+
+    /** @p value per second with a K, M or G suffix, 1024 based, into @p out. */
+    inline const char*
+    readable_rate(double value, char (&out)[16]) {
+        const char* units = " KMG";
+        while (value >= 1000 && units[1]) {
+            value /= 1024;
+            units++;
+        }
+        std::snprintf(out, sizeof(out), "%.1f%c", value, *units);
+        return out;
+    }
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <performance_monitor/thread_table.h>
+
+#include "console_screen_buffer.h"
+#include "readable_rate.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <unordered_map>
+#include <vector>
+
+namespace watcher {
+    namespace perf = performance;
+
+    struct thread_row_t {
+        std::uint32_t   tid{ 0 };
+        double          sent_per_s{ 0 };
+        double          recv_per_s{ 0 };
+        double          pkts_per_s{ 0 };
+        double          retx_per_s{ 0 };
+    };
+
+    /** Busiest threads of one process in a thread_table_t, by bytes. */
+    class thread_view_t {
+    public:
+        thread_view_t(const perf::thread_table_t& table, std::uint32_t pid, std::size_t k)
+            : _table{ table }
+            , _pid{ pid }
+            , _k{ k } {}
+
+        /** Samples the table, @p interval_s since the previous call. */
+        inline void
+        update(double interval_s) {
+            interval_s = interval_s > 0 ? interval_s : 1.0;
+            _table.snapshot(_threads, _pid);
+            _rows.clear();
+            std::unordered_map<std::uint32_t, perf::thread_data_t> current;
+            for (const auto& data : _threads) {
+                // evicted and reused tids start over from zero
+                const auto it   = _last.find(data.tid);
+                const auto last = it != _last.end() &&
+                                  it->second.pkg_sent + it->second.pkg_recv <= data.pkg_sent + data.pkg_recv
+                                ? it->second : perf::thread_data_t{};
+                thread_row_t row;
+                row.tid        = data.tid;
+                row.sent_per_s = (data.bytes_sent - last.bytes_sent) / interval_s;
+                row.recv_per_s = (data.bytes_recv - last.bytes_recv) / interval_s;
+                row.pkts_per_s = ((data.pkg_sent - last.pkg_sent) + (data.pkg_recv - last.pkg_recv)) / interval_s;
+                row.retx_per_s = (data.retransmissions - last.retransmissions) / interval_s;
+                _rows.push_back(row);
+                current.emplace(data.tid, data);
+            }
+            _last.swap(current);
+            const auto k = std::min(_k, _rows.size());
+            const auto greater = [](const thread_row_t& a, const thread_row_t& b) {
+                return a.sent_per_s + a.recv_per_s > b.sent_per_s + b.recv_per_s;
+            };
+            std::nth_element(_rows.begin(), _rows.begin() + k, _rows.end(), greater);
+            std::sort(_rows.begin(), _rows.begin() + k, greater);
+        }
+
+        /** Draws the rows starting at @p line, column titles included. */
+        inline void
+        render(console::screen_buffer_t& screen, std::int16_t line) const {
+            char text[64];
+            screen << console::position_t{ line++, 0 }
+                   << console::foreground_color_t{ console::color_t::DARKCYAN }
+                   << "Threads:    TID  sent/s  recv/s  pkts/s retx/s"
+                   << console::foreground_color_t{ console::color_t::WHITE };
+            for (std::size_t ii = 0; ii < _k; ii++, line++) {
+                if (ii >= _rows.size()) {
+                    screen << console::position_t{ line, 0 } << "\n";
+                    continue;
+                }
+                const auto& row = _rows[ii];
+                char sent[16], recv[16], pkts[16];
+                std::snprintf(text, sizeof(text), "%14u %7s %7s %7s %6.0f",
+                              row.tid,
+                              readable_rate(row.sent_per_s, sent),
+                              readable_rate(row.recv_per_s, recv),
+                              readable_rate(row.pkts_per_s, pkts),
+                              row.retx_per_s);
+                screen << console::position_t{ line, 0 } << (const char*)text;
+            }
+        }
+
+        inline std::size_t
+        size() const noexcept {
+            return _threads.size();
+        }
+
+    private:
+        const perf::thread_table_t&               _table;
+        std::uint32_t                             _pid;
+        std::size_t                               _k;
+        std::vector<perf::thread_data_t>          _threads;
+        std::vector<thread_row_t>                 _rows;
+        std::unordered_map<std::uint32_t, perf::thread_data_t> _last;
+    };
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <performance_monitor/pid_table.h>
+#include <performance_monitor/process_monitor.h>
+
+#include "console_screen_buffer.h"
+#include "readable_rate.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <utility>
+#include <vector>
+
+namespace watcher {
+    namespace perf = performance;
+
+    enum class sort_key_t {
+        bytes,
+        packets,
+        retransmissions,
+    };
+
+    struct top_row_t {
+        std::uint32_t   pid{ 0 };
+        std::uint32_t   host{ 0 };      // of a fleet_table_t, 0 for this one
+        double          sent_per_s{ 0 };
+        double          recv_per_s{ 0 };
+        double          pkts_per_s{ 0 };
+        double          retx_per_s{ 0 };
+    };
+
+    /** Moves the @p k rows with the highest @p key rates to the front of
+     *  @p rows, sorted; the others are left in any order. */
+    inline void
+    rank_top(std::vector<top_row_t>& rows, std::size_t k, sort_key_t key) {
+        k = std::min(k, rows.size());
+        const auto greater = [key](const top_row_t& a, const top_row_t& b) {
+            switch (key) {
+            case sort_key_t::packets:         return a.pkts_per_s > b.pkts_per_s;
+            case sort_key_t::retransmissions: return a.retx_per_s > b.retx_per_s;
+            default:                          return a.sent_per_s + a.recv_per_s > b.sent_per_s + b.recv_per_s;
+            }
+        };
+        std::nth_element(rows.begin(), rows.begin() + k, rows.end(), greater);
+        std::sort(rows.begin(), rows.begin() + k, greater);
+    }
+
+    /** Top-K processes of a pid_table_t ranked by rate.
+     *  Rates of every slot come from one interval_rates() pass over the
+     *  table's columns, only processes with traffic in the interval become
+     *  rows, and only the K shown rows are sorted. */
+    class top_view_t {
+    public:
+        top_view_t(const perf::pid_table_t& table, std::size_t k)
+            : _table{ table }
+            , _k{ k }
+            , _current{ table.counters().size() }
+            , _previous{ table.counters().size() }
+            , _rates{ table.counters().size() }
+            , _keys(table.capacity(), perf::pid_table_t::empty_pid) {
+            _rows.reserve(_table.capacity());
+        }
+
+        inline void
+        set_sort_key(sort_key_t key) noexcept {
+            _sort_key = key;
+            rank();
+        }
+
+        inline sort_key_t
+        sort_key() const noexcept {
+            return _sort_key;
+        }
+
+        /** Samples the table, @p interval_s since the previous call. */
+        inline void
+        update(double interval_s) {
+            interval_s = interval_s > 0 ? interval_s : 1.0;
+            _rows.clear();
+            // slots start from zero, the previous sample of a new process
+            // is already right unless its slot was evicted and reused since
+            _current.copy_from(_table.counters());
+            perf::interval_rates(_current, _previous, 1.0 / interval_s, 0.0, _rates);
+            for (std::size_t ii = 0; ii < _table.capacity(); ii++) {
+                const auto pid      = _table.key(ii);
+                const auto previous = std::exchange(_keys[ii], pid);
+                const bool reused   = previous != pid && previous != perf::pid_table_t::empty_pid &&
+                                      previous != perf::pid_table_t::evicted_pid;
+                // any counter the rows rank by, retransmits alone included
+                const bool moved = _rates.is_above(ii) || _rates.packets[ii] > 0 || _rates.retransmissions[ii] > 0;
+                if (!moved || !_table.used(ii) || reused) {
+                    continue;
+                }
+                top_row_t row;
+                row.pid        = pid;
+                row.sent_per_s = _rates.sent[ii];
+                row.recv_per_s = _rates.recv[ii];
+                row.pkts_per_s = _rates.packets[ii];
+                row.retx_per_s = _rates.retransmissions[ii];
+                _rows.push_back(row);
+            }
+            std::swap(_current, _previous);
+            rank();
+        }
+
+        /** Draws the table starting at @p line. */
+        inline void
+        render(console::screen_buffer_t& screen,
+               std::int16_t line,
+               const perf::process_monitor_t& processes) const {
+            char text[64];
+            screen << console::position_t{ line++, 0 }
+                   << console::foreground_color_t{ console::color_t::DARKCYAN }
+                   << "   PID name        sent/s  recv/s  pkts/s retx/s"
+                   << console::foreground_color_t{ console::color_t::WHITE };
+            for (std::size_t ii = 0; ii < _k; ii++, line++) {
+                if (ii >= std::min(_k, _rows.size())) {
+                    screen << console::position_t{ line, 0 } << "\n";
+                    continue;
+                }
+                const auto& row     = _rows[ii];
+                const auto  process = processes.process_data(row.pid);
+                char sent[16], recv[16], pkts[16];
+                std::snprintf(text, sizeof(text), "%6u %-9.9s %7s %7s %7s %6.0f",
+                              row.pid,
+                              process ? process->name : "?",
+                              readable_rate(row.sent_per_s, sent),
+                              readable_rate(row.recv_per_s, recv),
+                              readable_rate(row.pkts_per_s, pkts),
+                              row.retx_per_s);
+                screen << console::position_t{ line, 0 } << (const char*)text;
+            }
+        }
+
+    private:
+        inline void
+        rank() {
+            rank_top(_rows, _k, _sort_key);
+        }
+
+        const perf::pid_table_t&                  _table;
+        std::size_t                               _k;
+        sort_key_t                                _sort_key{ sort_key_t::bytes };
+        perf::counter_block_t                     _current;
+        perf::counter_block_t                     _previous;
+        perf::rate_block_t                        _rates;
+        std::vector<top_row_t>                    _rows;
+        std::vector<std::uint32_t>                _keys;      // of _previous
+    };
+}
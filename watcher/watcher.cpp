@@ -1,15 +1,26 @@
 // watcher.cpp : This file contains the 'main' function. Program execution begins and ends there.
 //
+#include "loopback_generator.h"
+#include "fleet_collector.h"
+#include "fleet_reporter.h"
+#include <random>
 #include <sstream>
 #include <string>
 #include <iostream>
+#include <performance_monitor/capture_analyzer.h>
 #include <performance_monitor/network_monitor.h>
 #include <performance_monitor/moving_average.h>
+#include <performance_monitor/output_sink.h>
+#include <performance_monitor/process_monitor.h>
 
 #include "console_screen_buffer.h"
+#include "daemon.h"
+#include "thread_view.h"
+#include "top_view.h"
 
 inline static console::screen_buffer_t screen;
 inline static bool s_running = true;
+inline static bool s_daemon  = false;
 const auto Kib = 1024;
 const auto Mib = 1024 * Kib;
 const auto Gib = 1024 * Mib;
@@ -34,6 +45,11 @@ get_readable_size(double value) {
 BOOL WINAPI
 consoleHandler(DWORD signal) {
     using namespace std::chrono_literals;
+    if (s_daemon) {
+        // also the service wrapper closing or the system shutting down
+        s_running = false;
+        return TRUE;
+    }
     if (signal == CTRL_C_EVENT) {
         screen.clean_screen();
         s_running = false;
@@ -44,25 +60,427 @@ consoleHandler(DWORD signal) {
     return TRUE;
 }
 
+/** Wall clock of "now" in the event clock, so rows line up with event timestamps. */
+inline std::int64_t
+now_unix_ns(const perf::network_monitor_t& monitor) {
+    return monitor.event_clock().to_unix_ns(perf::tick_clock_t::qpc());
+}
+
+inline int
+run_system_wide(const perf::network_monitor_t& monitor,
+                const perf::process_monitor_t& processes,
+                std::uint64_t interval,
+                perf::output_sink_t* sink) {
+    using namespace std::chrono_literals;
+    watcher::top_view_t view{ monitor.pid_table(), 40 };
+    std::vector<perf::pid_data_t> pids;
+    perf::timestamp_t ts, frame_ts;
+    screen << console::foreground_color_t{ console::color_t::DARKCYAN }
+           << "All processes, sort by [b]ytes [p]ackets [r]etx"
+           << console::foreground_color_t{ console::color_t::WHITE }
+           << console::flush_t{};
+    while (s_running) {
+        while (_kbhit()) {
+            switch (_getch()) {
+            case 'b': view.set_sort_key(watcher::sort_key_t::bytes);           break;
+            case 'p': view.set_sort_key(watcher::sort_key_t::packets);         break;
+            case 'r': view.set_sort_key(watcher::sort_key_t::retransmissions); break;
+            }
+        }
+        if (ts.ms() > interval) {
+            const auto interval_s = ts.sec();
+            ts.now();
+            frame_ts.now();
+            view.update(interval_s);
+            view.render(screen, 2, processes);
+            if (sink) {
+                const auto now = now_unix_ns(monitor);
+                pids.clear();
+                monitor.pid_table().snapshot(pids);
+                sink->write(now, monitor.snapshot());
+                for (const auto& data : pids) {
+                    sink->write(now, data);
+                }
+                sink->submit();
+            }
+            screen << console::position_t{ 1, 0 } << "frame: "
+                   << std::to_string(frame_ts.us()).append(" us, pids: ")
+                   << monitor.pid_table().size() << "\n"
+                   << console::flush_t{};
+        }
+        std::this_thread::sleep_for(50ms);
+    }
+    return EXIT_SUCCESS;
+}
+
+/** Aggregates a recorded capture on every core, rows go to stdout. */
+inline int
+analyze(int argc, char* argv[]) {
+    try {
+        if (argc < 3) {
+            throw std::invalid_argument("missing capture");
+        }
+        const auto interval = std::chrono::milliseconds{ argc >= 4 ? std::stoull(argv[3]) : 1000ull };
+        const auto threads  = argc >= 5 ? std::stoul(argv[4]) : std::thread::hardware_concurrency();
+        const auto format   = perf::parse_output_format(argc >= 6 ? argv[5] : "jsonl");
+        if (!format) {
+            throw std::invalid_argument("unknown output format");
+        }
+        perf::timestamp_t ts;
+        auto analysis = perf::analyze_capture(argv[2], interval, threads);
+        if (!analysis) {
+            return EXIT_FAILURE;
+        }
+        const auto elapsed_ms = ts.ms();
+        if (auto sink = perf::make_output_sink(*format, "-")) {
+            analysis->write(*sink);
+        }
+        std::cerr << analysis->events << " events in " << elapsed_ms << " ms, "
+                  << analysis->pids.size() << " processes, "
+                  << analysis->flows.size() << " flows, ~"
+                  << (std::uint64_t)analysis->peers.estimate() << " remote endpoints, payload p50/p99 "
+                  << analysis->sizes.percentile(0.5) << "/" << analysis->sizes.percentile(0.99) << " B\n";
+        return EXIT_SUCCESS;
+    }
+    catch (std::exception& err) {
+        std::cerr << "Fail to parse input arguments.\n"
+                  << "Usage: watcher.exe --analyze <Capture: path> [<Interval(ms): ull> [<Threads: uint> [jsonl | csv | binary]]]\n"
+                  << "Original exception: " << err.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
+
+/** Replays a capture through the sampler at every rate up to 1024 and
+ *  prints how far the sampled byte total lands from the exact one. */
+inline int
+sampling_error(int argc, char* argv[]) {
+    const std::string_view mode_name = argc >= 4 ? argv[3] : "flow";
+    if (argc < 3 || (mode_name != "every" && mode_name != "flow")) {
+        std::cerr << "Usage: watcher.exe --sampling-error <Capture: path> [every | flow]";
+        return EXIT_FAILURE;
+    }
+    const auto mode = mode_name == "every" ? perf::sampling_mode_t::every_nth : perf::sampling_mode_t::flow_hash;
+    std::vector<std::uint32_t> rates;
+    for (std::uint32_t rate = 1; rate <= 1024; rate <<= 1) {
+        rates.push_back(rate);
+    }
+    const auto errors = perf::replay_sampling(argv[2], mode, rates);
+    if (!errors) {
+        return EXIT_FAILURE;
+    }
+    char line[128];
+    std::cout << "    rate         kept     error   +-95%   covered\n";
+    for (const auto& error : *errors) {
+        std::snprintf(line, sizeof(line), "%8u %12zu %8.3f%% %6.3f%% %9s\n",
+                      error.rate, error.events_kept,
+                      error.relative_error() * 100,
+                      error.exact > 0 ? error.estimate.margin / error.exact * 100 : 0.0,
+                      error.covered() ? "yes" : "no");
+        std::cout << line;
+    }
+    return EXIT_SUCCESS;
+}
+
+/** Merges the counters of every watcher reporting to @p port, see
+ *  fleet_collector_t. */
+inline int
+collect(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: watcher.exe --collect <Port: uint> [<Interval(ms): ull> [<Output: path | -> [jsonl | csv | binary]]]";
+        return EXIT_FAILURE;
+    }
+    try {
+        const auto port     = (std::uint16_t)std::stoul(argv[2]);
+        const auto interval = std::chrono::milliseconds{ argc >= 4 ? std::stoull(argv[3]) : 1000ull };
+        std::unique_ptr<perf::output_sink_t> sink;
+        if (argc >= 5) {
+            const auto format = perf::parse_output_format(argc >= 6 ? argv[5] : "jsonl");
+            if (!format) {
+                throw std::invalid_argument("unknown output format");
+            }
+            if (!(sink = perf::make_output_sink(*format, argv[4]))) {
+                return EXIT_FAILURE;
+            }
+        }
+        s_daemon = true;
+        (void)SetConsoleCtrlHandler(consoleHandler, TRUE);
+        return watcher::fleet_collector_t{ port, interval, std::move(sink) }.run(s_running);
+    }
+    catch (std::exception& err) {
+        std::cerr << "Error: " << err.what() << "\n";
+        return EXIT_FAILURE;
+    }
+}
+
+/** Stand-ins for a fleet on one machine: @p hosts reporters named
+ *  load-<n>, each with @p processes processes of random traffic,
+ *  reporting once a second, spread over the second. */
+inline int
+fleet_load(int argc, char* argv[]) {
+    using counter_t = perf::counter_block_t::counter_t;
+    if (argc < 4) {
+        std::cerr << "Usage: watcher.exe --fleet-load <Collector: host:port> <Hosts: uint> [<Processes: uint>]";
+        return EXIT_FAILURE;
+    }
+    const std::string_view collector = argv[2];
+    const auto hosts     = (std::size_t)std::stoul(argv[3]);
+    const auto processes = (std::size_t)(argc >= 5 ? std::stoul(argv[4]) : 50);
+    std::vector<std::unique_ptr<watcher::fleet_reporter_t>> reporters;
+    std::vector<std::vector<perf::fleet_row_t>>             rows(hosts);
+    for (std::size_t host = 0; host < hosts; host++) {
+        reporters.push_back(std::make_unique<watcher::fleet_reporter_t>(collector, "load-" + std::to_string(host)));
+        rows[host].resize(processes + 1);
+        for (std::size_t ii = 0; ii < processes; ii++) {
+            rows[host][ii].pid = (std::uint32_t)(4 * ii + 1000);
+        }
+        rows[host][processes].pid = perf::fleet_row_t::host_pid;
+    }
+    s_daemon = true;
+    (void)SetConsoleCtrlHandler(consoleHandler, TRUE);
+    std::mt19937_64 random{ 1 };
+    auto second = std::chrono::steady_clock::now();
+    while (s_running) {
+        for (std::size_t host = 0; host < hosts && s_running; host++) {
+            std::this_thread::sleep_until(second + host * std::chrono::seconds{ 1 } / hosts);
+            // a quarter of the processes move every second, totals last
+            auto& host_rows = rows[host];
+            auto& totals    = host_rows.back();
+            for (std::size_t ii = 0; ii + 1 < host_rows.size(); ii++) {
+                if (random() % 4) {
+                    continue;
+                }
+                const auto packets = (std::int64_t)(random() % 100);
+                const auto bytes   = packets * (std::int64_t)(random() % 1400 + 60);
+                const bool sent    = random() % 2;
+                for (auto* row : { &host_rows[ii], &totals }) {
+                    row->counters[sent ? counter_t::bytes_sent : counter_t::bytes_recv] += bytes;
+                    row->counters[sent ? counter_t::pkg_sent : counter_t::pkg_recv]     += packets;
+                }
+                host_rows[ii].counters[counter_t::retransmissions] += random() % 100 == 0;
+            }
+            const auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            reporters[host]->report(now, host_rows);
+        }
+        second += std::chrono::seconds{ 1 };
+        std::size_t connected{ 0 }, skipped{ 0 };
+        for (const auto& reporter : reporters) {
+            connected += reporter->connected();
+            skipped   += reporter->skipped();
+        }
+        std::cerr << connected << "/" << hosts << " connected, " << skipped << " intervals skipped\n";
+    }
+    return EXIT_SUCCESS;
+}
+
+/** Counter deltas of a monitor of this process once every byte, datagram
+ *  and disconnect of a loopback run arrived, or nothing changed for 3 s
+ *  (trace buffers are flushed every second). */
+inline perf::network_snapshot_t
+wait_for_events(const perf::network_monitor_t& monitor,
+                const perf::network_snapshot_t& before,
+                const watcher::loopback_result_t& expected) {
+    using namespace std::chrono_literals;
+    auto last    = monitor.snapshot();
+    auto changed = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - changed < 3s) {
+        std::this_thread::sleep_for(100ms);
+        const auto current = monitor.snapshot();
+        if (current.tcp.bytes_sent - before.tcp.bytes_sent >= expected.tcp_bytes_sent &&
+            current.tcp.bytes_recv - before.tcp.bytes_recv >= expected.tcp_bytes_recv &&
+            current.udp.bytes_sent - before.udp.bytes_sent >= expected.udp_bytes_sent &&
+            current.udp.bytes_recv - before.udp.bytes_recv >= expected.udp_bytes_recv &&
+            current.udp.pkg_sent - before.udp.pkg_sent >= expected.udp_datagrams_sent &&
+            current.udp.pkg_recv - before.udp.pkg_recv >= expected.udp_datagrams_recv &&
+            current.tcp.connections_lost - before.tcp.connections_lost >= expected.connections) {
+            return current;
+        }
+        if (current.stats.events_used != last.stats.events_used) {
+            changed = std::chrono::steady_clock::now();
+        }
+        last = current;
+    }
+    return last;
+}
+
+/** Monitors this process while it talks to itself over 127.0.0.1 at
+ *  increasing rates: checks the byte, packet and disconnect counters
+ *  against what went through the sockets and reports what the monitor
+ *  cost at each rate. */
+inline int
+self_test() {
+    using namespace std::chrono_literals;
+    watcher::loopback_generator_t generator;
+    if (!generator.start()) {
+        return EXIT_FAILURE;
+    }
+    const auto pid = (std::uint32_t)::GetCurrentProcessId();
+    perf::process_monitor_t process_monitor;
+    if (!process_monitor.start(200ms, { pid })) {
+        return EXIT_FAILURE;
+    }
+    std::this_thread::sleep_for(500ms);
+    const auto memory = [&]() {
+        return (std::int64_t)process_monitor.process_data(pid).value_or(perf::process_data_t{}).private_bytes;
+    };
+    const auto memory_before = memory();
+
+    perf::network_monitor_t monitor;
+    if (!monitor.start(perf::session_trace_handler_t::create_guid(), pid)) {
+        std::cerr << "Failed to start monitor\n";
+        return EXIT_FAILURE;
+    }
+    if (!monitor.wait_ready(5s)) {
+        std::cerr << "No event within 5 s, counting anyway\n";
+    }
+    std::cout << "First event " << monitor.event_stats().time_to_first_event_ns / 1000 << " us after start\n";
+
+    watcher::loopback_traffic_t levels[4];
+    for (std::size_t ii = 0; ii < 4; ii++) {
+        levels[ii].connections   = 20;
+        levels[ii].messages      = 250 << (2 * ii);
+        levels[ii].message_size  = 1000 + 37 * (std::uint32_t)ii;   // odd sizes catch off by ones
+        levels[ii].datagrams     = 1000 << (2 * ii);
+        levels[ii].datagram_size = 512 + 3 * (std::uint32_t)ii;
+        levels[ii].bytes_per_s   = ii < 3 ? (std::uint64_t)Mib << (3 * ii) : 0;
+    }
+    bool passed = true;
+    char line[200];
+    std::cout << "   MiB/s    events   tcp sent/recv   udp sent/recv   pkgs  conns   lost   trace cpu   cb p99   memory\n";
+    for (const auto& traffic : levels) {
+        const auto before   = monitor.snapshot();
+        const auto expected = generator.run(traffic);
+        const auto after    = wait_for_events(monitor, before, expected);
+        const auto counted  = [](std::int64_t delta, std::int64_t expected) {
+            return delta == expected ? "ok" : "FAIL";
+        };
+        // a datagram is a packet; on loopback a send is at most one
+        // segment, but Nagle may merge several
+        const auto tcp_pkg_sent = after.tcp.pkg_sent - before.tcp.pkg_sent;
+        const auto tcp_pkg_recv = after.tcp.pkg_recv - before.tcp.pkg_recv;
+        const bool pkgs_ok = after.udp.pkg_sent - before.udp.pkg_sent == expected.udp_datagrams_sent &&
+                             after.udp.pkg_recv - before.udp.pkg_recv == expected.udp_datagrams_recv &&
+                             tcp_pkg_sent >= expected.connections && tcp_pkg_sent <= expected.tcp_sends &&
+                             tcp_pkg_recv >= expected.connections && tcp_pkg_recv <= expected.tcp_sends;
+        // one disconnect per connection end that logs it, both are ours
+        const auto disconnects = after.tcp.connections_lost - before.tcp.connections_lost;
+        const bool conns_ok    = expected.connections == traffic.connections &&
+                                 disconnects >= expected.connections && disconnects <= 2 * (std::size_t)expected.connections;
+        const bool ok = after.tcp.bytes_sent - before.tcp.bytes_sent == expected.tcp_bytes_sent &&
+                        after.tcp.bytes_recv - before.tcp.bytes_recv == expected.tcp_bytes_recv &&
+                        after.udp.bytes_sent - before.udp.bytes_sent == expected.udp_bytes_sent &&
+                        after.udp.bytes_recv - before.udp.bytes_recv == expected.udp_bytes_recv &&
+                        pkgs_ok && conns_ok;
+        passed = passed && ok;
+        const auto bytes = expected.tcp_bytes_sent + expected.udp_bytes_sent;
+        std::snprintf(line, sizeof(line), "%8.1f %9zu %7s / %-7s %7s / %-7s %5s %6s %6zu %9.2f%% %6lld ns %+6lld KiB\n",
+                      bytes / expected.seconds / Mib,
+                      after.stats.events_used - before.stats.events_used,
+                      counted(after.tcp.bytes_sent - before.tcp.bytes_sent, expected.tcp_bytes_sent),
+                      counted(after.tcp.bytes_recv - before.tcp.bytes_recv, expected.tcp_bytes_recv),
+                      counted(after.udp.bytes_sent - before.udp.bytes_sent, expected.udp_bytes_sent),
+                      counted(after.udp.bytes_recv - before.udp.bytes_recv, expected.udp_bytes_recv),
+                      pkgs_ok ? "ok" : "FAIL",
+                      conns_ok ? "ok" : "FAIL",
+                      after.stats.events_lost - before.stats.events_lost,
+                      (after.stats.trace_thread_cpu_ns - before.stats.trace_thread_cpu_ns) / (expected.seconds * 1E7),
+                      (long long)after.stats.callback_latency.percentile(0.99),
+                      (long long)((memory() - memory_before) / Kib));
+        std::cout << line;
+        if (!ok) {
+            std::cout << "  expected tcp " << expected.tcp_bytes_sent << "/" << expected.tcp_bytes_recv
+                      << " udp " << expected.udp_bytes_sent << "/" << expected.udp_bytes_recv
+                      << ", counted tcp " << after.tcp.bytes_sent - before.tcp.bytes_sent
+                      << "/" << after.tcp.bytes_recv - before.tcp.bytes_recv
+                      << " udp " << after.udp.bytes_sent - before.udp.bytes_sent
+                      << "/" << after.udp.bytes_recv - before.udp.bytes_recv << "\n"
+                      << "  expected packets tcp " << expected.connections << ".." << expected.tcp_sends
+                      << " udp " << expected.udp_datagrams_sent << "/" << expected.udp_datagrams_recv
+                      << ", counted tcp " << tcp_pkg_sent << "/" << tcp_pkg_recv
+                      << " udp " << after.udp.pkg_sent - before.udp.pkg_sent
+                      << "/" << after.udp.pkg_recv - before.udp.pkg_recv << "\n"
+                      << "  expected " << traffic.connections << " connections, " << expected.connections
+                      << " opened, " << disconnects << " disconnects\n";
+        }
+    }
+    std::cout << (passed ? "PASSED\n" : "FAILED\n");
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 int main(int argc, char* argv[]) {
     using namespace std::chrono_literals;
-    SetConsoleTitle("Peformance Monitor Watcher 2019");
     if (argc < 2) {
-        std::cerr << "Invalid call. Usage: watcher.exe <PID: short> <Interval(ms): ull>";
+        std::cerr << "Invalid call. Usage: watcher.exe <PID: uint | all> <Interval(ms): ull> [<Output: path | -> [jsonl | csv | binary]]\n"
+                  << "                     watcher.exe --daemon <Config: path>\n"
+                  << "                     watcher.exe --analyze <Capture: path> [<Interval(ms): ull> [<Threads: uint> [jsonl | csv | binary]]]\n"
+                  << "                     watcher.exe --sampling-error <Capture: path> [every | flow]\n"
+                  << "                     watcher.exe --self-test\n"
+                  << "                     watcher.exe --collect <Port: uint> [<Interval(ms): ull> [<Output: path | -> [jsonl | csv | binary]]]\n"
+                  << "                     watcher.exe --fleet-load <Collector: host:port> <Hosts: uint> [<Processes: uint>]";
         return EXIT_FAILURE;
     }
+    if (std::string_view{ argv[1] } == "--analyze") {
+        return analyze(argc, argv);
+    }
+    if (std::string_view{ argv[1] } == "--self-test") {
+        return self_test();
+    }
+    if (std::string_view{ argv[1] } == "--sampling-error") {
+        return sampling_error(argc, argv);
+    }
+    if (std::string_view{ argv[1] } == "--collect") {
+        return collect(argc, argv);
+    }
+    if (std::string_view{ argv[1] } == "--fleet-load") {
+        return fleet_load(argc, argv);
+    }
+    if (std::string_view{ argv[1] } == "--daemon") {
+        if (argc < 3) {
+            std::cerr << "Usage: watcher.exe --daemon <Config: path>";
+            return EXIT_FAILURE;
+        }
+        // no console needed, the handler just won't be called without one
+        s_daemon = true;
+        (void)SetConsoleCtrlHandler(consoleHandler, TRUE);
+        return watcher::daemon_t{ argv[2] }.run(s_running);
+    }
+    SetConsoleTitle("Peformance Monitor Watcher 2019");
     if (!SetConsoleCtrlHandler(consoleHandler, TRUE)) {
         std::cout << "\nERROR: Could not set control handler";
         return EXIT_FAILURE;
     }
-    system("logman stop ETW-section.etl -ets > out.txt");
     try {
         auto interval = (argc >= 3 ? std::stoull(argv[2]) : 100ull);
-        short pid = std::stoi(argv[1]);
+        std::uint32_t pid = std::string_view{ argv[1] } == "all"
+                          ? perf::network_monitor_t::all_pids
+                          : std::stoul(argv[1]);
+        std::unique_ptr<perf::output_sink_t> sink;
+        if (argc >= 4) {
+            const auto format = perf::parse_output_format(argc >= 5 ? argv[4] : "jsonl");
+            if (!format) {
+                throw std::invalid_argument("unknown output format");
+            }
+            if (!(sink = perf::make_output_sink(*format, argv[3]))) {
+                return EXIT_FAILURE;
+            }
+        }
+        std::vector<std::uint32_t> process_pids;
+        if (pid != perf::network_monitor_t::all_pids) {
+            process_pids.push_back(pid);
+        }
         uuid_t my_id = perf::session_trace_handler_t::create_guid();
 
         perf::network_monitor_t monitor;
-        if (monitor.start(my_id, pid)) {
+        perf::process_monitor_t process_monitor;
+        if (pid != perf::network_monitor_t::all_pids) {
+            monitor.enable_burst_analysis({ 100us, 1ms, 10ms });
+            monitor.enable_connection_tracking();
+        }
+        const perf::session_config_t session_config;
+        monitor.set_session_config(session_config);
+        monitor.enable_buffer_control(std::make_unique<perf::adaptive_buffer_controller_t>(session_config));
+        if (monitor.start(my_id, pid) &&
+            process_monitor.start(std::chrono::milliseconds{ interval }, process_pids)) {
 
             if (!screen.create()) {
                 std::cerr << "Unable to create console buffer: "
@@ -74,6 +492,9 @@ int main(int argc, char* argv[]) {
                     << perf::session_trace_handler_t::get_last_error_as_string();
                 return EXIT_FAILURE;
             }
+            if (pid == perf::network_monitor_t::all_pids) {
+                return run_system_wide(monitor, process_monitor, interval, sink.get());
+            }
 
             screen << console::foreground_color_t{console::color_t::DARKCYAN}
                 <<  "TCP data:"
@@ -109,6 +530,34 @@ int main(int argc, char* argv[]) {
                 << "\nbytes recv speed: "
                 << "\ninterval:         "
                 << "\nlast timestamp:   "
+                << console::foreground_color_t{ console::color_t::DARKCYAN }
+                << "\n\nMonitor:        "
+                << console::foreground_color_t{ console::color_t::WHITE }
+                << "\nevents delivered: "
+                << "\nevents used:      "
+                << "\nsampling:         "
+                << console::foreground_color_t{ console::color_t::DARKCYAN }
+                << "\n\nProcess:        "
+                << console::foreground_color_t{ console::color_t::WHITE }
+                << "\ncpu:              "
+                << "\nworking set:      "
+                << "\nthreads:          "
+                << "\nctx switches/s:   "
+                << "\npage faults/s:    "
+                << console::foreground_color_t{ console::color_t::DARKCYAN }
+                << "\n\nBursts:         peak bytes, peak/avg"
+                << console::foreground_color_t{ console::color_t::WHITE }
+                << "\n100 us:           "
+                << "\n1 ms:             "
+                << "\n10 ms:            "
+                << console::foreground_color_t{ console::color_t::DARKCYAN }
+                << "\n\nSelf:           "
+                << console::foreground_color_t{ console::color_t::WHITE }
+                << "\ncallback p50/p99: "
+                << "\nconsumer lag:     "
+                << "\ntrace cpu:        "
+                << "\nlost/dropped:     "
+                << "\ntrace buffers:    "
                 << console::flush_t{};
 
             std::stringstream ss;
@@ -118,29 +567,76 @@ int main(int argc, char* argv[]) {
             perf::moving_average_t udp_bytes_sent2{ 1024 }, udp_bytes_recv2{ 1024 };
             auto last_tcp_data = monitor.tcp_data();
             auto last_udp_data = monitor.udp_data();
-            perf::timestamp_t ts;
+            auto last_process_data = process_monitor.process_data(pid).value_or(perf::process_data_t{});
+            watcher::thread_view_t thread_view{ monitor.thread_table(), pid, 7 };
+            std::vector<perf::thread_data_t> threads;
+            std::vector<perf::connection_stats_t> connections;
+            perf::connection_stats_t last_connections;
+            perf::timestamp_t ts, sample_ts, threads_ts, connections_ts;
             while (s_running) {
                 auto tcp_data = monitor.tcp_data();
                 auto udp_data = monitor.udp_data();
-                auto interv1 = tcp_data.interval_ms > 0 ? tcp_data.interval_ms : 1E9;
-                auto interv2 = (tcp_data.last_timestamp - last_tcp_data.last_timestamp) / 100.0;
-                auto udp_interv1 = udp_data.interval_ms > 0 ? udp_data.interval_ms : 1E9;
-                auto udp_interv2 = (udp_data.last_timestamp - last_udp_data.last_timestamp) / 100.0;
+                // 1: event time between the last events of both samples, 2: wall time between samples
+                auto interv1 = tcp_data.interval_ms > 0 ? tcp_data.interval_ms / 1E3 : 1E9;
+                auto interv2 = sample_ts.sec();
+                auto udp_interv1 = udp_data.interval_ms > 0 ? udp_data.interval_ms / 1E3 : 1E9;
                 interv2 = interv2 > 0 ? interv2 : 1E9;
-                udp_interv2 = udp_interv2 > 0 ? udp_interv2 : 1E9;
+                sample_ts.now();
 
                 bytes_sent1 += (tcp_data.bytes_sent - last_tcp_data.bytes_sent) / interv1;
                 bytes_sent2 += (tcp_data.bytes_sent - last_tcp_data.bytes_sent) / interv2;
                 bytes_recv1 += (tcp_data.bytes_recv - last_tcp_data.bytes_recv) / interv1;
                 bytes_recv2 += (tcp_data.bytes_recv - last_tcp_data.bytes_recv) / interv2;
-                udp_bytes_sent1 += (udp_data.bytes_sent - last_udp_data.bytes_sent) / interv1;
+                udp_bytes_sent1 += (udp_data.bytes_sent - last_udp_data.bytes_sent) / udp_interv1;
                 udp_bytes_sent2 += (udp_data.bytes_sent - last_udp_data.bytes_sent) / interv2;
-                udp_bytes_recv1 += (udp_data.bytes_recv - last_udp_data.bytes_recv) / interv1;
+                udp_bytes_recv1 += (udp_data.bytes_recv - last_udp_data.bytes_recv) / udp_interv1;
                 udp_bytes_recv2 += (udp_data.bytes_recv - last_udp_data.bytes_recv) / interv2;
+                last_tcp_data = tcp_data;
+                last_udp_data = udp_data;
 
                 std::this_thread::sleep_for(5ms);
 
                 if (ts.ms() > interval) {
+                    auto event_stats = monitor.event_stats();
+                    auto process_data = process_monitor.process_data(pid).value_or(perf::process_data_t{});
+                    auto process_interv = process_data.last_timestamp != last_process_data.last_timestamp &&
+                                          process_data.interval_ms > 0 ? process_data.interval_ms : 1E9;
+                    auto cpu_time = (process_data.user_time + process_data.kernel_time) -
+                                    (last_process_data.user_time + last_process_data.kernel_time);
+                    const auto now = now_unix_ns(monitor);
+                    std::string bursts[3];
+                    std::size_t n_of_bursts{ 0 };
+                    monitor.burst_analyzer()->report(
+                        [&](std::uint32_t, const perf::burst_stats_t& stats) {
+                            if (n_of_bursts < 3) {
+                                bursts[n_of_bursts++] = std::to_string(stats.peak_bytes)
+                                    .append(" B, ")
+                                    .append(std::to_string(stats.peak_to_average));
+                            }
+                        },
+                        [&](const perf::flow_key_t& key, const perf::burst_stats_t& stats) {
+                            if (sink) {
+                                sink->write(now, key, stats);
+                            }
+                        });
+                    thread_view.update(threads_ts.sec());
+                    threads_ts.now();
+                    monitor.connection_tracker()->snapshot(connections);
+                    const auto it = std::find_if(connections.begin(), connections.end(),
+                                                 [pid](const perf::connection_stats_t& stats) { return stats.pid == pid; });
+                    const auto current_connections = it != connections.end() ? *it : last_connections;
+                    const auto churn = perf::connection_churn(current_connections, last_connections, connections_ts.sec());
+                    last_connections = current_connections;
+                    connections_ts.now();
+                    if (sink) {
+                        monitor.thread_table().snapshot(threads, pid);
+                        for (const auto& data : threads) {
+                            sink->write(now, data);
+                        }
+                        sink->write(now, current_connections);
+                        sink->write(now, monitor.snapshot());
+                        sink->submit();
+                    }
                     screen
                         << console::position_t{ 1, 18 } << tcp_data.connections
                         << console::position_t{ 2, 18 } << tcp_data.connections_lost
@@ -170,7 +666,37 @@ int main(int argc, char* argv[]) {
                         << console::position_t{ 28, 18 } << get_readable_size(*udp_bytes_recv2)
                         << console::position_t{ 29, 18 } << udp_data.interval_ms
                         << console::position_t{ 30, 18 } << udp_data.last_timestamp
-                        << console::flush_t{};
+                        << console::position_t{ 33, 18 } << event_stats.events_delivered
+                        << console::position_t{ 34, 18 } << event_stats.events_used
+                        << console::position_t{ 35, 18 } << std::string{ "1/" }.append(std::to_string(monitor.sampling_rate()))
+                        << console::position_t{ 38, 18 } << std::to_string(cpu_time / (process_interv * 1E4) * 100).append(" %")
+                        << console::position_t{ 39, 18 } << std::to_string(process_data.working_set / Kib).append(" KiB")
+                        << console::position_t{ 40, 18 } << process_data.threads
+                        << console::position_t{ 41, 18 } << (process_data.context_switches - last_process_data.context_switches) * 1E3 / process_interv
+                        << console::position_t{ 42, 18 } << (process_data.page_faults - last_process_data.page_faults) * 1E3 / process_interv
+                        << console::position_t{ 45, 18 } << bursts[0] << "\n"
+                        << console::position_t{ 46, 18 } << bursts[1] << "\n"
+                        << console::position_t{ 47, 18 } << bursts[2] << "\n"
+                        << console::position_t{ 50, 18 } << std::to_string(event_stats.callback_latency.percentile(0.5)).append(" / ")
+                                                            .append(std::to_string(event_stats.callback_latency.percentile(0.99))).append(" ns")
+                        << console::position_t{ 51, 18 } << std::to_string(event_stats.consumer_lag_ns / 1000).append(" us (max ")
+                                                            .append(std::to_string(event_stats.max_consumer_lag_ns / 1000)).append(" us)")
+                        << console::position_t{ 52, 18 } << std::to_string(event_stats.trace_thread_cpu_ns / 1000000).append(" ms, ")
+                                                            .append(perf::to_string(monitor.trace_state())).append(", ")
+                                                            .append(std::to_string(event_stats.trace_restarts)).append(" restarts    ")
+                        << console::position_t{ 53, 18 } << std::to_string(event_stats.events_lost).append(" / ")
+                                                            .append(std::to_string(event_stats.events_dropped))
+                        << console::position_t{ 54, 18 } << std::to_string(monitor.session_config().maximum_buffers).append(" x ")
+                                                            .append(std::to_string(monitor.session_config().buffer_size_kb)).append(" KiB");
+                    thread_view.render(screen, 56);
+                    char churn_text[128];
+                    std::snprintf(churn_text, sizeof(churn_text),
+                                  "Connections/s: %.1f opened, %.1f closed, %.1f failed, %.0f%% < 1 s, p50 lifetime %lld us",
+                                  churn.opened_per_s, churn.closed_per_s, churn.failed_per_s, churn.short_lived_ratio * 100,
+                                  (long long)current_connections.lifetime_us.percentile(0.5));
+                    screen << console::position_t{ 64, 0 } << (const char*)churn_text << "\n";
+                    screen << console::flush_t{};
+                    last_process_data = process_data;
                     ts.now();
                 }
                 std::this_thread::sleep_for(300ms);
@@ -183,13 +709,13 @@ int main(int argc, char* argv[]) {
     }
     catch (std::invalid_argument& err) {
         std::cerr << "Fail to parse input arguments.\n"
-                  << "Usage: watcher.exe <PID: short> <Interval(ms): ull>\n"
+                  << "Usage: watcher.exe <PID: uint | all> <Interval(ms): ull> [<Output: path | -> [jsonl | csv | binary]]\n"
                   << "Original exception: " << err.what() << std::endl;
         return EXIT_FAILURE;
     }
     catch (std::out_of_range& err) {
         std::cerr << "Fail to parse input arguments.\n"
-                  << "Usage: watcher.exe <PID: short> <Interval(ms): ull>\n"
+                  << "Usage: watcher.exe <PID: uint | all> <Interval(ms): ull> [<Output: path | -> [jsonl | csv | binary]]\n"
                   << "Original exception: " << err.what() << std::endl;
         return EXIT_FAILURE;
     }